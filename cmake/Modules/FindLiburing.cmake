@@ -0,0 +1,31 @@
+#
+# Find the liburing includes and library
+#
+# This module defines
+# LIBURING_INCLUDE_DIRS, where to find liburing.h
+# LIBURING_LIBRARIES, the libraries to link against to use liburing.
+# LIBURING_FOUND, If false, do not try to use liburing.
+
+INCLUDE(FindPkgConfig)
+PKG_CHECK_MODULES(PC_LIBURING "liburing")
+
+FIND_PATH(LIBURING_INCLUDE_DIRS
+    NAMES liburing.h
+    HINTS ${PC_LIBURING_INCLUDE_DIRS}
+    PATHS
+    /usr/local/include
+    /usr/include
+)
+
+FIND_LIBRARY(LIBURING_LIBRARIES
+    NAMES uring
+    HINTS ${PC_LIBURING_LIBDIR}
+    PATHS
+    ${LIBURING_INCLUDE_DIRS}/../lib
+    /usr/local/lib
+    /usr/lib
+)
+
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(LIBURING DEFAULT_MSG LIBURING_LIBRARIES LIBURING_INCLUDE_DIRS)
+MARK_AS_ADVANCED(LIBURING_LIBRARIES LIBURING_INCLUDE_DIRS)
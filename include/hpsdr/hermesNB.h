@@ -23,8 +23,11 @@
 #define INCLUDED_HPSDR_HERMESNB_H
 
 #include <hpsdr/api.h>
+#include <hpsdr/hermes_options.h>
 #include <gnuradio/block.h>
 
+class HermesProxy;
+
 namespace gr {
   namespace hpsdr {
 
@@ -51,7 +54,8 @@ namespace gr {
 			 unsigned char TxDr, int RxSmp, const char* Intfc, 
 			 const char * ClkS, int AlexRA, int AlexTA,
 			 int AlexHPF, int AlexLPF, int Verbose, int NumRx,
-			 const char* MACAddr);
+			 const char* MACAddr,
+			 const hermes_options & Opts = hermes_options());
 
       void set_Receive0Frequency(float);	// callback
       void set_Receive1Frequency(float);	// callback
@@ -78,6 +82,9 @@ namespace gr {
       bool stop();				// override
       bool start();				// override
 
+     protected:
+      HermesProxy* Hermes;			// this block's proxy, one per instance
+
     };
 
   } // namespace hpsdr
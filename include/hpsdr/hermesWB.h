@@ -23,8 +23,11 @@
 #define INCLUDED_HPSDR_HERMESWB_H
 
 #include <hpsdr/api.h>
+#include <hpsdr/hermes_options.h>
 #include <gnuradio/block.h>
 
+class HermesProxyW;
+
 namespace gr {
   namespace hpsdr {
 
@@ -48,7 +51,8 @@ namespace gr {
        */
       static sptr make(bool RxPre, const char* Intfc, const char * ClkS,
 			int AlexRA, int AlexTA, int AlexHPF, int AlexLPF,
-			const char* MACAddr);
+			const char* MACAddr,
+			const hermes_options & Opts = hermes_options());
 
       void set_RxPreamp(int);			// callback
       void set_ClockSource(const char *);	// callback
@@ -60,6 +64,9 @@ namespace gr {
       bool stop();				// override
       bool start();				// override
 
+     protected:
+      HermesProxyW* HermesW;			// this block's proxy, one per instance
+
     };
 
   } // namespace hpsdr
@@ -0,0 +1,82 @@
+/* -*- c++ -*- */
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef INCLUDED_HPSDR_HERMES_OPTIONS_H
+#define INCLUDED_HPSDR_HERMES_OPTIONS_H
+
+#include <hpsdr/api.h>
+#include <string>
+
+namespace gr {
+  namespace hpsdr {
+
+    /*!
+     * \brief Receive, buffer and engine options of a hermesNB or hermesWB
+     * \ingroup hpsdr
+     *
+     * Everything past the radio settings of make(). The defaults are the
+     * ones of the GRC blocks, so only the fields that differ need setting.
+     * From Python, hpsdr.options(RxBatch=32, ...) makes one.
+     *
+     * hermesWB has no use for RxLazyDecode, Protocol, RxBufSamples and
+     * RxMaxLatency, and leaves them alone.
+     */
+    struct HPSDR_API hermes_options
+    {
+      int RxBatch;		// max datagrams per receive syscall (1 = one recvfrom per packet)
+      int RxBatchTmo;		// usec to wait for a full receive batch (0 = no wait)
+      int RxBackend;		// UDP socket (0), AF_PACKET mmap ring (1) or io_uring (2)
+      int RxSockBuf;		// socket receive buffer, bytes (0 = kernel default)
+      int TxSockBuf;		// socket send buffer, bytes (0 = kernel default)
+      int RxBusyPoll;		// usec to busy poll for a packet before blocking (0 = off)
+      int DiscoverTmo;		// msec start() waits for the radio to answer discovery (0 = for ever)
+      int RxReactor;		// shared epoll receive threads for all radios (0 = one per radio)
+      std::string RxReactorCpus;	// cores the shared receive threads are pinned to, e.g. "2,3" ("" = not pinned)
+      int RxSched;		// receive thread scheduling: 0 normal, 1 SCHED_FIFO, 2 SCHED_RR
+      int RxPriority;		// real-time priority for RxSched 1 or 2 (1..99)
+      std::string RxCpus;	// cores the own receive thread is pinned to, e.g. "3" ("" = not pinned)
+      int MemLock;		// 1 = prefault the sample buffers and mlockall() the process
+      int RxReorder;		// reorder window in frames, 0 = off (up to 16)
+      int RxPipeline;		// 1 = receive thread only queues raw frames, an unpack thread decodes them
+      std::string RxUnpackCpus;	// cores the unpack thread is pinned to, e.g. "4" ("" = not pinned)
+      int RxLazyDecode;		// 1 = decode the queued sample rows in general_work(), hermesNB only
+      int Protocol;		// 1 = Metis (Protocol 1), 2 = Protocol 2, hermesNB only
+      std::string CaptureFile;	// record the Metis frames on the wire to this file, plus an index ("" = off)
+      int ReplayPace;		// "file:" Intfc replay: 0 nominal rate (loops), 1 original timestamps, 2 as fast as possible
+      int RxRingBufs;		// receive ring buffers, rounded up to a power of 2 (0 = 128)
+      int RxBufSamples;		// complex samples per receive buffer, a power of 2, 16..16384 (0 = 128), hermesNB only
+      int TxRingBufs;		// transmit ring frames, rounded up to a power of 2 (0 = 128)
+      int HugePages;		// 1 = put the buffers in one arena of 2 MB huge pages
+      int RxMaxLatency;		// msec of samples kept waiting, older ones dropped and tagged rx_drop (0 = keep all), hermesNB only
+
+      hermes_options()
+	: RxBatch(1), RxBatchTmo(0), RxBackend(0), RxSockBuf(0), TxSockBuf(0),
+	  RxBusyPoll(0), DiscoverTmo(10000), RxReactor(0), RxReactorCpus(""),
+	  RxSched(0), RxPriority(50), RxCpus(""), MemLock(0), RxReorder(0),
+	  RxPipeline(0), RxUnpackCpus(""), RxLazyDecode(0), Protocol(1),
+	  CaptureFile(""), ReplayPace(0), RxRingBufs(0), RxBufSamples(0),
+	  TxRingBufs(0), HugePages(0), RxMaxLatency(0)
+      {
+      }
+    };
+
+  } // namespace hpsdr
+} // namespace gr
+
+#endif /* INCLUDED_HPSDR_HERMES_OPTIONS_H */
@@ -47,16 +47,30 @@
 #include <gnuradio/io_signature.h>
 #include "HermesProxy.h"
 #include "metis.h"
+#include "hpsdr_p2.h"
 #include <stdio.h>
 #include <cstring>
 
 
+// Protocol 2 receive thread callbacks
+
+static void HermesP2IQ(void* arg, int ddc, unsigned char* packet, int length, const struct timespec* stamp)
+{
+	((HermesProxy*)arg)->ReceiveDDCIQ(ddc, packet, length, stamp);
+}
+
+static void HermesP2Status(void* arg, unsigned char* packet, int length)
+{
+	((HermesProxy*)arg)->ReceiveP2Status(packet, length);
+}
+
+
 HermesProxy::HermesProxy(int RxFreq0, int RxFreq1, int TxFreq, bool RxPre,
 			 int PTTModeSel, bool PTTTxMute, bool PTTRxMute,
 			 unsigned char TxDr, int RxSmp, const char* Intfc, 
 			 const char * ClkS, int AlexRA, int AlexTA,
 			 int AlexHPF, int AlexLPF, int Verb, int NumRx,
-			 const char* MACAddr)	// constructor
+			 const char* MACAddr, const gr::hpsdr::hermes_options & Opts)	// constructor
 {
 
 
@@ -82,7 +96,8 @@ HermesProxy::HermesProxy(int RxFreq0, int RxFreq1, int TxFreq, bool RxPre,
 
 
 	RxSampleRate = RxSmp;
-	strcpy(interface, Intfc);	// Ethernet interface to use (defaults to eth0)
+	strncpy(interface, Intfc, sizeof(interface)-1);	// Ethernet interface to use (defaults to eth0)
+	interface[sizeof(interface)-1] = 0;
 	NumReceivers = NumRx;
 
 	unsigned int cs;		// Convert ClockSource strings to unsigned, then intitalize
@@ -120,11 +135,25 @@ HermesProxy::HermesProxy(int RxFreq0, int RxFreq1, int TxFreq, bool RxPre,
 	RxWriteCounter = 0;	//
 	RxReadCounter = 0;	// These control the Rx buffers to Gnuradio
 	RxWriteFill = 0;	//
+	RxReadSeen = 0;		//
+	RxWriteSeen = 0;	//
+	RxReadHeld = false;	//
+	RxReadBusy = 0;		// set with the ring below
+	RxWriteSerial = 0;	//
+	RxReadSerial = ~0u;	// RxIQBuf[0] is Serial 0
 
 	TxWriteCounter = 0;	//
  	TxReadCounter = 0;	// These control the Tx buffers to Hermes
+	TxWriteSeen = 0;	//
+	TxReadSeen = 0;		//
 	TxControlCycler = 0;	//
 	TxFrameIdleCount = 0;	//
+	TxFramesDue = 0;	//
+	TxDucDue = 0;		//
+	TxDucCursor = 63;	// Protocol 2: TxBuf[0] holds no samples
+	TxVoxActive = false;	//
+	TxSentPTT = false;	//
+	RxUpdateDue = 0;	//
 
 	LostRxBufCount = 0;	//
 	TotalRxBufCount = 0;	//
@@ -133,54 +162,153 @@ HermesProxy::HermesProxy(int RxFreq0, int RxFreq1, int TxFreq, bool RxPre,
 	CorruptRxCount = 0;	//
 	LostEthernetRx = 0;	//
 	CurrentEthSeqNum = 0;	//
+	StaleRxBufCount = 0;	//
 
 	
-	// allocate the receiver buffers
-	for(int i=0; i<NUMRXIQBUFS; i++)
-		RxIQBuf[i] = new float[RXBUFSIZE];
+	Protocol = (Opts.Protocol == 2) ? 2 : 1;
+
+	// Ring geometry. Any frame may begin in a buffer, so a buffer of n
+	// samples sees ceil(n/126) frame starts at most (126 rows per frame
+	// with 1 receiver, 72 rows of 2 samples with 2, more in Protocol 2).
+
+	RxRingBufs = metis_ring_size(Opts.RxRingBufs, NUMRXIQBUFS, 4, 1 << 22);
+	RxBufSize = 2 * metis_ring_size(Opts.RxBufSamples, RXBUFSAMPLES, 16, 16384);
+	RxTimesPerBuf = (RxBufSize/2 + 125) / 126;
+	TxRingBufs = metis_ring_size(Opts.TxRingBufs, NUMTXBUFS, 4, 1 << 20);
+
+	// allocate the receiver buffers, or the raw frame ring hermesNB decodes from,
+	// and the transmit buffers, all in one arena
+	RxLazyDecode = (Opts.RxLazyDecode != 0) && (Protocol == 1);	// Protocol 2 packets are not Metis frames
+	RxMaxLatency = (Opts.RxMaxLatency > 0) ? Opts.RxMaxLatency : 0;
+	Unpack = metis_unpack_best();	// fastest sample conversion the CPU runs
+	RxReadBusy = RxRingBufs;	// hermesNB is reading none
+
+	size_t RxBytes = RxLazyDecode ? 0 : metis_arena_round((size_t)RxRingBufs * RxBufSize * sizeof(float));
+	size_t TxBytes = metis_arena_round((size_t)TxRingBufs * TXBUFSIZE);
+	size_t StampBytes = metis_arena_round((size_t)RxRingBufs * RxTimesPerBuf * sizeof(struct timespec));
+	size_t TableBytes = metis_arena_round((size_t)RxRingBufs * sizeof(IQBuf_t))
+		+ metis_arena_round((size_t)RxRingBufs * sizeof(RxTime_t))
+		+ metis_arena_round((size_t)TxRingBufs * sizeof(RawBuf_t));
+	size_t IndexBytes = metis_arena_round((size_t)RxRingBufs * RxTimesPerBuf * sizeof(unsigned));
+
+	Arena = metis_arena_alloc(RxBytes + TxBytes + StampBytes + TableBytes + 2*IndexBytes, Opts.HugePages, &ArenaSize);
+
+	unsigned char * p = (unsigned char *)Arena;
+	float * RxSlots = (float *)p;				p += RxBytes;
+	unsigned char * TxSlots = p;				p += TxBytes;
+	struct timespec * Stamps = (struct timespec *)p;	p += StampBytes;
+	RxIQBuf = (IQBuf_t *)p;					p += metis_arena_round((size_t)RxRingBufs * sizeof(IQBuf_t));
+	RxIQTime = (RxTime_t *)p;				p += metis_arena_round((size_t)RxRingBufs * sizeof(RxTime_t));
+	TxBuf = (RawBuf_t *)p;					p += metis_arena_round((size_t)TxRingBufs * sizeof(RawBuf_t));
+	unsigned * Offsets = (unsigned *)p;			p += IndexBytes;
+	unsigned * Sequences = (unsigned *)p;
+
+	for(unsigned i=0; i<RxRingBufs; i++)
+	{
+		RxIQBuf[i] = RxLazyDecode ? NULL : RxSlots + (size_t)i * RxBufSize;
+		RxIQTime[i].Count = 0;
+		RxIQTime[i].Serial = 0;
+		RxIQTime[i].Dropped = 0;
+		RxIQTime[i].Offset = Offsets + (size_t)i * RxTimesPerBuf;
+		RxIQTime[i].Sequence = Sequences + (size_t)i * RxTimesPerBuf;
+		RxIQTime[i].Stamp = Stamps + (size_t)i * RxTimesPerBuf;
+	}
+	for(unsigned i=0; i<TxRingBufs; i++)
+		TxBuf[i] = TxSlots + (size_t)i * TXBUFSIZE;
 
-	// allocate the transmit buffers
-	for(int i=0; i<NUMTXBUFS; i++)
-		TxBuf[i] = new unsigned char[TXBUFSIZE];
+	if (RxLazyDecode)
+		metis_raw_ring_init(&RxRawRing, METIS_RAW_RING_FRAMES);
 
-	metis_discover((const char *)(interface));
+	if(Opts.MemLock)			// touch every page now, not in the receive thread
+	  {
+	    memset(Arena, 0, ArenaSize);
+	    if (RxLazyDecode)
+		memset(RxRawRing.slots, 0, (RxRawRing.mask+1)*sizeof(METIS_RAW_SLOT));
+	    metis_lock_memory();	// and keep them resident
+	  }
+
+	if (Protocol == 2)
+	{
+	  metis = NULL;
+	  p2 = p2_open((const char *)(interface), mactarget, HermesP2IQ, HermesP2Status, this);
+	  p2_socket_buffers(p2, Opts.RxSockBuf, Opts.TxSockBuf);	// kernel socket buffer sizes
+	  p2_receive_scheduling(p2, Opts.RxSched, Opts.RxPriority, Opts.RxCpus.c_str());	// real-time policy and cores
+	  if (!Opts.CaptureFile.empty())
+	    fprintf(stderr, "Hermes: capture is only for Protocol 1, %s not recorded\n", Opts.CaptureFile.c_str());
+	}
+	else
+	{
+	  metis = metis_open((const char *)(interface), mactarget, this, NULL);	// this radio's session, shared with
+	  								// a proxy on the same interface and MAC
+	  metis_receive_backend(metis, Opts.RxBackend);	// UDP socket, AF_PACKET ring or io_uring
+	  metis_receive_batch(metis, Opts.RxBatch, Opts.RxBatchTmo);	// datagrams per receive syscall
+	  metis_socket_buffers(metis, Opts.RxSockBuf, Opts.TxSockBuf);	// kernel socket buffer sizes
+	  metis_busy_poll(metis, Opts.RxBusyPoll);		// usec to spin before blocking on receive
+	  metis_receive_reactor(metis, Opts.RxReactor, Opts.RxReactorCpus.c_str());	// shared epoll receive threads
+	  metis_receive_scheduling(metis, Opts.RxSched, Opts.RxPriority, Opts.RxCpus.c_str());	// real-time policy and cores
+	  metis_receive_reorder(metis, Opts.RxReorder);	// frames held to undo network reordering
+	  metis_receive_pipeline(metis, Opts.RxPipeline, Opts.RxUnpackCpus.c_str());	// decode on a thread of its own
+	  metis_capture_file(metis, Opts.CaptureFile.c_str());		// record the frames on the wire, "" = off
+	  metis_replay_pacing(metis, Opts.ReplayPace);		// how a "file:" Intfc replays its frames
+	  metis_discover(metis);				// runs in the background, Connect() waits for it
+	  p2 = NULL;
+	}
+
+	DiscoveryTimeout = Opts.DiscoverTmo;
+	Connected = false;
+	metis_entry = 0;
+};
 
 //
+// Wait for discovery, started by the constructor, to find the radio.
 // If there is no specified MAC address (i.e. wildcard, or anything less than 17 
 // charracters, then just grab the first Hermes/Metis that
 // responds to discovery. If there is a specific MAC address specified, then wait
 // until it appears in the Metis cards table, and set the metis table index to match.
 // The string is HH:HH:HH:HH:HH:HH\0 formated, where HH is a 2-digital Hexidecimal number
 // uppercase, example:    04:7F:3D:0F:28:5A
+// Returns false if no such radio answered within DiscoveryTimeout msec.
 //
+bool HermesProxy::Connect()
+{
+	if (Connected)
+	  return true;
 
-	metis_entry = 0;
-	if (strlen(mactarget) != 17)			// Not a fully-qualified MAC address, default to first MAC found
+	if (Protocol == 2)
 	{
-	  while (metis_found() == 0)
-		;					// wait until Hermes responds with first discovered MAC
+	  if (p2_wait_found(p2, DiscoveryTimeout) != 0)	// sends discovery until a reply arrives
+	  {
+	    fprintf(stderr, "Hermes: no Protocol 2 %s answered discovery within %d msec\n",
+		(strlen(mactarget) == 17) ? mactarget : "radio", DiscoveryTimeout);
+	    return false;
+	  }
+	  Connected = true;
+
+	  P2_SETTINGS settings;
+	  P2Settings(&settings);
+	  p2_configure(p2, &settings);			// general and specific packets, radio stopped
+	  TxSentPTT = settings.ptt;
+	  return true;
 	}
-	else						// Search the table for the entry matching requested MAC address
+
+	int entry = metis_wait_found(metis, mactarget, DiscoveryTimeout);	// sleeps until a reply arrives
+	if (entry < 0)
 	{
-	  bool found = false;
-	  while(!found)					// Search for MAC address in the metis_table until the cows come home
-	    for(int i=0; i<metis_found(); i++)
-	      {
-		if (strcmp(mactarget, metis_mac_address(i)) == 0)	// Exact match found
-		{
-		  metis_entry = i;					// Select entry in metis_table
-	          found = true;
-		  break;
-		}
-	      }
+	  fprintf(stderr, "Hermes: no %s answered discovery within %d msec\n",
+		(strlen(mactarget) == 17) ? mactarget : "radio", DiscoveryTimeout);
+	  return false;
 	}
 
-	metis_receive_stream_control(RxStream_Off, metis_entry);	// turn off Hermes -> PC streams
+	metis_entry = entry;
+	Connected = true;
+
+	metis_receive_stream_control(metis, RxStream_Off, metis_entry);	// turn off Hermes -> PC streams
 
 	UpdateHermes();					// send specific control registers
 							// and initialize 1st Tx buffer
-							// before allowing scheduler to Start()
-};
+							// before the Rx stream is started
+	return true;
+}
 
 HermesProxy::~HermesProxy()
 {
@@ -190,28 +318,106 @@ HermesProxy::~HermesProxy()
 	        LostRxBufCount, TotalRxBufCount, LostTxBufCount,
 		TotalTxBufCount, CorruptRxCount, LostEthernetRx);
 
-	metis_receive_stream_control(RxStream_Off, metis_entry);	// stop Hermes data stream
-	
-	metis_stop_receive_thread();	// stop receive_thread & close socket
+	if (Protocol == 2)
+	{
+	  unsigned long RxPackets, StatusPackets, StrayPackets;
+	  p2_receive_statistics(p2, &RxPackets, &StatusPackets, &StrayPackets);
+	  fprintf(stderr, "RxPackets = %lu  StatusPackets = %lu  StrayPackets = %lu\n",
+		RxPackets, StatusPackets, StrayPackets);
 
-	for(int i=0; i<NUMTXBUFS; i++)
-		delete [] TxBuf[i];
+	  if (Connected)
+	  {
+	    P2_SETTINGS settings;
+	    P2Settings(&settings);
+	    p2_stop(p2, &settings);			// stop the radio's streams
+	  }
+	  p2_close(p2);
+	}
+	else
+	{
+	  unsigned long RxSyscalls, RxPackets;
+	  metis_receive_statistics(metis, &RxSyscalls, &RxPackets);
+	  fprintf(stderr, "RxSyscalls = %lu  RxPackets = %lu  SyscallsPerPacket = %.3f\n",
+	  	RxSyscalls, RxPackets,
+	  	RxPackets ? (double)RxSyscalls / (double)RxPackets : 0.0);
+
+	  // Sequence gaps count EP6 frames lost anywhere. The pipeline counts the
+	  // EP6 frames its raw ring had no room for. The kernel only counts drops
+	  // for the socket as a whole, EP6 and EP4 together, so the rest of the
+	  // gaps can only be put down to the wire when the kernel dropped nothing.
+	  unsigned long RxReordered, RxDuplicates, RxLate, RxGaps;
+	  metis_receive_reorder_statistics(metis, 6, &RxReordered, &RxDuplicates, &RxLate, &RxGaps);
+	  fprintf(stderr, "RxReordered = %lu  RxDuplicates = %lu  RxLate = %lu  RxGaps = %lu\n",
+	  	RxReordered, RxDuplicates, RxLate, RxGaps);
+
+	  unsigned long KernelDrops = metis_kernel_drops(metis);
+	  unsigned long PipelineDrops = metis_pipeline_drops(metis, 6);
+	  unsigned long OtherDrops = (LostEthernetRx > PipelineDrops) ? LostEthernetRx - PipelineDrops : 0;
+	  fprintf(stderr, "KernelDrops = %lu (EP6+EP4)  PipelineDrops = %lu  %s = %lu  RingDrops = %lu\n",
+	  	KernelDrops, PipelineDrops, KernelDrops ? "KernelOrWireDrops" : "WireDrops",
+	  	OtherDrops, LostRxBufCount);
+	  unsigned long LengthDrops = metis_length_drops(metis);
+	  if (LengthDrops)
+	    fprintf(stderr, "LengthDrops = %lu (EP6+EP4) UDP length beyond the captured packet\n", LengthDrops);
+	  if (RxMaxLatency)
+	    fprintf(stderr, "StaleDrops = %lu %s older than %d msec\n", StaleRxBufCount,
+	    	RxLazyDecode ? "frames" : "buffers", RxMaxLatency);
+
+	  unsigned long RxLatency[METIS_LATENCY_BUCKETS], RxSpinHits, RxLatencyTotal = 0;
+	  metis_receive_latency(metis, RxLatency, &RxSpinHits);
+	  for (int i=0; i<METIS_LATENCY_BUCKETS; i++)
+	    RxLatencyTotal += RxLatency[i];
+	  if (RxLatencyTotal > 0)
+	  {
+	    fprintf(stderr, "RxLatency (usec, kernel stamp to dispatch)  RxSpinHits = %lu\n ", RxSpinHits);
+	    for (int i=0; i<METIS_LATENCY_BUCKETS; i++)
+	      if (RxLatency[i] > 0)
+	        fprintf(stderr, " <%u:%lu", 1u << i, RxLatency[i]);
+	    fprintf(stderr, "\n");
+	  }
 
-	for(int i=0; i<NUMRXIQBUFS; i++)
-		delete [] RxIQBuf[i];
+	  if (Connected)
+	    metis_receive_stream_control(metis, RxStream_Off, metis_entry);	// stop Hermes data stream
+	  
+	  metis_close(metis, this, NULL);	// last one out stops receive_thread & closes socket
+	}
+
+	metis_arena_free(Arena, ArenaSize);
+
+	if (RxLazyDecode)
+		metis_raw_ring_free(&RxRawRing);
 }
 
 
 void HermesProxy::Stop()	// stop ethernet I/O
 {
-	metis_receive_stream_control(RxStream_Off, metis_entry);	// stop Hermes Rx data stream
+	if (Connected && (Protocol == 2))
+	{
+	  P2_SETTINGS settings;
+	  P2Settings(&settings);
+	  p2_stop(p2, &settings);			// clear the run bit
+	}
+	else if (Connected)
+	  metis_receive_stream_control(metis, RxStream_Off, metis_entry);	// stop Hermes Rx data stream
 	TxStop = true;					// stop Tx data to Hermes
 };
 
-void HermesProxy::Start()	// start rx stream
+bool HermesProxy::Start()	// start rx stream
 {
+	if (!Connect())					// radio has not answered discovery
+	  return false;
+
 	TxStop = false;					// allow Tx data to Hermes
-	metis_receive_stream_control(RxStream_NB_On, metis_entry);	// stop Hermes Rx data stream
+	if (Protocol == 2)
+	{
+	  P2_SETTINGS settings;
+	  P2Settings(&settings);
+	  p2_start(p2, &settings);			// set the run bit, streams start
+	  TxSentPTT = settings.ptt;
+	}
+	else
+	  metis_receive_stream_control(metis, RxStream_NB_On, metis_entry);	// stop Hermes Rx data stream
+	return true;
 };
 
 void HermesProxy::PrintRawBuf(RawBuf_t inbuf)	// for debugging
@@ -254,7 +460,7 @@ void HermesProxy::PrintRawBuf(RawBuf_t inbuf)	// for debugging
 
 // ********** Routines to receive data from Hermes/Metis and give to Gnuradio ****************
 
-void HermesProxy::ReceiveRxIQ(unsigned char * inbuf)	// called by metis Rx thread.
+void HermesProxy::ReceiveRxIQ(unsigned char * inbuf, const struct timespec * stamp)	// called by metis Rx thread.
 {
 
 	// look for lost receive packets based on skips in the HPSDR ethernet header
@@ -267,7 +473,7 @@ void HermesProxy::ReceiveRxIQ(unsigned char * inbuf)	// called by metis Rx threa
 
 	if(SequenceNum > CurrentEthSeqNum + 1)
 	{
-	    LostEthernetRx += (SequenceNum - CurrentEthSeqNum);
+	    LostEthernetRx += (SequenceNum - CurrentEthSeqNum - 1);	// frames missing in the gap
 	    CurrentEthSeqNum = SequenceNum;
 	}
 	else
@@ -302,16 +508,86 @@ void HermesProxy::ReceiveRxIQ(unsigned char * inbuf)	// called by metis Rx threa
 	//
 
 
+	TotalRxBufCount++;
+
+	ScheduleTxFrame(TotalRxBufCount); // Schedule a Tx ethernet frame to Hermes if ready.
+
 	inbuf += 8;			// skip past Ethernet header
 
+	if (!ParseRxStatus(inbuf))
+	  return;			// failed sync, drop the frame
+
+	if (RxLazyDecode)		// hermesNB decodes the samples when it wants them
+	{
+	  METIS_RAW_SLOT* slot = metis_raw_ring_claim(&RxRawRing);
+	  if (slot == NULL)
+	  {
+	    LostRxBufCount++;		// general_work is a whole ring behind. Throw away data
+	    return;
+	  }
+	  memcpy(slot->frame, &inbuf[8], 504);		// sample rows of the first USB frame,
+	  memcpy(slot->frame + 504, &inbuf[520], 504);	// and of the second, back to back
+	  slot->length = 2 * 504;
+	  if (stamp != NULL)
+	    slot->stamp = *stamp;
+	  else
+	    slot->stamp.tv_sec = slot->stamp.tv_nsec = 0;
+	  metis_raw_ring_publish(&RxRawRing);
+	  return;
+	}
+
 	IQBuf_t outbuf;			// RxWrite output buffer selector
 	
 	outbuf = RxIQBuf[RxWriteCounter];	// initialize buffer pointer
 
-	TotalRxBufCount++;
+	// Use write and read counters to select from the Rx buffers,
+	// these are circular.
 
-	ScheduleTxFrame(TotalRxBufCount); // Schedule a Tx ethernet frame to Hermes if ready.
+	if ((outbuf = GetNextRxBuf(outbuf)) == NULL)
+	    return;			// all buffers full. Throw away data
+
+	// Remember when this frame arrived, and where its first sample goes, so that
+	// hermesNB can tag that sample with rx_time. No stamp if the kernel gave none.
 
+	RxTime_t * Time = &RxIQTime[RxWriteCounter];
+	if ((stamp != NULL) && (stamp->tv_sec != 0) && (Time->Count < RxTimesPerBuf))
+	{
+	  Time->Offset[Time->Count] = RxWriteFill;
+	  Time->Sequence[Time->Count] = SequenceNum;
+	  Time->Stamp[Time->Count] = *stamp;
+	  Time->Count++;
+	}
+
+	// Convert 24-bit 2's complement integer samples to float with
+	// maximum value of +1.0 and minimum of -1.0
+	// skip sync/register headers (i=0 and i=64)
+
+
+	if (NumReceivers == 1)		// one receiver
+	{					// 8 byte header + 8 bytes per row * 63 rows = 512 byte USB
+	  if ((outbuf = UnpackRxRows(&inbuf[8], 63, 8, outbuf)) == NULL)	// first USB frame
+	    return;			// all buffers full. Throw away data
+	  UnpackRxRows(&inbuf[520], 63, 8, outbuf);				// second USB frame
+	}
+	else				// two receivers
+	{				// 8 byte header + 14 bytes per row * 36 rows = 512 byte USB
+	//PrintRawBuf(inbuf-8);
+	  if ((outbuf = UnpackRxRows(&inbuf[8], 36, 14, outbuf)) == NULL)	// first USB frame
+	    return;			// all buffers full. Throw away data
+	  UnpackRxRows(&inbuf[520], 36, 14, outbuf);				// second USB frame
+	}
+
+	return;			// normal return;
+
+};
+
+
+// Check the sync bytes of both USB frames in an EP6 frame (past its 8 byte
+// Ethernet header) and take the status registers they carry. False, and
+// counted as corrupt, when either frame has lost sync.
+
+bool HermesProxy::ParseRxStatus(const unsigned char * inbuf)
+{
 	// Need to check for both 1st and 2nd USB frames for the status registers.
 	// Some status come in only in the first, and some only in the second.
 
@@ -365,40 +641,7 @@ void HermesProxy::ReceiveRxIQ(unsigned char * inbuf)	// called by metis Rx threa
 			  AIN6 = (unsigned int)c3 * 256 + (unsigned int)c4;
 			}
 
-			if (Verbose)
-			{
-			  SlowCount++;
-			  if ((SlowCount & 0x1ff) == 0x1ff)
-			  {
-				float FwdPwr = (float)AIN1 * (float)AIN1 / 145000.0;
-				float RevPwr = (float)AIN2 * (float)AIN2 / 145000.0;
-
-				// calculate SWR
-				double SWR =  0.0;
-				try
-				{
-					SWR = (1+sqrt(RevPwr/FwdPwr))/(1-sqrt(RevPwr/FwdPwr));
-					if(false == std::isnormal(SWR))
-					{
-						throw 0;
-					}
-				}
-				catch(int& e)
-				{
-					// there was an anomaly in the SWR calculation, make it obvious ...
-					SWR =  99.9;
-				}
-
-				fprintf(stderr, "AlexFwdPwr = %4.0f  AlexRevPwr = %4.0f   ", FwdPwr, RevPwr);
-				// report SWR if forward power is non-zero
-				if(static_cast<int>(FwdPwr) != 0)
-				{
-					fprintf(stderr, "SWR = %.2f:1 ", SWR);
-				}
-				fprintf(stderr, "ADCOver: %u  HermesVersion: %d (dec)  %X (hex)\n", ADCoverload, HermesVersion, HermesVersion);
-				//fprintf(stderr, "AIN1:%u  AIN2:%u  AIN3:%u  AIN4:%u  AIN5:%u  AIN6:%u\n", AIN1, AIN2, AIN3, AIN4, AIN5, AIN6);  
-				}
-			}
+			PrintStatus();
 		} //endif sync is valid
 		
 		else
@@ -406,81 +649,97 @@ void HermesProxy::ReceiveRxIQ(unsigned char * inbuf)	// called by metis Rx threa
 			CorruptRxCount++;
 			//fprintf(stderr, "HermesProxy: EP6 received from Hermes failed sync header check.\n");
 			//PrintRawBuf(inbuf-8);	// include Ethernet header
-			return;
+			return false;
 		}
 
 	}	// end for two USB frames
 
+	return true;
+};
 
-	// Use write and read counters to select from the Rx buffers,
-	// these are circular.
-
-	if ((outbuf = GetNextRxBuf(outbuf)) == NULL)
-	    return;			// all buffers full. Throw away data
-
-	// Convert 24-bit 2's complement integer samples to float with
-	// maximum value of +1.0 and minimum of -1.0
-	// skip sync/register headers (i=0 and i=64)
-
-
-	if (NumReceivers == 1)		// one receiver
-	{					// 8 byte header + 8 bytes per row * 63 rows = 512 byte USB
-	  for (int i=1; i<128; i++)	// both USB frames, skip header on first frame
-	  {
-	    if (i==64)			// skip header for 2nd frame
-	      continue;
+// Verbose: every 512th call report the Alex power, SWR and ADC overload
+// last reported by the radio.
 
-	    Unpack1RxIQ(&inbuf[i*8], outbuf);  // convert 2's comp to float and place in outbuf
+void HermesProxy::PrintStatus()
+{
+	if (!Verbose)
+	  return;
 
-	    if ((outbuf = GetNextRxBuf(outbuf)) == NULL)  // if needed, get next buffer
-	        return;			// all buffers full. Throw away data      
-	  } 
-	}
-	else				// two receivers
-	{				// 8 byte header + 14 bytes per row * 36 rows = 512 byte USB
-	//PrintRawBuf(inbuf-8);
-	  for (int i=0; i<36; i++)	// first USB frame
-	  {
-	    Unpack2RxIQ(&inbuf[(i*14) + 8], outbuf);  // convert 2's comp to float and place in outbuf
+	SlowCount++;
+	if ((SlowCount & 0x1ff) == 0x1ff)
+	{
+		float FwdPwr = (float)AIN1 * (float)AIN1 / 145000.0;
+		float RevPwr = (float)AIN2 * (float)AIN2 / 145000.0;
 
-	    if ((outbuf = GetNextRxBuf(outbuf)) == NULL)  // if needed, get next buffer
-	        return;			// all buffers full. Throw away data
-	  } 
-	  for (int i=0; i<36; i++)	// second USB frame
-	  {
-	    Unpack2RxIQ(&inbuf[(i*14) + 520], outbuf);  // convert 2's comp to float and place in outbuf
+		// calculate SWR
+		double SWR =  0.0;
+		try
+		{
+			SWR = (1+sqrt(RevPwr/FwdPwr))/(1-sqrt(RevPwr/FwdPwr));
+			if(false == std::isnormal(SWR))
+			{
+				throw 0;
+			}
+		}
+		catch(int& e)
+		{
+			// there was an anomaly in the SWR calculation, make it obvious ...
+			SWR =  99.9;
+		}
 
-	    if ((outbuf = GetNextRxBuf(outbuf)) == NULL)  // if needed, get next buffer
-	      return;			// all buffers full. Throw away data
-	  }
+		fprintf(stderr, "AlexFwdPwr = %4.0f  AlexRevPwr = %4.0f   ", FwdPwr, RevPwr);
+		// report SWR if forward power is non-zero
+		if(static_cast<int>(FwdPwr) != 0)
+		{
+			fprintf(stderr, "SWR = %.2f:1 ", SWR);
+		}
+		fprintf(stderr, "ADCOver: %u  HermesVersion: %d (dec)  %X (hex)\n", ADCoverload, HermesVersion, HermesVersion);
+		//fprintf(stderr, "AIN1:%u  AIN2:%u  AIN3:%u  AIN4:%u  AIN5:%u  AIN6:%u\n", AIN1, AIN2, AIN3, AIN4, AIN5, AIN6);  
 	}
-
-	return;			// normal return;
-
 };
 
-
 IQBuf_t HermesProxy::GetNextRxBuf(IQBuf_t current_outbuf) // get new Rx buffer if we've filled current one
 {
 
 	//pthread_mutex_lock(&mutexRPG);
 
-	//if(RxWriteFill > RXBUFSIZE)
+	//if(RxWriteFill > RxBufSize)
 	//  fprintf(stderr, "ERROR: RxWriteFill: %d  Overflow\n",RxWriteFill);
 
-	if(RxWriteFill & RXBUFSIZE)  // need a new buffer?
+	if(RxWriteFill & RxBufSize)  // need a new buffer?
 	{
-	  if (((RxWriteCounter+1) & (NUMRXIQBUFS - 1)) == RxReadCounter)
+	  unsigned WriteCounter = (RxWriteCounter+1) & (RxRingBufs - 1);
+
+	  if (RxMaxLatency)
+	  {
+	    if (!DropOldRxBufs(WriteCounter))	// hermesNB still holds the next buffer:
+	    {					// start the current one over
+		RxWriteFill = 0;
+		RxIQTime[RxWriteCounter].Count = 0;
+		RxIQTime[RxWriteCounter].Serial = ++RxWriteSerial;
+		return current_outbuf;
+	    }
+	  }
+	  else
 	  {
+	    if (WriteCounter == RxReadSeen)	// looks full, see what hermesNB has read since
+	      RxReadSeen = __atomic_load_n(&RxReadCounter, __ATOMIC_ACQUIRE);
+	    if (WriteCounter == RxReadSeen)
+	    {
 		LostRxBufCount++;	// No Rx Buffers available. Throw away the data
 	  	//pthread_mutex_unlock(&mutexRPG);
 		return NULL;
+	    }
 	  }
-	  ++RxWriteCounter &= (NUMRXIQBUFS - 1); // get next writeable buffer
 	  RxWriteFill = 0;
+	  RxIQTime[WriteCounter].Count = 0;	// no frame has started in it yet
+	  RxIQTime[WriteCounter].Serial = ++RxWriteSerial;
+
+	  // get next writeable buffer, and hand the full one over to hermesNB
+	  __atomic_store_n(&RxWriteCounter, WriteCounter, __ATOMIC_RELEASE);
 
 	  //pthread_mutex_unlock(&mutexRPG);
-	  return RxIQBuf[RxWriteCounter];
+	  return RxIQBuf[WriteCounter];
 	}
 	else				// don't need a new buffer
 	{
@@ -489,116 +748,96 @@ IQBuf_t HermesProxy::GetNextRxBuf(IQBuf_t current_outbuf) // get new Rx buffer i
 	}
 };
 
-void HermesProxy::Unpack1RxIQ(const unsigned char* inptr, const IQBuf_t outbuf)
+bool HermesProxy::DropOldRxBufs(unsigned WriteCounter)	// RxMaxLatency: called by GetNextRxBuf
 {
-	// Unpack 8 bytes in the HPSDR USB frame to I and Q for 1 receiver.
-	// 24 bit 2's complement --> float (-1.0 ... +1.0)
-	// Ignore the 16-bit Mic sample from Hermes/Metis
-
-	if ((PTTOnMutesRx) & (PTTMode == PTTOn))
+	// Once WriteCounter is taken, at most RxMaxLatency worth of buffers may
+	// wait for hermesNB; older ones are thrown away by moving RxReadCounter
+	// on. A compare and swap that fails means hermesNB claimed one meanwhile.
+	// If hermesNB has held on to a buffer for a whole ring, it has stalled and
+	// everything waiting is stale: drop it all and refill the current buffer.
+	// RxReadBusy is looked at again after every failed swap, since the
+	// buffer hermesNB just claimed may be WriteCounter.
+
+	unsigned Latency = RxLatencyBufs();
+	unsigned ReadCounter = __atomic_load_n(&RxReadCounter, __ATOMIC_SEQ_CST);
+	bool Held;
+	for (;;)
 	{
-	  outbuf[RxWriteFill++] = 0.0;
-	  outbuf[RxWriteFill++] = 0.0;
-	  return;
-	}	
+	  Held = (WriteCounter == __atomic_load_n(&RxReadBusy, __ATOMIC_SEQ_CST));
+	  unsigned End = Held ? RxWriteCounter : WriteCounter;
+	  unsigned Keep = Held ? 0 : Latency;
+	  if (((End - ReadCounter) & (RxRingBufs - 1)) <= Keep)
+	    break;
 
-	int I, Q;
+	  unsigned Oldest = (End - Keep) & (RxRingBufs - 1);
+	  if (__atomic_compare_exchange_n(&RxReadCounter, &ReadCounter, Oldest, false,
+					  __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+	  {
+	    StaleRxBufCount += (Oldest - ReadCounter) & (RxRingBufs - 1);
+	    break;
+	  }
+	}
 
-	I = (int)(((signed char)*inptr)<<16);		// Rx0 I
-	inptr++;
-	I += ((int)((unsigned char)*inptr)<<8);
-	inptr++;
-	I += (int)((unsigned char)*inptr);
-	inptr++;
-	if(I<0) I = -(~I + 1);
-
-	Q = (int)(((signed char)*inptr)<<16);		// Rx0 Q
-	inptr++;
-	Q += ((int)((unsigned char)*inptr)<<8);
-	inptr++;
-	Q += (int)((unsigned char)*inptr);
-	inptr++;
-	if(Q<0) Q = -(~Q + 1);
-
-	outbuf[RxWriteFill++] = (float)I/8388607.0;
-	outbuf[RxWriteFill++] = (float)Q/8388607.0;
-
-	// inptr+= 2;					// skip Mic samples
+	if (Held)
+	  StaleRxBufCount++;			// the current buffer goes too
+	return !Held;
 };
 
-void HermesProxy::Unpack2RxIQ(const unsigned char* inptr, const IQBuf_t outbuf)
+IQBuf_t HermesProxy::UnpackRxRows(const unsigned char* inptr, int rows, int stride, IQBuf_t outbuf)
 {
-	// Unpack 14 bytes in the HPSDR USB frame to I and Q for 2 receivers.
-	// 24 bit 2's complement --> float (-1.0 ... +1.0)
-	// Ignore the 16-bit Mic sample from Hermes/Metis
+	// Convert rows of the HPSDR USB frame (or Protocol 2 packet), I and Q for
+	// 1 receiver or for 2, to floats (-1.0 ... +1.0) straight into the Rx
+	// buffers, as many at a time as the current buffer has room for. A row
+	// never straddles two buffers: their sizes are powers of 2, 32 floats
+	// and up. Returns the buffer to go on with, or NULL when all are full.
 
-	if ((PTTOnMutesRx) & (PTTMode == PTTOn))
-	{
-	  outbuf[RxWriteFill++] = 0.0;
-	  outbuf[RxWriteFill++] = 0.0;
-	  outbuf[RxWriteFill++] = 0.0;
-	  outbuf[RxWriteFill++] = 0.0;
-	  return;
-	}	
-
-	int I, Q, I1, Q1;
-	float If, Qf, I1f, Q1f;
-
-	I = (int)(((signed char)*inptr)<<16);		// Rx0 I
-	inptr++;
-	I += ((int)((unsigned char)*inptr)<<8);
-	inptr++;
-	I += (int)((unsigned char)*inptr);
-	inptr++;
-	if(I<0) I = -(~I + 1);
-	If = (float)I/8388607.0;
-
-	Q = (int)(((signed char)*inptr)<<16);		// Rx0 Q
-	inptr++;
-	Q += ((int)((unsigned char)*inptr)<<8);
-	inptr++;
-	Q += (int)((unsigned char)*inptr);
-	inptr++;
-	if(Q<0) Q = -(~Q + 1);
-	Qf = (float)Q/8388607.0;
-
-
-	I1 = (int)(((signed char)*inptr)<<16);		// Rx1 I
-	inptr++;
-	I1 += ((int)((unsigned char)*inptr)<<8);
-	inptr++;
-	I1 += (int)((unsigned char)*inptr);
-	inptr++;
-	if(I1<0) I1 = -(~I1 + 1);
-	I1f = (float)I1/8388607.0;
-
-	Q1 = (int)(((signed char)*inptr)<<16);		// Rx1 Q
-	inptr++;
-	Q1 += ((int)((unsigned char)*inptr)<<8);
-	inptr++;
-	Q1 += (int)((unsigned char)*inptr);
-	inptr++;
-	if(Q1<0) Q1 = -(~Q1 + 1);
-	Q1f = (float)Q1/8388607.0;
-
-	outbuf[RxWriteFill++] = If;
-	outbuf[RxWriteFill++] = Qf;
-	outbuf[RxWriteFill++] = I1f;
-	outbuf[RxWriteFill++] = Q1f;
-
-	// inptr+= 2;					// skip Mic samples
+	int FloatsPerRow = (NumReceivers == 1) ? 2 : 4;
+	bool Mute = (PTTOnMutesRx) & (PTTMode == PTTOn);
 
-	return;
+	while (rows > 0)
+	{
+	  int n = (RxBufSize - RxWriteFill) / FloatsPerRow;
+	  if (n > rows)
+	    n = rows;
+
+	  if (Mute)
+	    memset(outbuf + RxWriteFill, 0, n * FloatsPerRow * sizeof(float));
+	  else if (NumReceivers == 1)
+	    Unpack->one(inptr, n, stride, outbuf + RxWriteFill);	// skips the Mic samples
+	  else
+	    Unpack->two(inptr, n, stride, outbuf + RxWriteFill);
+	  RxWriteFill += n * FloatsPerRow;
+	  inptr += n * stride;
+	  rows -= n;
+
+	  if ((outbuf = GetNextRxBuf(outbuf)) == NULL)  // if needed, get next buffer
+	    return NULL;
+	}
+	return outbuf;
 };
 
-IQBuf_t HermesProxy::GetRxIQ()		// called by HermesNB to pickup any RxIQ
+IQBuf_t HermesProxy::GetRxIQ(RxTime_t * Time)	// called by HermesNB to pickup any RxIQ
 {
 
 	//int status = pthread_mutex_trylock(&mutexRPG);	// Don't block gnuradio scheduler
 	//  if(status != 0)
 	//    return NULL;		// return 'no buffers' if can't acquire the mutex
 
-	if(RxReadCounter == RxWriteCounter)
+	// The buffer handed out last time has been copied out by now: free it.
+	// The receive thread must not refill a buffer while it is being read.
+
+	if (RxMaxLatency)
+	  return ClaimRxIQ(Time);
+
+	if(RxReadHeld)
+	{
+	  __atomic_store_n(&RxReadCounter, (RxReadCounter+1) & (RxRingBufs - 1), __ATOMIC_RELEASE);
+	  RxReadHeld = false;
+	}
+
+	if(RxReadCounter == RxWriteSeen)		// looks empty, see what has arrived since
+	  RxWriteSeen = __atomic_load_n(&RxWriteCounter, __ATOMIC_ACQUIRE);
+	if(RxReadCounter == RxWriteSeen)
 	{
 	  //pthread_mutex_unlock(&mutexRPG);
 	  return NULL;				// empty - no buffers to return
@@ -606,13 +845,172 @@ IQBuf_t HermesProxy::GetRxIQ()		// called by HermesNB to pickup any RxIQ
 	}
 
 	IQBuf_t ReturnBuffer = RxIQBuf[RxReadCounter];	// get the next receiver buffer
-	++RxReadCounter &= (NUMRXIQBUFS - 1);		// increment read counter modulo
+	if (Time != NULL)
+	  *Time = RxIQTime[RxReadCounter];		// and when its frames arrived
+	RxReadHeld = true;				// freed by the next call
+	RxReadSerial = RxIQTime[RxReadCounter].Serial;
 
 	//pthread_mutex_unlock(&mutexRPG);
 
 	return ReturnBuffer;
 };
 
+IQBuf_t HermesProxy::ClaimRxIQ(RxTime_t * Time)	// GetRxIQ() with RxMaxLatency
+{
+	// The buffer handed out last time has been copied out by now.
+
+	__atomic_store_n(&RxReadBusy, RxRingBufs, __ATOMIC_SEQ_CST);
+
+	// Claim the oldest buffer by moving RxReadCounter past it, unless the
+	// receive thread moves it on first. RxReadBusy is set beforehand, so the
+	// receive thread sees it before it can come round to the buffer again.
+
+	unsigned ReadCounter = __atomic_load_n(&RxReadCounter, __ATOMIC_SEQ_CST);
+	do
+	{
+	  if (ReadCounter == __atomic_load_n(&RxWriteCounter, __ATOMIC_ACQUIRE))
+	  {
+	    __atomic_store_n(&RxReadBusy, RxRingBufs, __ATOMIC_SEQ_CST);
+	    return NULL;			// empty - no buffers to return
+	  }
+	  __atomic_store_n(&RxReadBusy, ReadCounter, __ATOMIC_SEQ_CST);
+	}
+	while (!__atomic_compare_exchange_n(&RxReadCounter, &ReadCounter, (ReadCounter+1) & (RxRingBufs - 1),
+					   false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+	RxTime_t * Claimed = &RxIQTime[ReadCounter];
+	if (Time != NULL)
+	{
+	  *Time = *Claimed;
+	  Time->Dropped = Claimed->Serial - RxReadSerial - 1;	// thrown away since the last one
+	}
+	RxReadSerial = Claimed->Serial;
+
+	return RxIQBuf[ReadCounter];
+};
+
+
+bool HermesProxy::RxRoom(int frames)	// called by metis.cc before a fast replay hands out frames
+{
+	if (RxLazyDecode)
+	  return metis_raw_ring_space(&RxRawRing) >= (unsigned)frames;
+
+	// the frames' floats, plus the part filled buffer they start in; a ring
+	// too shallow for that many is waited on until it is empty. With
+	// RxMaxLatency only the buffers it keeps count as room.
+	unsigned limit = RxMaxLatency ? RxLatencyBufs() : RxRingBufs - 1;
+	unsigned needed = ((unsigned)frames * RxSamplesPerFrame() * 2 * NumReceivers + RxBufSize - 1) / RxBufSize + 1;
+	if (needed > limit)
+	  needed = limit;
+
+	RxReadSeen = __atomic_load_n(&RxReadCounter, __ATOMIC_ACQUIRE);
+	unsigned filled = (RxWriteCounter - RxReadSeen) & (RxRingBufs - 1);
+	return (limit > filled) && (limit - filled >= needed);
+};
+
+unsigned HermesProxy::RxLatencyBufs()	// RxMaxLatency: how many full RxIQBufs may wait
+{
+	unsigned long Samples = (unsigned long)RxMaxLatency * RxSampleRate / 1000;	// per receiver
+	unsigned long Bufs = Samples * 2 * NumReceivers / RxBufSize;
+
+	if (Bufs < 1)
+	  Bufs = 1;
+	if (Bufs > RxRingBufs - 2)		// so the ring never fills up
+	  Bufs = RxRingBufs - 2;
+	return (unsigned)Bufs;
+};
+
+int HermesProxy::DropOldRxFrames()	// called by HermesNB with RxLazyDecode and RxMaxLatency
+{
+	// Only hermesNB empties the raw ring, so the oldest frames are dropped
+	// on this side, before decoding. Returns how many.
+
+	unsigned long Samples = (unsigned long)RxMaxLatency * RxSampleRate / 1000;	// per receiver
+	unsigned Keep = Samples / RxSamplesPerFrame();
+	if (Keep < 1)
+	  Keep = 1;
+
+	int Dropped = 0;
+	for (unsigned Waiting = metis_raw_ring_count(&RxRawRing); Waiting > Keep; Waiting--)
+	{
+	  metis_raw_ring_release(&RxRawRing);
+	  Dropped++;
+	}
+	StaleRxBufCount += Dropped;
+	return Dropped;
+};
+
+int HermesProxy::RxSamplesPerBuf()	// called by HermesNB, complex samples in one RxIQBuf
+{
+	return RxBufSize / 2;
+};
+
+bool HermesProxy::RxFinished()		// called by HermesNB, true when there will be no more samples
+{
+	if (metis == NULL || !metis_receive_finished(metis))
+	  return false;
+
+	if (RxLazyDecode)
+	  return metis_raw_ring_count(&RxRawRing) == 0;
+
+	unsigned ReadCounter = RxReadCounter;
+	if (RxReadHeld)				// handed out already, so not waiting
+	  ReadCounter = (ReadCounter+1) & (RxRingBufs - 1);
+	return ReadCounter == __atomic_load_n(&RxWriteCounter, __ATOMIC_ACQUIRE);
+};
+
+
+// ************  Lazy decode: hermesNB converts queued sample rows straight into its outputs ****
+
+int HermesProxy::RxSamplesPerFrame()	// complex samples per receiver in one Ethernet frame
+{
+	return (NumReceivers == 1) ? 2*63 : 2*36;	// 63 rows of 8 bytes, or 36 rows of 14 bytes, per USB frame
+};
+
+const METIS_RAW_SLOT * HermesProxy::PeekRxFrame()	// called by HermesNB, sample rows of the oldest queued frame
+{
+	return metis_raw_ring_peek(&RxRawRing);
+};
+
+void HermesProxy::ReleaseRxFrame()	// called by HermesNB, done with PeekRxFrame()
+{
+	metis_raw_ring_release(&RxRawRing);
+};
+
+// Decode the sample rows ReceiveRxIQ() queued for one EP6 frame to
+// RxSamplesPerFrame() complex samples in out0, and in out1 for the second
+// receiver (NULL when there is no output for it).
+
+void HermesProxy::DecodeRxRows(const unsigned char * rows, gr_complex * out0, gr_complex * out1)
+{
+	int n = RxSamplesPerFrame();
+
+	if ((PTTOnMutesRx) & (PTTMode == PTTOn))
+	{
+	  for (int j=0; j<n; j++)
+	  {
+	    out0[j] = gr_complex(0.0, 0.0);
+	    if (out1 != NULL)
+	      out1[j] = gr_complex(0.0, 0.0);
+	  }
+	  return;
+	}
+
+	if (NumReceivers == 1)			// I2 I1 I0 Q2 Q1 Q0 M1 M0
+	  Unpack->one(rows, 2*63, 8, (float *)out0);	// a gr_complex is I, Q
+	else					// I Q for Rx0, I Q for Rx1, M1 M0
+	{
+	  float IQ[2*36*4];
+	  Unpack->two(rows, 2*36, 14, IQ);
+	  for (int i=0; i<2*36; i++)
+	  {
+	    out0[i] = gr_complex(IQ[4*i], IQ[4*i+1]);
+	    if (out1 != NULL)
+	      out1[i] = gr_complex(IQ[4*i+2], IQ[4*i+3]);
+	  }
+	}
+};
+
 
 // ************  Routines to send data from gnuradio to the transmitter ***************
 
@@ -713,29 +1111,24 @@ void HermesProxy::UpdateHermes()	// send a set of control registers to hardware
 	//fprintf(stderr, "UpdateHermes called\n");
 
 	unsigned char buffer[512];	// dummy up a USB HPSDR buffer;
+	unsigned char buffer1[512];	// second USB frame of each Ethernet frame
 	for(int i=0; i<512; i++)
-		buffer[i] = 0;
+		buffer[i] = buffer1[i] = 0;
 
-	int length = 512;		// metis_write ignores this value
 	unsigned char ep = 0x02;	// all Hermes data is sent to end point 2
 
-	// metis_write needs to be called twice to make one ethernet write to the hardware
+	// Each Ethernet write to the hardware carries two USB frames.
 	// Set these registers before starting the receive stream
 
 	BuildControlRegs(0, buffer);
-	metis_write(ep, buffer, length);
-	BuildControlRegs(2, buffer);
-	metis_write(ep, buffer, length);
+	BuildControlRegs(2, buffer1);
+	metis_send_frame(metis, ep, buffer, buffer1);
 
-	BuildControlRegs(0, buffer);
-	metis_write(ep, buffer, length);
-	BuildControlRegs(4, buffer);
-	metis_write(ep, buffer, length);
+	BuildControlRegs(4, buffer1);
+	metis_send_frame(metis, ep, buffer, buffer1);
 
-	BuildControlRegs(0, buffer);
-	metis_write(ep, buffer, length);
-	BuildControlRegs(6, buffer);
-	metis_write(ep, buffer, length);
+	BuildControlRegs(6, buffer1);
+	metis_send_frame(metis, ep, buffer, buffer1);
 
 	// Initialize the first TxBuffer (currently empty) with a valid control frame (on startup only)
 	
@@ -748,6 +1141,56 @@ void HermesProxy::UpdateHermes()	// send a set of control registers to hardware
 }
 
 
+// Alex filter selection in the Protocol 1 C&C bit layout. A setting of 0
+// follows the receive or transmit frequency.
+
+unsigned char HermesProxy::AlexRxFilter()
+{
+	unsigned char RxHPF = AlexRxHPF;
+
+	if (AlexRxHPF == 0)				// if Rx autotrack
+	{
+		if (Receive0Frequency < 1500000)
+		  RxHPF = 0x20;				// bypass
+		else if (Receive0Frequency < 6500000)
+		  RxHPF = 0x10;				// 1.5 MHz HPF
+		else if (Receive0Frequency < 9500000)
+		  RxHPF = 0x08;				// 6.5 MHz HPF
+		else if (Receive0Frequency < 13000000)
+		  RxHPF = 0x04;				// 9.5 mHz HPF
+		else if (Receive0Frequency < 20000000)
+		  RxHPF = 0x01;				// 13 Mhz HPF
+		else if (Receive0Frequency < 50000000)
+		  RxHPF = 0x02;				// 20 MHz HPF
+		else RxHPF = 0x40;			// 6M BPF + LNA
+	}
+	return RxHPF;
+};
+
+unsigned char HermesProxy::AlexTxFilter()
+{
+	unsigned char TxLPF = AlexTxLPF;
+
+	if (AlexTxLPF == 0)				// if Tx autotrack
+	{
+		if (TransmitFrequency > 30000000)
+		  TxLPF = 0x10;				// 6m LPF
+		else if (TransmitFrequency > 19000000)
+		  TxLPF = 0x20;				// 10/12m LPF
+		else if (TransmitFrequency > 14900000)
+		  TxLPF = 0x40;				// 15/17m LPF
+		else if (TransmitFrequency > 9900000)
+		  TxLPF = 0x01;				// 30/20m LPF
+		else if (TransmitFrequency > 4900000)
+		  TxLPF = 0x02;				// 60/40m LPF
+		else if (TransmitFrequency > 3400000)
+		  TxLPF = 0x04;				// 80m LPF
+		else TxLPF = 0x08;			// 160m LPF
+	}
+	return TxLPF;
+};
+
+
 void HermesProxy::BuildControlRegs(unsigned RegNum, RawBuf_t outbuf)
 {
 	// create the sync + control register values to send to Hermes
@@ -837,41 +1280,8 @@ void HermesProxy::BuildControlRegs(unsigned RegNum, RawBuf_t outbuf)
 
 	    unsigned char RxHPF, TxLPF;
 
-	    RxHPF = AlexRxHPF;
-	    if (AlexRxHPF == 0)				// if Rx autotrack
-	    {
-		if (Receive0Frequency < 1500000)
-		  RxHPF = 0x20;				// bypass
-		else if (Receive0Frequency < 6500000)
-	          RxHPF = 0x10;				// 1.5 MHz HPF
-		else if (Receive0Frequency < 9500000)
-		  RxHPF = 0x08;				// 6.5 MHz HPF
-		else if (Receive0Frequency < 13000000)
-		  RxHPF = 0x04;				// 9.5 mHz HPF
-		else if (Receive0Frequency < 20000000)
-		  RxHPF = 0x01;				// 13 Mhz HPF
-		else if (Receive0Frequency < 50000000)
-		  RxHPF = 0x02;				// 20 MHz HPF
-		else RxHPF = 0x40;			// 6M BPF + LNA
-	    }
-
-	    TxLPF = AlexTxLPF;
-	    if (AlexTxLPF == 0)				// if Tx autotrack
-	    {
-		if (TransmitFrequency > 30000000)
-		  TxLPF = 0x10;				// 6m LPF
-		else if (TransmitFrequency > 19000000)
-		  TxLPF = 0x20;				// 10/12m LPF
-		else if (TransmitFrequency > 14900000)
-		  TxLPF = 0x40;				// 15/17m LPF
-		else if (TransmitFrequency > 9900000)
-		  TxLPF = 0x01;				// 30/20m LPF
-		else if (TransmitFrequency > 4900000)
-		  TxLPF = 0x02;				// 60/40m LPF
-		else if (TransmitFrequency > 3400000)
-		  TxLPF = 0x04;				// 80m LPF
-		else TxLPF = 0x08;			// 160m LPF
-	    }
+	    RxHPF = AlexRxFilter();
+	    TxLPF = AlexTxFilter();
 
 	    outbuf[5] = 0x40;				// c2 - Alex Manual filter control enabled
 	    outbuf[6] = RxHPF & 0x7f;			// c3 - Alex HPF filter selection
@@ -912,6 +1322,9 @@ int HermesProxy::PutTxIQ(const gr_complex * in0, /*const gr_complex * in1,*/ int
         RawBuf_t outbuf;
 	int A, B, I, Q;
 
+	if (Protocol == 2)		// DUC samples, no C&C registers
+	  return PutDUCIQ(in0, nsamples);
+
 	outbuf = GetNextTxBuf();	// get a Txbuffer
 
 	if (outbuf == NULL)		// Could not get a Tx buffer
@@ -1018,82 +1431,352 @@ RawBuf_t HermesProxy::GetNextTxBuf()		// get a TXBuf if available
 	  //if(status != 0)
 	 //   return NULL;	// No buffers if can't acquire mutex
 
-	  if (((TxWriteCounter+1) & (NUMTXBUFS - 1)) == TxReadCounter)
+	  unsigned WriteCounter = (TxWriteCounter+1) & (TxRingBufs - 1);
+
+	  if (WriteCounter == TxReadSeen)	// looks full, see what has been sent since
+	    TxReadSeen = __atomic_load_n(&TxReadCounter, __ATOMIC_ACQUIRE);
+	  if (WriteCounter == TxReadSeen)
 	  {
 	    //pthread_mutex_unlock(&mutexGPT);
 	    return NULL;
 	  }
-	 
-	  ++TxWriteCounter &= (NUMTXBUFS - 1); // get next writeable buffer
+
+	  // get next writeable buffer, and hand the one filled last time over to be sent
+	  __atomic_store_n(&TxWriteCounter, WriteCounter, __ATOMIC_RELEASE);
 
 	  //pthread_mutex_unlock(&mutexGPT);
-	  return TxBuf[TxWriteCounter];
+	  return TxBuf[WriteCounter];
 };
 
 
 // SendTxIQ() is called on a periodic basis to send Tx Ethernet frames to the 
-// Hermes/Metis hardware.
+// Hermes/Metis hardware. It sends 2 USB frames in one Ethernet Frame.
+// When metis is receiving in batches the frame is only counted as due here,
+// and metis calls FlushTxIQ() once the whole receive batch is dispatched.
+
 void HermesProxy::SendTxIQ()
 {
 
 	if(TxStop)				// Kill Tx frames if stopped
 		return;
 
+	TxFramesDue++;
+
+	if(!metis_receive_batching(metis))
+		FlushTxIQ();
+
+	return;
+};
+
+
+// Send every due Tx Ethernet frame. The USB frames are passed to metis
+// straight out of TxBuf[] and only freed once they have been sent.
+
+void HermesProxy::FlushTxIQ()
+{
+	RawBuf_t frames[2 * METIS_MAX_TX_BATCH];
+	int nframes = 0;
+	unsigned ReadCounter = TxReadCounter;
+
+	if(TxStop)				// Kill Tx frames if stopped
+	{
+		TxFramesDue = 0;
+		return;
+	}
+
 	unsigned char ep = 0x2;			// Tx data goes to end point 2
 
-//	fprintf(stderr, "SendTxIQ: TxReadCounter = %d   TxWriteCounter = %d  TxFrameIdleCount = %d\n",
-//		TxReadCounter, TxWriteCounter, TxFrameIdleCount); 
+	while(TxFramesDue > 0)
+	{
+	  TxFramesDue--;
+	  TotalTxBufCount++;
 
-	// Time to send one Tx Eth frame (2 x USB frames).
-	// If there are at least two buffers in the queue, send then free them.
+	  // If there are at least two buffers in the queue, send then free them.
 
-	//pthread_mutex_lock(&mutexGPT);
+	  if (((TxWriteSeen - ReadCounter) & (TxRingBufs - 1)) < 2)	// looks short, see what has come since
+	    TxWriteSeen = __atomic_load_n(&TxWriteCounter, __ATOMIC_ACQUIRE);
+	  if (((TxWriteSeen - ReadCounter) & (TxRingBufs - 1)) < 2)    // zero or one buffer ready
+	  {
+	    LostTxBufCount++;
+	    continue;
+	  }
 
-	bool bufempty = (TxReadCounter == TxWriteCounter);
-	bool bufone = ((TxReadCounter+1 & (NUMTXBUFS - 1)) == TxWriteCounter);
+	  frames[nframes*2] = TxBuf[ReadCounter];		// one USB frame
+	  ++ReadCounter &= (TxRingBufs - 1);
+	  frames[nframes*2+1] = TxBuf[ReadCounter];		// next USB frame
+	  ++ReadCounter &= (TxRingBufs - 1);
 
-	//pthread_mutex_unlock(&mutexGPT);
+	  if (++nframes == METIS_MAX_TX_BATCH)
+	  {
+	    metis_send_frames(metis, ep, frames, nframes);
+	    __atomic_store_n(&TxReadCounter, ReadCounter, __ATOMIC_RELEASE);	// and free them
+	    nframes = 0;
+	  }
+	}
 
-	TotalTxBufCount++;
+	if (nframes == 1)
+	  metis_send_frame(metis, ep, frames[0], frames[1]);
+	else if (nframes > 1)
+	  metis_send_frames(metis, ep, frames, nframes);
+
+	__atomic_store_n(&TxReadCounter, ReadCounter, __ATOMIC_RELEASE);	// and free them
+
+	return;
+};
 
-	if ( bufempty | bufone )    // zero or one buffer ready	
+
+// ********** Protocol 2 **********
+//
+// The radio is set up by the command packets of hpsdr_p2.cc instead of C&C
+// registers. DDC0 packets carry 238 samples of one receiver, or 119 of
+// each with DDC1 synchronised to DDC0 and interleaved I0 Q0 I1 Q1, the
+// same layout as RxIQBuf. The DUC runs at a fixed 192 kHz, so in Protocol 2
+// the Tx input of hermesNB is taken at 192 kHz. Each TxBuf holds 63 DUC
+// samples, 24 bit big endian I then Q, and a DUC packet is sent for every
+// 240 samples the radio consumes, counted from the DDC samples received.
+
+#define P2_UPDATES_PER_SEC	20	// high priority packets sent per second while streaming
+
+// Alex0 bits for each Protocol 1 HPF and LPF bit, lowest bit first.
+static const unsigned int P2AlexHPF[7] = { P2_ALEX_13MHZ_HPF, P2_ALEX_20MHZ_HPF, P2_ALEX_9_5MHZ_HPF,
+	P2_ALEX_6_5MHZ_HPF, P2_ALEX_1_5MHZ_HPF, P2_ALEX_BYPASS_HPF, P2_ALEX_6M_PREAMP };
+static const unsigned int P2AlexLPF[7] = { P2_ALEX_30_20_LPF, P2_ALEX_60_40_LPF, P2_ALEX_80_LPF,
+	P2_ALEX_160_LPF, P2_ALEX_6_BYPASS_LPF, P2_ALEX_12_10_LPF, P2_ALEX_17_15_LPF };
+
+void HermesProxy::P2Settings(P2_SETTINGS* settings)
+{
+	unsigned char RxHPF = AlexRxFilter();
+	unsigned char TxLPF = AlexTxFilter();
+	unsigned int alex = 0;
+
+	for (int i=0; i<7; i++)
 	{
-	  LostTxBufCount++;
+	  if (RxHPF & (1 << i))
+	    alex |= P2AlexHPF[i];
+	  if (TxLPF & (1 << i))
+	    alex |= P2AlexLPF[i];
+	}
+
+	switch (AlexRxAnt)			// Protocol 1 C3 antenna bits
+	{
+	  case 0xa0: alex |= P2_ALEX_RX_EXT1; break;
+	  case 0xc0: alex |= P2_ALEX_RX_EXT2; break;
+	  case 0xe0: alex |= P2_ALEX_RX_XVTR; break;
+	  default: break;			// Tx antenna via T/R relay
+	}
+
+	if (AlexTxAnt == 1)
+	  alex |= P2_ALEX_TX_ANT2;
+	else if (AlexTxAnt == 2)
+	  alex |= P2_ALEX_TX_ANT3;
+	else
+	  alex |= P2_ALEX_TX_ANT1;
+
+	settings->receivers = NumReceivers;
+	settings->sample_rate = RxSampleRate;
+	settings->rx_frequency[0] = Receive0Frequency;
+	settings->rx_frequency[1] = Receive1Frequency;
+	settings->tx_frequency = Duplex ? TransmitFrequency : Receive0Frequency;
+	settings->drive = (PTTOffMutesTx & (PTTMode == PTTOff)) ? 0 : TxDrive;
+	settings->ptt = (PTTMode == PTTOn) || ((PTTMode == PTTVox) && TxVoxActive);
+	settings->dither = ADCdither;
+	settings->random = ADCrandom;
+	settings->attenuation = RxAtten;
+	settings->alex = alex;
+};
+
+void HermesProxy::UpdateP2()
+{
+	P2_SETTINGS settings;
+
+	P2Settings(&settings);
+	p2_update(p2, &settings);		// and the DDC rate, if it has changed
+	TxSentPTT = settings.ptt;
+};
+
+void HermesProxy::ReceiveDDCIQ(int ddc, unsigned char * inbuf, int length, const struct timespec * stamp)	// called by p2 Rx thread.
+{
+	if (ddc != 0)			// DDC1 comes interleaved in DDC0's packets
+	  return;
+
+	// look for lost receive packets based on skips in the sequence number
+
+	unsigned int SequenceNum = (unsigned char)(inbuf[0]) << 24;
+	SequenceNum += (unsigned char)(inbuf[1]) << 16;
+	SequenceNum += (unsigned char)(inbuf[2]) << 8;
+	SequenceNum += (unsigned char)(inbuf[3]);
+
+	if(SequenceNum > CurrentEthSeqNum + 1)
+	{
+	    LostEthernetRx += (SequenceNum - CurrentEthSeqNum - 1);	// packets missing in the gap
+	    CurrentEthSeqNum = SequenceNum;
+	}
+	else
+	{
+	  if(SequenceNum == CurrentEthSeqNum + 1)
+	    CurrentEthSeqNum++;
+	}
 
-	//fprintf(stderr, "SendTxIQ01: TxReadCounter = %d   TxWriteCounter = %d  "
-		//"TxFrameIdleCount = %d  bufempty = %d   bufone = %d\n",
-		//TxReadCounter, TxWriteCounter, TxFrameIdleCount, bufempty, bufone); 
+	int BitsPerSample = (inbuf[12] << 8) | inbuf[13];
+	int Samples = (inbuf[14] << 8) | inbuf[15];
+	int RowBytes = (NumReceivers == 1) ? 6 : 12;	// I Q, or I0 Q0 I1 Q1, 24 bits each
 
-	 // if(TxFrameIdleCount++ > 400)
-	 // {
-	    //UpdateHermes();             // Force basic register update if 
-	 //   TxFrameIdleCount = 0;	//   we've not sent for about 1 second
-	 // }
+	if ((BitsPerSample != 24) || (P2_IQ_HEADER + Samples * RowBytes > length))
+	{
+	  CorruptRxCount++;		// not the layout that was asked for
+	  return;
 	}
-	else	// two or more buffers ready
+
+	TotalRxBufCount++;
+
+	ScheduleDUCIQ(Samples);		// DUC packets the radio has made room for
+
+	RxUpdateDue += Samples;		// and refresh the radio's settings now and then
+	if (RxUpdateDue >= (unsigned long)(RxSampleRate / P2_UPDATES_PER_SEC))
 	{
+	  RxUpdateDue = 0;
+	  UpdateP2();
+	}
 
-	//fprintf(stderr, "SendTxIQ02: TxReadCounter = %d   TxWriteCounter = %d  TxFrameIdleCount = %d\n",
-		//TxReadCounter, TxWriteCounter, TxFrameIdleCount); 
+	IQBuf_t outbuf;			// RxWrite output buffer selector
 
-	  metis_write(ep, TxBuf[TxReadCounter], 512);	// write one USB frame to metis
+	outbuf = RxIQBuf[RxWriteCounter];	// initialize buffer pointer
 
-	 // pthread_mutex_lock(&mutexGPT);
-	  ++TxReadCounter &= (NUMTXBUFS - 1);		// and free it
-	  //pthread_mutex_unlock(&mutexGPT);
+	if ((outbuf = GetNextRxBuf(outbuf)) == NULL)
+	    return;			// all buffers full. Throw away data
 
-	  metis_write(ep, TxBuf[TxReadCounter], 512);	// write next USB frame to metis
+	RxTime_t * Time = &RxIQTime[RxWriteCounter];
+	if ((stamp != NULL) && (stamp->tv_sec != 0) && (Time->Count < RxTimesPerBuf))
+	{
+	  Time->Offset[Time->Count] = RxWriteFill;
+	  Time->Sequence[Time->Count] = SequenceNum;
+	  Time->Stamp[Time->Count] = *stamp;
+	  Time->Count++;
+	}
 
-	  //pthread_mutex_lock(&mutexGPT);
-	  ++TxReadCounter &= (NUMTXBUFS - 1);		// and free it
-	  //pthread_mutex_unlock(&mutexGPT);
+	inbuf += P2_IQ_HEADER;		// skip sequence, timestamp, bits and samples
 
-	 // TxFrameIdleCount = 0;				// have just sent a frame
-	};
+	UnpackRxRows(inbuf, Samples, RowBytes, outbuf);	// rows without the mic bytes of a USB row
+};
+
+void HermesProxy::ReceiveP2Status(unsigned char * inbuf, int length)	// called by p2 Rx thread.
+{
+	if (length < P2_SHORT_BYTES)
+	{
+	  CorruptRxCount++;
+	  return;
+	}
+
+	ADCoverload = (inbuf[5] & 0x01) != 0;			// ADC0
+	AIN5 = (unsigned int)inbuf[6] * 256 + (unsigned int)inbuf[7];	// exciter power
+	AIN1 = (unsigned int)inbuf[14] * 256 + (unsigned int)inbuf[15];	// Alex forward power
+	AIN2 = (unsigned int)inbuf[22] * 256 + (unsigned int)inbuf[23];	// Alex reverse power
+	AIN6 = (unsigned int)inbuf[49] * 256 + (unsigned int)inbuf[50];	// supply volts
+
+	PrintStatus();
+};
+
+void HermesProxy::ScheduleDUCIQ(int RxSamples)
+{
+	TxDucDue += (unsigned long)RxSamples * P2_DUC_RATE;
+
+	while (TxDucDue >= (unsigned long)P2_DUC_SAMPLES * RxSampleRate)
+	{
+	  TxDucDue -= (unsigned long)P2_DUC_SAMPLES * RxSampleRate;
+	  SendDUCIQ();
+	}
+};
+
+// Fill a DUC packet from the Tx buffers, freeing each once all its samples
+// are taken. When hermesNB has not kept up the rest of the packet is silence
+// and the packet is counted as lost.
+
+void HermesProxy::SendDUCIQ()
+{
+	bool Short = false;
+
+	if(TxStop)				// Kill Tx packets if stopped
+		return;
+
+	TotalTxBufCount++;
+
+	for (int i=0; i<P2_DUC_SAMPLES; i++)
+	{
+	  if (TxDucCursor == 63)		// current buffer used up, free it
+	  {
+	    // as in FlushTxIQ() the newest buffer, which PutDUCIQ() may still
+	    // be filling, is left alone
+	    if (((TxWriteSeen - TxReadCounter) & (TxRingBufs - 1)) < 2)
+	      TxWriteSeen = __atomic_load_n(&TxWriteCounter, __ATOMIC_ACQUIRE);
+	    if (((TxWriteSeen - TxReadCounter) & (TxRingBufs - 1)) < 2)
+	    {
+	      memset(&TxDucIQ[i*6], 0, (P2_DUC_SAMPLES - i) * 6);
+	      Short = true;
+	      break;
+	    }
+	    __atomic_store_n(&TxReadCounter, (TxReadCounter+1) & (TxRingBufs - 1), __ATOMIC_RELEASE);
+	    TxDucCursor = 0;
+	  }
+	  memcpy(&TxDucIQ[i*6], &TxBuf[TxReadCounter][TxDucCursor*6], 6);
+	  TxDucCursor++;
+	}
+
+	if (Short)
+	  LostTxBufCount++;
+
+	p2_send_duc(p2, TxDucIQ);
+
+	bool PTT = (PTTMode == PTTOn) || ((PTTMode == PTTVox) && TxVoxActive);
+	if (PTT != TxSentPTT)			// Vox keyed or released, or PTT switched
+	  UpdateP2();
 
 	return;
 };
 
+int HermesProxy::PutDUCIQ(const gr_complex * in0, int nsamples)
+{
+	RawBuf_t outbuf;
+	int I, Q;
+	bool activity = false;
+
+	if (nsamples > 63)
+	  nsamples = 63;
+
+	outbuf = GetNextTxBuf();	// get a Txbuffer
+
+	if (outbuf == NULL)		// Could not get a Tx buffer
+	  return 0;		 	// Tell hermeNB we didn't consume any input
+
+	for (int i=0; i<nsamples; i++)	// 24 bit I then Q, no swap as in Protocol 1
+	{
+	  I = (int)(in0[i].real() * 8388607.0);	// scale to 24 bits
+	  Q = (int)(in0[i].imag() * 8388607.0);
+
+	  if(PTTOffMutesTx & (PTTMode == PTTOff))	// Kill Tx if in Rx and PTTControls the Tx
+	  {
+	    I = 0;
+	    Q = 0;
+	  };
+
+	  if ((I != 0) || (Q != 0))
+	    activity = true;
+
+	  outbuf[i*6 + 0] = (unsigned char)((I >> 16) & 0xff);	// I2 MSB
+	  outbuf[i*6 + 1] = (unsigned char)((I >> 8) & 0xff);
+	  outbuf[i*6 + 2] = (unsigned char)(I & 0xff);		// I0 LSB
+	  outbuf[i*6 + 3] = (unsigned char)((Q >> 16) & 0xff);	// Q2 MSB
+	  outbuf[i*6 + 4] = (unsigned char)((Q >> 8) & 0xff);
+	  outbuf[i*6 + 5] = (unsigned char)(Q & 0xff);		// Q0 LSB
+	}
+
+	for (int i=nsamples; i<63; i++)	// a short buffer is padded with silence
+	  memset(&outbuf[i*6], 0, 6);
+
+	TxVoxActive = activity;		// Vox keys the radio while there is signal
+
+	return nsamples;
+};
+
 
 // TODO not yet implemented
 void HermesProxy::ReceiveMicLR() {};	// receive an LR audio bufer from Hermes hardware
@@ -31,25 +31,40 @@
 //					-- Add additional parameters to constructor
 
 #include <gnuradio/io_signature.h>
+#include <hpsdr/hermes_options.h>
+#include <time.h>
+#include "metis.h"
+#include "metis_raw_ring.h"
+#include "metis_unpack.h"
+#include "hpsdr_p2.h"
 
 #ifndef HermesProxy_H
 #define HermesProxy_H
 
-#define NUMRXIQBUFS	128		// number of receiver IQ buffers in circular queue.
-					// Must be integral power of 2 (2,4,8,16,32,64, etc.)
-
-#define RXBUFSIZE	256		// number of floats in one RxIQBuf, #complexes is half
-					// Must be integral power of 2 (2,4,8,16,32,64, etc.)
+// Ring geometry is set by constructor parameters; these are the defaults,
+// taken when a parameter is 0. Ring depths and the Rx buffer size are
+// rounded up to a power of 2.
 
+#define NUMRXIQBUFS	128		// number of receiver IQ buffers in circular queue
+#define RXBUFSAMPLES	128		// complex samples in one RxIQBuf, all receivers together
 #define NUMTXBUFS	128		// number of transmit buffers in circular queue
-					// Must be integral power of 2
 
-#define TXBUFSIZE	512		// number of bytes in one TxBuf
+#define TXBUFSIZE	512		// number of bytes in one TxBuf, one HPSDR USB frame
 					
 
 typedef float* IQBuf_t;			// IQ buffer type (IQ samples as floats)
 typedef unsigned char* RawBuf_t;	// Raw transmit buffer type
 
+typedef struct				// Arrival times of the Ethernet frames whose first
+{					// sample landed in one RxIQBuf
+	unsigned Count;			// number of frames that began in this buffer
+	unsigned * Offset;		// float index of each frame's first sample
+	unsigned * Sequence;		// HPSDR Ethernet sequence number
+	struct timespec * Stamp;	// kernel receive time (CLOCK_REALTIME)
+	unsigned Serial;		// buffers started before this one
+	unsigned Dropped;		// GetRxIQ(): buffers thrown away just before this one
+} RxTime_t;				// the arrays hold RxTimesPerBuf entries each
+
 enum {  PTTOff,				// PTT disabled
 	PTTVox,				// PTT vox mode (examines TxFrame to decide whether to Tx)
 	PTTOn };			// PTT force Tx on
@@ -59,31 +74,82 @@ class HermesProxy
 
 private:
 
-	IQBuf_t RxIQBuf[NUMRXIQBUFS];	// ReceiveIQ buffers
+	// Every buffer below is carved out of one arena, optionally on huge
+	// pages, in ring order: the Rx buffers back to back, then the Tx
+	// buffers, then the arrival times and the tables.
+
+	void * Arena;			// metis_arena_alloc()
+	size_t ArenaSize;		// as mapped
+	unsigned RxRingBufs;		// number of RxIQBufs, a power of 2
+	unsigned RxBufSize;		// number of floats in one RxIQBuf, #complexes is half. A power of 2
+	unsigned RxTimesPerBuf;		// Ethernet frames that can begin in one RxIQBuf
+	unsigned TxRingBufs;		// number of TxBufs, a power of 2
+
+	IQBuf_t * RxIQBuf;		// ReceiveIQ buffers
+	RxTime_t * RxIQTime;		// Arrival times of the frames in each RxIQBuf
+	RawBuf_t * TxBuf; 		// Transmit buffers
+
+	// RxIQBuf and TxBuf are single producer, single consumer rings. The
+	// receive thread fills RxIQBuf and empties TxBuf, hermesNB the other
+	// way round. A counter is only written by its own thread, published
+	// with a release store and read by the other thread with an acquire
+	// load. The counters of each thread share a cache line, away from the
+	// other thread's and from the statistics, with the thread's copy of
+	// the other side's counters, reloaded only when a ring looks full or
+	// empty.
+	//
+	// With RxMaxLatency set the receive thread throws away the oldest Rx
+	// buffers instead of the newest, so it moves RxReadCounter too. Then
+	// GetRxIQ() claims a buffer by moving RxReadCounter past it, and both
+	// threads do so with compare and swap; RxReadBusy keeps the receive
+	// thread out of the buffer hermesNB is reading.
+
+	char RingPad0[64];
 	unsigned RxWriteCounter;	// Which Rx buffer to write to
-	unsigned RxReadCounter;		// Which Rx buffer to read from
 	unsigned RxWriteFill;		// Fill level of the RxWrite buffer
-
-	RawBuf_t TxBuf[NUMTXBUFS]; 	// Transmit buffers
-	unsigned TxWriteCounter;	// Which Tx buffer to write to
+	unsigned RxReadSeen;		// RxReadCounter, as last loaded
 	unsigned TxReadCounter;		// Which Tx buffer to read from
+	unsigned TxWriteSeen;		// TxWriteCounter, as last loaded
+	unsigned RxWriteSerial;		// Serial of the RxWrite buffer
+	unsigned long StaleRxBufCount;	// RxMaxLatency: old buffers thrown away
+	char RingPad1[64];		// receive thread above, hermesNB below
+	unsigned RxReadCounter;		// Which Rx buffer to read from
+	bool RxReadHeld;		// GetRxIQ() handed out RxIQBuf[RxReadCounter], not yet freed
+	unsigned RxWriteSeen;		// RxWriteCounter, as last loaded
+	unsigned TxWriteCounter;	// Which Tx buffer to write to
+	unsigned TxReadSeen;		// TxReadCounter, as last loaded
+	unsigned RxReadBusy;		// RxMaxLatency: buffer hermesNB is reading, RxRingBufs when none
+	unsigned RxReadSerial;		// Serial of the last buffer handed out
+	char RingPad2[64];
+
 	unsigned TxControlCycler;	// Which Tx control register set to send
 	unsigned TxFrameIdleCount;	// How long we've gone since sending a TxFrame
+	unsigned TxFramesDue;		// Tx Ethernet frames scheduled but not yet sent
 
 	unsigned long LostRxBufCount;	// Lost-buffer counter for packets we actually got
 	unsigned long TotalRxBufCount;	// Total buffer count (may roll over)
 	unsigned long LostTxBufCount;	//
 	unsigned long TotalTxBufCount;	//
-	unsigned long CorruptRxCount;	//
-	unsigned long LostEthernetRx;	//
 	unsigned long CurrentEthSeqNum;	// Diagnostic
 
+	METIS_RAW_RING RxRawRing;	// Sample rows of EP6 frames waiting for general_work, RxLazyDecode only
+
+	unsigned long TxDucDue;		// Protocol 2: DUC samples due, times RxSampleRate
+	unsigned TxDucCursor;		// Protocol 2: samples already taken from TxBuf[TxReadCounter]
+	unsigned char TxDucIQ[P2_DUC_SAMPLES*6];	// Protocol 2: DUC packet being filled
+	bool TxVoxActive;		// Protocol 2: last Tx buffer had signal in it
+	bool TxSentPTT;			// Protocol 2: PTT as last sent to the radio
+	unsigned long RxUpdateDue;	// Protocol 2: samples since the last high priority packet
+
 	//pthread_mutex_t mutexRPG;	// Rx to Proxy to Gnuradio buffer
 	//pthread_mutex_t mutexGPT;	// Gnuradio to Proxy to Tx buffer
 
 
 public:
 
+	unsigned long CorruptRxCount;	// frames of the wrong length or failing the sync check, metis.cc counts too
+	unsigned long LostEthernetRx;	// gaps in the Rx frame sequence numbers
+
 	unsigned Receive0Frequency;	// 1st rcvr. Corresponds to out0 in gnuradio
 	unsigned Receive1Frequency;	// 2nd rcvr. Corresponds to out1 in gnuradio
 	unsigned TransmitFrequency;
@@ -116,11 +182,19 @@ public:
 	bool TxStop;
 	bool PTTOffMutesTx;		// PTT Off mutes the transmitter
 	bool PTTOnMutesRx;		// PTT On receiver
-	char interface[16];
+	char interface[256];	// network interface, "loopback" or "file:<path>"
 
 	char mactarget[18];		// Requested target's MAC address as string
 					// "HH:HH:HH:HH:HH:HH" HH is hexadecimal string.
+	int Protocol;			// 1 = Metis (Protocol 1), 2 = Protocol 2
+	METIS_SESSION* metis;		// this radio's Metis session, Protocol 1
+	P2_SESSION* p2;			// this radio's Protocol 2 session
 	unsigned int metis_entry;	// Index into Metis_card MAC table
+	bool Connected;			// metis_entry is valid, radio answered discovery
+	int DiscoveryTimeout;		// msec Connect() waits for discovery, 0 = for ever
+	bool RxLazyDecode;		// receive thread only queues sample rows, hermesNB decodes them
+	const METIS_UNPACK* Unpack;	// sample conversion kernels for this CPU
+	int RxMaxLatency;		// msec of samples kept waiting for hermesNB, oldest dropped beyond. 0 = off
 
 
 	HermesProxy(int RxFreq0, int RxFreq1, int TxFreq, bool RxPre,
@@ -128,27 +202,52 @@ public:
 			 unsigned char TxDr, int RxSmp, const char* Intfc, 
 			 const char * ClkS, int AlexRA, int AlexTA,
 			 int AlexHPF, int AlexRPF, int Verbose, int NumRx,
-			 const char* MACAddr);	// constructor
+			 const char* MACAddr, const gr::hpsdr::hermes_options & Opts);	// constructor
 
 	~HermesProxy();			// destructor
 
 	void Stop();			// stop ethernet I/O
-	void Start();			// start rx stream
+	bool Start();			// connect if need be, start rx stream
+	bool Connect();			// wait for discovery to find the radio
 
 	void SendTxIQ();		// send an IQ buffer to Hermes transmit hardware
+	void FlushTxIQ();		// send all Tx frames that are due
 	void BuildControlRegs(unsigned, RawBuf_t);	// fill in the 8 byte sync+control registers from RegNum
 	int PutTxIQ(const gr_complex *, /*const gr_complex *,*/ int);	// post a transmit TxIQ buffer
 	void ScheduleTxFrame(unsigned long);    // Schedule a Tx frame
 	RawBuf_t GetNextTxBuf(); // get an empty Tx Buffer
 
 	void UpdateHermes();		// update control registers in Hermes without any Tx data
-
-	void ReceiveRxIQ(unsigned char *); // receive an IQ buffer from Hermes hardware via metis.cc thread
-	IQBuf_t GetRxIQ();		// Gnuradio pickup a received RxIQ buffer if available
+	unsigned char AlexRxFilter();	// Alex Rx HPF bits, autotracked if asked for
+	unsigned char AlexTxFilter();	// Alex Tx LPF bits, autotracked if asked for
+	void PrintStatus();		// Verbose: report power, SWR and overload now and then
+
+	void P2Settings(P2_SETTINGS*);	// Protocol 2: what the radio is to be set to
+	void UpdateP2();		// Protocol 2: send the high priority packet
+	void ReceiveDDCIQ(int, unsigned char *, int, const struct timespec *);	// Protocol 2: DDC packet from the receive thread
+	void ReceiveP2Status(unsigned char *, int);	// Protocol 2: status packet from the receive thread
+	void ScheduleDUCIQ(int);	// Protocol 2: send DUC packets due after this many Rx samples
+	void SendDUCIQ();		// Protocol 2: send one DUC packet from the Tx buffers
+	int PutDUCIQ(const gr_complex *, int);	// Protocol 2: post a transmit TxIQ buffer
+
+	void ReceiveRxIQ(unsigned char *, const struct timespec *); // receive an IQ buffer from Hermes hardware via metis.cc thread
+	IQBuf_t GetRxIQ(RxTime_t * = NULL);	// Gnuradio pickup a received RxIQ buffer (and its arrival times) if available, good until the next call
+	int RxSamplesPerBuf();		// complex samples in one RxIQBuf, all receivers together
+	bool RxRoom(int);		// metis.cc: this many more frames fit without dropping any
+	unsigned RxLatencyBufs();	// RxMaxLatency: how many full RxIQBufs may wait
+	bool DropOldRxBufs(unsigned);	// RxMaxLatency: make room before taking the next buffer
+	IQBuf_t ClaimRxIQ(RxTime_t *);	// RxMaxLatency: GetRxIQ()
+	int DropOldRxFrames();		// RxMaxLatency with RxLazyDecode: drop raw frames beyond it
+	bool RxFinished();		// a replay has played out and every sample has been picked up
 	IQBuf_t GetNextRxBuf(IQBuf_t);  // return existing out buffer, next output buffer (if needed),
 					// or NULL if no new one available
-	void Unpack1RxIQ(const unsigned char*, const IQBuf_t);	// unpack a received IQ sample 1 receiver case
-	void Unpack2RxIQ(const unsigned char*, const IQBuf_t);	// unpack a received IQ sample 2 receiver case
+	IQBuf_t UnpackRxRows(const unsigned char*, int, int, IQBuf_t);	// unpack rows of received IQ samples into the Rx buffers
+
+	bool ParseRxStatus(const unsigned char*);	// check sync and take the status registers of both USB frames
+	int RxSamplesPerFrame();	// complex samples per receiver in one Ethernet frame
+	const METIS_RAW_SLOT* PeekRxFrame();	// RxLazyDecode: sample rows of the oldest frame, or NULL
+	void ReleaseRxFrame();		// RxLazyDecode: done with it
+	void DecodeRxRows(const unsigned char*, gr_complex*, gr_complex*);	// decode one frame's rows straight to outputs
 
 	void PrintRawBuf(RawBuf_t);	// for debugging
 
@@ -44,10 +44,11 @@
 
 HermesProxyW::HermesProxyW(bool RxPre, const char* Intfc, const char * ClkS,
 			 int AlexRA, int AlexTA, int AlexHPF, int AlexLPF,
-			 const char* MACAddr)	// constructor
+			 const char* MACAddr, const gr::hpsdr::hermes_options & Opts)	// constructor
 {
 
-	strcpy(interface, Intfc);	// Ethernet interface to use (defaults to eth0)
+	strncpy(interface, Intfc, sizeof(interface)-1);	// Ethernet interface to use (defaults to eth0)
+	interface[sizeof(interface)-1] = 0;
 	unsigned int cs;		// Convert ClockSource strings to unsigned, then intitalize
 	sscanf(ClkS, "%x", &cs);
 	ClockSource = (cs & 0xFC);
@@ -81,11 +82,14 @@ HermesProxyW::HermesProxyW(bool RxPre, const char* Intfc, const char * ClkS,
 	RxWriteCounter = 0;	//
 	RxReadCounter = 0;	// These control the Rx buffers to Gnuradio
 	RxWriteFill = 0;	//
+	RxReadSeen = 0;		//
+	RxWriteSeen = 0;	//
 
 	TxWriteCounter = 0;	//
  	TxReadCounter = 0;	// These control the Tx buffers to Hermes
 	TxControlCycler = 0;	//
 	TxFrameIdleCount = 0;	//
+	TxFramesDue = 0;	//
 
 	LostRxBufCount = 0;	//
 	TotalRxBufCount = 0;	//
@@ -97,52 +101,91 @@ HermesProxyW::HermesProxyW(bool RxPre, const char* Intfc, const char * ClkS,
 
 
 	
-	// allocate the receiver buffers
-	for(int i=0; i<NUMRXIQBUFS; i++)
-		RxIQBuf[i] = new float[RXBUFSIZE];
-
-	// allocate the transmit buffers
-	for(int i=0; i<NUMTXBUFS; i++)
-		TxBuf[i] = new unsigned char[TXBUFSIZE];
-
-	metis_discover((const char *)(interface));
+	// Ring geometry: the Rx ring holds whole 64 buffer vectors, two at least
+
+	RxRingBufs = metis_ring_size(Opts.RxRingBufs, NUMRXIQBUFS, 128, 1 << 20);
+	TxRingBufs = metis_ring_size(Opts.TxRingBufs, NUMTXBUFS, 4, 1 << 20);
+
+	// allocate the receiver and transmit buffers, all in one arena (zeroed)
+
+	size_t RxBytes = metis_arena_round((size_t)RxRingBufs * WBBUFSIZE * sizeof(float));
+	size_t TxBytes = metis_arena_round((size_t)TxRingBufs * TXBUFSIZE);
+	size_t TimeBytes = metis_arena_round((size_t)RxRingBufs * sizeof(struct timespec));
+	size_t TableBytes = metis_arena_round((size_t)RxRingBufs * sizeof(IQBuf_t))
+		+ metis_arena_round((size_t)TxRingBufs * sizeof(RawBuf_t));
+
+	Arena = metis_arena_alloc(RxBytes + TxBytes + TimeBytes + TableBytes, Opts.HugePages, &ArenaSize);
+
+	unsigned char * p = (unsigned char *)Arena;
+	float * RxSlots = (float *)p;				p += RxBytes;
+	unsigned char * TxSlots = p;				p += TxBytes;
+	RxIQTime = (struct timespec *)p;			p += TimeBytes;
+	RxIQBuf = (IQBuf_t *)p;					p += metis_arena_round((size_t)RxRingBufs * sizeof(IQBuf_t));
+	TxBuf = (RawBuf_t *)p;
+
+	for(unsigned i=0; i<RxRingBufs; i++)
+		RxIQBuf[i] = RxSlots + (size_t)i * WBBUFSIZE;
+	for(unsigned i=0; i<TxRingBufs; i++)
+		TxBuf[i] = TxSlots + (size_t)i * TXBUFSIZE;
+
+	if(Opts.MemLock)			// touch every page now, not in the receive thread
+	  {
+	    memset(Arena, 0, ArenaSize);
+	    metis_lock_memory();	// and keep them resident
+	  }
+
+	metis = metis_open((const char *)(interface), mactarget, NULL, this);	// this radio's session, shared with
+									// a proxy on the same interface and MAC
+	metis_receive_backend(metis, Opts.RxBackend);	// UDP socket, AF_PACKET ring or io_uring
+	metis_receive_batch(metis, Opts.RxBatch, Opts.RxBatchTmo);	// datagrams per receive syscall
+	metis_socket_buffers(metis, Opts.RxSockBuf, Opts.TxSockBuf);	// kernel socket buffer sizes
+	metis_busy_poll(metis, Opts.RxBusyPoll);		// usec to spin before blocking on receive
+	metis_receive_reactor(metis, Opts.RxReactor, Opts.RxReactorCpus.c_str());	// shared epoll receive threads
+	metis_receive_scheduling(metis, Opts.RxSched, Opts.RxPriority, Opts.RxCpus.c_str());	// real-time policy and cores
+	metis_receive_reorder(metis, Opts.RxReorder);	// frames held to undo network reordering
+	metis_receive_pipeline(metis, Opts.RxPipeline, Opts.RxUnpackCpus.c_str());	// decode on a thread of its own
+	metis_capture_file(metis, Opts.CaptureFile.c_str());		// record the frames on the wire, "" = off
+	metis_replay_pacing(metis, Opts.ReplayPace);		// how a "file:" Intfc replays its frames
+	metis_discover(metis);				// runs in the background, Connect() waits for it
+
+	DiscoveryTimeout = Opts.DiscoverTmo;
+	Connected = false;
+	metis_entry = 0;
+};
 
 //
+// Wait for discovery, started by the constructor, to find the radio.
 // If there is no specified MAC address (i.e. wildcard, or anything less than 17 
 // charracters, then just grab the first Hermes/Metis that
 // responds to discovery. If there is a specific MAC address specified, then wait
 // until it appears in the Metis cards table, and set the metis table index to match.
 // The string is HH:HH:HH:HH:HH:HH\0 formated, where HH is a 2-digital Hexidecimal number
 // uppercase, example:    04:7F:3D:0F:28:5A
+// Returns false if no such radio answered within DiscoveryTimeout msec.
 //
+bool HermesProxyW::Connect()
+{
+	if (Connected)
+	  return true;
 
-	metis_entry = 0;
-	if (strlen(mactarget) != 17)			// Not a fully-qualified MAC address, default to first MAC found
+	int entry = metis_wait_found(metis, mactarget, DiscoveryTimeout);	// sleeps until a reply arrives
+	if (entry < 0)
 	{
-	  while (metis_found() == 0)
-		;					// wait until Hermes responds with first discovered MAC
-	}
-	else						// Search the table for the entry matching requested MAC address
-	{
-	  bool found = false;
-	  while(!found)					// Search for MAC address in the metis_table until the cows come home
-	    for(int i=0; i<metis_found(); i++)
-	      {
-		if (strcmp(mactarget, metis_mac_address(i)) == 0)	// Exact match found
-		{
-		  metis_entry = i;					// Select entry in metis_table
-	          found = true;
-		  break;
-		}
-	      }
+	  fprintf(stderr, "Hermes: no %s answered discovery within %d msec\n",
+		(strlen(mactarget) == 17) ? mactarget : "radio", DiscoveryTimeout);
+	  return false;
 	}
 
-	metis_receive_stream_control(RxStream_Off, metis_entry);	// turn off Hermes -> PC streams
+	metis_entry = entry;
+	Connected = true;
+
+	metis_receive_stream_control(metis, RxStream_Off, metis_entry);	// turn off Hermes -> PC streams
 
 	UpdateHermes();					// send specific control registers
 							// and initialize 1st Tx buffer
-							// before allowing scheduler to Start()
-};
+							// before the Rx stream is started
+	return true;
+}
 
 HermesProxyW::~HermesProxyW()
 {
@@ -152,29 +195,69 @@ HermesProxyW::~HermesProxyW()
 	        LostRxBufCount, TotalRxBufCount, LostTxBufCount,
 		TotalTxBufCount, CorruptRxCount, LostEthernetRx);
 
-	metis_receive_stream_control(RxStream_Off, metis_entry);	// stop Hermes data stream
-	
-	metis_stop_receive_thread();	// stop receive_thread & close socket
+	unsigned long RxSyscalls, RxPackets;
+	metis_receive_statistics(metis, &RxSyscalls, &RxPackets);
+	fprintf(stderr, "RxSyscalls = %lu  RxPackets = %lu  SyscallsPerPacket = %.3f\n",
+		RxSyscalls, RxPackets,
+		RxPackets ? (double)RxSyscalls / (double)RxPackets : 0.0);
+
+	// Sequence gaps count EP4 frames lost anywhere. The pipeline counts the
+	// EP4 frames its raw ring had no room for. The kernel only counts drops
+	// for the socket as a whole, EP6 and EP4 together, so the rest of the
+	// gaps can only be put down to the wire when the kernel dropped nothing.
+	unsigned long RxReordered, RxDuplicates, RxLate, RxGaps;
+	metis_receive_reorder_statistics(metis, 4, &RxReordered, &RxDuplicates, &RxLate, &RxGaps);
+	fprintf(stderr, "RxReordered = %lu  RxDuplicates = %lu  RxLate = %lu  RxGaps = %lu\n",
+		RxReordered, RxDuplicates, RxLate, RxGaps);
+
+	unsigned long KernelDrops = metis_kernel_drops(metis);
+	unsigned long PipelineDrops = metis_pipeline_drops(metis, 4);
+	unsigned long OtherDrops = (LostEthernetRx > PipelineDrops) ? LostEthernetRx - PipelineDrops : 0;
+	fprintf(stderr, "KernelDrops = %lu (EP6+EP4)  PipelineDrops = %lu  %s = %lu  RingDrops = %lu\n",
+		KernelDrops, PipelineDrops, KernelDrops ? "KernelOrWireDrops" : "WireDrops",
+		OtherDrops, LostRxBufCount);
+	unsigned long LengthDrops = metis_length_drops(metis);
+	if (LengthDrops)
+	  fprintf(stderr, "LengthDrops = %lu (EP6+EP4) UDP length beyond the captured packet\n", LengthDrops);
+
+	unsigned long RxLatency[METIS_LATENCY_BUCKETS], RxSpinHits, RxLatencyTotal = 0;
+	metis_receive_latency(metis, RxLatency, &RxSpinHits);
+	for (int i=0; i<METIS_LATENCY_BUCKETS; i++)
+	  RxLatencyTotal += RxLatency[i];
+	if (RxLatencyTotal > 0)
+	{
+	  fprintf(stderr, "RxLatency (usec, kernel stamp to dispatch)  RxSpinHits = %lu\n ", RxSpinHits);
+	  for (int i=0; i<METIS_LATENCY_BUCKETS; i++)
+	    if (RxLatency[i] > 0)
+	      fprintf(stderr, " <%u:%lu", 1u << i, RxLatency[i]);
+	  fprintf(stderr, "\n");
+	}
 
-	for(int i=0; i<NUMTXBUFS; i++)
-		delete [] TxBuf[i];
+	if (Connected)
+	  metis_receive_stream_control(metis, RxStream_Off, metis_entry);	// stop Hermes data stream
+	
+	metis_close(metis, NULL, this);	// last one out stops receive_thread & closes socket
 
-	for(int i=0; i<NUMRXIQBUFS; i++)
-		delete [] RxIQBuf[i];
+	metis_arena_free(Arena, ArenaSize);
 }
 
 
 void HermesProxyW::Stop()	// stop ethernet I/O
 {
-	metis_receive_stream_control(RxStream_Off, metis_entry);	// stop Hermes Rx data stream
+	if (Connected)
+	  metis_receive_stream_control(metis, RxStream_Off, metis_entry);	// stop Hermes Rx data stream
 	TxStop = true;					// stop Tx data to Hermes
 };
 
-void HermesProxyW::Start()	// start rx stream
+bool HermesProxyW::Start()	// start rx stream
 {
+	if (!Connect())					// radio has not answered discovery
+	  return false;
+
 	TxStop = false;					// allow Tx data to Hermes
 	// Note: just turning on the WB stream does not work. Have to throw away the NB samples.
-	metis_receive_stream_control(RxStream_NBWB_On, metis_entry);	// start Hermes Wideband Rx data stream
+	metis_receive_stream_control(metis, RxStream_NBWB_On, metis_entry);	// start Hermes Wideband Rx data stream
+	return true;
 };
 
 void HermesProxyW::PrintRawBuf(RawBuf_t inbuf)	// for debugging
@@ -217,7 +300,7 @@ void HermesProxyW::PrintRawBuf(RawBuf_t inbuf)	// for debugging
 
 // ********** Routines to receive data from Hermes/Metis and give to Gnuradio ****************
 
-void HermesProxyW::ReceiveRxIQ(unsigned char * inbuf)	// called by metis Rx thread.
+void HermesProxyW::ReceiveRxIQ(unsigned char * inbuf, const struct timespec * stamp)	// called by metis Rx thread.
 {
 
 	// look for lost receive packets based on skips in the HPSDR ethernet header
@@ -230,7 +313,7 @@ void HermesProxyW::ReceiveRxIQ(unsigned char * inbuf)	// called by metis Rx thre
 
 	if(SequenceNum > CurrentEthSeqNum + 1)
 	{
-	    LostEthernetRx += (SequenceNum - CurrentEthSeqNum);
+	    LostEthernetRx += (SequenceNum - CurrentEthSeqNum - 1);	// frames missing in the gap
 	    CurrentEthSeqNum = SequenceNum;
 	}
 	else
@@ -260,7 +343,7 @@ void HermesProxyW::ReceiveRxIQ(unsigned char * inbuf)	// called by metis Rx thre
 	  if (!RxWriteBufAligned()) // not aligned - we have a problem
 	    for (int i=0; i<63; i++)
 	    {
-	      if (RxBufFillCount() >= (NUMRXIQBUFS - 1)) // buffers full, drop ethernet frame
+	      if (RxBufFillCount() >= (int)(RxRingBufs - 1)) // buffers full, drop ethernet frame
 		return;		
 
 	      IQBuf_t dummy = GetNextRxWriteBuf();  	// fill a buffer with trash
@@ -270,7 +353,7 @@ void HermesProxyW::ReceiveRxIQ(unsigned char * inbuf)	// called by metis Rx thre
 
 	}
 
-	if (RxBufFillCount() >= (NUMRXIQBUFS - 2))	// We're full. throw away ethernet frame
+	if (RxBufFillCount() >= (int)(RxRingBufs - 2))	// We're full. throw away ethernet frame
 	  return;
 
 
@@ -279,6 +362,12 @@ void HermesProxyW::ReceiveRxIQ(unsigned char * inbuf)	// called by metis Rx thre
 //  fwrite(&inbuf[c], 1, 1, f);
 //fwrite(inbuf, 1, 1024, f);
 
+	// The first buffer of the frame carries its arrival time, which becomes
+	// the rx_time of the vector when this frame starts one.
+
+	if (stamp != NULL)
+	  RxIQTime[RxWriteCounter] = *stamp;
+
 	IQBuf_t outbuf = GetCurrentRxWriteBuf();
 	for (int j = 0; j<256; j++)	// read 256 floats
 	{
@@ -315,22 +404,35 @@ bool HermesProxyW::RxWriteBufAligned()  //Check if Rcv Write buffer is aligned o
 	return false;
 };
 
-int HermesProxyW::RxBufFillCount()		// how many RxBuffers are filled?
+int HermesProxyW::RxBufFillCount()		// how many RxBuffers are filled? Either thread
 {
-	if (RxWriteCounter >= RxReadCounter)
-	  return(RxWriteCounter - RxReadCounter);
-	else
-	  return(RxWriteCounter + NUMRXIQBUFS - RxReadCounter);
+	unsigned WriteCounter = __atomic_load_n(&RxWriteCounter, __ATOMIC_ACQUIRE);
+	unsigned ReadCounter = __atomic_load_n(&RxReadCounter, __ATOMIC_ACQUIRE);
+
+	return (WriteCounter - ReadCounter) & (RxRingBufs - 1);
+};
+
+bool HermesProxyW::RxRoom(int frames)	// called by metis.cc before a fast replay hands out frames
+{
+	return RxBufFillCount() + 2*frames <= (int)RxRingBufs - 2;	// two buffers per frame
+};
+
+bool HermesProxyW::RxFinished()	// called by HermesWB, true when no more whole vector will come
+{
+	return metis_receive_finished(metis) && RxBufFillCount() < 64;
 };
 
 IQBuf_t HermesProxyW::GetNextRxReadBuf()	
 {						// used to be called GetIQBuf()
 
-	if(RxReadCounter == RxWriteCounter)	
+	if(RxReadCounter == RxWriteSeen)		// looks empty, see what has arrived since
+	  RxWriteSeen = __atomic_load_n(&RxWriteCounter, __ATOMIC_ACQUIRE);
+	if(RxReadCounter == RxWriteSeen)
 	  return NULL;				// empty - no buffers to return
-	
-	++RxReadCounter &= (NUMRXIQBUFS - 1);		// increment read counter modulo
-	IQBuf_t ReturnBuffer = RxIQBuf[RxReadCounter];	// get the next receiver buffer
+
+	unsigned ReadCounter = (RxReadCounter+1) & (RxRingBufs - 1);
+	__atomic_store_n(&RxReadCounter, ReadCounter, __ATOMIC_RELEASE);	// free the current one
+	IQBuf_t ReturnBuffer = RxIQBuf[ReadCounter];	// get the next receiver buffer
 
 	return ReturnBuffer;
 };
@@ -340,17 +442,30 @@ IQBuf_t HermesProxyW::GetCurrentRxReadBuf()
 	return RxIQBuf[RxReadCounter];
 };
 
+struct timespec HermesProxyW::GetCurrentRxReadTime()
+{
+	return RxIQTime[RxReadCounter];
+};
+
 IQBuf_t HermesProxyW::GetNextRxWriteBuf()	
 {						// used to be called GetIQBuf()
-	if (((RxWriteCounter+1) & (NUMRXIQBUFS - 1)) == RxReadCounter)
+	unsigned WriteCounter = (RxWriteCounter+1) & (RxRingBufs - 1);
+
+	if (WriteCounter == RxReadSeen)		// looks full, see what hermesWB has read since
+	  RxReadSeen = __atomic_load_n(&RxReadCounter, __ATOMIC_ACQUIRE);
+	if (WriteCounter == RxReadSeen)
 	{
 	  LostRxBufCount++;	// No Rx Buffers available. Throw away the data
  	  return NULL;
 	}
-	  
-	++RxWriteCounter &= (NUMRXIQBUFS - 1); // get next writeable buffer
+
 	RxWriteFill = 0;
-	return RxIQBuf[RxWriteCounter];
+	RxIQTime[WriteCounter].tv_sec = 0;	// no frame has started in it yet
+	RxIQTime[WriteCounter].tv_nsec = 0;
+
+	// get next writeable buffer, and hand the full one over to hermesWB
+	__atomic_store_n(&RxWriteCounter, WriteCounter, __ATOMIC_RELEASE);
+	return RxIQBuf[WriteCounter];
 };
 
 IQBuf_t HermesProxyW::GetCurrentRxWriteBuf()
@@ -385,29 +500,24 @@ void HermesProxyW::UpdateHermes()	// send a set of control registers to hardware
 	//fprintf(stderr, "UpdateHermes called\n");
 
 	unsigned char buffer[512];	// dummy up a USB HPSDR buffer;
+	unsigned char buffer1[512];	// second USB frame of each Ethernet frame
 	for(int i=0; i<512; i++)
-		buffer[i] = 0;
+		buffer[i] = buffer1[i] = 0;
 
-	int length = 512;		// metis_write ignores this value
 	unsigned char ep = 0x02;	// all Hermes data is sent to end point 2
 
-	// metis_write needs to be called twice to make one ethernet write to the hardware
+	// Each Ethernet write to the hardware carries two USB frames.
 	// Set these registers before starting the receive stream
 
 	BuildControlRegs(0, buffer);
-	metis_write(ep, buffer, length);
-	BuildControlRegs(2, buffer);
-	metis_write(ep, buffer, length);
+	BuildControlRegs(2, buffer1);
+	metis_send_frame(metis, ep, buffer, buffer1);
 
-	BuildControlRegs(0, buffer);
-	metis_write(ep, buffer, length);
-	BuildControlRegs(4, buffer);
-	metis_write(ep, buffer, length);
+	BuildControlRegs(4, buffer1);
+	metis_send_frame(metis, ep, buffer, buffer1);
 
-	BuildControlRegs(0, buffer);
-	metis_write(ep, buffer, length);
-	BuildControlRegs(6, buffer);
-	metis_write(ep, buffer, length);
+	BuildControlRegs(6, buffer1);
+	metis_send_frame(metis, ep, buffer, buffer1);
 
 	// Initialize the first TxBuffer (currently empty) with a valid control frame (on startup only)
 	
@@ -614,10 +724,10 @@ void HermesProxyW::PutTxIQ() 	// Send next control registers plus all zero data
 
 RawBuf_t HermesProxyW::GetNextTxBuf()		// get a TXBuf if available
 {
-	  if (((TxWriteCounter+1) & (NUMTXBUFS - 1)) == TxReadCounter)
+	  if (((TxWriteCounter+1) & (TxRingBufs - 1)) == TxReadCounter)
 	    return NULL;
 	 
-	  ++TxWriteCounter &= (NUMTXBUFS - 1); // get next writeable buffer
+	  ++TxWriteCounter &= (TxRingBufs - 1); // get next writeable buffer
 
 	  return TxBuf[TxWriteCounter];
 };
@@ -625,6 +735,8 @@ RawBuf_t HermesProxyW::GetNextTxBuf()		// get a TXBuf if available
 
 // SendTxIQ() is called on a periodic basis to send Tx Ethernet frames to the 
 // Hermes/Metis hardware. It sends 2 USB frames in one Ethernet Frame.
+// When metis is receiving in batches the frame is only counted as due here,
+// and metis calls FlushTxIQ() once the whole receive batch is dispatched.
 
 void HermesProxyW::SendTxIQ()
 {
@@ -632,40 +744,64 @@ void HermesProxyW::SendTxIQ()
 	if(TxStop)				// Kill Tx frames if stopped
 		return;
 
-	unsigned char ep = 0x2;			// Tx data goes to end point 2
+	TxFramesDue++;
 
-//	fprintf(stderr, "SendTxIQ: TxReadCounter = %d   TxWriteCounter = %d  TxFrameIdleCount = %d\n",
-//		TxReadCounter, TxWriteCounter, TxFrameIdleCount); 
+	if(!metis_receive_batching(metis))
+		FlushTxIQ();
+
+	return;
+};
 
-	// Time to send one Tx Eth frame (2 x USB frames).
-	// If there are at least two buffers in the queue, send then free them.
 
-	bool bufempty = (TxReadCounter == TxWriteCounter);
-	bool bufone = ((TxReadCounter+1 & (NUMTXBUFS - 1)) == TxWriteCounter);
+// Send every due Tx Ethernet frame. The USB frames are passed to metis
+// straight out of TxBuf[] and only freed once they have been sent.
 
-	TotalTxBufCount++;
+void HermesProxyW::FlushTxIQ()
+{
+	RawBuf_t frames[2 * METIS_MAX_TX_BATCH];
+	int nframes = 0;
+	unsigned ReadCounter = TxReadCounter;
 
-	if ( bufempty | bufone )    // zero or one buffer ready	
+	if(TxStop)				// Kill Tx frames if stopped
 	{
-	  LostTxBufCount++;		// Not necessarily a lost buffer for hermesWB
+		TxFramesDue = 0;
+		return;
+	}
 
-	//fprintf(stderr, "SendTxIQ01: TxReadCounter = %d   TxWriteCounter = %d  "
-		//"TxFrameIdleCount = %d  bufempty = %d   bufone = %d\n",
-		//TxReadCounter, TxWriteCounter, TxFrameIdleCount, bufempty, bufone); 
+	unsigned char ep = 0x2;			// Tx data goes to end point 2
 
-	}
-	else	// two or more buffers ready
+	while(TxFramesDue > 0)
 	{
+	  TxFramesDue--;
+	  TotalTxBufCount++;
+
+	  // If there are at least two buffers in the queue, send then free them.
+
+	  if (((TxWriteCounter - ReadCounter) & (TxRingBufs - 1)) < 2)    // zero or one buffer ready
+	  {
+	    LostTxBufCount++;		// Not necessarily a lost buffer for hermesWB
+	    continue;
+	  }
+
+	  frames[nframes*2] = TxBuf[ReadCounter];		// one USB frame
+	  ++ReadCounter &= (TxRingBufs - 1);
+	  frames[nframes*2+1] = TxBuf[ReadCounter];		// next USB frame
+	  ++ReadCounter &= (TxRingBufs - 1);
+
+	  if (++nframes == METIS_MAX_TX_BATCH)
+	  {
+	    metis_send_frames(metis, ep, frames, nframes);
+	    TxReadCounter = ReadCounter;			// and free them
+	    nframes = 0;
+	  }
+	}
 
-	//fprintf(stderr, "SendTxIQ02: TxReadCounter = %d   TxWriteCounter = %d  TxFrameIdleCount = %d\n",
-		//TxReadCounter, TxWriteCounter, TxFrameIdleCount); 
-
-	  metis_write(ep, TxBuf[TxReadCounter], 512);	// write one USB frame to metis
-	  ++TxReadCounter &= (NUMTXBUFS - 1);		// and free it
+	if (nframes == 1)
+	  metis_send_frame(metis, ep, frames[0], frames[1]);
+	else if (nframes > 1)
+	  metis_send_frames(metis, ep, frames, nframes);
 
-	  metis_write(ep, TxBuf[TxReadCounter], 512);	// write next USB frame to metis
-	  ++TxReadCounter &= (NUMTXBUFS - 1);		// and free it
-	};
+	TxReadCounter = ReadCounter;			// and free them
 
 	return;
 };
@@ -29,17 +29,10 @@
 #ifndef HermesProxyW_H
 #define HermesProxyW_H
 
-#define NUMRXIQBUFS	128		// number of receiver IQ buffers in circular queue.
-					// Must be integral power of 2 (2,4,8,16,32,64, etc.)
+// NUMRXIQBUFS, NUMTXBUFS and TXBUFSIZE come from HermesProxy.h. The Rx
+// ring holds at least two 64 buffer vectors.
 
-#define RXBUFSIZE	256		// number of floats in one RxIQBuf, #complexes is half
-					// Must be integral power of 2 (2,4,8,16,32,64, etc.)
-
-#define NUMTXBUFS	128		// number of transmit buffers in circular queue
-					// Must be integral power of 2
-
-#define TXBUFSIZE	512		// number of bytes in one TxBuf
-					
+#define WBBUFSIZE	256		// number of floats in one RxIQBuf, the samples of one EP4 USB frame
 
 
 //typedef float* IQBuf_t;			// IQ buffer type (IQ samples as floats)
@@ -54,27 +47,49 @@ class HermesProxyW
 
 private:
 
-	IQBuf_t RxIQBuf[NUMRXIQBUFS];	// ReceiveIQ buffers
+	// The buffers are carved out of one arena, as in HermesProxy.
+
+	void * Arena;			// metis_arena_alloc()
+	size_t ArenaSize;		// as mapped
+	unsigned RxRingBufs;		// number of RxIQBufs, a power of 2
+	unsigned TxRingBufs;		// number of TxBufs, a power of 2
+
+	IQBuf_t * RxIQBuf;		// ReceiveIQ buffers
+	struct timespec * RxIQTime;	// Arrival time of the frame starting in each RxIQBuf (0 = none)
+	RawBuf_t * TxBuf; 		// Transmit buffers
+
+	// RxIQBuf is a single producer, single consumer ring from the receive
+	// thread to hermesWB, as in HermesProxy: each counter is published with
+	// a release store and read by the other thread with an acquire load,
+	// and each thread's counters have a cache line of their own. TxBuf is
+	// filled and emptied by the receive thread alone.
+
+	char RingPad0[64];
 	unsigned RxWriteCounter;	// Which Rx buffer to write to
-	unsigned RxReadCounter;		// Which Rx buffer to read from
 	unsigned RxWriteFill;		// Fill level of the RxWrite buffer
-
-	RawBuf_t TxBuf[NUMTXBUFS]; 	// Transmit buffers
+	unsigned RxReadSeen;		// RxReadCounter, as last loaded
 	unsigned TxWriteCounter;	// Which Tx buffer to write to
 	unsigned TxReadCounter;		// Which Tx buffer to read from
+	char RingPad1[64];		// receive thread above, hermesWB below
+	unsigned RxReadCounter;		// Which Rx buffer to read from
+	unsigned RxWriteSeen;		// RxWriteCounter, as last loaded
+	char RingPad2[64];
+
 	unsigned TxControlCycler;	// Which Tx control register set to send
 	unsigned TxFrameIdleCount;	// How long we've gone since sending a TxFrame
+	unsigned TxFramesDue;		// Tx Ethernet frames scheduled but not yet sent
 
 	unsigned long LostRxBufCount;	// Lost-buffer counter for packets we actually got
 	unsigned long TotalRxBufCount;	// Total buffer count (may roll over)
 	unsigned long LostTxBufCount;	//
 	unsigned long TotalTxBufCount;	//
-	unsigned long CorruptRxCount;	//
-	unsigned long LostEthernetRx;	//
 	unsigned long CurrentEthSeqNum;	// Diagnostic
 
 public:
 
+	unsigned long CorruptRxCount;	// frames of the wrong length or failing the sync check, metis.cc counts too
+	unsigned long LostEthernetRx;	// gaps in the Rx frame sequence numbers
+
 	unsigned Receive0Frequency;	// 1st rcvr. Corresponds to out0 in gnuradio
 	unsigned Receive1Frequency;	// 2nd rcvr. Corresponds to out1 in gnuradio
 	unsigned TransmitFrequency;
@@ -107,23 +122,28 @@ public:
 	bool TxStop;
 	bool PTTOffMutesTx;		// PTT Off mutes the transmitter
 	bool PTTOnMutesRx;		// PTT On receiver
-	char interface[16];
+	char interface[256];	// network interface, "loopback" or "file:<path>"
 
 	char mactarget[18];		// Requested target's MAC address as string
 					// "HH:HH:HH:HH:HH:HH" HH is hexadecimal string.
+	METIS_SESSION* metis;		// this radio's Metis session
 	unsigned int metis_entry;	// Index into Metis_card MAC table
+	bool Connected;			// metis_entry is valid, radio answered discovery
+	int DiscoveryTimeout;		// msec Connect() waits for discovery, 0 = for ever
 
 
 	HermesProxyW(bool RxPre, const char* Intfc, const char * ClkS,
 			int AlexRA, int AlexTA, int AlexHPF, int AlexRPF,
-			const char* MACAddr);	// constructor
+			const char* MACAddr, const gr::hpsdr::hermes_options & Opts);	// constructor
 
 	~HermesProxyW();			// destructor
 
 	void Stop();			// stop ethernet I/O
-	void Start();			// start rx stream
+	bool Start();			// connect if need be, start rx stream
+	bool Connect();			// wait for discovery to find the radio
 
 	void SendTxIQ();		// send an IQ buffer to Hermes transmit hardware
+	void FlushTxIQ();		// send all Tx frames that are due
 	void BuildControlRegs(unsigned, RawBuf_t);	// fill in the 8 byte sync+control registers from RegNum
 	void PutTxIQ();			// post a transmit TxIQ buffer
 	void ScheduleTxFrame();    	// Schedule a Tx frame
@@ -131,15 +151,18 @@ public:
 
 	void UpdateHermes();		// update control registers in Hermes without any Tx data
 
-	void ReceiveRxIQ(unsigned char *); // receive an IQ buffer from Hermes hardware via metis.cc thread
+	void ReceiveRxIQ(unsigned char *, const struct timespec *); // receive an IQ buffer from Hermes hardware via metis.cc thread
 
 	IQBuf_t GetNextRxWriteBuf();	// Used to be named GetRxIQ()  
 	IQBuf_t GetNextRxReadBuf();	// Used to be named GetNextRxBuf(IQBuf_t)
 	IQBuf_t GetCurrentRxReadBuf();	//
+	struct timespec GetCurrentRxReadTime();	// arrival time of the frame starting in the current read buffer
 	IQBuf_t GetCurrentRxWriteBuf();	//  
 	bool RxReadBufAligned();	// True if the current Rcv Read Buffer is aligned on a 64 buffer boundary
 	bool RxWriteBufAligned();	// True if the current Rcv Write Buffer is aligned on a 64 buffer boundary
 	int RxBufFillCount();		// how many RxBuffers are filled?
+	bool RxRoom(int);		// metis.cc: this many more frames fit without dropping any
+	bool RxFinished();		// a replay has played out and every vector has been picked up
 
 	void PrintRawBuf(RawBuf_t);	// for debugging
 
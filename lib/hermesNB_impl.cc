@@ -33,8 +33,6 @@
 #include "HermesProxy.h"
 #include <stdio.h>	// for DEBUG PRINTF's
 
-HermesProxy* Hermes;	// make it visible to metis.cc
-
 
 namespace gr {
   namespace hpsdr {
@@ -45,12 +43,12 @@ namespace gr {
 			 unsigned char TxDr, int RxSmp, const char* Intfc, 
 			 const char * ClkS, int AlexRA, int AlexTA,
 			 int AlexHPF, int AlexLPF, int Verbose, int NumRx,
-			 const char* MACAddr)
+			 const char* MACAddr, const hermes_options & Opts)
     {
       return gnuradio::get_initial_sptr
         (new hermesNB_impl(RxFreq0, RxFreq1, TxFreq, RxPre, PTTModeSel, PTTTxMute,
 			PTTRxMute, TxDr, RxSmp, Intfc, ClkS, AlexRA, AlexTA,
-			AlexHPF, AlexLPF, Verbose, NumRx, MACAddr));
+			AlexHPF, AlexLPF, Verbose, NumRx, MACAddr, Opts));
     }
 
     /*
@@ -61,18 +59,29 @@ namespace gr {
 			 unsigned char TxDr, int RxSmp, const char* Intfc, 
 			 const char * ClkS, int AlexRA, int AlexTA,
 			 int AlexHPF, int AlexLPF, int Verbose, int NumRx,
-			 const char* MACAddr)
+			 const char* MACAddr, const hermes_options & Opts)
       : gr::block("hermesNB",
               gr::io_signature::make(1, 1, sizeof(gr_complex)),		// inputs to hermesNB block
               gr::io_signature::make(1, 2, sizeof(gr_complex)) )	// outputs from hermesNB block
     {
 	Hermes = new HermesProxy(RxFreq0, RxFreq1, TxFreq, RxPre, PTTModeSel, PTTTxMute,
 		 PTTRxMute, TxDr, RxSmp, Intfc, ClkS, AlexRA, AlexTA,
-		 AlexHPF, AlexLPF, Verbose, NumRx, MACAddr);	// Create proxy, do Hermes ethernet discovery
+		 AlexHPF, AlexLPF, Verbose, NumRx, MACAddr, Opts);	// Create proxy, start Hermes ethernet discovery
 	//Hermes->RxSampleRate = RxSmp;
 	//Hermes->RxPreamp = RxPre;
 
-	gr::block::set_output_multiple(256);		// process outputs in groups of at least 256 samples
+	if (Hermes->RxLazyDecode)		// LazyWork() only ever emits whole frames
+	  gr::block::set_output_multiple(Hermes->RxSamplesPerFrame());
+	else if (Opts.RxMaxLatency > 0)		// serve any request that holds one buffer
+	  gr::block::set_output_multiple(Hermes->RxSamplesPerBuf() / NumRx);
+	else
+	{
+	  int Multiple = 2 * Hermes->RxSamplesPerBuf();	// process outputs in groups of at least 256 samples,
+	  gr::block::set_output_multiple(Multiple > 256 ? Multiple : 256);	// and of two whole Rx buffers
+	}
+
+	RxTimeKey = pmt::string_to_symbol("rx_time");
+	RxDropKey = pmt::string_to_symbol("rx_drop");
 	//gr::block::set_relative_rate((double) NumRx);	// FIXME - need to also account for Rx sample rate
 
     }
@@ -95,7 +104,8 @@ bool hermesNB::stop()		// override base class
 
 bool hermesNB::start()		// override base class
     {
-	Hermes->Start();		// start rx stream on Hermes
+	if (!Hermes->Start())		// wait for discovery, start rx stream on Hermes
+	  return false;
 	return gr::block::start();	// call base class start()
     }
 
@@ -179,6 +189,84 @@ void hermesNB::set_Verbose(int Verb)		// callback to turn Verbose mode on or off
 
 
 
+// Put an rx_time tag on the first sample of every Ethernet frame that began in
+// the RxIQBuf just copied out. The value is the usual (uint64 seconds, double
+// fractional seconds) tuple, taken from the kernel receive timestamp.
+
+void hermesNB_impl::TagRxTime(const RxTime_t & Time, int BufCount, int SamplesPerBuf, int NumOutputs)
+    {
+	int FloatsPerSample = 2 * NumOutputs;		// I,Q per receiver, interleaved
+
+	if (Time.Dropped)				// RxMaxLatency threw older buffers away
+	  TagRxDrop((uint64_t)Time.Dropped * SamplesPerBuf, BufCount * SamplesPerBuf, NumOutputs);
+
+	for (unsigned k=0; k<Time.Count; k++)
+	{
+	  pmt::pmt_t value = pmt::make_tuple(
+		pmt::from_uint64((uint64_t)Time.Stamp[k].tv_sec),
+		pmt::from_double((double)Time.Stamp[k].tv_nsec * 1.0e-9));
+
+	  for (int port=0; port<NumOutputs; port++)
+	    add_item_tag(port, nitems_written(port) + (uint64_t)(BufCount * SamplesPerBuf)
+			 + Time.Offset[k] / FloatsPerSample, RxTimeKey, value);
+	}
+    }
+
+// Put an rx_drop tag on the first sample after a gap left by RxMaxLatency,
+// holding the number of samples per output that were thrown away.
+
+void hermesNB_impl::TagRxDrop(uint64_t Samples, int Offset, int NumOutputs)
+    {
+	pmt::pmt_t value = pmt::from_uint64(Samples);
+
+	for (int port=0; port<NumOutputs; port++)
+	  add_item_tag(port, nitems_written(port) + (uint64_t)Offset, RxDropKey, value);
+    }
+
+void hermesNB_impl::TagFrameTime(const struct timespec & Stamp, int Offset, int NumOutputs)
+    {
+	if (Stamp.tv_sec == 0)				// the kernel gave no stamp
+	  return;
+
+	pmt::pmt_t value = pmt::make_tuple(
+		pmt::from_uint64((uint64_t)Stamp.tv_sec),
+		pmt::from_double((double)Stamp.tv_nsec * 1.0e-9));
+
+	for (int port=0; port<NumOutputs; port++)
+	  add_item_tag(port, nitems_written(port) + (uint64_t)Offset, RxTimeKey, value);
+    }
+
+// With RxLazyDecode the receive thread checks sync, takes the status and
+// only queues the sample rows of each EP6 frame. Decode as many whole frames
+// as there is room for straight into the output buffers, with no float ring
+// in between. Returns the number of items produced.
+
+int hermesNB_impl::LazyWork(int noutput_items, gr_complex *out0, gr_complex *out1)
+    {
+	int PerFrame = Hermes->RxSamplesPerFrame();
+	int NumOutputs = (out1 != NULL) ? 2 : 1;
+	const METIS_RAW_SLOT * Frame;
+	int produced = 0;
+
+	if (Hermes->RxMaxLatency)			// drop what is older than that first
+	{
+	  int Dropped = Hermes->DropOldRxFrames();
+	  if (Dropped)
+	    TagRxDrop((uint64_t)Dropped * PerFrame, 0, NumOutputs);
+	}
+
+	while ((produced + PerFrame <= noutput_items) && ((Frame = Hermes->PeekRxFrame()) != NULL))
+	{
+	  TagFrameTime(Frame->stamp, produced, NumOutputs);
+	  Hermes->DecodeRxRows(Frame->frame, out0 + produced,
+			       (out1 != NULL) ? out1 + produced : NULL);
+	  produced += PerFrame;
+	  Hermes->ReleaseRxFrame();
+	}
+
+	return produced;
+    }
+
 void hermesNB_impl::forecast (int noutput_items, gr_vector_int &ninput_items_required)
     {
         /* <+forecast+> e.g. ninput_items_required[0] = noutput_items */
@@ -195,39 +283,53 @@ int hermesNB_impl::general_work (int noutput_items,
 
        gr_complex *out0 = (gr_complex *) output_items[0];		// Rcvr 0 samples
     
-       gr_complex *out1;						// Rcvr 1 samples
+       gr_complex *out1 = NULL;					// Rcvr 1 samples
        if (output_items.size() == 2)
 	 out1 = (gr_complex *) output_items[1];
 
-  // We always get 128 I and 128 Q samples per request from HermesProxy, interleaved
-  // See how many 128 sample buffers we can send to Gnuradio
+       if (Hermes->RxLazyDecode)			// decode raw frames right here
+       {
+         int produced = LazyWork(noutput_items, out0, out1);
+
+         if (ninput_items[0] >= 63)
+           consume_each(Hermes->PutTxIQ(in0, 63));	// Tx as below
+
+         if (produced == 0 && Hermes->RxFinished())
+           return WORK_DONE;			// a replay has played out
+
+         return(produced);
+       }
+
+  // We get RxSamplesPerBuf() I and Q samples per request from HermesProxy (128
+  // unless set otherwise), interleaved. See how many buffers we can send to Gnuradio
 
        IQBuf_t Rx;
+       RxTime_t RxTime;
        int CanSendBuffers;
+       int PerBuf = Hermes->RxSamplesPerBuf() / output_items.size();	// samples per buffer per Rcvr
 
-       if(output_items.size() == 1)
-         CanSendBuffers = noutput_items / 128;	// 128 samples per buffer - 1 Rcvr
-       else
-         CanSendBuffers = noutput_items / 64;	//  64 samples per buffer - 2 Rcvrs
+       CanSendBuffers = noutput_items / PerBuf;
 
 
 //  fprintf(stderr, "noutput_items = %d   CanSendBuffers = %d  ninput_items = %d  output_items.size = %d\n", noutput_items, CanSendBuffers, ninput_items[0], output_items.size());
 
-       int BufCount;					// # of 256-byte buffers (regardless of format)
+       int BufCount;					// # of Rx buffers (regardless of format)
 
        for( BufCount=0; BufCount<CanSendBuffers; BufCount++)
        {
-         if( (Rx = Hermes->GetRxIQ()) == NULL)	//no more available from the radio
+         if( (Rx = Hermes->GetRxIQ(&RxTime)) == NULL)	//no more available from the radio
          break; 					
 
+         TagRxTime(RxTime, BufCount, PerBuf, output_items.size());
+
          if (output_items.size() == 1)		// one receiver
-           for(int j=0; j<128; j++)
-             out0[(BufCount * 128) + j] = gr_complex(*Rx++, *Rx++);	// get 128 complex samples as 2 sets of 64 samples
+           for(int j=0; j<PerBuf; j++)
+             out0[(BufCount * PerBuf) + j] = gr_complex(*Rx++, *Rx++);	// get PerBuf complex samples
          else
-           for(int j=0; j<64; j++)			// two receivers
+           for(int j=0; j<PerBuf; j++)			// two receivers
            {
-             out0[(BufCount * 64) + j] = gr_complex(*Rx++, *Rx++);	// get 128 complex samples as 2 sets of 64 samples
-             out1[(BufCount * 64) + j] = gr_complex(*Rx++, *Rx++);
+             out0[(BufCount * PerBuf) + j] = gr_complex(*Rx++, *Rx++);	// get 2 sets of PerBuf complex samples
+             out1[(BufCount * PerBuf) + j] = gr_complex(*Rx++, *Rx++);
            }
         }
 
@@ -243,11 +345,11 @@ int hermesNB_impl::general_work (int noutput_items,
 
   //fprintf(stderr, "BufCount = %d\n", BufCount);
 
+       if (BufCount == 0 && Hermes->RxFinished())
+         return WORK_DONE;			// a replay has played out, the flowgraph can end
+
 
-       if(output_items.size() == 1)
-         return(BufCount*128);  	// Tell gnuradio how many output items we produced per stream
-       else
-         return(BufCount*64);  	// Tell gnuradio how many output items we produced per stream
+       return(BufCount*PerBuf);  	// Tell gnuradio how many output items we produced per stream
 
     }	// general_work
 
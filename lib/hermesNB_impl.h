@@ -22,6 +22,7 @@
 #define INCLUDED_HPSDR_HERMESNB_IMPL_H
 
 #include <hpsdr/hermesNB.h>
+#include "HermesProxy.h"		// RxTime_t
 
 namespace gr {
   namespace hpsdr {
@@ -29,7 +30,13 @@ namespace gr {
     class hermesNB_impl : public hermesNB
     {
      private:
-      // Nothing to declare in this block.
+      pmt::pmt_t RxTimeKey;		// "rx_time" stream tag key
+      pmt::pmt_t RxDropKey;		// "rx_drop" stream tag key
+
+      void TagRxTime(const RxTime_t &, int, int, int);	// tag each frame's first sample with its arrival time
+      void TagFrameTime(const struct timespec &, int, int);	// same for one raw frame decoded at an output offset
+      void TagRxDrop(uint64_t, int, int);	// mark where RxMaxLatency dropped samples
+      int LazyWork(int, gr_complex *, gr_complex *);	// RxLazyDecode: decode queued frames into the outputs
 
      public:
 
@@ -53,6 +60,7 @@ namespace gr {
  * \param Verbose  Turns Verbose mode on (=1) or off (=0)
  * \param NumRx  Number of Receivers (1 or 2)
  * \param MACAddr MAC Address of target or * for first detected
+ * \param Opts    Receive, buffer and engine options (see hermes_options.h)
  *
  */
       hermesNB_impl(int RxFreq0, int RxFreq1, int TxFreq, bool RxPre,
@@ -60,7 +68,7 @@ namespace gr {
 			 unsigned char TxDr, int RxSmp, const char* Intfc, 
 			 const char * ClkS, int AlexRA, int AlexTA,
 			 int AlexHPF, int AlexLPF, int Verbose, int NumRx,
-			 const char* MACAddr);
+			 const char* MACAddr, const hermes_options & Opts);
       ~hermesNB_impl();
 
       // Where all the action really happens
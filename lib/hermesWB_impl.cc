@@ -34,18 +34,16 @@
 #include <stdio.h>	// for DEBUG PRINTF's
 
 
-HermesProxyW* HermesW;	// make it visible to metis.cc
-
 namespace gr {
   namespace hpsdr {
 
     hermesWB::sptr
     hermesWB::make(bool RxPre, const char* Intfc, const char * ClkS,
 		   int AlexRA, int AlexTA, int AlexHPF, int AlexLPF,
-		   const char* MACAddr)
+		   const char* MACAddr, const hermes_options & Opts)
     {
       return gnuradio::get_initial_sptr
-        (new hermesWB_impl(RxPre, Intfc, ClkS, AlexRA, AlexTA, AlexHPF, AlexLPF, MACAddr));
+        (new hermesWB_impl(RxPre, Intfc, ClkS, AlexRA, AlexTA, AlexHPF, AlexLPF, MACAddr, Opts));
     }
 
     /*
@@ -53,12 +51,14 @@ namespace gr {
      */
     hermesWB_impl::hermesWB_impl(bool RxPre, const char* Intfc, const char * ClkS,
 			 int AlexRA, int AlexTA, int AlexHPF, int AlexLPF,
-			 const char* MACAddr)
+			 const char* MACAddr, const hermes_options & Opts)
       : gr::block("hermesWB",
               gr::io_signature::make(0, 0, 0),				// No inputs to hermesWB block
               gr::io_signature::make(1, 1, 16384 * sizeof(float)) )	// output from hermesWB block
     {
-	HermesW = new HermesProxyW(RxPre, Intfc, ClkS, AlexRA, AlexTA, AlexHPF, AlexLPF, MACAddr);	// Create proxy, do Hermes ethernet discovery
+	HermesW = new HermesProxyW(RxPre, Intfc, ClkS, AlexRA, AlexTA, AlexHPF, AlexLPF, MACAddr, Opts);	// Create proxy, start Hermes ethernet discovery
+
+	RxTimeKey = pmt::string_to_symbol("rx_time");
     }
 
     /*
@@ -79,7 +79,8 @@ bool hermesWB::stop()		// override base class
 
 bool hermesWB::start()		// override base class
     {
-	HermesW->Start();		// start rx stream on Hermes
+	if (!HermesW->Start())		// wait for discovery, start rx stream on Hermes
+	  return false;
 	return gr::block::start();	// call base class start()
     }
 
@@ -149,9 +150,16 @@ int hermesWB_impl::general_work (int noutput_items,
 		return 0;
 	  }
   	if (HermesW->RxBufFillCount() < 64)	// aligned but not enough buffers, do nothing
-	  return 0;
+	  return HermesW->RxFinished() ? WORK_DONE : 0;	// unless a replay has played out
 
    // aligned and have enough Read buffers - emit one complete vector to out0[]
+   // tagged with the kernel receive time of the frame that starts it
+
+	struct timespec RxTime = HermesW->GetCurrentRxReadTime();
+	if (RxTime.tv_sec != 0)
+	  add_item_tag(0, nitems_written(0), RxTimeKey,
+		pmt::make_tuple(pmt::from_uint64((uint64_t)RxTime.tv_sec),
+				pmt::from_double((double)RxTime.tv_nsec * 1.0e-9)));
 
 	IQBuf_t ReadBuf = HermesW->GetCurrentRxReadBuf();
 	IQBuf_t out = out0;
@@ -29,7 +29,7 @@ namespace gr {
     class hermesWB_impl : public hermesWB
     {
      private:
-      // Nothing to declare in this block.
+      pmt::pmt_t RxTimeKey;		// "rx_time" stream tag key
 
      public:
 
@@ -41,11 +41,13 @@ namespace gr {
  * \param AlexTA  HPSDR Alex Tx Ant Selector
  * \param AlexHPF  HPSDR Alex Rx High Pass Filter Selector
  * \param AlexLPF  HPSDR Alex Tx Low Pass Filter Selector
+ * \param MACAddr MAC Address of target or * for first detected
+ * \param Opts    Receive, buffer and engine options (see hermes_options.h)
  *
  */
       hermesWB_impl(bool RxPre, const char* Intfc, const char * ClkS,
 			 int AlexRA, int AlexTA, int AlexHPF, int AlexLPF,
-			 const char* MACAddr);
+			 const char* MACAddr, const hermes_options & Opts);
       ~hermesWB_impl();
 
       // Where all the action really happens
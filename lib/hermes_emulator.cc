@@ -0,0 +1,611 @@
+/* -*-  C++  -*-  */
+/* hermes_emulator.cc */
+
+/*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*
+*/
+
+// hermes-emulator: a Hermes/Metis board in software, on UDP port 1024.
+//
+// It answers the discovery broadcast, obeys the 0x04 start/stop command
+// and, while started, sends EP6 frames to whoever started it: sync and
+// C&C status bytes in each USB frame, then I/Q (and zero mic) samples in
+// the 1 or 2 receiver layout, at 48k to 384k. Receivers and rate are taken
+// from the C&C bytes of the EP2 frames the host sends, as the board does.
+// With EP4 enabled it sends bursts of 32 wideband frames, one 16384
+// sample block each. Frames are sent on a CLOCK_MONOTONIC schedule at the
+// true wire rate (one EP6 frame per 126, or 72, samples).
+//
+// The EP2 frames are consumed and counted: sequence gaps, and how evenly
+// they arrive, which is the host's Tx pacing.
+//
+// The samples are a tone (1/64 of the sample rate on receiver 1, 1/32 on
+// receiver 2), noise, or a counter that makes any loss or reordering plain
+// in the received stream.
+//
+// Run it on a host with a real interface, on the loopback interface
+// (Ethernet Interface "lo" in the blocks) or on one end of a veth pair,
+// e.g.
+//
+//   ip link add veth0 type veth peer name veth1
+//   ip addr add 10.11.0.1/24 dev veth0; ip link set veth0 up
+//   ip addr add 10.11.0.2/24 dev veth1; ip link set veth1 up
+//   hermes-emulator -a 10.11.0.2 -v
+//
+// and point the blocks at veth0.
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include "metis.h"
+
+#define EMU_PORT		1024		// Metis discovery, control and data port
+#define EMU_MAX_RECEIVERS	2
+#define EMU_TONE_SIZE		64		// tone period, samples
+#define EMU_WB_FRAMES		32		// EP4 frames in a 16384 sample block
+#define EMU_MAX_LATE		100000000L	// nsec behind schedule before the backlog is dropped
+#define EMU_MAX_BURST		64		// EP6 frames sent at most per wakeup
+#define EMU_TX_RATE		48000		// EP2 samples per second, fixed
+
+enum { Content_Tone, Content_Noise, Content_Counter };
+
+typedef struct _EMULATOR {
+    int socket;
+    unsigned char mac[6];
+    unsigned char version;		// firmware version reported
+    int content;			// Content_*
+    int wb_bursts;			// EP4 blocks per second
+    int verbose;
+
+    struct sockaddr_in host;		// who sent the start command
+    int streams;			// 1 = EP6, 2 = EP4
+    int speed;				// 0 = 48k .. 3 = 384k
+    int receivers;
+    int mox;
+
+    struct timespec ep6_due;		// CLOCK_MONOTONIC time of the next EP6 frame
+    struct timespec ep4_due;		// and of the next EP4 block
+    unsigned int ep6_sequence;
+    unsigned int ep4_sequence;
+    unsigned int cc_register;		// C&C status register sent next, 0..3
+    unsigned long long sample;		// samples sent per receiver since start
+    unsigned int wb_sample;
+    unsigned int noise;			// xorshift state
+
+    int tone_i[EMU_TONE_SIZE];
+    int tone_q[EMU_TONE_SIZE];
+
+    // counters, the totals and the last second's
+    unsigned long ep6_frames;
+    unsigned long ep4_frames;
+    unsigned long send_errors;
+    unsigned long late_resets;		// schedule dropped after a stall
+    unsigned long ep2_frames;
+    unsigned long ep2_lost;
+    unsigned long ep2_reordered;
+    unsigned int ep2_expected;
+    int ep2_started;
+    struct timespec ep2_last;		// arrival of the last EP2 frame
+    long ep2_max_gap;			// nsec, longest between two EP2 frames
+    unsigned long second_ep6;
+    unsigned long second_ep2;
+} EMULATOR;
+
+static volatile sig_atomic_t emu_stop = 0;
+
+
+static void emulator_signal(int) {
+    emu_stop = 1;
+}
+
+static long long emulator_nsec(const struct timespec* t) {
+    return (long long)t->tv_sec * 1000000000LL + t->tv_nsec;
+}
+
+static void emulator_add(struct timespec* t, long long nsec) {
+    long long total = emulator_nsec(t) + nsec;
+
+    t->tv_sec = total / 1000000000LL;
+    t->tv_nsec = total % 1000000000LL;
+}
+
+static int emulator_rate(EMULATOR* emu) {
+    return 48000 << emu->speed;
+}
+
+// Complex samples per receiver in one EP6 frame: 63 rows of 8 bytes, or 36
+// rows of 14 bytes, per USB frame.
+static int emulator_samples_per_frame(EMULATOR* emu) {
+    return emu->receivers == 1 ? 2*63 : 2*36;
+}
+
+static long long emulator_ep6_period(EMULATOR* emu) {
+    return (long long)emulator_samples_per_frame(emu) * 1000000000LL / emulator_rate(emu);
+}
+
+static unsigned int emulator_random(EMULATOR* emu) {
+    emu->noise ^= emu->noise << 13;
+    emu->noise ^= emu->noise >> 17;
+    emu->noise ^= emu->noise << 5;
+    return emu->noise;
+}
+
+static void emulator_header(unsigned char* frame, unsigned char ep, unsigned int sequence) {
+    frame[0] = 0xEF;
+    frame[1] = 0xFE;
+    frame[2] = 0x01;
+    frame[3] = ep;
+    frame[4] = (sequence >> 24) & 0xFF;
+    frame[5] = (sequence >> 16) & 0xFF;
+    frame[6] = (sequence >> 8) & 0xFF;
+    frame[7] = sequence & 0xFF;
+}
+
+// One 24 bit I/Q pair of receiver rx for the current sample.
+static void emulator_sample(EMULATOR* emu, int rx, unsigned char* p) {
+    int i;
+    int q;
+
+    switch(emu->content) {
+        case Content_Noise:
+            i = ((int)(emulator_random(emu) & 0x3FFFF)) - 0x20000;	// about -36 dBFS
+            q = ((int)(emulator_random(emu) & 0x3FFFF)) - 0x20000;
+            break;
+        case Content_Counter:
+            i = (int)((emu->sample + rx * 0x400000) & 0xFFFFFF);	// receivers a quarter scale apart
+            q = i ^ 0xFFFFFF;
+            break;
+        default:
+            i = emu->tone_i[(emu->sample * (rx + 1)) % EMU_TONE_SIZE];
+            q = emu->tone_q[(emu->sample * (rx + 1)) % EMU_TONE_SIZE];
+            break;
+    }
+
+    p[0] = (i >> 16) & 0xFF;
+    p[1] = (i >> 8) & 0xFF;
+    p[2] = i & 0xFF;
+    p[3] = (q >> 16) & 0xFF;
+    p[4] = (q >> 8) & 0xFF;
+    p[5] = q & 0xFF;
+}
+
+// The C&C status bytes of one EP6 USB frame. The registers take turns as
+// on the board: overload and firmware version, then the power and supply
+// readings. The power readings only move while the host keys the radio.
+static void emulator_status(EMULATOR* emu, unsigned char* c) {
+    unsigned int power = emu->mox ? 0x0800 : 0x0000;
+
+    memset(c, 0, 5);
+    c[0] = (emu->cc_register << 3);
+    switch(emu->cc_register) {
+        case 0:
+            c[4] = emu->version;
+            break;
+        case 1:			// AIN5 exciter power, AIN1 forward power
+            c[1] = (power >> 8) & 0xFF;
+            c[2] = power & 0xFF;
+            c[3] = (power >> 8) & 0xFF;
+            c[4] = power & 0xFF;
+            break;
+        case 2:			// AIN2 reverse power, AIN3
+            c[1] = (power >> 12) & 0xFF;
+            break;
+        case 3:			// AIN4, AIN6 supply volts
+            c[3] = 0x0C;
+            c[4] = 0x80;
+            break;
+    }
+    emu->cc_register = (emu->cc_register + 1) & 3;
+}
+
+static void emulator_send(EMULATOR* emu, unsigned char* frame, int length) {
+    if(sendto(emu->socket, frame, length, 0, (struct sockaddr*)&emu->host, sizeof(emu->host)) != length)
+        emu->send_errors++;
+}
+
+static void emulator_ep6_frame(EMULATOR* emu) {
+    unsigned char frame[METIS_FRAME_BYTES];
+    int rows = emu->receivers == 1 ? 63 : 36;
+    int row_bytes = emu->receivers == 1 ? 8 : 14;
+    unsigned char* p;
+    int u;
+    int r;
+    int rx;
+
+    emulator_header(frame, 6, emu->ep6_sequence++);
+    for(u=0;u<2;u++) {
+        p = frame + 8 + u*512;
+        p[0] = p[1] = p[2] = 0x7F;
+        emulator_status(emu, p+3);
+        p += 8;
+        memset(p, 0, 504);
+        for(r=0;r<rows;r++, p+=row_bytes) {
+            for(rx=0;rx<emu->receivers;rx++)
+                emulator_sample(emu, rx, p + rx*6);
+            emu->sample++;		// mic bytes stay zero
+        }
+    }
+
+    emulator_send(emu, frame, METIS_FRAME_BYTES);
+    emu->ep6_frames++;
+    emu->second_ep6++;
+}
+
+// One block of raw ADC samples, 16 bit little endian as HermesProxyW reads
+// them, 512 per USB frame. Blocks start on a sequence number that is a
+// multiple of 32.
+static void emulator_ep4_block(EMULATOR* emu) {
+    unsigned char frame[METIS_FRAME_BYTES];
+    int f;
+    int s;
+    int adc;
+
+    for(f=0;f<EMU_WB_FRAMES;f++) {
+        emulator_header(frame, 4, emu->ep4_sequence++);
+        for(s=0;s<1024/2;s++, emu->wb_sample++) {
+            switch(emu->content) {
+                case Content_Noise:
+                    adc = ((int)(emulator_random(emu) & 0x3FF)) - 0x200;
+                    break;
+                case Content_Counter:
+                    adc = (short)(emu->wb_sample & 0xFFFF);
+                    break;
+                default:
+                    adc = emu->tone_q[emu->wb_sample % EMU_TONE_SIZE] >> 8;	// 16 bit
+                    break;
+            }
+            frame[8 + s*2] = adc & 0xFF;
+            frame[8 + s*2 + 1] = (adc >> 8) & 0xFF;
+        }
+        emulator_send(emu, frame, METIS_FRAME_BYTES);
+        emu->ep4_frames++;
+    }
+    emu->wb_sample = 0;		// each block is a fresh capture on the board
+}
+
+static void emulator_discovery_reply(EMULATOR* emu, struct sockaddr_in* from) {
+    unsigned char reply[60];
+
+    memset(reply, 0, sizeof(reply));
+    reply[0] = 0xEF;
+    reply[1] = 0xFE;
+    reply[2] = emu->streams ? 0x03 : 0x02;	// 3 = already sending
+    memcpy(reply+3, emu->mac, 6);
+    reply[9] = emu->version;
+    reply[10] = 0x01;			// Hermes
+    sendto(emu->socket, reply, sizeof(reply), 0, (struct sockaddr*)from, sizeof(*from));
+}
+
+static void emulator_start(EMULATOR* emu, int streams, struct sockaddr_in* from) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(streams && !emu->streams) {		// a board starts its sequence numbers over
+        emu->host = *from;
+        emu->ep6_sequence = 0;
+        emu->ep4_sequence = 0;
+        emu->sample = 0;
+        emu->ep2_started = 0;
+        emu->ep6_due = now;
+        emu->ep4_due = now;
+        fprintf(stderr, "hermes-emulator: started by %s:%d,%s%s\n", inet_ntoa(from->sin_addr),
+            ntohs(from->sin_port), (streams & 1) ? " EP6" : "", (streams & 2) ? " EP4" : "");
+    } else if(!streams && emu->streams)
+        fprintf(stderr, "hermes-emulator: stopped\n");
+    if((streams & 2) && !(emu->streams & 2))
+        emu->ep4_due = now;
+    emu->streams = streams;
+}
+
+// Take the settings a board takes from the C&C bytes of register 0: speed,
+// receivers and MOX.
+static void emulator_control(EMULATOR* emu, unsigned char* usb) {
+    int receivers;
+    int speed;
+
+    if(usb[0] != 0x7F || usb[1] != 0x7F || usb[2] != 0x7F)
+        return;
+    emu->mox = usb[3] & 0x01;
+    if((usb[3] & 0xFE) != 0x00)
+        return;
+
+    speed = usb[4] & 0x03;
+    receivers = ((usb[7] >> 3) & 0x07) + 1;
+    if(receivers > EMU_MAX_RECEIVERS)
+        receivers = EMU_MAX_RECEIVERS;
+
+    if(speed != emu->speed || receivers != emu->receivers) {
+        emu->speed = speed;
+        emu->receivers = receivers;
+        clock_gettime(CLOCK_MONOTONIC, &emu->ep6_due);	// a new schedule
+        if(emu->verbose)
+            fprintf(stderr, "hermes-emulator: %d receiver%s at %d kHz\n", receivers,
+                receivers == 1 ? "" : "s", emulator_rate(emu) / 1000);
+    }
+}
+
+// An EP2 frame: count it, check its sequence number and when it came, and
+// take the C&C bytes of both USB frames.
+static void emulator_ep2(EMULATOR* emu, unsigned char* frame, int length) {
+    unsigned int sequence = (frame[4] << 24) | (frame[5] << 16) | (frame[6] << 8) | frame[7];
+    struct timespec now;
+    long long gap;
+
+    if(length < METIS_FRAME_BYTES)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(emu->ep2_started) {
+        if(sequence > emu->ep2_expected)
+            emu->ep2_lost += sequence - emu->ep2_expected;
+        else if(sequence < emu->ep2_expected)
+            emu->ep2_reordered++;
+        gap = emulator_nsec(&now) - emulator_nsec(&emu->ep2_last);
+        if(gap > emu->ep2_max_gap)
+            emu->ep2_max_gap = (long)gap;
+    }
+    if(!emu->ep2_started || sequence >= emu->ep2_expected)
+        emu->ep2_expected = sequence + 1;
+    emu->ep2_started = 1;
+    emu->ep2_last = now;
+    emu->ep2_frames++;
+    emu->second_ep2++;
+
+    emulator_control(emu, frame + 8);
+    emulator_control(emu, frame + 8 + 512);
+}
+
+static void emulator_receive(EMULATOR* emu) {
+    unsigned char buffer[2048];
+    struct sockaddr_in from;
+    socklen_t length;
+    int bytes;
+
+    while(1) {
+        length = sizeof(from);
+        bytes = recvfrom(emu->socket, buffer, sizeof(buffer), MSG_DONTWAIT, (struct sockaddr*)&from, &length);
+        if(bytes < 0)
+            return;
+        if(bytes < 4 || buffer[0] != 0xEF || buffer[1] != 0xFE)
+            continue;
+
+        switch(buffer[2]) {
+            case 0x02:
+                emulator_discovery_reply(emu, &from);
+                break;
+            case 0x04:
+                emulator_start(emu, buffer[3] & 0x03, &from);
+                break;
+            case 0x01:
+                if(buffer[3] == 2 && bytes >= 8)
+                    emulator_ep2(emu, buffer, bytes);
+                break;
+        }
+    }
+}
+
+// Send what is due by now. A stall longer than EMU_MAX_LATE drops the
+// backlog, as the board's FIFO would overflow.
+static void emulator_stream(EMULATOR* emu) {
+    struct timespec now;
+    long long period;
+    int sent;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if(emu->streams & 1) {
+        period = emulator_ep6_period(emu);
+        if(emulator_nsec(&now) - emulator_nsec(&emu->ep6_due) > EMU_MAX_LATE) {
+            emu->ep6_due = now;
+            emu->late_resets++;
+        }
+        for(sent=0;sent<EMU_MAX_BURST && emulator_nsec(&emu->ep6_due) <= emulator_nsec(&now);sent++) {
+            emulator_ep6_frame(emu);
+            emulator_add(&emu->ep6_due, period);
+        }
+    }
+
+    if((emu->streams & 2) && emu->wb_bursts > 0 && emulator_nsec(&emu->ep4_due) <= emulator_nsec(&now)) {
+        emulator_ep4_block(emu);
+        emulator_add(&emu->ep4_due, 1000000000LL / emu->wb_bursts);
+        if(emulator_nsec(&now) - emulator_nsec(&emu->ep4_due) > EMU_MAX_LATE)
+            emu->ep4_due = now;
+    }
+}
+
+// How long until something is due, for ppoll().
+static void emulator_timeout(EMULATOR* emu, struct timespec* timeout) {
+    struct timespec now;
+    long long wait = 100000000LL;		// idle: look for a stop every 100 msec
+    long long until;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(emu->streams & 1) {
+        until = emulator_nsec(&emu->ep6_due) - emulator_nsec(&now);
+        if(until < wait)
+            wait = until;
+    }
+    if((emu->streams & 2) && emu->wb_bursts > 0) {
+        until = emulator_nsec(&emu->ep4_due) - emulator_nsec(&now);
+        if(until < wait)
+            wait = until;
+    }
+    if(wait < 0)
+        wait = 0;
+    timeout->tv_sec = wait / 1000000000LL;
+    timeout->tv_nsec = wait % 1000000000LL;
+}
+
+static void emulator_second(EMULATOR* emu) {
+    fprintf(stderr, "hermes-emulator: EP6 %lu/s (%d/s nominal), EP2 %lu/s (%d/s nominal), EP2 lost %lu, "
+        "longest EP2 gap %.1f ms, send errors %lu\n",
+        emu->second_ep6, (emu->streams & 1) ? (int)(1000000000LL / emulator_ep6_period(emu)) : 0,
+        emu->second_ep2, EMU_TX_RATE / 126, emu->ep2_lost, emu->ep2_max_gap / 1.0e6, emu->send_errors);
+    emu->second_ep6 = 0;
+    emu->second_ep2 = 0;
+}
+
+static void emulator_totals(EMULATOR* emu) {
+    fprintf(stderr, "hermes-emulator: sent %lu EP6 and %lu EP4 frames, %lu send errors, %lu schedule resets\n",
+        emu->ep6_frames, emu->ep4_frames, emu->send_errors, emu->late_resets);
+    fprintf(stderr, "hermes-emulator: received %lu EP2 frames, %lu lost, %lu out of order, longest gap %.1f ms\n",
+        emu->ep2_frames, emu->ep2_lost, emu->ep2_reordered, emu->ep2_max_gap / 1.0e6);
+}
+
+static void emulator_usage() {
+    fprintf(stderr,
+        "usage: hermes-emulator [-a address] [-m MAC] [-c tone|noise|counter] [-w blocks]\n"
+        "                       [-f version] [-t seconds] [-v]\n"
+        "  -a  address to listen on, port 1024 (default all)\n"
+        "  -m  MAC address reported (default 02:00:00:00:00:03)\n"
+        "  -c  sample content (default tone)\n"
+        "  -w  EP4 blocks of 16384 samples per second (default 10)\n"
+        "  -f  firmware version reported (default 31)\n"
+        "  -t  stop after this many seconds (default run until interrupted)\n"
+        "  -v  print rates and Tx pacing every second\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    EMULATOR emu;
+    struct sockaddr_in address;
+    struct sockaddr_in from;
+    struct pollfd pfd;
+    struct timespec timeout;
+    struct timespec started;
+    struct timespec now;
+    long long next_second;
+    unsigned int m[6];
+    int seconds = 0;
+    int on = 1;
+    int c;
+    int i;
+
+    memset(&emu, 0, sizeof(emu));
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(EMU_PORT);
+    emu.mac[0] = 0x02;
+    emu.mac[5] = 0x03;
+    emu.version = 31;
+    emu.wb_bursts = 10;
+    emu.receivers = 1;
+    emu.noise = 0x12345678;
+
+    while((c = getopt(argc, argv, "a:m:c:w:f:t:v")) != -1) {
+        switch(c) {
+            case 'a':
+                if(inet_aton(optarg, &address.sin_addr) == 0)
+                    emulator_usage();
+                break;
+            case 'm':
+                if(sscanf(optarg, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6)
+                    emulator_usage();
+                for(i=0;i<6;i++)
+                    emu.mac[i] = m[i] & 0xFF;
+                break;
+            case 'c':
+                if(strcmp(optarg, "tone") == 0)
+                    emu.content = Content_Tone;
+                else if(strcmp(optarg, "noise") == 0)
+                    emu.content = Content_Noise;
+                else if(strcmp(optarg, "counter") == 0)
+                    emu.content = Content_Counter;
+                else
+                    emulator_usage();
+                break;
+            case 'w':
+                emu.wb_bursts = atoi(optarg);
+                break;
+            case 'f':
+                emu.version = atoi(optarg) & 0xFF;
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            case 'v':
+                emu.verbose = 1;
+                break;
+            default:
+                emulator_usage();
+        }
+    }
+
+    for(i=0;i<EMU_TONE_SIZE;i++) {
+        emu.tone_i[i] = (int)(0x100000 * cos(2 * M_PI * i / EMU_TONE_SIZE));	// -18 dBFS
+        emu.tone_q[i] = (int)(0x100000 * sin(2 * M_PI * i / EMU_TONE_SIZE));
+    }
+
+    emu.socket = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(emu.socket < 0) {
+        perror("hermes-emulator: create socket failed");
+        exit(1);
+    }
+    setsockopt(emu.socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(emu.socket, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+    if(bind(emu.socket, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("hermes-emulator: bind socket failed for port 1024");
+        exit(1);
+    }
+
+    signal(SIGINT, emulator_signal);
+    signal(SIGTERM, emulator_signal);
+
+    fprintf(stderr, "hermes-emulator: Hermes %02X:%02X:%02X:%02X:%02X:%02X firmware %d on %s:%d\n",
+        emu.mac[0], emu.mac[1], emu.mac[2], emu.mac[3], emu.mac[4], emu.mac[5], emu.version,
+        inet_ntoa(address.sin_addr), EMU_PORT);
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    next_second = emulator_nsec(&started) + 1000000000LL;
+    memset(&from, 0, sizeof(from));
+    pfd.fd = emu.socket;
+    pfd.events = POLLIN;
+
+    while(!emu_stop) {
+        emulator_timeout(&emu, &timeout);
+        if(ppoll(&pfd, 1, &timeout, NULL) > 0)
+            emulator_receive(&emu);
+        emulator_stream(&emu);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(emulator_nsec(&now) >= next_second) {
+            if(emu.verbose && emu.streams)
+                emulator_second(&emu);
+            next_second += 1000000000LL;
+        }
+        if(seconds > 0 && now.tv_sec - started.tv_sec >= seconds)
+            break;
+    }
+
+    emulator_totals(&emu);
+    close(emu.socket);
+    return 0;
+}
@@ -0,0 +1,640 @@
+/* -*-  C++  -*-  */
+/* hpsdr_p2.cc */
+
+/*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*
+*/
+
+// HPSDR Protocol 2 engine (see hpsdr_p2.h).
+//
+// Every packet to the radio starts with a 32 bit big endian sequence number
+// that runs separately for each radio port. Multi-byte fields are big endian.
+// Only the fields this engine drives are filled in; everything else is left
+// zero, which the protocol defines as off or default.
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <ifaddrs.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include "metis.h"
+#include "metis_reactor.h"
+#include "hpsdr_p2.h"
+
+#define P2_WAIT_MSEC		100		// longest the receive thread waits before checking for a stop
+#define P2_DISCOVER_MSEC	1000		// between discovery requests
+#define P2_MAX_TARGETS		16		// interfaces discovery is broadcast on
+
+struct _P2_SESSION {
+    char interface[64];
+    char mac[18];			// MAC address asked for, may be empty
+    P2_IQ_HANDLER iq;
+    P2_STATUS_HANDLER status;
+    void* arg;
+
+    int general_socket;			// discovery and commands go out of this one
+    int ddc_socket[P2_MAX_DDC];		// connected to radio port 1035+n
+    int status_socket;			// connected to radio port 1025
+    unsigned short local_port;		// shared by all of them, network order
+    int rcvbuf;
+    int sndbuf;
+
+    struct sockaddr_in radio;		// radio address, port 1024
+    int found;
+    char ip_address[16];
+    char mac_address[18];
+
+    int rx_sched;
+    int rx_priority;
+    char rx_cpus[64];
+    pthread_t receive_thread_id;
+    int receiving;
+    int stop;
+
+    pthread_mutex_t command_lock;	// the command packets and their sequence numbers
+    unsigned int general_sequence;
+    unsigned int ddc_specific_sequence;
+    unsigned int duc_specific_sequence;
+    unsigned int high_priority_sequence;
+    unsigned int duc_sequence;		// only the thread sending DUC packets
+    int run;
+    int sent_receivers;			// as last sent in the receiver specific packet
+    int sent_rate;
+
+    unsigned long packets;		// DDC packets handed on
+    unsigned long status_packets;
+    unsigned long strays;		// from another address or port, or too short
+};
+
+
+static void p2_put32(unsigned char* p, unsigned int value) {
+    p[0] = (value >> 24) & 0xFF;
+    p[1] = (value >> 16) & 0xFF;
+    p[2] = (value >> 8) & 0xFF;
+    p[3] = value & 0xFF;
+}
+
+static void p2_put16(unsigned char* p, unsigned int value) {
+    p[0] = (value >> 8) & 0xFF;
+    p[1] = value & 0xFF;
+}
+
+static int p2_socket(P2_SESSION* session) {
+    int sock;
+    int on=1;
+
+    sock=socket(PF_INET,SOCK_DGRAM,IPPROTO_UDP);
+    if(sock<0) {
+        perror("create socket failed for p2_socket");
+        exit(1);
+    }
+    if(setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+        perror("cannot set SO_REUSEPORT on p2_socket");
+        exit(1);
+    }
+
+    // arrival time of every packet, for rx_time
+    if(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) != 0)
+        perror("cannot set SO_TIMESTAMPNS, samples will not carry rx_time");
+
+    if(session->rcvbuf > 0)
+        if(setsockopt(sock,SOL_SOCKET,SO_RCVBUFFORCE,&session->rcvbuf,sizeof(session->rcvbuf))<0)
+            setsockopt(sock,SOL_SOCKET,SO_RCVBUF,&session->rcvbuf,sizeof(session->rcvbuf));
+
+    return sock;
+}
+
+// A socket on the session's local port that only takes packets from the
+// radio's port.
+static int p2_stream_socket(P2_SESSION* session, int port) {
+    struct sockaddr_in name;
+    int sock=p2_socket(session);
+
+    memset(&name,0,sizeof(name));
+    name.sin_family=AF_INET;
+    name.sin_addr.s_addr=htonl(INADDR_ANY);
+    name.sin_port=session->local_port;
+    if(bind(sock,(struct sockaddr*)&name,sizeof(name))<0) {
+        perror("bind failed for p2_stream_socket, sorting by source port");
+        close(sock);
+        return -1;
+    }
+
+    name=session->radio;
+    name.sin_port=htons(port);
+    if(connect(sock,(struct sockaddr*)&name,sizeof(name))<0) {
+        perror("connect failed for p2_stream_socket, sorting by source port");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void p2_send(P2_SESSION* session, int port, unsigned char* buffer, int length) {
+    struct sockaddr_in to=session->radio;
+
+    to.sin_port=htons(port);
+    if(sendto(session->general_socket,buffer,length,0,(struct sockaddr*)&to,sizeof(to))<0)
+        perror("sendto failed for p2_send");
+}
+
+P2_SESSION* p2_open(const char* interface, const char* mac,
+                    P2_IQ_HANDLER iq, P2_STATUS_HANDLER status, void* arg) {
+    P2_SESSION* session;
+    struct sockaddr_in name;
+    socklen_t length=sizeof(name);
+    int on=1;
+    int i;
+
+    session=(P2_SESSION*)calloc(1,sizeof(P2_SESSION));
+    if(session == NULL) {
+        perror("cannot allocate Protocol 2 session");
+        exit(1);
+    }
+    strncpy(session->interface,interface,sizeof(session->interface)-1);
+    strncpy(session->mac,mac,sizeof(session->mac)-1);
+    session->iq=iq;
+    session->status=status;
+    session->arg=arg;
+    session->status_socket=-1;
+    for(i=0;i<P2_MAX_DDC;i++)
+        session->ddc_socket[i]=-1;
+    pthread_mutex_init(&session->command_lock,NULL);
+
+    if(strcmp(interface, "loopback") == 0)
+        p2_sim_start();
+
+    session->general_socket=p2_socket(session);
+    if(setsockopt(session->general_socket, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on)) != 0) {
+        perror("cannot set SO_BROADCAST on p2 general socket");
+        exit(1);
+    }
+
+    memset(&name,0,sizeof(name));
+    name.sin_family=AF_INET;
+    name.sin_addr.s_addr=htonl(INADDR_ANY);
+    name.sin_port=0;
+    if(bind(session->general_socket,(struct sockaddr*)&name,sizeof(name))<0) {
+        perror("bind failed for p2 general socket");
+        exit(1);
+    }
+    getsockname(session->general_socket,(struct sockaddr*)&name,&length);
+    session->local_port=name.sin_port;
+
+    return session;
+}
+
+// The stream sockets take rcvbuf; the general socket, which sends the DUC
+// packets, takes sndbuf at once.
+void p2_socket_buffers(P2_SESSION* session, int rcvbuf, int sndbuf) {
+    session->rcvbuf=rcvbuf;
+    session->sndbuf=sndbuf;
+    if(sndbuf > 0)
+        if(setsockopt(session->general_socket,SOL_SOCKET,SO_SNDBUFFORCE,&sndbuf,sizeof(sndbuf))<0)
+            setsockopt(session->general_socket,SOL_SOCKET,SO_SNDBUF,&sndbuf,sizeof(sndbuf));
+}
+
+void p2_receive_scheduling(P2_SESSION* session, int sched, int priority, const char* cpus) {
+    session->rx_sched=sched;
+    session->rx_priority=priority;
+    strncpy(session->rx_cpus,cpus,sizeof(session->rx_cpus)-1);
+}
+
+// Where discovery requests go: the emulated radio for "loopback", else the
+// broadcast address of interface, or of every IPv4 interface that can
+// broadcast when interface is "*" or empty.
+static int p2_discovery_targets(P2_SESSION* session, struct sockaddr_in* targets, int max) {
+    struct ifaddrs* ifaddr;
+    struct ifaddrs* ifa;
+    int any = session->interface[0] == 0 || strcmp(session->interface, "*") == 0;
+    int n=0;
+
+    if(strcmp(session->interface, "loopback") == 0) {
+        memset(&targets[0],0,sizeof(targets[0]));
+        targets[0].sin_family=AF_INET;
+        targets[0].sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+        targets[0].sin_port=htons(P2_PORT_GENERAL);
+        return 1;
+    }
+
+    if(getifaddrs(&ifaddr) < 0) {
+        perror("getifaddrs failed");
+        return 0;
+    }
+
+    for(ifa=ifaddr;ifa!=NULL && n<max;ifa=ifa->ifa_next) {
+        if(ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_INET)
+            continue;
+        if(!any && strcmp(ifa->ifa_name, session->interface) != 0)
+            continue;
+        if(!(ifa->ifa_flags & IFF_UP) || !(ifa->ifa_flags & IFF_BROADCAST) || ifa->ifa_broadaddr == NULL)
+            continue;
+        if(any && (ifa->ifa_flags & IFF_LOOPBACK))
+            continue;
+
+        memcpy(&targets[n],ifa->ifa_broadaddr,sizeof(targets[n]));
+        targets[n].sin_port=htons(P2_PORT_GENERAL);
+        n++;
+    }
+
+    freeifaddrs(ifaddr);
+    return n;
+}
+
+// Take a discovery reply: byte 4 is 2 when the radio is free, 3 when it is
+// already streaming to someone, the MAC address follows.
+static int p2_discovery_reply(P2_SESSION* session, unsigned char* reply, int length, struct sockaddr_in* from) {
+    char mac_address[18];
+
+    if(length < 21 || ntohs(from->sin_port) != P2_PORT_GENERAL)
+        return 0;
+    if(reply[0] != 0 || reply[1] != 0 || reply[2] != 0 || reply[3] != 0 || (reply[4] != 2 && reply[4] != 3))
+        return 0;
+
+    sprintf(mac_address,"%02X:%02X:%02X:%02X:%02X:%02X",
+        reply[5],reply[6],reply[7],reply[8],reply[9],reply[10]);
+    if(strlen(session->mac) == 17 && strcmp(session->mac, mac_address) != 0)
+        return 0;
+
+    strcpy(session->mac_address,mac_address);
+    strcpy(session->ip_address,inet_ntoa(from->sin_addr));
+    session->radio=*from;
+    fprintf(stderr,"Protocol 2 radio %s at %s, board %d, firmware %d.%d, %d DDCs%s\n",
+        session->mac_address,session->ip_address,reply[11],reply[13]/10,reply[13]%10,reply[20],
+        reply[4] == 3 ? " (busy)" : "");
+    return 1;
+}
+
+int p2_wait_found(P2_SESSION* session, int timeout_ms) {
+    struct sockaddr_in targets[P2_MAX_TARGETS];
+    unsigned char request[P2_SHORT_BYTES];
+    unsigned char reply[P2_PACKET_BYTES];
+    struct sockaddr_in from;
+    socklen_t length;
+    struct pollfd pfd;
+    struct timespec start;
+    struct timespec now;
+    long waited;
+    int ntargets;
+    int bytes;
+    int i;
+
+    if(session->found)
+        return 0;
+
+    fprintf(stderr,"Looking for Protocol 2 radio on interface %s\n",session->interface);
+    ntargets=p2_discovery_targets(session,targets,P2_MAX_TARGETS);
+    if(ntargets == 0) {
+        fprintf(stderr,"No %s interface.\n",session->interface);
+        return -1;
+    }
+
+    memset(request,0,sizeof(request));
+    request[4]=0x02;			// discovery
+
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    for(;;) {
+        for(i=0;i<ntargets;i++)
+            if(sendto(session->general_socket,request,sizeof(request),0,(struct sockaddr*)&targets[i],sizeof(targets[i]))<0)
+                perror("sendto failed for p2 discovery");
+
+        pfd.fd=session->general_socket;
+        pfd.events=POLLIN;
+        while(poll(&pfd,1,P2_DISCOVER_MSEC) > 0) {
+            length=sizeof(from);
+            bytes=recvfrom(session->general_socket,reply,sizeof(reply),0,(struct sockaddr*)&from,&length);
+            if(bytes > 0 && p2_discovery_reply(session,reply,bytes,&from)) {
+                session->found=1;
+                return 0;
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC,&now);
+        waited=(now.tv_sec-start.tv_sec)*1000L + (now.tv_nsec-start.tv_nsec)/1000000L;
+        if(timeout_ms > 0 && waited >= timeout_ms)
+            return -1;
+    }
+}
+
+char* p2_ip_address(P2_SESSION* session) {
+    return session->ip_address;
+}
+
+char* p2_mac_address(P2_SESSION* session) {
+    return session->mac_address;
+}
+
+
+// ********** command packets **********
+
+// Port numbers are the protocol defaults, written out so the radio does not
+// depend on its own.
+static void p2_send_general(P2_SESSION* session) {
+    unsigned char buffer[P2_SHORT_BYTES];
+
+    memset(buffer,0,sizeof(buffer));
+    p2_put32(buffer,session->general_sequence++);
+    buffer[4]=0x00;				// general packet
+    p2_put16(buffer+5,P2_PORT_DDC_SPECIFIC);
+    p2_put16(buffer+7,P2_PORT_DUC_SPECIFIC);
+    p2_put16(buffer+9,P2_PORT_HIGH_PRIORITY);
+    p2_put16(buffer+11,P2_PORT_STATUS);
+    p2_put16(buffer+13,1028);			// Rx audio
+    p2_put16(buffer+15,P2_PORT_DUC_IQ);
+    p2_put16(buffer+17,P2_PORT_DDC_IQ);
+    p2_put16(buffer+19,1026);			// mic samples
+    p2_put16(buffer+21,1027);			// wideband ADC0
+    buffer[37]=0x00;				// frequencies in Hz, not phase words
+    buffer[58]=0x01;				// PA enabled
+    buffer[59]=0x01;				// Alex0 enabled
+    p2_send(session,P2_PORT_GENERAL,buffer,sizeof(buffer));
+}
+
+// DDC0 from ADC0, and DDC1 too with its samples interleaved into DDC0's
+// packets when there are two receivers.
+static void p2_send_ddc_specific(P2_SESSION* session, const P2_SETTINGS* settings) {
+    unsigned char buffer[P2_PACKET_BYTES];
+    int ddc;
+
+    memset(buffer,0,sizeof(buffer));
+    p2_put32(buffer,session->ddc_specific_sequence++);
+    buffer[4]=1;				// ADCs
+    buffer[5]=settings->dither ? 0x01 : 0x00;
+    buffer[6]=settings->random ? 0x01 : 0x00;
+    buffer[7]=settings->receivers == 2 ? 0x03 : 0x01;	// DDC enables
+    for(ddc=0;ddc<settings->receivers && ddc<P2_MAX_DDC;ddc++) {
+        buffer[17+ddc*6]=0;			// ADC0
+        p2_put16(buffer+18+ddc*6,settings->sample_rate/1000);
+        buffer[22+ddc*6]=24;			// bits per sample
+    }
+    if(settings->receivers == 2)
+        buffer[1363]=0x02;			// DDC1 synchronised to DDC0
+
+    p2_send(session,P2_PORT_DDC_SPECIFIC,buffer,sizeof(buffer));
+    session->sent_receivers=settings->receivers;
+    session->sent_rate=settings->sample_rate;
+}
+
+static void p2_send_duc_specific(P2_SESSION* session) {
+    unsigned char buffer[P2_SHORT_BYTES];
+
+    memset(buffer,0,sizeof(buffer));
+    p2_put32(buffer,session->duc_specific_sequence++);
+    buffer[4]=1;				// DACs
+    p2_send(session,P2_PORT_DUC_SPECIFIC,buffer,sizeof(buffer));
+}
+
+static void p2_send_high_priority(P2_SESSION* session, const P2_SETTINGS* settings) {
+    unsigned char buffer[P2_PACKET_BYTES];
+    int ddc;
+
+    memset(buffer,0,sizeof(buffer));
+    p2_put32(buffer,session->high_priority_sequence++);
+    buffer[4]=(session->run ? 0x01 : 0x00) | (settings->ptt ? 0x02 : 0x00);
+    for(ddc=0;ddc<P2_MAX_DDC;ddc++)
+        p2_put32(buffer+9+ddc*4,settings->rx_frequency[ddc]);
+    p2_put32(buffer+329,settings->tx_frequency);
+    buffer[345]=settings->drive;
+    p2_put32(buffer+1432,settings->alex);
+    buffer[1443]=settings->attenuation;		// ADC0
+    p2_send(session,P2_PORT_HIGH_PRIORITY,buffer,sizeof(buffer));
+}
+
+
+// ********** receive **********
+
+// Receive whatever is queued on sock without blocking and hand it on. A
+// packet on the general socket is sorted by its source port.
+static void p2_drain(P2_SESSION* session, int sock, int ddc, int from_status) {
+    unsigned char buffer[P2_PACKET_BYTES];
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct sockaddr_in from;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    struct timespec stamp;
+    int bytes;
+    int port;
+    int stream;
+    int status;
+
+    for(;;) {
+        iov.iov_base=buffer;
+        iov.iov_len=sizeof(buffer);
+        memset(&msg,0,sizeof(msg));
+        msg.msg_name=&from;
+        msg.msg_namelen=sizeof(from);
+        msg.msg_iov=&iov;
+        msg.msg_iovlen=1;
+        msg.msg_control=control;
+        msg.msg_controllen=sizeof(control);
+
+        bytes=recvmsg(sock,&msg,MSG_DONTWAIT);
+        if(bytes < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNREFUSED)
+                perror("recvmsg failed for p2_receive_thread");
+            return;
+        }
+
+        stamp.tv_sec=0;
+        stamp.tv_nsec=0;
+        for(cmsg=CMSG_FIRSTHDR(&msg);cmsg!=NULL;cmsg=CMSG_NXTHDR(&msg,cmsg))
+            if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+                memcpy(&stamp,CMSG_DATA(cmsg),sizeof(stamp));
+
+        stream=ddc;
+        status=from_status;
+        if(ddc < 0 && !from_status) {		// general socket
+            port=ntohs(from.sin_port);
+            if(from.sin_addr.s_addr != session->radio.sin_addr.s_addr || port == P2_PORT_GENERAL) {
+                if(port != P2_PORT_GENERAL)
+                    session->strays++;		// late discovery replies are not counted
+                continue;
+            }
+            if(port >= P2_PORT_DDC_IQ && port < P2_PORT_DDC_IQ+P2_MAX_DDC)
+                stream=port-P2_PORT_DDC_IQ;
+            else if(port == P2_PORT_STATUS)
+                status=1;
+            else {
+                session->strays++;
+                continue;
+            }
+        }
+
+        if(status) {
+            session->status_packets++;
+            session->status(session->arg,buffer,bytes);
+        } else if(bytes >= P2_IQ_HEADER) {
+            session->packets++;
+            session->iq(session->arg,stream,buffer,bytes,&stamp);
+        } else
+            session->strays++;
+    }
+}
+
+static void* p2_receive_thread(void* arg) {
+    P2_SESSION* session=(P2_SESSION*)arg;
+    struct pollfd pfd[P2_MAX_DDC+2];
+    int ddc[P2_MAX_DDC+2];
+    int nfds=0;
+    int i;
+
+    for(i=0;i<P2_MAX_DDC;i++)
+        if(session->ddc_socket[i] >= 0) {
+            pfd[nfds].fd=session->ddc_socket[i];
+            ddc[nfds++]=i;
+        }
+    if(session->status_socket >= 0) {
+        pfd[nfds].fd=session->status_socket;
+        ddc[nfds++]=P2_MAX_DDC;			// marks the status socket
+    }
+    pfd[nfds].fd=session->general_socket;
+    ddc[nfds++]=-1;
+    for(i=0;i<nfds;i++)
+        pfd[i].events=POLLIN;
+
+    while(!__atomic_load_n(&session->stop, __ATOMIC_ACQUIRE)) {
+        if(poll(pfd,nfds,P2_WAIT_MSEC) < 0) {
+            if(errno == EINTR)
+                continue;
+            perror("poll failed for p2_receive_thread");
+            exit(1);
+        }
+        for(i=0;i<nfds;i++)
+            if(pfd[i].revents & (POLLIN | POLLERR)) {
+                if(ddc[i] == P2_MAX_DDC)
+                    p2_drain(session,pfd[i].fd,-1,1);
+                else
+                    p2_drain(session,pfd[i].fd,ddc[i],0);
+            }
+    }
+
+    return NULL;
+}
+
+void p2_configure(P2_SESSION* session, const P2_SETTINGS* settings) {
+    int rc;
+    int i;
+
+    if(!session->receiving) {
+        for(i=0;i<P2_MAX_DDC;i++)
+            session->ddc_socket[i]=p2_stream_socket(session,P2_PORT_DDC_IQ+i);
+        session->status_socket=p2_stream_socket(session,P2_PORT_STATUS);
+
+        rc=pthread_create(&session->receive_thread_id,NULL,p2_receive_thread,session);
+        if(rc != 0) {
+            fprintf(stderr,"pthread_create failed on p2_receive_thread: rc=%d\n", rc);
+            exit(1);
+        }
+        session->receiving=1;
+        metis_thread_setup(session->receive_thread_id,"Protocol 2 receive thread",
+            session->rx_sched,session->rx_priority,session->rx_cpus);
+    }
+
+    pthread_mutex_lock(&session->command_lock);
+    p2_send_general(session);
+    p2_send_ddc_specific(session,settings);
+    p2_send_duc_specific(session);
+    p2_send_high_priority(session,settings);
+    pthread_mutex_unlock(&session->command_lock);
+}
+
+void p2_update(P2_SESSION* session, const P2_SETTINGS* settings) {
+    pthread_mutex_lock(&session->command_lock);
+    if(settings->receivers != session->sent_receivers || settings->sample_rate != session->sent_rate)
+        p2_send_ddc_specific(session,settings);
+    p2_send_high_priority(session,settings);
+    pthread_mutex_unlock(&session->command_lock);
+}
+
+void p2_start(P2_SESSION* session, const P2_SETTINGS* settings) {
+    pthread_mutex_lock(&session->command_lock);
+    session->run=1;
+    pthread_mutex_unlock(&session->command_lock);
+    p2_update(session,settings);
+}
+
+void p2_stop(P2_SESSION* session, const P2_SETTINGS* settings) {
+    pthread_mutex_lock(&session->command_lock);
+    session->run=0;
+    pthread_mutex_unlock(&session->command_lock);
+    p2_update(session,settings);
+}
+
+void p2_send_duc(P2_SESSION* session, const unsigned char* iq) {
+    unsigned char sequence[4];
+    struct sockaddr_in to=session->radio;
+    struct msghdr msg;
+    struct iovec iov[2];
+
+    p2_put32(sequence,session->duc_sequence++);
+    iov[0].iov_base=sequence;
+    iov[0].iov_len=sizeof(sequence);
+    iov[1].iov_base=(void*)iq;
+    iov[1].iov_len=P2_DUC_SAMPLES*6;
+
+    to.sin_port=htons(P2_PORT_DUC_IQ);
+    memset(&msg,0,sizeof(msg));
+    msg.msg_name=&to;
+    msg.msg_namelen=sizeof(to);
+    msg.msg_iov=iov;
+    msg.msg_iovlen=2;
+    if(sendmsg(session->general_socket,&msg,0)<0)
+        perror("sendmsg failed for p2_send_duc");
+}
+
+void p2_receive_statistics(P2_SESSION* session, unsigned long* packets, unsigned long* status,
+                           unsigned long* strays) {
+    *packets=session->packets;
+    *status=session->status_packets;
+    *strays=session->strays;
+}
+
+void p2_close(P2_SESSION* session) {
+    int i;
+
+    if(session->receiving) {
+        __atomic_store_n(&session->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(session->receive_thread_id,NULL);
+    }
+
+    for(i=0;i<P2_MAX_DDC;i++)
+        if(session->ddc_socket[i] >= 0)
+            close(session->ddc_socket[i]);
+    if(session->status_socket >= 0)
+        close(session->status_socket);
+    close(session->general_socket);
+
+    if(strcmp(session->interface, "loopback") == 0)
+        p2_sim_stop();
+
+    pthread_mutex_destroy(&session->command_lock);
+    free(session);
+}
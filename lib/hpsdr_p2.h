@@ -0,0 +1,146 @@
+/* -*- c++ -*- */
+/* hpsdr_p2.h */
+
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// HPSDR Protocol 2 (openHPSDR Ethernet protocol, "new protocol") transport
+// and framing, the counterpart of metis.cc for Protocol 1.
+//
+// Protocol 1 carries everything through radio port 1024 in 1032 byte Metis
+// frames with the C&C registers riding in the Tx data. Protocol 2 gives each
+// stream a port of its own: the general packet (radio port 1024), receiver
+// and transmitter specific packets (1025, 1026) and the high priority packet
+// (1027) set the radio up, the DUC takes I/Q on 1029, each DDC streams from
+// 1035+n and the radio reports its status from 1025.
+//
+// A session has one local UDP port. Discovery and commands leave through a
+// general socket; each DDC stream and the status stream get a socket of
+// their own, bound to the same port with SO_REUSEPORT and connected to the
+// radio port they come from, so the kernel sorts the streams. Anything that
+// still reaches the general socket is sorted by source port.
+//
+// The interface name "loopback" talks to a Protocol 2 radio emulated inside
+// the process on 127.0.0.1 (hpsdr_p2_sim.cc).
+
+#ifndef HPSDR_P2_H
+#define HPSDR_P2_H
+
+#include <time.h>
+
+#define P2_PORT_GENERAL		1024	// discovery and general packet
+#define P2_PORT_DDC_SPECIFIC	1025	// receiver specific packet, to the radio
+#define P2_PORT_DUC_SPECIFIC	1026	// transmitter specific packet, to the radio
+#define P2_PORT_HIGH_PRIORITY	1027	// run, PTT, frequencies, drive, Alex
+#define P2_PORT_DUC_IQ		1029	// DUC0 I/Q, to the radio
+#define P2_PORT_STATUS		1025	// high priority status, from the radio
+#define P2_PORT_DDC_IQ		1035	// DDC0 I/Q from the radio, DDCn from 1035+n
+
+#define P2_MAX_DDC		2	// DDCs driven: DDC0, and DDC1 synchronised to it
+#define P2_PACKET_BYTES		1444	// DDC and DUC I/Q, specific and high priority packets
+#define P2_SHORT_BYTES		60	// discovery, general and status packets
+#define P2_IQ_HEADER		16	// DDC I/Q: sequence, timestamp, bits, samples
+#define P2_DDC_SAMPLES		238	// 24 bit I/Q pairs per DDC packet, one DDC
+#define P2_SYNC_SAMPLES		119	// per DDC when DDC1 is synchronised to DDC0
+#define P2_DUC_SAMPLES		240	// 24 bit I/Q pairs per DUC packet
+#define P2_DUC_RATE		192000	// DUC sample rate, fixed by the protocol
+
+// Alex0 register bits of the high priority packet.
+#define P2_ALEX_13MHZ_HPF	0x00000002
+#define P2_ALEX_20MHZ_HPF	0x00000004
+#define P2_ALEX_6M_PREAMP	0x00000008
+#define P2_ALEX_9_5MHZ_HPF	0x00000010
+#define P2_ALEX_6_5MHZ_HPF	0x00000020
+#define P2_ALEX_1_5MHZ_HPF	0x00000040
+#define P2_ALEX_RX_BYPASS	0x00000800	// Rx antenna from the Rx1/Rx2/XV inputs
+#define P2_ALEX_RX_XVTR		0x00000900
+#define P2_ALEX_RX_EXT1		0x00000A00
+#define P2_ALEX_RX_EXT2		0x00000C00
+#define P2_ALEX_BYPASS_HPF	0x00001000
+#define P2_ALEX_30_20_LPF	0x00100000
+#define P2_ALEX_60_40_LPF	0x00200000
+#define P2_ALEX_80_LPF		0x00400000
+#define P2_ALEX_160_LPF		0x00800000
+#define P2_ALEX_TX_ANT1		0x01000000
+#define P2_ALEX_TX_ANT2		0x02000000
+#define P2_ALEX_TX_ANT3		0x04000000
+#define P2_ALEX_6_BYPASS_LPF	0x20000000
+#define P2_ALEX_12_10_LPF	0x40000000
+#define P2_ALEX_17_15_LPF	0x80000000
+
+// What the radio is asked to do. p2_configure() and p2_update() send it.
+typedef struct _P2_SETTINGS {
+    int receivers;			// 1, or 2 with DDC1 synchronised to DDC0
+    int sample_rate;			// DDC rate, Hz
+    unsigned int rx_frequency[P2_MAX_DDC];	// DDC frequencies, Hz
+    unsigned int tx_frequency;		// DUC frequency, Hz
+    unsigned char drive;		// DUC drive level, 0..255
+    int ptt;				// transmit
+    int dither;				// ADC0 dither
+    int random;				// ADC0 randomiser
+    unsigned char attenuation;		// ADC0 step attenuator, dB
+    unsigned int alex;			// Alex0 register, P2_ALEX_* bits
+} P2_SETTINGS;
+
+// Called on the receive thread with each DDC I/Q packet (as received, header
+// included) and each status packet. stamp is the kernel arrival time, zero
+// when there is none.
+typedef void (*P2_IQ_HANDLER)(void* arg, int ddc, unsigned char* packet, int length, const struct timespec* stamp);
+typedef void (*P2_STATUS_HANDLER)(void* arg, unsigned char* packet, int length);
+
+typedef struct _P2_SESSION P2_SESSION;
+
+P2_SESSION* p2_open(const char* interface, const char* mac,
+                    P2_IQ_HANDLER iq, P2_STATUS_HANDLER status, void* arg);
+void p2_close(P2_SESSION* session);
+
+// Before p2_configure().
+void p2_socket_buffers(P2_SESSION* session, int rcvbuf, int sndbuf);
+void p2_receive_scheduling(P2_SESSION* session, int sched, int priority, const char* cpus);
+
+// Look for the radio, every second until timeout_ms (0 = for ever). Returns
+// 0 when one with the MAC address asked for (any, unless it is 17
+// characters) has answered.
+int p2_wait_found(P2_SESSION* session, int timeout_ms);
+char* p2_ip_address(P2_SESSION* session);
+char* p2_mac_address(P2_SESSION* session);
+
+// Open the stream sockets, start the receive thread and send the general,
+// receiver specific, transmitter specific and high priority packets. The
+// radio is left stopped.
+void p2_configure(P2_SESSION* session, const P2_SETTINGS* settings);
+
+// Send the high priority packet, and the receiver specific packet first if
+// the DDC rate or count has changed. Any thread.
+void p2_update(P2_SESSION* session, const P2_SETTINGS* settings);
+
+// Set or clear the run bit, which starts and stops every stream.
+void p2_start(P2_SESSION* session, const P2_SETTINGS* settings);
+void p2_stop(P2_SESSION* session, const P2_SETTINGS* settings);
+
+// Send one DUC packet of P2_DUC_SAMPLES 24 bit big endian I/Q pairs.
+void p2_send_duc(P2_SESSION* session, const unsigned char* iq);
+
+// DDC packets and status packets received, and packets from elsewhere.
+void p2_receive_statistics(P2_SESSION* session, unsigned long* packets, unsigned long* status,
+                           unsigned long* strays);
+
+// The emulated radio behind "loopback" (hpsdr_p2_sim.cc).
+void p2_sim_start();
+void p2_sim_stop();
+
+// DDC samples the emulated radio has streamed since it was last set
+// running, and the DUC packets it has taken and found missing.
+void p2_sim_statistics(unsigned long long* ddc_samples, unsigned long* duc_packets,
+                       unsigned long* duc_lost);
+
+#endif  // HPSDR_P2_H
@@ -0,0 +1,367 @@
+/* -*-  C++  -*-  */
+/* hpsdr_p2_sim.cc */
+
+/*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*
+*/
+
+// Emulated Protocol 2 radio (see hpsdr_p2.h).
+//
+// A thread of its own with real UDP sockets on the radio's ports of
+// 127.0.0.1, so the Protocol 2 engine runs exactly as it would against a
+// board. It answers discovery, takes the DDC rate, count and
+// synchronisation from the receiver specific packet and the run bit from
+// the high priority packet, and while running streams DDC packets carrying
+// a tone at 1/64 of the sample rate (DDC1 at 1/32) at the pace of the DDC
+// rate, plus a status packet every 50 msec. DUC packets are counted and
+// their sequence numbers checked.
+//
+// There is one emulated radio per process, MAC 02:00:00:00:00:02, started
+// by the first session on "loopback" and stopped with the last.
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include "hpsdr_p2.h"
+
+#define SIM_TONE_SIZE		64		// tone period, samples
+#define SIM_STATUS_MSEC		50		// between status packets
+#define SIM_WAIT_MSEC		10		// longest a poll waits
+#define SIM_MAX_CATCHUP		64		// DDC packets sent at most per wakeup
+
+enum { SIM_GENERAL, SIM_DDC_SPECIFIC, SIM_DUC_SPECIFIC, SIM_HIGH_PRIORITY, SIM_DUC_IQ,
+       SIM_DDC0, SIM_DDC1, SIM_SOCKETS };
+
+static const int sim_ports[SIM_SOCKETS] = {
+    P2_PORT_GENERAL, P2_PORT_DDC_SPECIFIC, P2_PORT_DUC_SPECIFIC, P2_PORT_HIGH_PRIORITY,
+    P2_PORT_DUC_IQ, P2_PORT_DDC_IQ, P2_PORT_DDC_IQ+1 };
+
+typedef struct _P2_SIM {
+    int socket[SIM_SOCKETS];		// 1025 also sends the status packets
+    struct sockaddr_in host;		// where the general packet came from
+    int have_host;
+
+    int run;
+    int ptt;
+    int enables;			// DDC enable bits
+    int sync;				// DDC1 rides in DDC0's packets
+    int rate;				// DDC rate, Hz
+
+    struct timespec deadline;		// CLOCK_MONOTONIC time of the next DDC packet
+    struct timespec next_status;
+    unsigned int ddc_sequence[2];
+    unsigned int status_sequence;
+    unsigned long long sample;		// DDC timestamp, samples since run
+    unsigned int phase;
+
+    unsigned long duc_packets;
+    unsigned long duc_lost;
+    unsigned int duc_expected;
+
+    int tone_i[SIM_TONE_SIZE];
+    int tone_q[SIM_TONE_SIZE];
+} P2_SIM;
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;	// guards the three below
+static int sim_users = 0;
+static int sim_stop = 0;
+static pthread_t sim_thread_id;
+static P2_SIM sim;
+
+
+static void p2_sim_put32(unsigned char* p, unsigned int value) {
+    p[0] = (value >> 24) & 0xFF;
+    p[1] = (value >> 16) & 0xFF;
+    p[2] = (value >> 8) & 0xFF;
+    p[3] = value & 0xFF;
+}
+
+static void p2_sim_add(struct timespec* t, long nsec) {
+    t->tv_nsec += nsec;
+    t->tv_sec += t->tv_nsec / 1000000000L;
+    t->tv_nsec %= 1000000000L;
+}
+
+static long p2_sim_until(struct timespec* t) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (t->tv_sec - now.tv_sec) * 1000000000L + (t->tv_nsec - now.tv_nsec);
+}
+
+static void p2_sim_send(int s, unsigned char* buffer, int length) {
+    if(!sim.have_host)
+        return;
+    sendto(sim.socket[s], buffer, length, 0, (struct sockaddr*)&sim.host, sizeof(sim.host));
+}
+
+static void p2_sim_put_sample(unsigned char* p, int i, int q) {
+    p[0] = (i >> 16) & 0xFF;
+    p[1] = (i >> 8) & 0xFF;
+    p[2] = i & 0xFF;
+    p[3] = (q >> 16) & 0xFF;
+    p[4] = (q >> 8) & 0xFF;
+    p[5] = q & 0xFF;
+}
+
+// One DDC packet: DDC0 alone, DDC0 and DDC1 interleaved, or DDC1 alone.
+static void p2_sim_ddc_packet(int ddc, int both, int samples) {
+    unsigned char packet[P2_PACKET_BYTES];
+    unsigned char* p = packet + P2_IQ_HEADER;
+    unsigned int phase = sim.phase;
+    int s;
+
+    memset(packet, 0, sizeof(packet));
+    p2_sim_put32(packet, sim.ddc_sequence[ddc]++);
+    p2_sim_put32(packet+4, (unsigned int)(sim.sample >> 32));
+    p2_sim_put32(packet+8, (unsigned int)sim.sample);
+    packet[12] = 0;
+    packet[13] = 24;			// bits per sample
+    packet[14] = (samples >> 8) & 0xFF;
+    packet[15] = samples & 0xFF;
+
+    for(s=0;s<samples;s++, phase++) {
+        if(ddc == 0) {
+            p2_sim_put_sample(p, sim.tone_i[phase % SIM_TONE_SIZE], sim.tone_q[phase % SIM_TONE_SIZE]);
+            p += 6;
+        }
+        if(ddc == 1 || both) {
+            p2_sim_put_sample(p, sim.tone_i[(2*phase) % SIM_TONE_SIZE], sim.tone_q[(2*phase) % SIM_TONE_SIZE]);
+            p += 6;
+        }
+    }
+
+    p2_sim_send(ddc == 0 ? SIM_DDC0 : SIM_DDC1, packet, sizeof(packet));
+}
+
+static void p2_sim_status_packet() {
+    unsigned char packet[P2_SHORT_BYTES];
+
+    memset(packet, 0, sizeof(packet));
+    p2_sim_put32(packet, sim.status_sequence++);
+    packet[4] = sim.ptt ? 0x01 : 0x00;
+    packet[49] = 0x0C;			// supply volts, about 13.8 V on a Hermes
+    packet[50] = 0x80;
+    p2_sim_send(SIM_DDC_SPECIFIC, packet, sizeof(packet));
+}
+
+// The DDC packets due by now, at most SIM_MAX_CATCHUP of them.
+static void p2_sim_stream() {
+    int samples = sim.sync ? P2_SYNC_SAMPLES : P2_DDC_SAMPLES;
+    long tick = (long)samples * 1000000000L / (sim.rate > 0 ? sim.rate : 48000);
+    int sent = 0;
+
+    while(p2_sim_until(&sim.deadline) <= 0 && sent++ < SIM_MAX_CATCHUP) {
+        if(sim.enables & 1)
+            p2_sim_ddc_packet(0, sim.sync && (sim.enables & 2), samples);
+        if((sim.enables & 2) && !sim.sync)
+            p2_sim_ddc_packet(1, 0, samples);
+        sim.sample += samples;
+        sim.phase += samples;
+        p2_sim_add(&sim.deadline, tick);
+    }
+    if(p2_sim_until(&sim.deadline) < -100000000L)	// stalled: drop the backlog, the radio would have too
+        clock_gettime(CLOCK_MONOTONIC, &sim.deadline);
+
+    if(p2_sim_until(&sim.next_status) <= 0) {
+        p2_sim_status_packet();
+        p2_sim_add(&sim.next_status, SIM_STATUS_MSEC * 1000000L);
+    }
+}
+
+static void p2_sim_packet(int s, unsigned char* packet, int length, struct sockaddr_in* from) {
+    unsigned char reply[P2_SHORT_BYTES];
+    unsigned int sequence;
+    int run;
+
+    switch(s) {
+        case SIM_GENERAL:
+            if(length >= 5 && packet[4] == 0x02) {		// discovery
+                memset(reply, 0, sizeof(reply));
+                reply[4] = sim.run ? 0x03 : 0x02;
+                reply[5] = 0x02;			// locally administered MAC 02:00:00:00:00:02
+                reply[10] = 0x02;
+                reply[11] = 0x01;			// Hermes
+                reply[12] = 38;				// protocol version 3.8
+                reply[13] = 103;			// firmware 10.3
+                reply[20] = 2;				// DDCs
+                sendto(sim.socket[SIM_GENERAL], reply, sizeof(reply), 0, (struct sockaddr*)from, sizeof(*from));
+            } else if(length >= 5 && packet[4] == 0x00) {	// general packet
+                sim.host = *from;
+                sim.have_host = 1;
+            }
+            break;
+
+        case SIM_DDC_SPECIFIC:
+            if(length < 1364)
+                break;
+            sim.enables = packet[7];
+            sim.rate = ((packet[18] << 8) | packet[19]) * 1000;
+            sim.sync = (packet[1363] & 0x02) != 0;
+            break;
+
+        case SIM_HIGH_PRIORITY:
+            if(length < 1444)
+                break;
+            run = packet[4] & 0x01;
+            sim.ptt = (packet[4] & 0x02) != 0;
+            if(run && !sim.run) {
+                sim.ddc_sequence[0] = sim.ddc_sequence[1] = 0;
+                sim.sample = 0;
+                sim.duc_expected = 0;
+                clock_gettime(CLOCK_MONOTONIC, &sim.deadline);
+                sim.next_status = sim.deadline;
+            }
+            sim.run = run;
+            break;
+
+        case SIM_DUC_IQ:
+            if(length < 4 + P2_DUC_SAMPLES*6)
+                break;
+            sequence = (packet[0] << 24) | (packet[1] << 16) | (packet[2] << 8) | packet[3];
+            if(sim.duc_packets > 0 && sequence != sim.duc_expected)
+                sim.duc_lost += sequence - sim.duc_expected;
+            sim.duc_expected = sequence + 1;
+            sim.duc_packets++;
+            break;
+    }
+}
+
+static void* p2_sim_thread(void*) {
+    struct pollfd pfd[SIM_SOCKETS];
+    unsigned char packet[P2_PACKET_BYTES];
+    struct sockaddr_in from;
+    socklen_t length;
+    long wait_ms;
+    int bytes;
+    int s;
+
+    for(s=0;s<SIM_SOCKETS;s++) {
+        pfd[s].fd = sim.socket[s];
+        pfd[s].events = POLLIN;
+    }
+
+    while(!__atomic_load_n(&sim_stop, __ATOMIC_ACQUIRE)) {
+        wait_ms = SIM_WAIT_MSEC;
+        if(sim.run) {
+            wait_ms = (p2_sim_until(&sim.deadline) + 999999L) / 1000000L;	// no spinning
+            if(wait_ms < 0)
+                wait_ms = 0;
+            if(wait_ms > SIM_WAIT_MSEC)
+                wait_ms = SIM_WAIT_MSEC;
+        }
+
+        if(poll(pfd, SIM_SOCKETS, (int)wait_ms) > 0)
+            for(s=0;s<SIM_SOCKETS;s++)
+                while(pfd[s].revents & POLLIN) {
+                    length = sizeof(from);
+                    bytes = recvfrom(sim.socket[s], packet, sizeof(packet), MSG_DONTWAIT,
+                                     (struct sockaddr*)&from, &length);
+                    if(bytes < 0)
+                        break;
+                    p2_sim_packet(s, packet, bytes, &from);
+                }
+
+        if(sim.run)
+            p2_sim_stream();
+    }
+
+    return NULL;
+}
+
+void p2_sim_start() {
+    struct sockaddr_in name;
+    int rc;
+    int s;
+    int i;
+
+    pthread_mutex_lock(&sim_lock);
+    if(sim_users++ > 0) {
+        pthread_mutex_unlock(&sim_lock);
+        return;
+    }
+
+    memset(&sim, 0, sizeof(sim));
+    sim.rate = 48000;
+    sim.enables = 1;
+    for(i=0;i<SIM_TONE_SIZE;i++) {
+        sim.tone_i[i] = (int)(0x100000 * cos(2 * M_PI * i / SIM_TONE_SIZE));	// -18 dBFS
+        sim.tone_q[i] = (int)(0x100000 * sin(2 * M_PI * i / SIM_TONE_SIZE));
+    }
+
+    for(s=0;s<SIM_SOCKETS;s++) {
+        sim.socket[s] = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if(sim.socket[s] < 0) {
+            perror("create socket failed for p2_sim");
+            exit(1);
+        }
+        memset(&name, 0, sizeof(name));
+        name.sin_family = AF_INET;
+        name.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        name.sin_port = htons(sim_ports[s]);
+        if(bind(sim.socket[s], (struct sockaddr*)&name, sizeof(name)) < 0) {
+            fprintf(stderr,"Protocol 2 emulator: cannot bind 127.0.0.1:%d: %s\n", sim_ports[s], strerror(errno));
+            exit(1);
+        }
+    }
+
+    __atomic_store_n(&sim_stop, 0, __ATOMIC_RELEASE);
+    rc = pthread_create(&sim_thread_id, NULL, p2_sim_thread, NULL);
+    if(rc != 0) {
+        fprintf(stderr,"pthread_create failed on p2_sim_thread: rc=%d\n", rc);
+        exit(1);
+    }
+    fprintf(stderr,"Protocol 2 emulator: radio 02:00:00:00:00:02 on 127.0.0.1\n");
+    pthread_mutex_unlock(&sim_lock);
+}
+
+void p2_sim_stop() {
+    int s;
+
+    pthread_mutex_lock(&sim_lock);
+    if(--sim_users > 0) {
+        pthread_mutex_unlock(&sim_lock);
+        return;
+    }
+
+    __atomic_store_n(&sim_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(sim_thread_id, NULL);
+    for(s=0;s<SIM_SOCKETS;s++)
+        close(sim.socket[s]);
+    fprintf(stderr,"Protocol 2 emulator: %lu DUC packets received, %lu lost\n", sim.duc_packets, sim.duc_lost);
+    pthread_mutex_unlock(&sim_lock);
+}
+
+void p2_sim_statistics(unsigned long long* ddc_samples, unsigned long* duc_packets,
+                       unsigned long* duc_lost) {
+    *ddc_samples = __atomic_load_n(&sim.sample, __ATOMIC_RELAXED);
+    *duc_packets = __atomic_load_n(&sim.duc_packets, __ATOMIC_RELAXED);
+    *duc_lost = __atomic_load_n(&sim.duc_lost, __ATOMIC_RELAXED);
+}
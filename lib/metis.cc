@@ -43,6 +43,113 @@
 // Hermes hardware and send to HermesProxyW. Test that appropriate proxies
 // exist (pointer is not NULL).
 //
+// Version 0.3 - Batched receive. When the receive batch size is greater
+// than one the receive thread pulls several datagrams per recvmmsg()
+// call into a preallocated set of packet slots and dispatches them in
+// order. Counts receive syscalls and packets for the exit statistics.
+//
+// Version 0.4 - Gather transmit. metis_write() and its static output_buffer
+// are replaced by metis_send_frame(), which hands the Metis header and the
+// two USB frames to sendmsg() as an iovec, and metis_send_frames(), which
+// sends several such frames with one sendmmsg().
+//
+// Version 0.5 - Optional AF_PACKET receive backend. A TPACKET_V3 mmap ring
+// on the interface, filtered in the kernel to UDP from the Metis address and
+// port 1024, is walked in place and each payload is handed to the proxies
+// without a copy. Discovery and Tx stay on the UDP socket; the Tx frames
+// released while a ring block is dispatched are sent after it. Selected
+// with the RxBackend parameter of the proxies.
+//
+// Version 0.6 - Optional io_uring I/O engine (built when liburing is found).
+// One thread keeps receive buffers posted through a provided buffer ring
+// with a multishot recvmsg, dispatches the completions, and submits the Tx
+// frames released while doing so as linked sendmsg SQEs.
+//
+// Version 0.7 - Configurable socket buffers (SO_RCVBUFFORCE when permitted)
+// and kernel drop accounting. SO_RXQ_OVFL makes every received packet carry
+// the socket's drop counter in a cmsg; the AF_PACKET ring reports tp_drops.
+//
+// Version 0.8 - Kernel receive timestamps. SO_TIMESTAMPNS stamps every
+// datagram on arrival (the AF_PACKET ring carries tp_sec/tp_nsec) and the
+// stamp is handed to the proxies with the EP6/EP4 frame.
+//
+// Version 0.9 - Separate data socket. Discovery keeps the broadcast socket
+// on port 1024 and its own small receive thread. Stream control, Tx and all
+// Rx data use a data socket connect()ed to the discovered Metis, so the
+// kernel filters foreign traffic and skips the route lookup on every send.
+// The Metis address is taken from the discovery reply, no resolver call.
+//
+// Version 0.10 - Opt-in busy poll. SO_BUSY_POLL/SO_PREFER_BUSY_POLL on the
+// data socket, and the UDP receive loops spin on MSG_DONTWAIT for up to the
+// budget before they block. Every data frame's kernel-stamp-to-dispatch
+// latency goes into a log2 histogram.
+//
+//
+// Version 0.11 - Pluggable transports (metis_transport.h). This file keeps
+// the protocol: discovery replies, stream control, Tx frame headers and
+// dispatch of data frames to the proxies. The UDP socket, AF_PACKET ring
+// and io_uring code moved to metis_udp.cc; metis_sim.cc adds a file replay
+// and an in-process loopback radio. One generic receive thread serves every
+// transport and flushes batched Tx after each group of frames. Discovery is
+// repeated until a Metis is selected, and the threads are stopped by a flag
+// rather than cancelled.
+//
+// Version 0.12 - Event driven discovery. Each new discovery reply signals a
+// condition variable, and metis_wait_found() sleeps on it with a timeout
+// instead of the proxies spinning on metis_found(). The request is sent
+// again every DISCOVER_RETRY msec while waiting.
+//
+// Version 0.13 - Discovery on every IPv4 interface at once (interface "*"),
+// and a cache of where each MAC address was last found. A radio asked for
+// by MAC is first probed by unicast at its cached address; the broadcast
+// only goes out when that gets no answer.
+//
+// Version 0.14 - Sessions. The cards table, discovery, transport link,
+// receive thread, Tx sequence number and dispatch targets that were file
+// statics are now kept per METIS_SESSION, and the transports keep their
+// sockets and slots per METIS_LINK. Proxies on the same interface and MAC
+// address share a session, so several radios can stream from one process.
+//
+// Version 0.15 - Receive reactor. Optionally a small pool of threads
+// (metis_reactor.cc) waits with epoll on the data descriptors of all the
+// sessions and drains each ready one without blocking, instead of one
+// receive thread per session.
+//
+// Version 0.16 - Real-time receive. The receive thread, or the reactor
+// threads, can run under SCHED_FIFO/SCHED_RR and the own receive thread can
+// be pinned to chosen cores; metis_lock_memory() mlockall()s the process.
+// What was applied, and any permission failure, is reported at start.
+//
+// Version 0.17 - Reorder window. EP6 and EP4 frames each pass through a
+// small sequence number window (metis_reorder.cc) that holds early frames
+// and puts late ones back in place before they reach the proxies, so
+// reordering on the network is no longer taken for loss.
+//
+// Version 0.18 - Receive pipeline. Optionally the receive thread (or
+// reactor) only copies each data frame into a lock-free SPSC ring of raw
+// frames (metis_raw_ring.cc), and an unpack thread of the session's own
+// takes them from there to the reorder window and the proxies, so a slow
+// decode no longer holds up draining the socket.
+//
+// Version 0.19 - Capture. Optionally every data frame received and every
+// EP2 frame sent is recorded, as on the wire and with its time, to a
+// capture file with a sidecar index (metis_capture.cc). The frames are
+// taken before the pipeline and the reorder window.
+//
+// Version 0.20 - Replay pacing. The file replay also reads capture files
+// and can hand their frames out in file order, at the pace they were
+// captured or as fast as the proxies take them, with the captured times
+// and sequence numbers. Played out, it reports the session finished. The
+// fast replay holds the receive thread back while the proxies are full
+// instead of letting them drop frames.
+//
+// Version 0.21 - Buffer arenas. metis_arena_alloc() gives the proxies one
+// mapping, optionally on huge pages, to carve their rings out of.
+//
+// Version 0.22 - Unpack kernels. metis_unpack.cc converts the 24 bit
+// samples of a whole USB frame or Protocol 2 packet per call, with SSE4.1,
+// AVX2 or AVX-512 byte shuffles when the CPU has them.
+//
 
 
 #include <stdlib.h>
@@ -50,254 +157,707 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
-#include <sys/ioctl.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <netdb.h>
-#include <net/if_arp.h>
-#include <net/if.h>
-#include <ifaddrs.h>
 #include <pthread.h>
-
+#include <unistd.h>
+#include <time.h>
 
 #include <string.h>
 #include <errno.h>
 
 #include "metis.h"
+#include "metis_transport.h"
+#include "metis_reactor.h"
+#include "metis_reorder.h"
+#include "metis_raw_ring.h"
+#include "metis_capture.h"
 #include "HermesProxy.h"
 #include "HermesProxyW.h"
 
 #define MAX_METIS_CARDS 10
-METIS_CARD metis_cards[MAX_METIS_CARDS];
 
-#define DISCOVER_IDLE 0
-#define DISCOVER_SENT 1
-static int discover_state=DISCOVER_IDLE;
+#define DISCOVER_RETRY 1000		// msec between discovery broadcasts
+#define DISCOVER_PROBE 250		// msec to wait for the radio at its cached address
+#define METIS_CACHE_ENTRIES 32		// most radios remembered
+#define METIS_REPLAY_BATCH 8		// frames per receive in the fast replay
+#define METIS_REPLAY_POLL 100		// usec between looks at the proxies while they are full
+
+// Everything one radio needs. Proxies opening the same interface and MAC
+// address share a session (hermesNB and hermesWB on one Hermes), anything
+// else gets its own transport link, threads and sequence numbers.
+struct _METIS_SESSION {
+    METIS_SESSION* next;		// in the sessions list
+    char interface[256];
+    int users;				// proxies attached
+
+    pthread_mutex_t dispatch_lock;	// held while frames are handed to the proxies
+    HermesProxy* nb;			// EP6 goes here, NULL when none
+    HermesProxyW* wb;			// EP4 goes here, NULL when none
+
+    METIS_TRANSPORT* transport;		// chosen by metis_discover()
+    METIS_LINK link;			// its configuration, counters and state
+    int running;			// metis_discover() has started the threads
+
+    pthread_mutex_t discover_lock;	// guards cards[] and found
+    pthread_cond_t discover_cond;	// a new card was found
+    METIS_CARD cards[MAX_METIS_CARDS];
+    int found;
+
+    pthread_t discovery_thread_id;
+    pthread_t receive_thread_id;
+    int receiving;			// receive_thread_id is running
+    METIS_REACTOR_SOURCE* reactor;	// on a shared reactor thread instead, NULL when not
+    char reactor_cpus[64];		// cores for the reactor threads
+    int rx_sched;			// RxSched_* for whichever thread receives
+    int rx_priority;
+    char rx_cpus[64];			// cores for the own receive thread, "" for any
+    int discovering;
+    char discover_target[18];		// MAC address asked for, empty for any
+    int rx_stop;			// tells the discovery and receive threads to return
+
+    int data_entry;			// cards[] entry the transport is connected to
+    long send_sequence;
+
+    int reorder_window;			// frames, 0 = hand on in arrival order
+    METIS_REORDER rx_reorder[2];	// EP6 and EP4, used with the dispatch lock held
+
+    int pipeline;			// data frames go through raw and the unpack thread
+    char unpack_cpus[64];		// cores for the unpack thread, "" for any
+    METIS_RAW_RING raw;			// receive thread -> unpack thread
+    unsigned long pipeline_drops[2];	// EP6 and EP4 frames raw had no room for, or not 1032 bytes long
+    pthread_t unpack_thread_id;
+    int unpacking;			// unpack_thread_id is running
+
+    char capture_path[256];		// record frames to this file, "" for none
+    METIS_CAPTURE* capture;		// open while running, NULL when not capturing
+
+    int rx_throttle;			// receive only while the proxies have room (fast replay)
+    int replay_stamps;			// frame stamps are capture times, not arrival times
+    int rx_finished;			// the transport has no more frames and all are dispatched
+
+    int rx_batching;			// Tx frames are flushed after each group of received frames
+    unsigned long rx_latency[METIS_LATENCY_BUCKETS];	// log2 usec, kernel stamp to dispatch
+};
 
-#define PORT 1024
-#define DISCOVERY_SEND_PORT PORT
-#define DISCOVERY_RECEIVE_PORT PORT
-#define DATA_PORT PORT
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+static METIS_SESSION* sessions = NULL;
 
-static int discovery_socket;
-static struct sockaddr_in discovery_addr;
-static int discovery_length;
+static unsigned int cache_writes = 0;	// makes the cache temporary file names unique
 
-static int discovering;
 
-static unsigned char hw_address[6];
-static long ip_address;
+// A full "HH:HH:HH:HH:HH:HH" asks for that radio, anything else for any.
+static const char* metis_target(const char* mac) {
+    return (mac != NULL && strlen(mac) == 17) ? mac : "";
+}
 
-//static int data_socket;	// never used
-static struct sockaddr_in data_addr;
-static int data_addr_length;
+// Attach a proxy to the session for interface and mac, making one if there
+// is none yet. nb and/or wb are where the received frames go.
+METIS_SESSION* metis_open(const char* interface, const char* mac, HermesProxy* nb, HermesProxyW* wb) {
+    METIS_SESSION* session;
+
+    pthread_mutex_lock(&sessions_lock);
+    for(session=sessions;session!=NULL;session=session->next)
+        if(strcmp(session->interface,interface) == 0 && strcmp(session->discover_target,metis_target(mac)) == 0)
+            break;
+
+    if(session == NULL) {
+        session=new METIS_SESSION;
+        memset(session,0,sizeof(*session));
+        strncpy(session->interface,interface,sizeof(session->interface)-1);
+        strncpy(session->discover_target,metis_target(mac),sizeof(session->discover_target)-1);
+        pthread_mutex_init(&session->dispatch_lock,NULL);
+        pthread_mutex_init(&session->discover_lock,NULL);
+        pthread_cond_init(&session->discover_cond,NULL);
+        session->link.config.rx_batch=1;
+        session->link.config.rx_backend=RxBackend_UDP;
+        session->data_entry=-1;
+        session->send_sequence=-1;
+        session->next=sessions;
+        sessions=session;
+    }
+    session->users++;
+    pthread_mutex_unlock(&sessions_lock);
 
-static long send_sequence = -1;
-static unsigned char buffer[70];
+    pthread_mutex_lock(&session->dispatch_lock);
+    if(nb != NULL)
+        session->nb=nb;
+    if(wb != NULL)
+        session->wb=wb;
+    pthread_mutex_unlock(&session->dispatch_lock);
 
-static pthread_t receive_thread_id;
-static int found=0;
+    return session;
+}
 
-int ep;
-long sequence=-1;
+// The receive settings below only take effect before the session starts.
+// A second proxy on the same radio finds it running: its settings are
+// ignored, and it is told so when they differ from those of the first.
+static int metis_settings_fixed(METIS_SESSION* session, const char* setting, int differs) {
+    if(!session->running)
+        return 0;
+    if(differs)
+        fprintf(stderr,"Metis: %s is set by the first block on this radio, ignoring this block's\n", setting);
+    return 1;
+}
 
+// Select how many datagrams the receive thread asks for in one syscall.
+// A batch of 1 keeps the original one recvfrom() per packet behaviour.
+// The receive waits for the first datagram; with a timeout of zero it then
+// returns with whatever else is ready, otherwise it waits up to timeout_us
+// more for the batch to fill.
+// Must be called before metis_discover() starts the receive thread; on a
+// session that is already running (a second proxy on the same radio) the
+// settings of the first proxy stay.
+void metis_receive_batch(METIS_SESSION* session, int batch, int timeout_us) {
+    if(batch < 1)
+        batch = 1;
+    if(batch > METIS_MAX_RX_BATCH)
+        batch = METIS_MAX_RX_BATCH;
+    if(timeout_us < 0)
+        timeout_us = 0;
+
+    if(metis_settings_fixed(session, "receive batch",
+        batch != session->link.config.rx_batch || timeout_us != session->link.config.rx_batch_timeout))
+        return;
+
+    session->link.config.rx_batch = batch;
+    session->link.config.rx_batch_timeout = timeout_us;
+}
 
-extern HermesProxy* Hermes;
-extern HermesProxyW* HermesW;
+static void* metis_discovery_thread(void* arg);
 
+// Socket buffer sizes in bytes for the Metis socket, 0 keeps the kernel default.
+// Must be called before metis_discover().
+void metis_socket_buffers(METIS_SESSION* session, int rcvbuf, int sndbuf) {
+    if(metis_settings_fixed(session, "socket buffers",
+        rcvbuf != session->link.config.rx_sockbuf || sndbuf != session->link.config.tx_sockbuf))
+        return;
 
-#define inaddrr(x) (*(struct in_addr *) &ifr->x[sizeof sa.sin_port])
+    session->link.config.rx_sockbuf = rcvbuf;
+    session->link.config.tx_sockbuf = sndbuf;
+}
 
-static int get_addr(int sock, const char * ifname) {
+// Spin for up to usec microseconds on a non-blocking receive before falling
+// back to a blocking one, and ask the kernel to busy poll the NIC queue for
+// the same time. 0 turns it off. Must be called before metis_discover().
+void metis_busy_poll(METIS_SESSION* session, int usec) {
+    if(usec < 0)
+        usec = 0;
+    if(metis_settings_fixed(session, "busy poll", usec != session->link.config.rx_busy_poll))
+        return;
+    session->link.config.rx_busy_poll = usec;
+}
 
-  struct ifreq *ifr;
-  struct ifreq ifrr;
-  struct sockaddr_in sa;
+void metis_receive_latency(METIS_SESSION* session, unsigned long* histogram, unsigned long* spin_hits) {
+    memcpy(histogram, session->rx_latency, sizeof(session->rx_latency));
+    *spin_hits = session->link.stats.spin_hits;
+}
 
-  unsigned char      *u;
-  int i;
+// Let a shared pool of receive threads, pinned to the cores listed in cpus,
+// serve this session instead of a thread of its own. threads is the pool
+// size, 0 keeps the own thread. The first session to start the pool sets its size and cores.
+// Transports that cannot be polled keep their own thread regardless.
+// Must be called before metis_discover().
+void metis_receive_reactor(METIS_SESSION* session, int threads, const char* cpus) {
+    if(cpus == NULL)
+        cpus = "";
+    if(threads < 0)
+        threads = 0;
+    if(threads > METIS_MAX_REACTOR_THREADS)
+        threads = METIS_MAX_REACTOR_THREADS;
+    if(metis_settings_fixed(session, "receive reactor", threads != session->link.config.rx_reactor ||
+        strncmp(cpus, session->reactor_cpus, sizeof(session->reactor_cpus)-1) != 0))
+        return;
+    session->link.config.rx_reactor = threads;
+    strncpy(session->reactor_cpus, cpus, sizeof(session->reactor_cpus)-1);
+}
 
+// Run the receive thread (or the reactor threads, when this session starts
+// them) under sched at priority, and pin the own receive thread to the cores
+// listed in cpus ("" leaves it unpinned; the reactor uses its own list).
+// What was applied, or why not, is printed when the thread starts.
+// Must be called before metis_discover().
+void metis_receive_scheduling(METIS_SESSION* session, int sched, int priority, const char* cpus) {
+    if(cpus == NULL)
+        cpus = "";
+    if(metis_settings_fixed(session, "receive scheduling", sched != session->rx_sched ||
+        priority != session->rx_priority || strncmp(cpus, session->rx_cpus, sizeof(session->rx_cpus)-1) != 0))
+        return;
+
+    session->rx_sched = sched;
+    session->rx_priority = priority;
+    strncpy(session->rx_cpus, cpus, sizeof(session->rx_cpus)-1);
+}
 
-// new code to get all interface names on this host
+// Lock the process's pages, current and future, into RAM so a receive
+// thread never waits on a page fault. Done once for the process; needs
+// CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK (ulimit -l).
+void metis_lock_memory() {
+    static int locked = 0;
+    struct rlimit limit;
+
+    if(__atomic_exchange_n(&locked, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        getrlimit(RLIMIT_MEMLOCK,&limit);
+        fprintf(stderr,"Metis: mlockall failed: %s", strerror(errno));
+        if(limit.rlim_cur != RLIM_INFINITY)
+            fprintf(stderr," (memlock limit %lu kB, needs CAP_IPC_LOCK or a larger ulimit -l)",
+                (unsigned long)(limit.rlim_cur/1024));
+        fprintf(stderr,"\n");
+        return;
+    }
+    fprintf(stderr,"Metis: memory locked\n");
+}
 
-  struct ifconf ifc;
-  char buf[8192];
-  struct ifreq *ifquery;
-  int nInterfaces;
-  struct ifreq *item;
+// One anonymous mapping for all the ring buffers of a proxy, zeroed and page
+// aligned. With hugepages it is backed by 2 MB huge pages from the hugetlb
+// pool (vm.nr_hugepages); when the pool has none to spare the mapping falls
+// back to normal pages with a hint for transparent huge pages, and says so.
+// *mapped is set to the length to hand metis_arena_free(). Exits when no
+// memory is left.
+void* metis_arena_alloc(size_t bytes, int hugepages, size_t* mapped) {
+    size_t length;
+    void* arena;
+
+    if(hugepages) {
+        length=(bytes+METIS_HUGE_PAGE-1) & ~(size_t)(METIS_HUGE_PAGE-1);
+        arena=mmap(NULL,length,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+        if(arena != MAP_FAILED) {
+            fprintf(stderr,"Metis: %lu kB of buffers on %lu huge pages\n",
+                (unsigned long)(bytes/1024),(unsigned long)(length/METIS_HUGE_PAGE));
+            *mapped=length;
+            return arena;
+        }
+        fprintf(stderr,"Metis: no huge pages for %lu kB of buffers (%s), using normal pages\n",
+            (unsigned long)(bytes/1024),strerror(errno));
+    }
 
-  /* Query available interfaces. */
-  ifc.ifc_len = sizeof(buf);
-  ifc.ifc_buf = buf;
-  if(ioctl(sock, SIOCGIFCONF, &ifc) < 0)
-  {
-    printf("ioctl(SIOCGIFCONF) error");
-    return -1;
-  }
+    length=(bytes+getpagesize()-1) & ~(size_t)(getpagesize()-1);
+    arena=mmap(NULL,length,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if(arena == MAP_FAILED) {
+        perror("Metis: allocate buffers failed");
+        exit(1);
+    }
+#ifdef MADV_HUGEPAGE
+    if(hugepages)
+        madvise(arena,length,MADV_HUGEPAGE);
+#endif
+    *mapped=length;
+    return arena;
+}
 
-  /* Iterate through the list of interfaces. */
-  ifquery = ifc.ifc_req;
-  nInterfaces = ifc.ifc_len / sizeof(struct ifreq);
+void metis_arena_free(void* arena, size_t mapped) {
+    if(arena != NULL)
+        munmap(arena,mapped);
+}
 
-  for(int i=0; i<nInterfaces; i++)
-    fprintf(stderr, "Interface[%d]:%s  ", i, (char *)&ifquery[i].ifr_name);
+// Rounds a piece of an arena up so the next one starts on a new cache line.
+size_t metis_arena_round(size_t bytes) {
+    return (bytes+63) & ~(size_t)63;
+}
 
-  fprintf(stderr,"\n");
+// A ring geometry setting of a proxy: 0 (or less) takes fallback, anything
+// else is held to [min, max] and rounded up to a power of 2.
+unsigned metis_ring_size(int requested, unsigned fallback, unsigned min, unsigned max) {
+    unsigned size=1;
 
-// end new code
+    if(requested <= 0)
+        return fallback;
+    while(size < (unsigned)requested && size < max)
+        size <<= 1;
+    return (size < min) ? min : size;
+}
 
+// Hold up to window frames that arrive ahead of a missing one, per end
+// point, so that frames reordered on the way are handed to the proxies in
+// sequence. A frame is declared lost once window frames past it are in.
+// 0 (default) hands frames on as they arrive. Must be called before
+// metis_discover().
+void metis_receive_reorder(METIS_SESSION* session, int window) {
+    if(window < 0)
+        window = 0;
+    if(window > METIS_MAX_REORDER)
+        window = METIS_MAX_REORDER;
+    if(metis_settings_fixed(session, "reorder window", window != session->reorder_window))
+        return;
+    session->reorder_window = window;
+}
 
+// Reorder window counters for end point ep (6 = NB, 4 = WB).
+void metis_receive_reorder_statistics(METIS_SESSION* session, int ep, unsigned long* reordered,
+                                      unsigned long* duplicates, unsigned long* late, unsigned long* gaps) {
+    METIS_REORDER* reorder=&session->rx_reorder[ep == 4 ? 1 : 0];
+
+    pthread_mutex_lock(&session->dispatch_lock);
+    *reordered = reorder->reordered;
+    *duplicates = reorder->duplicates;
+    *late = reorder->late;
+    *gaps = reorder->gaps;
+    pthread_mutex_unlock(&session->dispatch_lock);
+}
 
-  ifr = &ifrr;
-  ifrr.ifr_addr.sa_family = AF_INET;
-  strncpy(ifrr.ifr_name, ifname, sizeof(ifrr.ifr_name));
+// Split receive in two: the receive thread only copies data frames into
+// a raw frame ring, and an unpack thread, pinned to the cores in cpus ("" =
+// unpinned), hands them on to the proxies. Must be called before
+// metis_discover().
+void metis_receive_pipeline(METIS_SESSION* session, int enable, const char* cpus) {
+    if(cpus == NULL)
+        cpus = "";
+    if(metis_settings_fixed(session, "receive pipeline", (enable != 0) != session->pipeline ||
+        strncmp(cpus, session->unpack_cpus, sizeof(session->unpack_cpus)-1) != 0))
+        return;
+
+    session->pipeline = enable != 0;
+    strncpy(session->unpack_cpus, cpus, sizeof(session->unpack_cpus)-1);
+}
 
-  if (ioctl(sock, SIOCGIFADDR, ifr) < 0) {
-    printf("No %s interface.\n", ifname);
-    return -1;
-  }
+// Record every data frame received and every EP2 frame sent to path, with
+// an index in path.idx (see metis_capture.h). "" or NULL records nothing.
+// Must be called before metis_discover().
+void metis_capture_file(METIS_SESSION* session, const char* path) {
+    if(path == NULL)
+        path = "";
+    if(metis_settings_fixed(session, "capture file",
+        strncmp(path, session->capture_path, sizeof(session->capture_path)-1) != 0))
+        return;
+
+    strncpy(session->capture_path, path, sizeof(session->capture_path)-1);
+}
 
-  ip_address=inaddrr(ifr_addr.sa_data).s_addr;
+// How the file replay ("file:<path>") paces its frames, RxReplay_*. Must
+// be called before metis_discover().
+void metis_replay_pacing(METIS_SESSION* session, int pace) {
+    if(pace < RxReplay_Nominal || pace > RxReplay_Fast)
+        pace = RxReplay_Nominal;
+    if(metis_settings_fixed(session, "replay pacing", pace != session->link.config.replay_pace))
+        return;
+    session->link.config.replay_pace = pace;
+}
 
-  if (ioctl(sock, SIOCGIFHWADDR, ifr) < 0) {
-    printf("No %s interface.\n", ifname);
-    return -1;
-  }
+// True once a replay has played out and every frame of it has been
+// handed to the proxies.
+int metis_receive_finished(METIS_SESSION* session) {
+    if(!__atomic_load_n(&session->rx_finished, __ATOMIC_ACQUIRE))
+        return 0;
+    return !session->pipeline || metis_raw_ring_space(&session->raw) == session->raw.mask + 1;
+}
 
-  u = (unsigned char *) &ifr->ifr_addr.sa_data;
+// Frames for end point ep (6 or 4) the receive thread dropped because the
+// unpack thread was a whole raw ring behind, or because they were not a
+// whole Metis frame.
+unsigned long metis_pipeline_drops(METIS_SESSION* session, int ep) {
+    return __atomic_load_n(&session->pipeline_drops[ep == 4 ? 1 : 0], __ATOMIC_RELAXED);
+}
 
-  for(i=0;i<6;i++)
-      hw_address[i]=u[i];
+// Bucket 0 is under 1 usec, bucket k is [2^(k-1), 2^k) usec, the last
+// bucket takes everything longer.
+static void metis_note_latency(METIS_SESSION* session, struct timespec* stamp) {
+    struct timespec now;
+    long usec;
+    int bucket=0;
+
+    clock_gettime(CLOCK_REALTIME,&now);
+    usec=(now.tv_sec-stamp->tv_sec)*1000000L + (now.tv_nsec-stamp->tv_nsec)/1000;
+    while(usec > 0 && bucket < METIS_LATENCY_BUCKETS-1) {
+        usec >>= 1;
+        bucket++;
+    }
+    session->rx_latency[bucket]++;
+}
 
+// Packets the kernel dropped before they reached us, because the
+// socket buffer or the AF_PACKET ring was full. The kernel counts them for
+// the socket or ring as a whole, EP6 and EP4 together.
+unsigned long metis_kernel_drops(METIS_SESSION* session) {
+    return session->link.stats.socket_drops + session->link.stats.ring_drops;
+}
 
-  return 0;
+// Datagrams the AF_PACKET backend threw away because their UDP length
+// did not fit what the ring captured, EP6 and EP4 together.
+unsigned long metis_length_drops(METIS_SESSION* session) {
+    return session->link.stats.length_drops;
 }
 
-void metis_discover(const char* interface) {
-    int rc;
-    int i;
-    int on=1;
-    struct ifreq ifr;
+// Select the receive backend for data frames: the UDP socket (default),
+// a TPACKET_V3 mmap ring on the interface, or io_uring. Must be called
+// before metis_discover().
+void metis_receive_backend(METIS_SESSION* session, int backend) {
+#ifndef HAVE_LIBURING
+    if(backend == RxBackend_IoUring) {
+        fprintf(stderr,"Metis: built without liburing, io_uring engine not available. Using UDP socket.\n");
+        backend = RxBackend_UDP;
+    }
+#endif
+    if(metis_settings_fixed(session, "receive backend", backend != session->link.config.rx_backend))
+        return;
 
-    fprintf(stderr,"Looking for Metis/Hermes card on interface %s\n",interface);
+    session->link.config.rx_backend = backend;
+}
 
-    discovering=1;
-    
-    // send a broadcast to locate metis boards on the network
-    discovery_socket=socket(PF_INET,SOCK_DGRAM,IPPROTO_UDP);
-    if(discovery_socket<0) {
-        perror("create socket failed for discovery_socket\n");
-        exit(1);
-    }
+// True when Tx frames are collected while a group of received packets is
+// dispatched, and sent together afterwards via FlushTxIQ().
+int metis_receive_batching(METIS_SESSION* session) {
+    return session->rx_batching;
+}
 
+void metis_receive_statistics(METIS_SESSION* session, unsigned long* syscalls, unsigned long* packets) {
+    *syscalls = session->link.stats.syscalls;
+    *packets = session->link.stats.packets;
+}
 
-    // get my MAC address and IP address
-    if(get_addr(discovery_socket,interface)<0) {
-        exit(1);
+// The interface name picks the transport: "file:<path>" replays a capture,
+// "loopback" runs the synthetic radio, anything else is a network interface
+// served by the RxBackend transport.
+static METIS_TRANSPORT* metis_select_transport(const char* interface, int backend) {
+    if(strncmp(interface, "file:", 5) == 0)
+        return &metis_replay_transport;
+    if(strcmp(interface, "loopback") == 0)
+        return &metis_loopback_transport;
+
+    switch(backend) {
+        case RxBackend_PacketMmap:
+            return &metis_packet_transport;
+#ifdef HAVE_LIBURING
+        case RxBackend_IoUring:
+            return &metis_uring_transport;
+#endif
+        default:
+            return &metis_udp_transport;
     }
+}
 
-    printf("%s IP Address: %ld.%ld.%ld.%ld\n",
-              interface,
-              ip_address&0xFF,
-              (ip_address>>8)&0xFF,
-              (ip_address>>16)&0xFF,
-              (ip_address>>24)&0xFF);
-
-    printf("%s MAC Address: %02x:%02x:%02x:%02x:%02x:%02x\n",
-         interface,
-         hw_address[0], hw_address[1], hw_address[2], hw_address[3], hw_address[4], hw_address[5]);
+static void* metis_receive_thread(void* arg);
+static void* metis_unpack_thread(void* arg);
+static void metis_reactor_join(METIS_SESSION* session);
 
+static void metis_start_receive_thread(METIS_SESSION* session) {
+    int rc;
 
-    // start a receive thread to get discovery responses
-    rc=pthread_create(&receive_thread_id,NULL,metis_receive_thread,NULL);
+    rc=pthread_create(&session->receive_thread_id,NULL,metis_receive_thread,session);
     if(rc != 0) {
         fprintf(stderr,"pthread_create failed on metis_receive_thread: rc=%d\n", rc);
         exit(1);
     }
+    session->receiving=1;
+    metis_thread_setup(session->receive_thread_id,"receive thread",
+        session->rx_sched,session->rx_priority,session->rx_cpus);
+}
 
-    // bind to this interface
-    struct sockaddr_in name={0};
-    name.sin_family = AF_INET;
-    name.sin_addr.s_addr = ip_address;
-    name.sin_port = htons(DISCOVERY_SEND_PORT);
-    bind(discovery_socket,(struct sockaddr*)&name,sizeof(name));
-
+static void metis_start_unpack_thread(METIS_SESSION* session) {
+    int rc;
 
-    // allow broadcast on the socket
-    rc=setsockopt(discovery_socket, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+    metis_raw_ring_init(&session->raw, METIS_RAW_RING_FRAMES);
+    session->pipeline_drops[0]=0;
+    session->pipeline_drops[1]=0;
+    rc=pthread_create(&session->unpack_thread_id,NULL,metis_unpack_thread,session);
     if(rc != 0) {
-        fprintf(stderr,"cannot set SO_BROADCAST: rc=%d\n", rc);
+        fprintf(stderr,"pthread_create failed on metis_unpack_thread: rc=%d\n", rc);
         exit(1);
     }
+    session->unpacking=1;
+    metis_thread_setup(session->unpack_thread_id,"unpack thread",
+        session->rx_sched,session->rx_priority,session->unpack_cpus);
+}
 
-    discovery_length=sizeof(discovery_addr);
-    memset(&discovery_addr,0,discovery_length);
-    discovery_addr.sin_family=AF_INET;
-    discovery_addr.sin_port=htons(DISCOVERY_SEND_PORT);
-    discovery_addr.sin_addr.s_addr=htonl(INADDR_BROADCAST);
+// Open the transport and start discovery, and the receive thread unless the
+// reactor is to receive. Only the first call on a session does anything.
+void metis_discover(METIS_SESSION* session) {
+    int rc;
 
-    buffer[0]=0xEF;
-    buffer[1]=0xFE;
-    buffer[2]=0x02;
-    for(i=0;i<60;i++) {
-        buffer[i+3]=0x00;
+    pthread_mutex_lock(&sessions_lock);
+    if(session->running) {
+        pthread_mutex_unlock(&sessions_lock);
+        return;
     }
+    session->running=1;
+    pthread_mutex_unlock(&sessions_lock);
+
+    fprintf(stderr,"Looking for Metis/Hermes card on interface %s\n",session->interface);
 
-    if(sendto(discovery_socket,buffer,63,0,(struct sockaddr*)&discovery_addr,discovery_length)<0) {
-        perror("sendto socket failed for discovery_socket\n");
+    session->transport=metis_select_transport(session->interface, session->link.config.rx_backend);
+    if(session->transport->open(&session->link, session->interface) < 0) {
+        fprintf(stderr,"Metis: %s not available. Using UDP socket.\n", session->transport->name);
+        session->transport=&metis_udp_transport;
+        session->transport->open(&session->link, session->interface);
+    }
+    fprintf(stderr,"Metis transport: %s\n", session->transport->name);
+
+    session->rx_batching = session->transport->groups || session->link.config.rx_batch > 1 || session->pipeline;
+    metis_reorder_init(&session->rx_reorder[0], session->reorder_window);
+    metis_reorder_init(&session->rx_reorder[1], session->reorder_window);
+    session->link.config.rx_nonblock = session->link.config.rx_reactor > 0 && session->transport->fd != NULL;
+    session->replay_stamps = session->transport == &metis_replay_transport && session->link.config.replay_pace != RxReplay_Nominal;
+    session->rx_throttle = session->transport == &metis_replay_transport && session->link.config.replay_pace == RxReplay_Fast;
+    session->rx_finished = 0;
+    session->data_entry=-1;
+    session->discovering=1;
+    __atomic_store_n(&session->rx_stop, 0, __ATOMIC_RELEASE);
+
+    if(session->capture_path[0])
+        session->capture=metis_capture_open(session->capture_path, session->interface);
+
+    if(session->pipeline)
+        metis_start_unpack_thread(session);
+
+    // start a thread to get discovery responses
+    rc=pthread_create(&session->discovery_thread_id,NULL,metis_discovery_thread,session);
+    if(rc != 0) {
+        fprintf(stderr,"pthread_create failed on metis_discovery_thread: rc=%d\n", rc);
         exit(1);
     }
+
+    // and the receive thread for the data frames; the reactor takes the
+    // session once it is connected
+    if(!session->link.config.rx_nonblock)
+        metis_start_receive_thread(session);
 }
 
-int metis_found() {
-    return found;
+int metis_found(METIS_SESSION* session) {
+    return __atomic_load_n(&session->found, __ATOMIC_ACQUIRE);
 }
 
-// close socket, stop receive thread, wait for thread to terminate
-void metis_stop_receive_thread() {
+// Wait until a Metis answers discovery: the one with MAC address mac when
+// that is a full "HH:HH:HH:HH:HH:HH" string, otherwise the first one.
+// Returns its cards[] entry, or -1 after timeout_ms (0 waits for ever).
+int metis_wait_found(METIS_SESSION* session, const char* mac, int timeout_ms) {
+    struct timespec deadline;
+    int entry=-1;
+    int rc=0;
+    int i;
+
+    clock_gettime(CLOCK_REALTIME,&deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
 
-    shutdown(discovery_socket, 2);
-    pthread_cancel(receive_thread_id);
-    pthread_join(receive_thread_id, NULL);
+    pthread_mutex_lock(&session->discover_lock);
+    while(1) {
+        for(i=0;i<session->found && entry<0;i++)
+            if(mac == NULL || strlen(mac) != 17 || strcmp(mac,session->cards[i].mac_address) == 0)
+                entry=i;
 
-};
+        if(entry >= 0 || rc == ETIMEDOUT)
+            break;
 
-char* metis_ip_address(int entry) {
-    if(entry>=0 && entry<found) {
-        return metis_cards[entry].ip_address;
+        if(timeout_ms > 0)
+            rc=pthread_cond_timedwait(&session->discover_cond,&session->discover_lock,&deadline);
+        else
+            pthread_cond_wait(&session->discover_cond,&session->discover_lock);
+    }
+    pthread_mutex_unlock(&session->discover_lock);
+
+    return entry;
+}
+
+// stop the discovery and receive threads, wait for them, close the transport
+static void metis_stop_receive_thread(METIS_SESSION* session) {
+
+    session->discovering=0;
+    __atomic_store_n(&session->rx_stop, 1, __ATOMIC_RELEASE);	// both threads look at this between waits
+
+    pthread_join(session->discovery_thread_id, NULL);
+    if(session->reactor != NULL)
+        metis_reactor_remove(session->reactor);
+    else if(session->receiving)
+        pthread_join(session->receive_thread_id, NULL);
+    session->reactor = NULL;
+    session->receiving = 0;
+
+    if(session->unpacking) {			// nothing more is put in the ring now
+        pthread_join(session->unpack_thread_id, NULL);
+        metis_raw_ring_free(&session->raw);
+        session->unpacking = 0;
+    }
+
+    session->transport->close(&session->link);
+    session->data_entry = -1;
+
+    if(session->capture != NULL) {
+        metis_capture_close(session->capture);
+        session->capture = NULL;
+    }
+}
+
+// Detach a proxy from its session. Once the receive thread lets go of the
+// dispatch lock no more frames reach it. The last proxy out stops the
+// threads, closes the transport and frees the session.
+void metis_close(METIS_SESSION* session, HermesProxy* nb, HermesProxyW* wb) {
+    METIS_SESSION** link;
+    int last;
+
+    pthread_mutex_lock(&session->dispatch_lock);
+    if(nb != NULL && session->nb == nb)
+        session->nb=NULL;
+    if(wb != NULL && session->wb == wb)
+        session->wb=NULL;
+    pthread_mutex_unlock(&session->dispatch_lock);
+
+    pthread_mutex_lock(&sessions_lock);
+    last = --session->users == 0;
+    if(last)
+        for(link=&sessions;*link!=NULL;link=&(*link)->next)
+            if(*link == session) {
+                *link=session->next;
+                break;
+            }
+    pthread_mutex_unlock(&sessions_lock);
+
+    if(!last)
+        return;
+
+    if(session->running)
+        metis_stop_receive_thread(session);	// stop receive_thread & close socket
+
+    pthread_cond_destroy(&session->discover_cond);
+    pthread_mutex_destroy(&session->discover_lock);
+    pthread_mutex_destroy(&session->dispatch_lock);
+    delete session;
+}
+
+char* metis_ip_address(METIS_SESSION* session, int entry) {
+    if(entry>=0 && entry<metis_found(session)) {
+        return session->cards[entry].ip_address;
     }
     return NULL;
 }
 
-char* metis_mac_address(int entry) {
-    if(entry>=0 && entry<found) {
-        return metis_cards[entry].mac_address;
+char* metis_mac_address(METIS_SESSION* session, int entry) {
+    if(entry>=0 && entry<metis_found(session)) {
+        return session->cards[entry].mac_address;
     }
     return NULL;
 }
 
-void metis_receive_stream_control(unsigned char streamControl, unsigned int entry) {
+void metis_receive_stream_control(METIS_SESSION* session, unsigned char streamControl, unsigned int entry) {
+    unsigned char buffer[64];
+    struct iovec iov;
     int i;
-    int rc;
-    struct hostent *h;
 
 //  fprintf(stderr,"Metis receive stream control: %d\n", streamControl);
 
-    discovering=0;
+    session->discovering=0;
 
-    h=gethostbyname(metis_cards[entry].ip_address);
-    if(h==NULL) {
-        fprintf(stderr,"metis_start_receiver_stream unknown target.  MAC: %s    IP: %s\n",
-	    metis_cards[entry].mac_address, metis_cards[entry].ip_address);
+    if(entry >= (unsigned int)metis_found(session)) {
+        fprintf(stderr,"metis_receive_stream_control unknown target entry %u\n", entry);
         exit(1);
     }
 
-    data_addr_length=sizeof(data_addr);
-    memset(&data_addr,0,data_addr_length);
-    data_addr.sin_family=AF_INET;
-    data_addr.sin_port=htons(DATA_PORT);
-    memcpy((char *)&data_addr.sin_addr.s_addr,h->h_addr_list[0],h->h_length);
+    // Point the transport at this Metis, once. The address was taken
+    // from its discovery reply.
+    if(session->data_entry != (int)entry) {
+        session->transport->connect(&session->link, &session->cards[entry].address,
+            session->cards[entry].interface[0] ? session->cards[entry].interface : NULL);
+        session->data_entry=entry;
+        metis_reactor_join(session);
+    }
 
     // send a packet to start or stop the stream
     buffer[0]=0xEF;
@@ -308,144 +868,520 @@ void metis_receive_stream_control(unsigned char streamControl, unsigned int entr
     for(i=0;i<60;i++)
         buffer[i+4]=0x00;
 
-    if(sendto(discovery_socket,buffer,64,0,(struct sockaddr*)&data_addr,data_addr_length)<0) {
-        perror("sendto socket failed for start\n");
-        exit(1);
+    iov.iov_base=buffer;
+    iov.iov_len=64;
+    session->transport->send(&session->link,&iov,1,1);
+
+    if(streamControl == 0) {
+      session->send_sequence = -1;	// reset HPSDR Tx Ethernet sequence number on stream stop
+
+      pthread_mutex_lock(&session->dispatch_lock);	// the radio starts its own over too, so
+      metis_reorder_init(&session->rx_reorder[0], session->reorder_window);	// drop what is held
+      metis_reorder_init(&session->rx_reorder[1], session->reorder_window);
+      pthread_mutex_unlock(&session->dispatch_lock);
     }
+}
+
+// Reorder window outputs, in sequence order.
+static void metis_deliver_nb(void* arg, unsigned char* frame, const struct timespec* stamp) {
+    METIS_SESSION* session=(METIS_SESSION*)arg;
 
-    if(streamControl == 0)
-      send_sequence = -1;	// reset HPSDR Tx Ethernet sequence number on stream stop
+    if (session->nb != NULL)
+      session->nb->ReceiveRxIQ(frame, stamp); // send Ethernet frame to Proxy
 }
 
-void* metis_receive_thread(void* arg) {
-    struct sockaddr_in addr;
-    int length;
-    unsigned char buffer[2048];
-    int bytes_read;
+static void metis_deliver_wb(void* arg, unsigned char* frame, const struct timespec* stamp) {
+    METIS_SESSION* session=(METIS_SESSION*)arg;
 
-    length=sizeof(addr);
-    while(1) {
-   	bytes_read=recvfrom(discovery_socket,buffer,sizeof(buffer),0,(struct sockaddr*)&addr,(socklen_t *)&length);
-        if(bytes_read<0) {
-            if (errno == EINTR)	 // new code to handle case of signal received
-              continue;
+    if (session->wb != NULL)
+      session->wb->ReceiveRxIQ(frame, stamp); // send Ethernet frame to Proxy
+}
 
-            perror("recvfrom socket failed for metis_receive_thread");
-            exit(1);
-        }
+static void metis_cache_store(METIS_CARD* card);
+
+// Dispatch one received datagram: discovery reply or EP6/EP4 data frame.
+// stamp is the kernel arrival time, zero when there is none. interface is
+// where a discovery reply came in, NULL when not on a network interface.
+// Data frames are only handed out with the dispatch lock held.
+static void metis_process_packet(METIS_SESSION* session, unsigned char* buffer, int bytes_read,
+                                 struct sockaddr_in* from, struct timespec* stamp, const char* interface) {
+    METIS_CARD* card;
+    char mac_address[18];
+    int added=-1;
+    int found;
+    int ep;
+    int i;
 
-	if(bytes_read == 0)
-	    continue;
-
-	if(bytes_read > 1048)
-	    fprintf(stderr, "Metis Receive Thread: bytes_read = %d  (>1048)\n", bytes_read);
-
-        if(buffer[0]==0xEF && buffer[1]==0xFE) {
-            switch(buffer[2]) {
-                case 1:
-                    if(!discovering) {
-                        // get the end point
-                        ep=buffer[3]&0xFF;
-
-                        // get the sequence number
-                        sequence=((buffer[4]&0xFF)<<24)+((buffer[5]&0xFF)<<16)+((buffer[6]&0xFF)<<8)+(buffer[7]&0xFF);
-                        switch(ep) {
-                            case 6: // EP6			Send to Hermes Narrowband
-                                // process the data
-				if(bytes_read != 1032)
-				  fprintf(stderr,"Metis: bytes_read = %d (!= 1032)\n", bytes_read);
-				if (Hermes != NULL)
-				  Hermes->ReceiveRxIQ(&buffer[0]); // send Ethernet frame to Proxy
-                                break;
-
-                            case 4: // EP4			Send to Hermes Wideband
-				if (HermesW != NULL)
-				  HermesW->ReceiveRxIQ(&buffer[0]); // send Ethernet frame to Proxy
-                                break;
-
-                            default:
-                                fprintf(stderr,"unexpected EP %d length=%d\n",ep,bytes_read);
-                                break;
-                        }
-                    } else {
-                        fprintf(stderr,"unexpected data packet when in discovery mode\n");
+    if(bytes_read == 0)
+        return;
+
+    if(bytes_read > 1048)
+        fprintf(stderr, "Metis Receive Thread: bytes_read = %d  (>1048)\n", bytes_read);
+
+    if(buffer[0]==0xEF && buffer[1]==0xFE) {
+        switch(buffer[2]) {
+            case 1:
+                if(!session->discovering) {
+                    // get the end point
+                    ep=buffer[3]&0xFF;
+
+                    switch(ep) {
+                        case 6: // EP6			Send to Hermes Narrowband
+                            // process the data
+				if(bytes_read != METIS_FRAME_BYTES) {	// ReceiveRxIQ reads all 1032 bytes
+				  if(session->nb != NULL)
+				    session->nb->CorruptRxCount++;
+				  break;
+				}
+				if(stamp != NULL && stamp->tv_sec != 0 && !session->replay_stamps)
+				  metis_note_latency(session, stamp);
+				metis_reorder_push(&session->rx_reorder[0], &buffer[0], bytes_read, stamp,
+				  metis_deliver_nb, session);
+                            break;
+
+                        case 4: // EP4			Send to Hermes Wideband
+				if(bytes_read != METIS_FRAME_BYTES) {
+				  if(session->wb != NULL)
+				    session->wb->CorruptRxCount++;
+				  break;
+				}
+				if(stamp != NULL && stamp->tv_sec != 0 && !session->replay_stamps)
+				  metis_note_latency(session, stamp);
+				metis_reorder_push(&session->rx_reorder[1], &buffer[0], bytes_read, stamp,
+				  metis_deliver_wb, session);
+                            break;
+
+                        default:
+                            fprintf(stderr,"unexpected EP %d length=%d\n",ep,bytes_read);
+                            break;
                     }
-                    break;
-                case 2:  // response to a discovery packet
-                    if(discovering) {
-                        if(found<MAX_METIS_CARDS) {
-                            // get MAC address from reply
-                            sprintf(metis_cards[found].mac_address,"%02X:%02X:%02X:%02X:%02X:%02X",
-                                buffer[3]&0xFF,buffer[4]&0xFF,buffer[5]&0xFF,
-				buffer[6]&0xFF,buffer[7]&0xFF,buffer[8]&0xFF);
-                            fprintf(stderr,"Metis MAC address %s\n",metis_cards[found].mac_address);
-    
-                            // get ip address from packet header
-                            sprintf(metis_cards[found].ip_address,"%d.%d.%d.%d",
-                                       addr.sin_addr.s_addr&0xFF,
-                                       (addr.sin_addr.s_addr>>8)&0xFF,
-                                       (addr.sin_addr.s_addr>>16)&0xFF,
-                                       (addr.sin_addr.s_addr>>24)&0xFF);
-                            fprintf(stderr,"Metis IP address %s\n",metis_cards[found].ip_address);
-                            found++;
-                        } else {
-                            fprintf(stderr,"too many metis/Hermes cards!\n");
-                        }
+                } else {
+                    fprintf(stderr,"unexpected data packet when in discovery mode\n");
+                }
+                break;
+            case 2:  // response to a discovery packet
+                if(session->discovering) {
+                    // get MAC address from reply
+                    sprintf(mac_address,"%02X:%02X:%02X:%02X:%02X:%02X",
+                        buffer[3]&0xFF,buffer[4]&0xFF,buffer[5]&0xFF,
+			buffer[6]&0xFF,buffer[7]&0xFF,buffer[8]&0xFF);
+
+                    pthread_mutex_lock(&session->discover_lock);
+                    found=session->found;
+
+                    // discovery is repeated, each Metis answers every time
+                    for(i=0;i<found;i++)
+                        if(strcmp(session->cards[i].mac_address,mac_address)==0)
+                            break;
+
+                    if(i<found)
+                        ;				// already known
+                    else if(found<MAX_METIS_CARDS) {
+                        card=&session->cards[found];
+                        strcpy(card->mac_address,mac_address);
+                        fprintf(stderr,"Metis MAC address %s\n",card->mac_address);
+
+                        // get ip address from packet header
+                        sprintf(card->ip_address,"%d.%d.%d.%d",
+                                   from->sin_addr.s_addr&0xFF,
+                                   (from->sin_addr.s_addr>>8)&0xFF,
+                                   (from->sin_addr.s_addr>>16)&0xFF,
+                                   (from->sin_addr.s_addr>>24)&0xFF);
+                        fprintf(stderr,"Metis IP address %s%s%s\n",card->ip_address,
+                            interface ? " on " : "", interface ? interface : "");
+
+                        // keep the address for the data socket, no need to resolve it later
+                        memset(&card->address,0,sizeof(card->address));
+                        card->address.sin_family=AF_INET;
+                        card->address.sin_addr=from->sin_addr;
+                        card->address.sin_port=htons(METIS_PORT);
+                        memset(card->interface,0,sizeof(card->interface));
+                        if(interface != NULL)
+                            strncpy(card->interface,interface,sizeof(card->interface)-1);
+                        added=found;
+                        __atomic_store_n(&session->found, found+1, __ATOMIC_RELEASE);	// entry is complete
+                        pthread_cond_broadcast(&session->discover_cond);
                     } else {
-                        fprintf(stderr,"unexepected discovery response when not in discovery mode\n");
+                        fprintf(stderr,"too many metis/Hermes cards!\n");
                     }
-                    break;
-                default:
-                    fprintf(stderr,"unexpected packet type: 0x%02X\n",buffer[2]);
-                    break;
-            }
-        } else {
-            fprintf(stderr,"received bad header bytes on data port %02X,%02X\n",buffer[0],buffer[1]);
+
+                    pthread_mutex_unlock(&session->discover_lock);
+
+                    if(added >= 0 && interface != NULL)
+                        metis_cache_store(&session->cards[added]);	// entries are never changed once added
+                } else {
+                    fprintf(stderr,"unexepected discovery response when not in discovery mode\n");
+                }
+                break;
+            default:
+                fprintf(stderr,"unexpected packet type: 0x%02X\n",buffer[2]);
+                break;
         }
+    } else {
+        fprintf(stderr,"received bad header bytes on data port %02X,%02X\n",buffer[0],buffer[1]);
     }
-    
 }
 
-static unsigned char output_buffer[1032];
-static int offset=8;
+// Where the MAC -> (interface, IP) cache lives: $HPSDR_METIS_CACHE, else
+// $XDG_CACHE_HOME/gr-hpsdr/metis, else ~/.cache/gr-hpsdr/metis. With create
+// the directories are made as needed. Returns 0 when there is nowhere to put it.
+static int metis_cache_path(char* path, int size, int create) {
+    const char* env=getenv("HPSDR_METIS_CACHE");
+    char dir[256];
+
+    if(env != NULL && env[0]) {
+        snprintf(path,size,"%s",env);
+        return 1;
+    }
+
+    if((env=getenv("XDG_CACHE_HOME")) != NULL && env[0])
+        snprintf(dir,sizeof(dir),"%s",env);
+    else if((env=getenv("HOME")) != NULL && env[0])
+        snprintf(dir,sizeof(dir),"%s/.cache",env);
+    else
+        return 0;
+
+    if(create)
+        mkdir(dir,0755);
+    strncat(dir,"/gr-hpsdr",sizeof(dir)-strlen(dir)-1);
+    if(create)
+        mkdir(dir,0755);
+
+    snprintf(path,size,"%s/metis",dir);
+    return 1;
+}
 
-int metis_write(unsigned char ep, unsigned char* buffer, int length) {
+// Look mac up in the cache. Fills in address and returns 1 when it is there.
+// Each line is "MAC interface IP", most recently found first.
+static int metis_cache_lookup(const char* mac, struct sockaddr_in* address) {
+    char path[512];
+    char line[128];
+    char entry_mac[18];
+    char entry_if[16];
+    char entry_ip[16];
+    FILE* cache;
+    int hit=0;
+
+    if(!metis_cache_path(path,sizeof(path),0) || (cache=fopen(path,"r")) == NULL)
+        return 0;
+
+    while(!hit && fgets(line,sizeof(line),cache) != NULL)
+        if(sscanf(line,"%17s %15s %15s",entry_mac,entry_if,entry_ip) == 3 && strcmp(entry_mac,mac) == 0) {
+            memset(address,0,sizeof(*address));
+            address->sin_family=AF_INET;
+            address->sin_port=htons(METIS_PORT);
+            hit=inet_aton(entry_ip,&address->sin_addr);
+        }
+
+    fclose(cache);
+    return hit;
+}
+
+// Record where card was found, replacing any older line for its MAC. The
+// file is rewritten through a temporary and rename(), so a concurrent reader
+// sees the old or the new version, never half of one. Every write has a
+// temporary of its own, sessions may store at the same time. Failures are
+// ignored, the cache only saves time.
+static void metis_cache_store(METIS_CARD* card) {
+    char path[512];
+    char temp[528];
+    char line[128];
+    char entry_mac[18];
+    FILE* cache;
+    FILE* out;
+    int kept=0;
+
+    if(!metis_cache_path(path,sizeof(path),1))
+        return;
+
+    snprintf(temp,sizeof(temp),"%s.%d.%u",path,(int)getpid(),__atomic_add_fetch(&cache_writes,1,__ATOMIC_RELAXED));
+    if((out=fopen(temp,"w")) == NULL)
+        return;
+
+    fprintf(out,"%s %s %s\n",card->mac_address,card->interface,card->ip_address);
+    if((cache=fopen(path,"r")) != NULL) {
+        while(fgets(line,sizeof(line),cache) != NULL && kept < METIS_CACHE_ENTRIES-1)
+            if(sscanf(line,"%17s",entry_mac) == 1 && strcmp(entry_mac,card->mac_address) != 0) {
+                fputs(line,out);
+                kept++;
+            }
+        fclose(cache);
+    }
+
+    if(fclose(out) != 0 || rename(temp,path) != 0)
+        unlink(temp);
+}
+
+// True once the radio asked for by MAC address has answered.
+static int metis_target_found(METIS_SESSION* session) {
+    int hit=0;
     int i;
 
-    if(offset==8) {
+    if(session->discover_target[0] == 0)
+        return 0;
 
-        send_sequence++;
-        output_buffer[0]=0xEF;
-        output_buffer[1]=0xFE;
-        output_buffer[2]=0x01;
-        output_buffer[3]=ep;
-        output_buffer[4]=(send_sequence>>24)&0xFF;
-        output_buffer[5]=(send_sequence>>16)&0xFF;
-        output_buffer[6]=(send_sequence>>8)&0xFF;
-        output_buffer[7]=(send_sequence)&0xFF;
+    pthread_mutex_lock(&session->discover_lock);
+    for(i=0;i<session->found;i++)
+        if(strcmp(session->cards[i].mac_address,session->discover_target) == 0)
+            hit=1;
+    pthread_mutex_unlock(&session->discover_lock);
 
+    return hit;
+}
+
+// Find the radio. One asked for by MAC is first probed at its cached
+// address, which skips the broadcast round on a restart. Otherwise, or when
+// the probe gets no answer, the request is broadcast on every interface every
+// DISCOVER_RETRY msec until a Metis is selected, so a radio that powers up
+// late, or a lost broadcast, is still found.
+static void* metis_discovery_thread(void* arg) {
+    METIS_SESSION* session=(METIS_SESSION*)arg;
+    METIS_TRANSPORT* transport=session->transport;
+    METIS_FRAME replies[MAX_METIS_CARDS];
+    struct sockaddr_in cached;
+    int count;
+    int i;
 
-        // copy the buffer over
-        for(i=0;i<512;i++) {
-            output_buffer[i+offset]=buffer[i];
+    if(session->discover_target[0] && metis_cache_lookup(session->discover_target,&cached)) {
+        fprintf(stderr,"Metis %s: probing cached address %s\n",session->discover_target,inet_ntoa(cached.sin_addr));
+        count=transport->discover(&session->link,replies,MAX_METIS_CARDS,DISCOVER_PROBE,&cached);
+        for(i=0;i<count;i++)
+            metis_process_packet(session,replies[i].buffer,replies[i].length,&replies[i].from,NULL,replies[i].interface);
+    }
+
+    while(session->discovering && !__atomic_load_n(&session->rx_stop, __ATOMIC_ACQUIRE) && !metis_target_found(session)) {
+        count=transport->discover(&session->link,replies,MAX_METIS_CARDS,DISCOVER_RETRY,NULL);
+        for(i=0;i<count && session->discovering;i++)	// a Metis may have been selected meanwhile
+            metis_process_packet(session,replies[i].buffer,replies[i].length,&replies[i].from,NULL,replies[i].interface);
+    }
+
+    return NULL;
+}
+
+// Hand a group of received data frames to metis_process_packet() in
+// order. Tx frames scheduled while the group is dispatched go out together
+// afterwards. With the pipeline the frames are only queued on the raw ring,
+// or dropped (and counted) when it is full or they are the wrong length.
+static void metis_dispatch(METIS_SESSION* session, METIS_FRAME* frames, int count) {
+    METIS_RAW_SLOT* slot;
+    int i;
+
+    session->link.stats.packets += count;
+
+    if(session->capture != NULL)
+        for(i=0;i<count;i++) {
+            struct iovec iov = { frames[i].buffer, (size_t)frames[i].length };
+            metis_capture_frame(session->capture, &iov, 1, &frames[i].stamp);
         }
-        offset=520;
-    } else {
-        // copy the buffer over
-        for(i=0;i<512;i++) {
-            output_buffer[i+offset]=buffer[i];
+
+    if(session->pipeline) {			// leave the rest to the unpack thread
+        for(i=0;i<count;i++) {
+            if(frames[i].length != METIS_FRAME_BYTES	// a slot holds exactly one frame
+               || (slot=metis_raw_ring_claim(&session->raw)) == NULL) {
+                if(frames[i].length > 3)
+                    session->pipeline_drops[frames[i].buffer[3] == 4 ? 1 : 0]++;
+                else
+                    session->pipeline_drops[0]++;
+                continue;
+            }
+            slot->length=frames[i].length;
+            slot->stamp=frames[i].stamp;
+            memcpy(slot->frame,frames[i].buffer,frames[i].length);
+            metis_raw_ring_publish(&session->raw);
+        }
+        metis_raw_ring_wake(&session->raw);
+        return;
+    }
+
+    pthread_mutex_lock(&session->dispatch_lock);
+    for(i=0;i<count;i++)
+        metis_process_packet(session,frames[i].buffer,frames[i].length,&frames[i].from,&frames[i].stamp,NULL);
+
+    if(session->rx_batching) {
+        if(session->nb != NULL)
+            session->nb->FlushTxIQ();
+        if(session->wb != NULL)
+            session->wb->FlushTxIQ();
+    }
+    pthread_mutex_unlock(&session->dispatch_lock);
+}
+
+// True when the proxies can take that many more frames without dropping any,
+// and with the pipeline the unpack thread has caught up.
+static int metis_proxies_have_room(METIS_SESSION* session, int frames) {
+    int room;
+
+    if(session->pipeline && metis_raw_ring_space(&session->raw) != session->raw.mask + 1)
+        return 0;
+
+    pthread_mutex_lock(&session->dispatch_lock);
+    room = (session->nb == NULL || session->nb->RxRoom(frames)) &&
+           (session->wb == NULL || session->wb->RxRoom(frames));
+    pthread_mutex_unlock(&session->dispatch_lock);
+    return room;
+}
+
+// Take groups of data frames from the transport and dispatch them, when
+// the session has a receive thread of its own. A throttled session waits
+// for the proxies to have room for a whole group first.
+static void* metis_receive_thread(void* arg) {
+    METIS_SESSION* session=(METIS_SESSION*)arg;
+    METIS_TRANSPORT* transport=session->transport;
+    METIS_FRAME frames[METIS_MAX_RX_BATCH];
+    struct timespec poll = { 0, METIS_REPLAY_POLL * 1000L };
+    int max = session->rx_throttle ? METIS_REPLAY_BATCH : METIS_MAX_RX_BATCH;
+    int count;
+
+    while(!__atomic_load_n(&session->rx_stop, __ATOMIC_ACQUIRE)) {
+        if(session->rx_throttle && !metis_proxies_have_room(session, max)) {
+            nanosleep(&poll, NULL);
+            continue;
+        }
+
+        count=transport->receive(&session->link,frames,max);
+        if(count > 0)
+            metis_dispatch(session,frames,count);
+
+        if(__atomic_load_n(&session->link.finished, __ATOMIC_ACQUIRE))
+            __atomic_store_n(&session->rx_finished, 1, __ATOMIC_RELEASE);	// all of it is dispatched now
+    }
+
+    return NULL;
+}
+
+// Take the frames the receive thread put in the raw ring and dispatch
+// them, a group at a time, as metis_dispatch() does without the pipeline.
+static void* metis_unpack_thread(void* arg) {
+    METIS_SESSION* session=(METIS_SESSION*)arg;
+    METIS_RAW_SLOT* slot;
+    int count;
+
+    while(!__atomic_load_n(&session->rx_stop, __ATOMIC_ACQUIRE)) {
+        if(metis_raw_ring_count(&session->raw) == 0) {
+            metis_raw_ring_wait(&session->raw, 100);
+            continue;
+        }
+
+        pthread_mutex_lock(&session->dispatch_lock);
+        for(count=0;count<METIS_MAX_RX_BATCH && (slot=metis_raw_ring_peek(&session->raw)) != NULL;count++) {
+            metis_process_packet(session,slot->frame,slot->length,NULL,&slot->stamp,NULL);
+            metis_raw_ring_release(&session->raw);
         }
-        offset=8;
 
-        // send the buffer
-        metis_send_buffer(&output_buffer[0],1032);
+        if(session->rx_batching) {
+            if(session->nb != NULL)
+                session->nb->FlushTxIQ();
+            if(session->wb != NULL)
+                session->wb->FlushTxIQ();
+        }
+        pthread_mutex_unlock(&session->dispatch_lock);
+    }
+
+    return NULL;
+}
+
+// Called on a reactor thread when the session's data descriptor is
+// readable. Takes everything queued, the transport does not block.
+static void metis_reactor_ready(void* arg) {
+    METIS_SESSION* session=(METIS_SESSION*)arg;
+    METIS_FRAME frames[METIS_MAX_RX_BATCH];
+    int count;
 
+    while((count=session->transport->receive(&session->link,frames,METIS_MAX_RX_BATCH)) > 0)
+        metis_dispatch(session,frames,count);
+}
+
+// Hand the session to the reactor once the transport is connected and its
+// descriptor is final. A transport that has none after all gets the
+// receive thread it would have had.
+static void metis_reactor_join(METIS_SESSION* session) {
+    int fd;
+
+    if(!session->link.config.rx_nonblock || session->reactor != NULL)
+        return;
+
+    fd=session->transport->fd(&session->link);
+    if(fd < 0) {
+        fprintf(stderr,"Metis: %s has no descriptor to poll, using a receive thread\n", session->transport->name);
+        session->link.config.rx_nonblock=0;
+        metis_start_receive_thread(session);
+        return;
     }
 
-    return length;
+    session->reactor=metis_reactor_add(fd,metis_reactor_ready,session,
+        session->link.config.rx_reactor,session->reactor_cpus,
+        session->rx_sched,session->rx_priority);
+}
+
+// Fill in the 8 byte Metis header for the next Tx Ethernet frame.
+static void metis_build_header(METIS_SESSION* session, unsigned char* header, unsigned char ep) {
+    long sequence=++session->send_sequence;
+
+    header[0]=0xEF;
+    header[1]=0xFE;
+    header[2]=0x01;
+    header[3]=ep;
+    header[4]=(sequence>>24)&0xFF;
+    header[5]=(sequence>>16)&0xFF;
+    header[6]=(sequence>>8)&0xFF;
+    header[7]=(sequence)&0xFF;
+}
+
+// Send one Ethernet frame made of two 512 byte USB frames to end point ep.
+// The Metis header and both USB frames go to the transport as an iovec, so
+// the USB frames are sent straight from the caller's buffers without a copy.
+void metis_send_frame(METIS_SESSION* session, unsigned char ep, unsigned char* usb0, unsigned char* usb1) {
+    unsigned char header[8];
+    struct iovec iov[3];
+
+    metis_build_header(session, header, ep);
+
+    iov[0].iov_base=header;
+    iov[0].iov_len=8;
+    iov[1].iov_base=usb0;
+    iov[1].iov_len=512;
+    iov[2].iov_base=usb1;
+    iov[2].iov_len=512;
+
+    if(session->capture != NULL)
+        metis_capture_frame(session->capture, iov, 3, NULL);
+    session->transport->send(&session->link,iov,3,1);
 }
 
-void metis_send_buffer(unsigned char* buffer,int length) {
+// Send nframes Ethernet frames. usb[] holds two USB frame pointers per
+// Ethernet frame, in order. The transport gets at most METIS_MAX_TX_BATCH
+// frames per call (one sendmmsg() on the UDP socket).
+void metis_send_frames(METIS_SESSION* session, unsigned char ep, unsigned char** usb, int nframes) {
+    unsigned char headers[METIS_MAX_TX_BATCH][8];
+    struct iovec iov[METIS_MAX_TX_BATCH*3];
+    int count;
+    int i;
+
+    while(nframes > 0) {
+        count = nframes > METIS_MAX_TX_BATCH ? METIS_MAX_TX_BATCH : nframes;
+
+        for(i=0;i<count;i++) {
+            metis_build_header(session, headers[i], ep);
+            iov[i*3].iov_base=headers[i];
+            iov[i*3].iov_len=8;
+            iov[i*3+1].iov_base=usb[i*2];
+            iov[i*3+1].iov_len=512;
+            iov[i*3+2].iov_base=usb[i*2+1];
+            iov[i*3+2].iov_len=512;
+            if(session->capture != NULL)
+                metis_capture_frame(session->capture, &iov[i*3], 3, NULL);
+        }
+
+        session->transport->send(&session->link,iov,3,count);
+
+        usb += count*2;
+        nframes -= count;
+    }
+}
+
+void metis_send_buffer(METIS_SESSION* session, unsigned char* buffer,int length) {
+    struct iovec iov;
+
 /*
 fprintf(stderr,"metis_send_buffer. length= %d\nBuffer: ", length);
 
@@ -461,8 +1397,7 @@ for(int i=520; i<528; i++)
 fprintf(stderr,"\n");
 */
 
-    if(sendto(discovery_socket,buffer,length,0,(struct sockaddr*)&data_addr,data_addr_length)!=length) {
-        perror("sendto socket failed for metis_send_data\n");
-        exit(1);
-    }
+    iov.iov_base=buffer;
+    iov.iov_len=length;
+    session->transport->send(&session->link,&iov,1,1);
 }
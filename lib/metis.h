@@ -6,6 +6,8 @@
 #ifndef METIS_H
 #define METIS_H
 
+#include <netinet/in.h>
+
 
 enum {	RxStream_Off,		// Hermes Receiver Stream Controls
 	RxStream_NB_On,		// Narrow Band (down converted)
@@ -13,22 +15,78 @@ enum {	RxStream_Off,		// Hermes Receiver Stream Controls
 	RxStream_NBWB_On	// Narrow Band and Wide Band both On
 };	
 
+enum {	RxBackend_UDP,		// recvfrom()/recvmmsg() on the UDP socket
+	RxBackend_PacketMmap,	// TPACKET_V3 mmap ring on the interface
+	RxBackend_IoUring	// io_uring engine for receive and transmit
+};
+
+enum {	RxSched_Other,		// normal time-shared scheduling
+	RxSched_FIFO,		// SCHED_FIFO at the given priority
+	RxSched_RR		// SCHED_RR at the given priority
+};
+
+enum {	RxReplay_Nominal,	// replay at the sample rate set, the file loops
+	RxReplay_Original,	// replay at the pace the frames were captured
+	RxReplay_Fast		// replay as fast as the proxies take the frames
+};
+
+#define METIS_FRAME_BYTES 1032	// Metis data frame: 8 byte header plus two USB frames
+#define METIS_MAX_RX_BATCH 64	// most datagrams taken by one receive syscall
+#define METIS_MAX_TX_BATCH 16	// most Ethernet frames sent by one sendmmsg()
+#define METIS_LATENCY_BUCKETS 16	// log2 usec receive latency histogram
+#define METIS_HUGE_PAGE (2*1024*1024)	// huge page size metis_arena_alloc() asks for
+
 typedef struct _METIS_CARD {
     char ip_address[16];
     char mac_address[18];
+    struct sockaddr_in address;		// data port, taken from the discovery reply
+    char interface[16];			// where the reply came in, empty when not a network interface
 } METIS_CARD;
 
-void metis_discover(const char* interface);
-int metis_found();
-char* metis_ip_address(int entry);
-char* metis_mac_address(int entry);
-void metis_receive_stream_control(unsigned char, unsigned int);
-void metis_stop_receive_thread();
+class HermesProxy;
+class HermesProxyW;
+
+// One radio, or one radio's NB and WB proxies, with its own transport link,
+// discovery and receive threads and Tx sequence number.
+typedef struct _METIS_SESSION METIS_SESSION;
+
+METIS_SESSION* metis_open(const char* interface, const char* mac, HermesProxy* nb, HermesProxyW* wb);
+void metis_close(METIS_SESSION* session, HermesProxy* nb, HermesProxyW* wb);
 
-int metis_write(unsigned char ep,unsigned char* buffer,int length);
-void* metis_receive_thread(void* arg);
-void metis_send_buffer(unsigned char* buffer,int length);
+void metis_socket_buffers(METIS_SESSION* session, int rcvbuf, int sndbuf);
+unsigned long metis_kernel_drops(METIS_SESSION* session);
+unsigned long metis_length_drops(METIS_SESSION* session);
+void metis_busy_poll(METIS_SESSION* session, int usec);
+void metis_receive_latency(METIS_SESSION* session, unsigned long* histogram, unsigned long* spin_hits);
+void metis_receive_backend(METIS_SESSION* session, int backend);
+void metis_receive_reactor(METIS_SESSION* session, int threads, const char* cpus);
+void metis_receive_scheduling(METIS_SESSION* session, int sched, int priority, const char* cpus);
+void metis_lock_memory();
+void* metis_arena_alloc(size_t bytes, int hugepages, size_t* mapped);
+void metis_arena_free(void* arena, size_t mapped);
+size_t metis_arena_round(size_t bytes);
+unsigned metis_ring_size(int requested, unsigned fallback, unsigned min, unsigned max);
+void metis_receive_reorder(METIS_SESSION* session, int window);
+void metis_receive_pipeline(METIS_SESSION* session, int enable, const char* cpus);
+unsigned long metis_pipeline_drops(METIS_SESSION* session, int ep);
+void metis_capture_file(METIS_SESSION* session, const char* path);
+void metis_replay_pacing(METIS_SESSION* session, int pace);
+int metis_receive_finished(METIS_SESSION* session);
+void metis_receive_reorder_statistics(METIS_SESSION* session, int ep, unsigned long* reordered,
+                                      unsigned long* duplicates, unsigned long* late, unsigned long* gaps);
+void metis_receive_batch(METIS_SESSION* session, int batch, int timeout_us);
+int metis_receive_batching(METIS_SESSION* session);
+void metis_receive_statistics(METIS_SESSION* session, unsigned long* syscalls, unsigned long* packets);
+void metis_discover(METIS_SESSION* session);
+int metis_found(METIS_SESSION* session);
+int metis_wait_found(METIS_SESSION* session, const char* mac, int timeout_ms);
+char* metis_ip_address(METIS_SESSION* session, int entry);
+char* metis_mac_address(METIS_SESSION* session, int entry);
+void metis_receive_stream_control(METIS_SESSION* session, unsigned char, unsigned int);
 
+void metis_send_frame(METIS_SESSION* session, unsigned char ep, unsigned char* usb0, unsigned char* usb1);
+void metis_send_frames(METIS_SESSION* session, unsigned char ep, unsigned char** usb, int nframes);
+void metis_send_buffer(METIS_SESSION* session, unsigned char* buffer,int length);
 
 #endif  // METIS_H
 
@@ -0,0 +1,378 @@
+/* -*-  C++  -*-  */
+/* metis_capture.cc */
+
+/*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*
+*/
+
+// Raw frame capture (see metis_capture.h).
+//
+// A block holds METIS_CAPTURE_BLOCK_RECORDS records, 135168 bytes, which
+// is a whole number of 4096 byte pages, so every block starts on a page
+// in the file and O_DIRECT can take it straight from memory. The blocks
+// are used in turn: capturing threads fill blocks[filled % CAPTURE_BLOCKS]
+// under the lock, the writer thread writes blocks[written % CAPTURE_BLOCKS]
+// without it, and a block is only filled again once it has been written.
+// The last, partly filled block is padded to a page and the file is cut
+// back to its records afterwards.
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include "metis_capture.h"
+
+#define CAPTURE_BLOCKS		64		// about 8 MB, over 2 sec of 384 kHz EP6 with EP4 and EP2
+#define CAPTURE_BLOCK_BYTES	(METIS_CAPTURE_BLOCK_RECORDS * METIS_CAPTURE_RECORD)
+#define CAPTURE_PAGE		4096		// O_DIRECT alignment of buffers, offsets and lengths
+
+typedef struct _CAPTURE_BLOCK {
+    unsigned char* data;		// CAPTURE_BLOCK_BYTES, page aligned
+    int records;			// filled so far
+    unsigned char index[METIS_CAPTURE_INDEX_ENTRY];	// entry for the first record
+} CAPTURE_BLOCK;
+
+struct _METIS_CAPTURE {
+    char path[512];
+    int fd;
+    int direct;				// fd is O_DIRECT
+    FILE* index;
+
+    pthread_mutex_t lock;		// guards everything below
+    pthread_cond_t cond;		// a block is full, or stop
+    CAPTURE_BLOCK blocks[CAPTURE_BLOCKS];
+    unsigned long filled;		// blocks handed to the writer
+    unsigned long written;		// blocks the writer is done with
+    int stop;
+    int failed;				// a write failed, nothing more is taken
+
+    unsigned long long records;		// in the file, its header included
+    unsigned long dropped;		// frames there was no block for
+    unsigned int last_sequence[3];	// EP6, EP4, EP2, for the index
+
+    pthread_t writer_thread_id;
+};
+
+
+static void metis_capture_put32(unsigned char* p, unsigned int value) {
+    p[0] = (value >> 24) & 0xFF;
+    p[1] = (value >> 16) & 0xFF;
+    p[2] = (value >> 8) & 0xFF;
+    p[3] = value & 0xFF;
+}
+
+static void metis_capture_put64(unsigned char* p, unsigned long long value) {
+    metis_capture_put32(p, (unsigned int)(value >> 32));
+    metis_capture_put32(p+4, (unsigned int)value);
+}
+
+static unsigned int metis_capture_get32(const unsigned char* p) {
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static unsigned long long metis_capture_get64(const unsigned char* p) {
+    return ((unsigned long long)metis_capture_get32(p) << 32) | metis_capture_get32(p+4);
+}
+
+// The index entry for a block whose first record is record, stamped stamp.
+static void metis_capture_index_entry(METIS_CAPTURE* capture, unsigned char* entry,
+                                      unsigned long long record, const struct timespec* stamp) {
+    metis_capture_put64(entry, record);
+    metis_capture_put64(entry+8, (unsigned long long)stamp->tv_sec);
+    metis_capture_put32(entry+16, (unsigned int)stamp->tv_nsec);
+    metis_capture_put32(entry+20, capture->last_sequence[0]);
+    metis_capture_put32(entry+24, capture->last_sequence[1]);
+    metis_capture_put32(entry+28, capture->last_sequence[2]);
+}
+
+// Write bytes of block to the file at offset, and its index entry after
+// it, so the index never points past what is on disk. A file system that
+// refuses O_DIRECT writes gets them buffered instead.
+static void metis_capture_write(METIS_CAPTURE* capture, CAPTURE_BLOCK* block, long bytes, off_t offset) {
+    long done = 0;
+    ssize_t rc;
+
+    while(done < bytes) {
+        rc = pwrite(capture->fd, block->data + done, bytes - done, offset + done);
+        if(rc < 0 && errno == EINVAL && capture->direct) {
+            fcntl(capture->fd, F_SETFL, fcntl(capture->fd, F_GETFL) & ~O_DIRECT);
+            capture->direct = 0;
+            continue;
+        }
+        if(rc < 0 && errno == EINTR)
+            continue;
+        if(rc <= 0) {
+            fprintf(stderr, "Metis capture: write to %s failed: %s, capture stopped\n",
+                capture->path, rc < 0 ? strerror(errno) : "no space");
+            pthread_mutex_lock(&capture->lock);
+            capture->failed = 1;
+            pthread_mutex_unlock(&capture->lock);
+            return;
+        }
+        done += rc;
+    }
+
+    fwrite(block->index, 1, METIS_CAPTURE_INDEX_ENTRY, capture->index);
+    fflush(capture->index);
+}
+
+// Write the full blocks as they come, then on stop whatever is in the
+// block being filled, padded to a page.
+static void* metis_capture_writer_thread(void* arg) {
+    METIS_CAPTURE* capture = (METIS_CAPTURE*)arg;
+    CAPTURE_BLOCK* block;
+    unsigned long number;
+    long bytes;
+
+    pthread_mutex_lock(&capture->lock);
+    while(1) {
+        while(capture->written == capture->filled && !capture->stop)
+            pthread_cond_wait(&capture->cond, &capture->lock);
+        if(capture->written == capture->filled)
+            break;
+
+        number = capture->written;
+        block = &capture->blocks[number % CAPTURE_BLOCKS];
+        pthread_mutex_unlock(&capture->lock);
+
+        if(!capture->failed)
+            metis_capture_write(capture, block, CAPTURE_BLOCK_BYTES, (off_t)number * CAPTURE_BLOCK_BYTES);
+
+        pthread_mutex_lock(&capture->lock);
+        block->records = 0;
+        capture->written++;
+    }
+
+    pthread_mutex_unlock(&capture->lock);		// stop is set, nothing is captured any more
+
+    block = &capture->blocks[capture->filled % CAPTURE_BLOCKS];
+    if(block->records > 0 && !capture->failed) {
+        bytes = (long)block->records * METIS_CAPTURE_RECORD;
+        bytes = (bytes + CAPTURE_PAGE - 1) / CAPTURE_PAGE * CAPTURE_PAGE;
+        metis_capture_write(capture, block, bytes, (off_t)capture->filled * CAPTURE_BLOCK_BYTES);
+    }
+
+    return NULL;
+}
+
+METIS_CAPTURE* metis_capture_open(const char* path, const char* interface) {
+    METIS_CAPTURE* capture;
+    char index_path[528];
+    unsigned char header[16];
+    unsigned char* record;
+    struct timespec now;
+    int rc;
+    int i;
+
+    capture = new METIS_CAPTURE;
+    memset(capture, 0, sizeof(*capture));
+    strncpy(capture->path, path, sizeof(capture->path)-1);
+    memset(capture->last_sequence, 0xFF, sizeof(capture->last_sequence));
+    pthread_mutex_init(&capture->lock, NULL);
+    pthread_cond_init(&capture->cond, NULL);
+
+    capture->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    capture->direct = capture->fd >= 0;
+    if(capture->fd < 0 && errno == EINVAL)		// tmpfs and friends
+        capture->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(capture->fd < 0) {
+        perror("cannot create Metis capture file");
+        exit(1);
+    }
+
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    capture->index = fopen(index_path, "wb");
+    if(capture->index == NULL) {
+        perror("cannot create Metis capture index");
+        exit(1);
+    }
+    memcpy(header, "HPSDRIDX", 8);
+    metis_capture_put32(header+8, METIS_CAPTURE_VERSION);
+    metis_capture_put32(header+12, METIS_CAPTURE_BLOCK_RECORDS);
+    fwrite(header, 1, sizeof(header), capture->index);
+    fflush(capture->index);
+
+    for(i=0;i<CAPTURE_BLOCKS;i++)
+        if(posix_memalign((void**)&capture->blocks[i].data, CAPTURE_PAGE, CAPTURE_BLOCK_BYTES) != 0) {
+            fprintf(stderr, "Metis: no memory for the capture blocks\n");
+            exit(1);
+        }
+
+    // record 0 is the file header
+    clock_gettime(CLOCK_REALTIME, &now);
+    record = capture->blocks[0].data;
+    memset(record, 0, METIS_CAPTURE_RECORD);
+    memcpy(record, "HPSDRCAP", 8);
+    metis_capture_put32(record+8, METIS_CAPTURE_VERSION);
+    metis_capture_put32(record+12, METIS_CAPTURE_RECORD);
+    metis_capture_put32(record+16, METIS_CAPTURE_BLOCK_RECORDS);
+    metis_capture_put64(record+20, (unsigned long long)now.tv_sec);
+    metis_capture_put32(record+28, (unsigned int)now.tv_nsec);
+    strncpy((char*)record+32, interface != NULL ? interface : "", 63);
+    metis_capture_index_entry(capture, capture->blocks[0].index, 0, &now);
+    capture->blocks[0].records = 1;
+    capture->records = 1;
+
+    rc = pthread_create(&capture->writer_thread_id, NULL, metis_capture_writer_thread, capture);
+    if(rc != 0) {
+        fprintf(stderr, "pthread_create failed on metis_capture_writer_thread: rc=%d\n", rc);
+        exit(1);
+    }
+
+    fprintf(stderr, "Metis capture: recording to %s%s\n", path, capture->direct ? " (O_DIRECT)" : "");
+    return capture;
+}
+
+void metis_capture_frame(METIS_CAPTURE* capture, const struct iovec* iov, int iovlen, const struct timespec* stamp) {
+    CAPTURE_BLOCK* block;
+    unsigned char* record;
+    unsigned char* frame;
+    struct timespec now;
+    unsigned int sequence;
+    int length = 0;
+    int ep;
+    int i;
+
+    if(stamp == NULL || stamp->tv_sec == 0) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        stamp = &now;
+    }
+
+    pthread_mutex_lock(&capture->lock);
+    if(capture->stop || capture->failed || capture->filled - capture->written >= CAPTURE_BLOCKS) {
+        capture->dropped++;			// the writer still has this block
+        pthread_mutex_unlock(&capture->lock);
+        return;
+    }
+
+    block = &capture->blocks[capture->filled % CAPTURE_BLOCKS];
+    record = block->data + block->records * METIS_CAPTURE_RECORD;
+    frame = record + METIS_CAPTURE_HEADER;
+
+    for(i=0;i<iovlen && length<METIS_CAPTURE_FRAME;i++) {
+        int piece = (int)iov[i].iov_len;
+        if(piece > METIS_CAPTURE_FRAME - length)
+            piece = METIS_CAPTURE_FRAME - length;
+        memcpy(frame + length, iov[i].iov_base, piece);
+        length += piece;
+    }
+    if(length < METIS_CAPTURE_FRAME)
+        memset(frame + length, 0, METIS_CAPTURE_FRAME - length);
+
+    ep = length >= 8 ? frame[3] : 0;
+    sequence = length >= 8 ? (frame[4] << 24) | (frame[5] << 16) | (frame[6] << 8) | frame[7] : 0;
+    if(ep == 6)
+        capture->last_sequence[0] = sequence;
+    else if(ep == 4)
+        capture->last_sequence[1] = sequence;
+    else if(ep == 2)
+        capture->last_sequence[2] = sequence;
+
+    record[0] = ep;
+    record[1] = ep == 2 ? METIS_CAPTURE_TX : 0;
+    record[2] = (length >> 8) & 0xFF;
+    record[3] = length & 0xFF;
+    metis_capture_put32(record+4, sequence);
+    metis_capture_put64(record+8, (unsigned long long)stamp->tv_sec);
+    metis_capture_put32(record+16, (unsigned int)stamp->tv_nsec);
+    metis_capture_put32(record+20, 0);
+
+    if(block->records == 0)
+        metis_capture_index_entry(capture, block->index, capture->records, stamp);
+    block->records++;
+    capture->records++;
+
+    if(block->records == METIS_CAPTURE_BLOCK_RECORDS) {
+        capture->filled++;
+        pthread_cond_signal(&capture->cond);
+    }
+    pthread_mutex_unlock(&capture->lock);
+}
+
+void metis_capture_close(METIS_CAPTURE* capture) {
+    int i;
+
+    pthread_mutex_lock(&capture->lock);
+    capture->stop = 1;
+    pthread_cond_signal(&capture->cond);
+    pthread_mutex_unlock(&capture->lock);
+    pthread_join(capture->writer_thread_id, NULL);
+
+    if(!capture->failed && ftruncate(capture->fd, (off_t)capture->records * METIS_CAPTURE_RECORD) != 0)
+        perror("Metis capture: cannot trim the capture file");
+    close(capture->fd);
+    fclose(capture->index);
+
+    fprintf(stderr, "Metis capture: %llu frames in %s, %lu dropped\n",
+        capture->records - 1, capture->path, capture->dropped);
+
+    for(i=0;i<CAPTURE_BLOCKS;i++)
+        free(capture->blocks[i].data);
+    pthread_cond_destroy(&capture->cond);
+    pthread_mutex_destroy(&capture->lock);
+    delete capture;
+}
+
+long metis_capture_index(const char* path, METIS_CAPTURE_ENTRY** entries) {
+    char index_path[528];
+    unsigned char header[16];
+    unsigned char entry[METIS_CAPTURE_INDEX_ENTRY];
+    struct stat st;
+    long count;
+    long i;
+    FILE* index;
+
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    index = fopen(index_path, "rb");
+    if(index == NULL)
+        return -1;
+
+    if(fstat(fileno(index), &st) < 0 || fread(header, 1, sizeof(header), index) != sizeof(header) ||
+       memcmp(header, "HPSDRIDX", 8) != 0 || metis_capture_get32(header+8) != METIS_CAPTURE_VERSION ||
+       metis_capture_get32(header+12) != METIS_CAPTURE_BLOCK_RECORDS) {
+        fclose(index);
+        return -1;
+    }
+
+    count = (st.st_size - (long)sizeof(header)) / METIS_CAPTURE_INDEX_ENTRY;
+    *entries = (METIS_CAPTURE_ENTRY*)malloc((count > 0 ? count : 1) * sizeof(METIS_CAPTURE_ENTRY));
+    if(*entries == NULL) {
+        fprintf(stderr, "Metis: no memory for the index of %s\n", path);
+        exit(1);
+    }
+
+    for(i=0;i<count && fread(entry, 1, sizeof(entry), index) == sizeof(entry);i++) {
+        (*entries)[i].record = metis_capture_get64(entry);
+        (*entries)[i].stamp.tv_sec = (time_t)metis_capture_get64(entry+8);
+        (*entries)[i].stamp.tv_nsec = metis_capture_get32(entry+16);
+        (*entries)[i].sequence[0] = metis_capture_get32(entry+20);
+        (*entries)[i].sequence[1] = metis_capture_get32(entry+24);
+        (*entries)[i].sequence[2] = metis_capture_get32(entry+28);
+    }
+    fclose(index);
+    return i;
+}
@@ -0,0 +1,91 @@
+/* -*- c++ -*- */
+/* metis_capture.h */
+
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Raw Metis frame capture to disk.
+//
+// Every data frame received (EP6, EP4) and sent (EP2) is appended to the
+// capture file as it was on the wire, 24 bit samples and all, behind a
+// short record header with its time and sequence number. Records are
+// copied into large aligned blocks and a writer thread of the capture's
+// own writes the full blocks out (with O_DIRECT where the file system
+// allows it), so the threads that capture never wait on the disk. When
+// the writer falls a whole set of blocks behind, frames are dropped and
+// counted instead.
+//
+// File layout, all numbers big endian like the Metis header:
+//
+//   record 0		file header: "HPSDRCAP", version, record size,
+//			records per block, start time, interface
+//   record n		[0] end point, [1] flags (METIS_CAPTURE_TX), [2..3]
+//			frame length, [4..7] sequence number, [8..15] seconds,
+//			[16..19] nanoseconds, then the frame in
+//			METIS_CAPTURE_FRAME bytes
+//
+// Every record is METIS_CAPTURE_RECORD bytes, so record n starts at byte
+// n * METIS_CAPTURE_RECORD. The sidecar index, <path>.idx, has a 16 byte
+// header ("HPSDRIDX", version, records per block) and then one entry per
+// block of METIS_CAPTURE_BLOCK_RECORDS records:
+//
+//   [0..7] record number of the block's first record, [8..15] seconds,
+//   [16..19] nanoseconds of that record, [20..23] [24..27] [28..31] the
+//   EP6, EP4 and EP2 sequence number last captured up to and including
+//   that record (0xFFFFFFFF before the first)
+//
+// so a reader can binary search the index by time or sequence number and
+// scan at most one block of records from there. Sequence numbers start
+// over when the stream is stopped and started again.
+
+#ifndef METIS_CAPTURE_H
+#define METIS_CAPTURE_H
+
+#include <sys/uio.h>
+#include <time.h>
+
+#define METIS_CAPTURE_HEADER		24	// record header bytes
+#define METIS_CAPTURE_FRAME		1032	// frame bytes, METIS_FRAME_BYTES
+#define METIS_CAPTURE_RECORD		1056	// header plus frame
+#define METIS_CAPTURE_BLOCK_RECORDS	128	// records per write and per index entry
+#define METIS_CAPTURE_INDEX_ENTRY	32	// bytes per index entry
+#define METIS_CAPTURE_VERSION		1
+
+#define METIS_CAPTURE_TX		0x01	// record flag: sent to the radio
+
+typedef struct _METIS_CAPTURE METIS_CAPTURE;
+
+// One index entry, as read back.
+typedef struct _METIS_CAPTURE_ENTRY {
+    unsigned long long record;		// the block's first record
+    struct timespec stamp;		// its time
+    unsigned int sequence[3];		// EP6, EP4, EP2 last captured, 0xFFFFFFFF before the first
+} METIS_CAPTURE_ENTRY;
+
+// Create path and path.idx and start the writer thread. Exits when the
+// files cannot be made. interface is noted in the file header.
+METIS_CAPTURE* metis_capture_open(const char* path, const char* interface);
+
+// Append one frame, gathered from iovlen pieces. stamp is its arrival (or
+// send) time; NULL or zero takes the time now. Any thread.
+void metis_capture_frame(METIS_CAPTURE* capture, const struct iovec* iov, int iovlen, const struct timespec* stamp);
+
+// Write out what is left, trim the file to its records, stop the writer
+// and print the totals.
+void metis_capture_close(METIS_CAPTURE* capture);
+
+// Read the index of the capture at path into *entries, which the caller
+// frees. Returns the number of entries, or -1 when there is no index or it
+// is not one for this layout.
+long metis_capture_index(const char* path, METIS_CAPTURE_ENTRY** entries);
+
+#endif  // METIS_CAPTURE_H
@@ -0,0 +1,126 @@
+/* -*-  C++  -*-  */
+/* metis_raw_ring.cc */
+
+/*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*
+*/
+
+// Raw frame SPSC ring (see metis_raw_ring.h).
+//
+// head and tail run freely and are masked on use. The producer publishes
+// with a release store of tail and the consumer frees with a release store
+// of head, each read with acquire by the other side, so a slot's contents
+// are complete before the other side sees it change hands.
+//
+// Sleeping: the consumer sets waiting and then looks at tail again, the
+// producer stores tail and then looks at waiting, both sequentially
+// consistent, so at least one of them sees the other and no wakeup is
+// lost. The timed wait is only a backstop for stopping.
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "metis_raw_ring.h"
+
+
+void metis_raw_ring_init(METIS_RAW_RING* ring, unsigned int frames) {
+    unsigned int size=1;
+
+    while(size < frames)
+        size <<= 1;
+
+    memset(ring,0,sizeof(*ring));
+    ring->slots=(METIS_RAW_SLOT*)calloc(size,sizeof(METIS_RAW_SLOT));
+    if(ring->slots == NULL) {
+        fprintf(stderr,"Metis: no memory for a %u frame raw ring\n", size);
+        exit(1);
+    }
+    ring->mask=size-1;
+    pthread_mutex_init(&ring->lock,NULL);
+    pthread_cond_init(&ring->cond,NULL);
+}
+
+void metis_raw_ring_free(METIS_RAW_RING* ring) {
+    pthread_cond_destroy(&ring->cond);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring->slots);
+    ring->slots=NULL;
+}
+
+METIS_RAW_SLOT* metis_raw_ring_claim(METIS_RAW_RING* ring) {
+    unsigned int tail=ring->tail;
+
+    if(tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > ring->mask) {
+        ring->overruns++;
+        return NULL;
+    }
+    return &ring->slots[tail & ring->mask];
+}
+
+void metis_raw_ring_publish(METIS_RAW_RING* ring) {
+    __atomic_store_n(&ring->tail, ring->tail+1, __ATOMIC_SEQ_CST);
+}
+
+void metis_raw_ring_wake(METIS_RAW_RING* ring) {
+    if(!__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST))
+        return;
+
+    pthread_mutex_lock(&ring->lock);
+    pthread_cond_signal(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+METIS_RAW_SLOT* metis_raw_ring_peek(METIS_RAW_RING* ring) {
+    unsigned int head=ring->head;
+
+    if(head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->slots[head & ring->mask];
+}
+
+void metis_raw_ring_release(METIS_RAW_RING* ring) {
+    __atomic_store_n(&ring->head, ring->head+1, __ATOMIC_RELEASE);
+}
+
+unsigned int metis_raw_ring_count(METIS_RAW_RING* ring) {
+    return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - ring->head;
+}
+
+unsigned int metis_raw_ring_space(METIS_RAW_RING* ring) {
+    return ring->mask + 1 - (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+}
+
+void metis_raw_ring_wait(METIS_RAW_RING* ring, int timeout_ms) {
+    struct timespec until;
+
+    clock_gettime(CLOCK_REALTIME,&until);
+    until.tv_sec += timeout_ms/1000;
+    until.tv_nsec += (timeout_ms%1000)*1000000L;
+    if(until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == ring->head)
+        pthread_cond_timedwait(&ring->cond,&ring->lock,&until);
+    __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ring->lock);
+}
@@ -0,0 +1,82 @@
+/* -*- c++ -*- */
+/* metis_raw_ring.h */
+
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Single producer, single consumer ring of raw Metis frames.
+//
+// The producer claims a slot, fills it and publishes it; the consumer
+// peeks at the oldest published slot, uses it in place and releases it.
+// Neither side takes a lock on the way. A consumer that finds the ring
+// empty can sleep in metis_raw_ring_wait(), and the producer only touches
+// the mutex to wake it when it is actually asleep.
+
+#ifndef METIS_RAW_RING_H
+#define METIS_RAW_RING_H
+
+#include <pthread.h>
+#include <time.h>
+
+#include "metis.h"
+
+#define METIS_RAW_RING_FRAMES	1024		// default depth, about 100 ms of 384 kHz EP6
+
+typedef struct _METIS_RAW_SLOT {
+    int length;
+    struct timespec stamp;		// kernel arrival time, zero when none
+    unsigned char frame[METIS_FRAME_BYTES];
+} METIS_RAW_SLOT;
+
+typedef struct _METIS_RAW_RING {
+    METIS_RAW_SLOT* slots;
+    unsigned int mask;			// slots - 1, a power of two
+    char pad0[64];			// producer and consumer fields on cache lines of their own
+
+    unsigned int tail;			// next slot to publish, written by the producer
+    unsigned long overruns;		// frames the producer found no room for
+    char pad1[64];
+
+    unsigned int head;			// next slot to release, written by the consumer
+    int waiting;			// the consumer is, or is about to be, asleep
+    char pad2[64];
+
+    pthread_mutex_t lock;		// only for sleeping and waking
+    pthread_cond_t cond;
+} METIS_RAW_RING;
+
+// Make a ring of frames slots, rounded up to a power of two.
+void metis_raw_ring_init(METIS_RAW_RING* ring, unsigned int frames);
+void metis_raw_ring_free(METIS_RAW_RING* ring);
+
+// Producer: the slot to fill next, or NULL (and an overrun counted) when
+// the ring is full. metis_raw_ring_publish() hands it to the consumer;
+// metis_raw_ring_wake() after a group of them wakes a sleeping consumer.
+METIS_RAW_SLOT* metis_raw_ring_claim(METIS_RAW_RING* ring);
+void metis_raw_ring_publish(METIS_RAW_RING* ring);
+void metis_raw_ring_wake(METIS_RAW_RING* ring);
+
+// Consumer: the oldest published slot, or NULL when the ring is empty.
+// metis_raw_ring_release() gives it back to the producer.
+METIS_RAW_SLOT* metis_raw_ring_peek(METIS_RAW_RING* ring);
+void metis_raw_ring_release(METIS_RAW_RING* ring);
+
+// Consumer: published slots waiting.
+unsigned int metis_raw_ring_count(METIS_RAW_RING* ring);
+
+// Producer: slots free to claim.
+unsigned int metis_raw_ring_space(METIS_RAW_RING* ring);
+
+// Consumer: sleep until a slot is published or timeout_ms has passed.
+void metis_raw_ring_wait(METIS_RAW_RING* ring, int timeout_ms);
+
+#endif  // METIS_RAW_RING_H
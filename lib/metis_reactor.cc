@@ -0,0 +1,289 @@
+/* -*-  C++  -*-  */
+/* metis_reactor.cc */
+
+/*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*
+*/
+
+// epoll receive threads shared by the sessions (see metis_reactor.h).
+//
+// Each pool thread has its own epoll set and a source stays on the thread
+// it was given, the one with the fewest sources at the time, so a radio's
+// frames are always handled on the same core and in order.
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include "metis.h"
+#include "metis_reactor.h"
+
+#define REACTOR_EVENTS		16		// ready descriptors taken per epoll_wait()
+#define REACTOR_WAIT_MSEC	100		// longest a thread waits before checking for a stop
+
+typedef struct _REACTOR_THREAD {
+    pthread_t id;
+    int epoll_fd;
+    int sources;			// sources on this thread
+    unsigned long passes;		// epoll_wait() rounds completed
+} REACTOR_THREAD;
+
+struct _METIS_REACTOR_SOURCE {
+    int fd;
+    void (*ready)(void* arg);
+    void* arg;
+    REACTOR_THREAD* thread;
+};
+
+static pthread_mutex_t reactor_lock = PTHREAD_MUTEX_INITIALIZER;	// guards everything below
+static REACTOR_THREAD reactor_threads[METIS_MAX_REACTOR_THREADS];
+static int reactor_nthreads = 0;
+static int reactor_sources = 0;
+static int reactor_stop = 0;
+static char reactor_cpus[64];		// what the pool was started with
+static int reactor_sched;
+static int reactor_priority;
+
+
+static void* metis_reactor_thread(void* arg) {
+    REACTOR_THREAD* thread=(REACTOR_THREAD*)arg;
+    struct epoll_event events[REACTOR_EVENTS];
+    METIS_REACTOR_SOURCE* source;
+    int count;
+    int i;
+
+    while(!__atomic_load_n(&reactor_stop, __ATOMIC_ACQUIRE)) {
+        count=epoll_wait(thread->epoll_fd,events,REACTOR_EVENTS,REACTOR_WAIT_MSEC);
+        if(count<0 && errno != EINTR) {
+            perror("epoll_wait failed for metis_reactor_thread");
+            exit(1);
+        }
+
+        for(i=0;i<count;i++) {
+            source=(METIS_REACTOR_SOURCE*)events[i].data.ptr;
+            source->ready(source->arg);
+        }
+
+        __atomic_add_fetch(&thread->passes, 1, __ATOMIC_RELEASE);	// see metis_reactor_remove()
+    }
+
+    return NULL;
+}
+
+int metis_cpu_list(const char* list, int* cpu, int max) {
+    const char* p=list;
+    char* end;
+    long first;
+    long last;
+    int n=0;
+
+    while(p != NULL && *p && n < max) {
+        first=strtol(p,&end,10);
+        if(end == p)
+            break;
+        last=first;
+        if(*end == '-')
+            last=strtol(end+1,&end,10);
+        for(;first<=last && n<max;first++)
+            cpu[n++]=(int)first;
+        p = *end == ',' ? end+1 : NULL;
+    }
+
+    return n;
+}
+
+// Real-time policies need CAP_SYS_NICE or an RLIMIT_RTPRIO allowance;
+// without them the thread keeps running under SCHED_OTHER.
+void metis_thread_setup(pthread_t thread, const char* who, int sched, int priority, const char* cpus) {
+    struct sched_param param;
+    int cpu[CPU_SETSIZE];
+    int ncpus=metis_cpu_list(cpus,cpu,CPU_SETSIZE);
+    cpu_set_t set;
+    int policy;
+    int rc;
+    int i;
+
+    if(sched == RxSched_FIFO || sched == RxSched_RR) {
+        policy = sched == RxSched_FIFO ? SCHED_FIFO : SCHED_RR;
+        if(priority < sched_get_priority_min(policy))
+            priority = sched_get_priority_min(policy);
+        if(priority > sched_get_priority_max(policy))
+            priority = sched_get_priority_max(policy);
+        param.sched_priority=priority;
+        rc=pthread_setschedparam(thread,policy,&param);
+        if(rc != 0)
+            fprintf(stderr,"Metis %s: cannot set %s priority %d: %s%s\n",who,
+                policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR",priority,strerror(rc),
+                rc == EPERM ? " (needs CAP_SYS_NICE or an rtprio limit)" : "");
+    }
+
+    if(ncpus > 0) {
+        CPU_ZERO(&set);
+        for(i=0;i<ncpus;i++)
+            if(cpu[i] >= 0 && cpu[i] < CPU_SETSIZE)
+                CPU_SET(cpu[i],&set);
+        rc=pthread_setaffinity_np(thread,sizeof(set),&set);
+        if(rc != 0)
+            fprintf(stderr,"Metis %s: cannot pin to cpus %s: %s\n",who,cpus,strerror(rc));
+    }
+
+    if(sched != RxSched_FIFO && sched != RxSched_RR && ncpus == 0)
+        return;				// nothing asked for, nothing to report
+
+    // report what the thread actually got
+    if(pthread_getschedparam(thread,&policy,&param) == 0)
+        fprintf(stderr,"Metis %s: %s priority %d",who,
+            policy == SCHED_FIFO ? "SCHED_FIFO" : policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER",
+            param.sched_priority);
+    if(pthread_getaffinity_np(thread,sizeof(set),&set) == 0) {
+        fprintf(stderr,", cpus");
+        for(i=0;i<CPU_SETSIZE;i++)
+            if(CPU_ISSET(i,&set))
+                fprintf(stderr," %d",i);
+    }
+    fprintf(stderr,"\n");
+}
+
+// Start threads pool threads, pinned in turn to the cores in cpus. passes
+// carries on from the last pool, see metis_reactor_remove().
+static void metis_reactor_start(int threads, const char* cpus, int sched, int priority) {
+    int cpu[CPU_SETSIZE];
+    int ncpus=metis_cpu_list(cpus,cpu,CPU_SETSIZE);
+    char who[32];
+    char one[16];
+    int rc;
+    int i;
+
+    strncpy(reactor_cpus,cpus,sizeof(reactor_cpus)-1);
+    reactor_sched=sched;
+    reactor_priority=priority;
+
+    __atomic_store_n(&reactor_stop, 0, __ATOMIC_RELEASE);
+    for(i=0;i<threads;i++) {
+        reactor_threads[i].sources=0;
+        reactor_threads[i].epoll_fd=epoll_create1(EPOLL_CLOEXEC);
+        if(reactor_threads[i].epoll_fd<0) {
+            perror("epoll_create1 failed for metis_reactor_thread");
+            exit(1);
+        }
+
+        rc=pthread_create(&reactor_threads[i].id,NULL,metis_reactor_thread,&reactor_threads[i]);
+        if(rc != 0) {
+            fprintf(stderr,"pthread_create failed on metis_reactor_thread: rc=%d\n", rc);
+            exit(1);
+        }
+
+        snprintf(who,sizeof(who),"reactor thread %d",i);
+        one[0]=0;
+        if(ncpus > 0)
+            snprintf(one,sizeof(one),"%d",cpu[i % ncpus]);
+        metis_thread_setup(reactor_threads[i].id,who,sched,priority,one);
+    }
+    reactor_nthreads=threads;
+
+    fprintf(stderr,"Metis reactor: %d receive thread%s\n",threads,threads == 1 ? "" : "s");
+}
+
+static void metis_reactor_shutdown() {
+    int i;
+
+    __atomic_store_n(&reactor_stop, 1, __ATOMIC_RELEASE);
+    for(i=0;i<reactor_nthreads;i++) {
+        pthread_join(reactor_threads[i].id,NULL);
+        close(reactor_threads[i].epoll_fd);
+        __atomic_add_fetch(&reactor_threads[i].passes, 1, __ATOMIC_RELEASE);	// no round under way now
+    }
+    reactor_nthreads=0;
+}
+
+METIS_REACTOR_SOURCE* metis_reactor_add(int fd, void (*ready)(void* arg), void* arg,
+                                        int threads, const char* cpus, int sched, int priority) {
+    METIS_REACTOR_SOURCE* source=new METIS_REACTOR_SOURCE;
+    struct epoll_event event;
+    REACTOR_THREAD* thread;
+    int i;
+
+    source->fd=fd;
+    source->ready=ready;
+    source->arg=arg;
+
+    if(cpus == NULL)
+        cpus = "";
+    if(threads < 1)
+        threads = 1;
+    if(threads > METIS_MAX_REACTOR_THREADS)
+        threads = METIS_MAX_REACTOR_THREADS;
+
+    pthread_mutex_lock(&reactor_lock);
+    if(reactor_nthreads == 0)
+        metis_reactor_start(threads,cpus,sched,priority);
+    else if(threads != reactor_nthreads || strncmp(cpus,reactor_cpus,sizeof(reactor_cpus)-1) != 0 ||
+            sched != reactor_sched || priority != reactor_priority)
+        fprintf(stderr,"Metis reactor: already running with %d thread%s on cpus \"%s\", "
+            "this radio's reactor threads, cpus and scheduling are ignored\n",
+            reactor_nthreads,reactor_nthreads == 1 ? "" : "s",reactor_cpus);
+
+    thread=&reactor_threads[0];
+    for(i=1;i<reactor_nthreads;i++)
+        if(reactor_threads[i].sources < thread->sources)
+            thread=&reactor_threads[i];
+    source->thread=thread;
+    thread->sources++;
+    reactor_sources++;
+
+    memset(&event,0,sizeof(event));
+    event.events=EPOLLIN;
+    event.data.ptr=source;
+    if(epoll_ctl(thread->epoll_fd,EPOLL_CTL_ADD,fd,&event)<0) {
+        perror("epoll_ctl failed for metis_reactor_add");
+        exit(1);
+    }
+    pthread_mutex_unlock(&reactor_lock);
+
+    return source;
+}
+
+// Once the descriptor is out of the epoll set, only a round that was
+// already under way can still call ready(). Wait for that round to end,
+// without holding up the other sources: the thread counts the round in
+// passes, and so does a shutdown of the pool (its threads are joined).
+void metis_reactor_remove(METIS_REACTOR_SOURCE* source) {
+    REACTOR_THREAD* thread=source->thread;
+    struct timespec wait = { 0, 1000000L };
+    unsigned long passes;
+
+    pthread_mutex_lock(&reactor_lock);
+    epoll_ctl(thread->epoll_fd,EPOLL_CTL_DEL,source->fd,NULL);
+    passes=__atomic_load_n(&thread->passes, __ATOMIC_ACQUIRE);
+    thread->sources--;
+    if(--reactor_sources == 0)
+        metis_reactor_shutdown();		// the next source starts the pool afresh
+    pthread_mutex_unlock(&reactor_lock);
+
+    while(__atomic_load_n(&thread->passes, __ATOMIC_ACQUIRE) == passes)
+        nanosleep(&wait,NULL);
+
+    delete source;
+}
@@ -0,0 +1,55 @@
+/* -*- c++ -*- */
+/* metis_reactor.h */
+
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Shared receive threads for metis.cc.
+//
+// Instead of one blocking receive thread per session, a small pool of
+// threads waits with epoll on the data descriptors of every session that
+// uses it, and calls the session back when its descriptor is readable.
+// The pool is started by the first source added and stopped when the last
+// one is removed.
+
+#ifndef METIS_REACTOR_H
+#define METIS_REACTOR_H
+
+#include <pthread.h>
+
+#define METIS_MAX_REACTOR_THREADS 8
+
+typedef struct _METIS_REACTOR_SOURCE METIS_REACTOR_SOURCE;
+
+// Call ready(arg) from a pool thread whenever fd is readable (level
+// triggered: until ready() has taken everything). threads and cpus only
+// count when this starts the pool: the number of threads, and a list like
+// "2,3" or "2-5" of the cores they are pinned to in turn ("" = not pinned).
+// So do sched (RxSched_*) and priority, the scheduling of the threads.
+// A later source asking for other ones is told that they are ignored.
+METIS_REACTOR_SOURCE* metis_reactor_add(int fd, void (*ready)(void* arg), void* arg,
+                                        int threads, const char* cpus, int sched, int priority);
+
+// Stop calling back. When this returns ready() is not running for the
+// source and will not be called again.
+void metis_reactor_remove(METIS_REACTOR_SOURCE* source);
+
+// Parse a list like "2,3" or "0-3,6" into cpu[], at most max entries.
+// Returns the number of entries.
+int metis_cpu_list(const char* list, int* cpu, int max);
+
+// Give a thread the RxSched_* policy at priority and, unless cpus is NULL
+// or empty, the cores in cpus. When either was asked for, prints what was
+// applied, or why not, as "Metis <who>: ...".
+void metis_thread_setup(pthread_t thread, const char* who, int sched, int priority, const char* cpus);
+
+#endif  // METIS_REACTOR_H
@@ -0,0 +1,171 @@
+/* -*-  C++  -*-  */
+/* metis_reorder.cc */
+
+/*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*
+*/
+
+// Sequence number reorder window (see metis_reorder.h).
+//
+// Sequence numbers are compared modulo 2^32, as the signed distance from
+// the next expected one. A held frame lives in slot sequence % METIS_MAX_REORDER;
+// the window never spans more than that many numbers, so slots do not clash.
+
+
+#include <string.h>
+
+#include "metis_reorder.h"
+
+#define REORDER_HISTORY	64		// frames behind expected told apart as duplicate or late
+
+
+static unsigned int metis_reorder_sequence(unsigned char* frame) {
+    return ((unsigned int)frame[4] << 24) | ((unsigned int)frame[5] << 16) |
+           ((unsigned int)frame[6] << 8) | (unsigned int)frame[7];
+}
+
+// Move expected on by one, handing on its frame if held, otherwise
+// counting it as a gap.
+static void metis_reorder_step(METIS_REORDER* reorder, METIS_DELIVER deliver, void* arg) {
+    METIS_REORDER_SLOT* slot=&reorder->slots[reorder->expected % METIS_MAX_REORDER];
+
+    if(slot->held && slot->sequence == reorder->expected) {
+        deliver(arg,slot->frame,&slot->stamp);
+        slot->held=0;
+        reorder->holding--;
+        reorder->history=(reorder->history<<1) | 1;
+    } else {
+        reorder->gaps++;
+        reorder->history<<=1;
+    }
+    reorder->expected++;
+}
+
+// Hand on the held frames that now follow expected without a hole.
+static void metis_reorder_release(METIS_REORDER* reorder, METIS_DELIVER deliver, void* arg) {
+    METIS_REORDER_SLOT* slot;
+
+    while(reorder->holding > 0) {
+        slot=&reorder->slots[reorder->expected % METIS_MAX_REORDER];
+        if(!slot->held || slot->sequence != reorder->expected)
+            break;
+        metis_reorder_step(reorder,deliver,arg);
+    }
+}
+
+// Move expected on to sequence, giving up on whatever is missing before it.
+static void metis_reorder_advance(METIS_REORDER* reorder, unsigned int sequence, METIS_DELIVER deliver, void* arg) {
+    unsigned int skip;
+
+    while((int)(sequence - reorder->expected) > 0) {
+        skip=sequence - reorder->expected;
+        if(reorder->holding == 0 && skip > REORDER_HISTORY) {
+            reorder->gaps+=skip;		// nothing held in a long run of lost frames
+            reorder->history=0;
+            reorder->expected=sequence;
+            break;
+        }
+        metis_reorder_step(reorder,deliver,arg);
+    }
+}
+
+void metis_reorder_init(METIS_REORDER* reorder, int window) {
+    int i;
+
+    if(window < 0)
+        window = 0;
+    if(window > METIS_MAX_REORDER)
+        window = METIS_MAX_REORDER;
+
+    reorder->window=window;
+    reorder->started=0;
+    reorder->holding=0;
+    reorder->history=0;
+    for(i=0;i<METIS_MAX_REORDER;i++)
+        reorder->slots[i].held=0;
+}
+
+void metis_reorder_push(METIS_REORDER* reorder, unsigned char* frame, int length,
+                        const struct timespec* stamp, METIS_DELIVER deliver, void* arg) {
+    METIS_REORDER_SLOT* slot;
+    unsigned int sequence;
+    int distance;
+
+    if(reorder->window == 0 || length < 8 || length > METIS_FRAME_BYTES) {
+        deliver(arg,frame,stamp);
+        return;
+    }
+
+    sequence=metis_reorder_sequence(frame);
+    if(!reorder->started) {
+        reorder->started=1;
+        reorder->expected=sequence;
+        reorder->history=0;
+    }
+
+    distance=(int)(sequence - reorder->expected);
+    if(distance < 0) {
+        if(distance >= -REORDER_HISTORY) {
+            if((reorder->history >> (-distance-1)) & 1)
+                reorder->duplicates++;
+            else
+                reorder->late++;
+            return;
+        }
+
+        // far behind: the radio started its sequence over
+        metis_reorder_flush(reorder,deliver,arg);
+        reorder->started=1;
+        reorder->expected=sequence;
+        distance=0;
+    }
+
+    if(distance >= reorder->window) {
+        metis_reorder_advance(reorder,sequence - reorder->window + 1,deliver,arg);
+        metis_reorder_release(reorder,deliver,arg);
+        distance=(int)(sequence - reorder->expected);
+    }
+
+    if(distance == 0) {
+        if(reorder->holding > 0)
+            reorder->reordered++;		// a later frame got here first
+        deliver(arg,frame,stamp);
+        reorder->history=(reorder->history<<1) | 1;
+        reorder->expected++;
+        metis_reorder_release(reorder,deliver,arg);
+        return;
+    }
+
+    slot=&reorder->slots[sequence % METIS_MAX_REORDER];
+    if(slot->held) {
+        reorder->duplicates++;			// only sequence can be in this slot now
+        return;
+    }
+    memcpy(slot->frame,frame,length);
+    if(stamp != NULL)
+        slot->stamp=*stamp;
+    else
+        memset(&slot->stamp,0,sizeof(slot->stamp));
+    slot->sequence=sequence;
+    slot->held=1;
+    reorder->holding++;
+}
+
+void metis_reorder_flush(METIS_REORDER* reorder, METIS_DELIVER deliver, void* arg) {
+    while(reorder->holding > 0)
+        metis_reorder_step(reorder,deliver,arg);
+    reorder->started=0;
+}
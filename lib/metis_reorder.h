@@ -0,0 +1,68 @@
+/* -*- c++ -*- */
+/* metis_reorder.h */
+
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Sequence number reorder window for the Metis data frames of one end point.
+//
+// Frames that arrive ahead of the next expected sequence number are copied
+// aside and held; in-order frames are handed on at once, followed by any
+// held ones they make contiguous. A missing frame is given up on, and
+// counted as a gap, only when a frame window or more ahead of it arrives,
+// so a frame is never held back by more than window-1 later ones.
+
+#ifndef METIS_REORDER_H
+#define METIS_REORDER_H
+
+#include <time.h>
+
+#include "metis.h"
+
+#define METIS_MAX_REORDER	16		// largest window, in frames
+
+typedef void (*METIS_DELIVER)(void* arg, unsigned char* frame, const struct timespec* stamp);
+
+typedef struct _METIS_REORDER_SLOT {
+    int held;
+    unsigned int sequence;
+    struct timespec stamp;
+    unsigned char frame[METIS_FRAME_BYTES];
+} METIS_REORDER_SLOT;
+
+typedef struct _METIS_REORDER {
+    int window;				// frames, 0 hands every frame on as it comes
+    int started;			// expected is valid
+    unsigned int expected;		// next sequence number to hand on
+    int holding;			// slots in use
+    unsigned long long history;		// bit i: expected-1-i was handed on
+    METIS_REORDER_SLOT slots[METIS_MAX_REORDER];
+
+    unsigned long reordered;		// arrived after a later frame and were put back in place
+    unsigned long duplicates;		// already handed on or already held
+    unsigned long late;			// arrived after their gap was declared, dropped
+    unsigned long gaps;			// frames given up on when the window moved past them
+} METIS_REORDER;
+
+// Empty the window and set its size, capped at METIS_MAX_REORDER. The
+// counters are kept.
+void metis_reorder_init(METIS_REORDER* reorder, int window);
+
+// Take one frame of length bytes and hand it and whatever it releases to
+// deliver(arg, ...), in sequence order.
+void metis_reorder_push(METIS_REORDER* reorder, unsigned char* frame, int length,
+                        const struct timespec* stamp, METIS_DELIVER deliver, void* arg);
+
+// Hand on everything held, in order, and start over with the next frame.
+void metis_reorder_flush(METIS_REORDER* reorder, METIS_DELIVER deliver, void* arg);
+
+#endif  // METIS_REORDER_H
@@ -0,0 +1,663 @@
+/* -*-  C++  -*-  */
+/* metis_sim.cc */
+
+/*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*
+*/
+
+// Transports that need no radio (see metis_transport.h).
+//
+// Loopback - a radio inside the process. It answers discovery, obeys the
+// start/stop command and produces EP6 frames carrying a tone at 1/64 of the
+// sample rate (1 receiver layout) and EP4 frames carrying a tone at 1/64 of
+// the ADC rate. Selected with the interface name "loopback".
+//
+// Replay - frames read back from a capture file (metis_capture.h) or a
+// file of back to back 1032 byte Metis frames, as seen on the wire.
+// Selected with the interface name "file:<path>". EP6 and EP4 frames are
+// handed out as their stream is enabled, paced as config.replay_pace says:
+//
+//   RxReplay_Nominal	at the pace the radio would, renumbered so the
+//			proxies see no gaps; the file wraps at the end
+//   RxReplay_Original	in file order, each at the time since the first
+//			that it was captured (capture files only)
+//   RxReplay_Fast	in file order, as soon as asked for
+//
+// The last two play the file once, with the captured sequence numbers and
+// arrival times, and then set the link's finished flag.
+//
+// Loopback and nominal replay produce frames at the pace the radio would:
+// one tick per EP6 frame's worth of samples at the sample rate set by the
+// C&C bytes of the Tx frames sent to them. A loopback frame holds 126
+// samples, one receiver; a replayed frame as many as the capture's
+// receiver count allows (72 with two), taken from the C&C bytes of the
+// EP2 frames in the file, or of those sent to it when the file has none.
+// Each link gets a radio of its own, so several sessions can run at once.
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <math.h>
+
+#include <string.h>
+#include <errno.h>
+
+#include "metis.h"
+#include "metis_transport.h"
+#include "metis_capture.h"
+
+#define SIM_FRAME_SIZE	1032		// Metis header + two USB frames
+#define SIM_SAMPLES	126		// complex samples per EP6 frame, 1 receiver
+#define SIM_SCAN_FRAMES	1024		// frames looked through for the capture's receiver count
+#define SIM_TONE_SIZE	64		// tone period, samples
+#define SIM_WAIT_MSEC	100		// longest a receive sleeps before returning 0
+
+// One simulated radio, per link.
+typedef struct _SIM_LINK {
+    int streams;			// start command bits: 1 = EP6, 2 = EP4
+    int speed;				// C1 speed bits: 0 = 48k .. 3 = 384k
+    int cc_receivers;			// C4 receiver count of the Tx frames
+    int receivers;			// EP6 layout, sets the tick; 0 = cc_receivers
+    unsigned long tx_frames;		// EP2 frames received from the proxies
+    int discovered;			// discovery answered once already
+    int restart;			// streams started, receive restarts the clock
+
+    struct timespec deadline;		// CLOCK_MONOTONIC time of the next tick
+    unsigned int ep6_sequence;
+    unsigned int ep4_sequence;
+    unsigned int phase;			// tone phase, samples
+
+    unsigned char slots[METIS_MAX_RX_BATCH][SIM_FRAME_SIZE];
+    unsigned char reply[63];		// discovery reply
+
+    int tone_i[SIM_TONE_SIZE];		// 24 bit I and Q of the EP6 tone
+    int tone_q[SIM_TONE_SIZE];
+    short tone_adc[SIM_TONE_SIZE];	// 16 bit ADC samples of the EP4 tone
+
+    int replay_fd;
+    unsigned char* replay_map;		// the capture file, read only
+    size_t replay_size;
+    long replay_record;			// bytes from one frame to the next
+    long replay_first;			// offset of frame 0's record
+    int replay_stamped;			// a capture file: records carry their time
+    int replay_pace;			// RxReplay_*
+    long replay_frames;			// whole frames in the file
+    long replay_next[7];		// next frame to look at, per end point
+    int replay_has[7];			// file holds frames for this end point
+    long replay_position;		// next frame in file order, Original and Fast
+    struct timespec replay_base;	// CLOCK_MONOTONIC time replay_base_stamp is due
+    struct timespec replay_base_stamp;	// capture time of the frame due at replay_base
+} SIM_LINK;
+
+
+// ********** shared by loopback and replay **********
+
+// Give the link a fresh simulated radio with MAC 02:00:00:00:00:mac.
+static SIM_LINK* metis_sim_open(METIS_LINK* link, unsigned char mac) {
+    SIM_LINK* sim;
+    int i;
+
+    sim = (SIM_LINK*)calloc(1, sizeof(SIM_LINK));
+    if(sim == NULL) {
+        perror("cannot allocate Metis simulated radio");
+        exit(1);
+    }
+    sim->replay_fd = -1;
+    sim->cc_receivers = 1;
+    sim->receivers = 1;
+    link->state = sim;
+
+    for(i=0;i<SIM_TONE_SIZE;i++) {
+        sim->tone_i[i] = (int)(0x100000 * cos(2 * M_PI * i / SIM_TONE_SIZE));	// -18 dBFS
+        sim->tone_q[i] = (int)(0x100000 * sin(2 * M_PI * i / SIM_TONE_SIZE));
+        sim->tone_adc[i] = (short)(0x1000 * sin(2 * M_PI * i / SIM_TONE_SIZE));
+    }
+
+    memset(sim->reply, 0, sizeof(sim->reply));
+    sim->reply[0] = 0xEF;
+    sim->reply[1] = 0xFE;
+    sim->reply[2] = 0x02;
+    sim->reply[3] = 0x02;		// locally administered MAC 02:00:00:00:00:mac
+    sim->reply[8] = mac;
+    return sim;
+}
+
+// The simulated radio answers at once the first time; after that each
+// request waits out its timeout so the discovery thread does not spin.
+static int metis_sim_discover(METIS_LINK* link, METIS_FRAME* replies, int max, int timeout_ms, struct sockaddr_in*) {
+    SIM_LINK* sim=(SIM_LINK*)link->state;
+    struct timespec wait;
+
+    if(max < 1)
+        return 0;
+
+    if(sim->discovered) {
+        wait.tv_sec = timeout_ms / 1000;
+        wait.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        nanosleep(&wait, NULL);
+    }
+    sim->discovered = 1;
+
+    replies[0].buffer = sim->reply;
+    replies[0].length = sizeof(sim->reply);
+    memset(&replies[0].from, 0, sizeof(replies[0].from));
+    replies[0].from.sin_family = AF_INET;
+    replies[0].from.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    replies[0].from.sin_port = htons(METIS_PORT);
+    clock_gettime(CLOCK_REALTIME, &replies[0].stamp);
+    replies[0].interface = NULL;
+    return 1;
+}
+
+// Nothing to connect: the simulated radio is already wired to the link.
+static void metis_sim_connect(METIS_LINK*, struct sockaddr_in*, const char*) {
+}
+
+// Act on what the proxies send: the start/stop command, and the sample
+// rate and receiver count from the C&C bytes of each USB frame with
+// C0 = 0x00 (or 0x01, MOX).
+static void metis_sim_send(METIS_LINK* link, struct iovec* iov, int iovlen, int nframes) {
+    SIM_LINK* sim=(SIM_LINK*)link->state;
+    unsigned char* data;
+    int f;
+    int u;
+
+    for(f=0;f<nframes;f++, iov+=iovlen) {
+        data = (unsigned char*)iov[0].iov_base;
+        if(iov[0].iov_len < 4 || data[0] != 0xEF || data[1] != 0xFE)
+            continue;
+
+        if(data[2] == 0x04) {
+            if((data[3] & 3) && !__atomic_load_n(&sim->streams, __ATOMIC_ACQUIRE))
+                __atomic_store_n(&sim->restart, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&sim->streams, data[3] & 3, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        if(data[2] != 0x01 || data[3] != 2)
+            continue;
+
+        __atomic_add_fetch(&sim->tx_frames, 1, __ATOMIC_RELAXED);
+        for(u=1;u<iovlen && u<3;u++) {	// header, then the two USB frames
+            unsigned char* usb = (unsigned char*)iov[u].iov_base;
+            if(iov[u].iov_len >= 8 && (usb[3] & 0xFE) == 0x00) {
+                __atomic_store_n(&sim->speed, usb[4] & 3, __ATOMIC_RELAXED);
+                __atomic_store_n(&sim->cc_receivers, ((usb[7] >> 3) & 7) + 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+static void metis_sim_header(unsigned char* frame, unsigned char ep, unsigned int sequence) {
+    frame[0] = 0xEF;
+    frame[1] = 0xFE;
+    frame[2] = 0x01;
+    frame[3] = ep;
+    frame[4] = (sequence >> 24) & 0xFF;
+    frame[5] = (sequence >> 16) & 0xFF;
+    frame[6] = (sequence >> 8) & 0xFF;
+    frame[7] = sequence & 0xFF;
+}
+
+// nsec from one EP6 frame to the next: 2 USB frames of 504 bytes, in rows
+// of 24 bit I and Q per receiver and a 16 bit Mic sample.
+static long metis_sim_tick(SIM_LINK* sim) {
+    int receivers = sim->receivers ? sim->receivers : __atomic_load_n(&sim->cc_receivers, __ATOMIC_RELAXED);
+    long samples = 2 * (504 / (6*receivers + 2));
+
+    return samples * 1000000000L / (48000 << __atomic_load_n(&sim->speed, __ATOMIC_RELAXED));
+}
+
+// Sleep until the next tick is due, at most SIM_WAIT_MSEC. Returns the
+// number of ticks now due, catching up no more than SIM_WAIT_MSEC.
+static long metis_sim_wait(SIM_LINK* sim) {
+    struct timespec now;
+    long tick = metis_sim_tick(sim);
+    long late;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    late = (now.tv_sec - sim->deadline.tv_sec) * 1000000000L + (now.tv_nsec - sim->deadline.tv_nsec);
+
+    if(late < 0) {
+        if(late < -SIM_WAIT_MSEC * 1000000L) {
+            now.tv_nsec += SIM_WAIT_MSEC * 1000000L;
+            now.tv_sec += now.tv_nsec / 1000000000L;
+            now.tv_nsec %= 1000000000L;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &now, NULL);
+            return 0;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sim->deadline, NULL);
+        late = 0;
+    }
+
+    if(late > SIM_WAIT_MSEC * 1000000L) {	// stalled: drop the backlog, the radio would have too
+        clock_gettime(CLOCK_MONOTONIC, &sim->deadline);
+        late = 0;
+    }
+
+    return late / tick + 1;
+}
+
+// Move the deadline on by ticks.
+static void metis_sim_advance(SIM_LINK* sim, long ticks) {
+    long tick = metis_sim_tick(sim);
+
+    sim->deadline.tv_nsec += ticks * tick;
+    sim->deadline.tv_sec += sim->deadline.tv_nsec / 1000000000L;
+    sim->deadline.tv_nsec %= 1000000000L;
+}
+
+typedef void (*SIM_SOURCE)(SIM_LINK* sim, unsigned char* frame, unsigned char ep);
+
+// Hand out the frames due by now from source, EP6 then EP4 for each tick.
+static int metis_sim_receive(METIS_LINK* link, METIS_FRAME* frames, int max, SIM_SOURCE source) {
+    SIM_LINK* sim=(SIM_LINK*)link->state;
+    struct timespec stamp;
+    int streams = __atomic_load_n(&sim->streams, __ATOMIC_ACQUIRE);
+    int per_tick = ((streams & 1) ? 1 : 0) + ((streams & 2) ? 1 : 0);
+    long ticks;
+    long done;
+    int count = 0;
+
+    if(streams == 0) {
+        struct timespec wait = { 0, 10000000L };
+        nanosleep(&wait, NULL);
+        return 0;
+    }
+
+    if(max > METIS_MAX_RX_BATCH)
+        max = METIS_MAX_RX_BATCH;
+
+    if(__atomic_exchange_n(&sim->restart, 0, __ATOMIC_RELAXED)) {
+        sim->ep6_sequence = 0;		// a real Metis restarts its sequence numbers
+        sim->ep4_sequence = 0;
+        clock_gettime(CLOCK_MONOTONIC, &sim->deadline);
+    }
+
+    ticks = metis_sim_wait(sim);
+    clock_gettime(CLOCK_REALTIME, &stamp);
+
+    for(done=0;done<ticks && count+per_tick<=max;done++) {
+        if(streams & 1)
+            source(sim, sim->slots[count++], 6);
+        if(streams & 2)
+            source(sim, sim->slots[count++], 4);
+    }
+    metis_sim_advance(sim, done);
+
+    for(int i=0;i<count;i++) {
+        frames[i].buffer = sim->slots[i];
+        frames[i].length = SIM_FRAME_SIZE;
+        memset(&frames[i].from, 0, sizeof(frames[i].from));
+        frames[i].from.sin_family = AF_INET;
+        frames[i].from.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        frames[i].from.sin_port = htons(METIS_PORT);
+        frames[i].stamp = stamp;
+    }
+
+    link->stats.syscalls++;
+    return count;
+}
+
+
+// ********** loopback transport **********
+
+static int metis_loopback_open(METIS_LINK* link, const char*) {
+    metis_sim_open(link, 0x01);
+    fprintf(stderr,"Metis loopback: synthetic radio 02:00:00:00:00:01\n");
+    return 0;
+}
+
+// One frame of the tone. EP6 uses the 1 receiver layout, I2 I1 I0 Q2 Q1 Q0
+// M1 M0; EP4 is 512 big endian 16 bit ADC samples per USB frame.
+static void metis_loopback_source(SIM_LINK* sim, unsigned char* frame, unsigned char ep) {
+    unsigned char* p;
+    int u;
+    int s;
+
+    if(ep == 6) {
+        metis_sim_header(frame, 6, sim->ep6_sequence++);
+        for(u=0;u<2;u++) {
+            p = frame + 8 + u*512;
+            p[0] = 0x7F;
+            p[1] = 0x7F;
+            p[2] = 0x7F;
+            memset(p+3, 0, 5);		// C0..C4
+            p += 8;
+            for(s=0;s<SIM_SAMPLES/2;s++) {
+                int i = sim->tone_i[sim->phase % SIM_TONE_SIZE];
+                int q = sim->tone_q[sim->phase % SIM_TONE_SIZE];
+                sim->phase++;
+                p[0] = (i >> 16) & 0xFF;
+                p[1] = (i >> 8) & 0xFF;
+                p[2] = i & 0xFF;
+                p[3] = (q >> 16) & 0xFF;
+                p[4] = (q >> 8) & 0xFF;
+                p[5] = q & 0xFF;
+                p[6] = 0;
+                p[7] = 0;
+                p += 8;
+            }
+        }
+    } else {
+        metis_sim_header(frame, 4, sim->ep4_sequence++);
+        p = frame + 8;
+        for(s=0;s<512;s++) {
+            short adc = sim->tone_adc[s % SIM_TONE_SIZE];
+            p[s*2] = (adc >> 8) & 0xFF;
+            p[s*2+1] = adc & 0xFF;
+        }
+    }
+}
+
+static int metis_loopback_receive(METIS_LINK* link, METIS_FRAME* frames, int max) {
+    return metis_sim_receive(link, frames, max, metis_loopback_source);
+}
+
+static void metis_loopback_close(METIS_LINK* link) {
+    SIM_LINK* sim=(SIM_LINK*)link->state;
+
+    fprintf(stderr,"Metis loopback: %lu Tx frames received\n", sim->tx_frames);
+    free(sim);
+    link->state = NULL;
+}
+
+METIS_TRANSPORT metis_loopback_transport = {
+    "loopback radio",
+    1,
+    metis_loopback_open,
+    metis_sim_discover,
+    metis_sim_connect,
+    metis_loopback_receive,
+    metis_sim_send,
+    NULL,
+    metis_loopback_close
+};
+
+
+// ********** replay transport **********
+
+static unsigned char* metis_replay_frame(SIM_LINK* sim, long f) {
+    return sim->replay_map + sim->replay_first + f*sim->replay_record + (sim->replay_stamped ? METIS_CAPTURE_HEADER : 0);
+}
+
+// When frame f was captured, zero when the file does not say.
+static void metis_replay_stamp(SIM_LINK* sim, long f, struct timespec* stamp) {
+    unsigned char* h = sim->replay_map + sim->replay_first + f*sim->replay_record;
+    unsigned long long sec = 0;
+    int i;
+
+    stamp->tv_sec = 0;
+    stamp->tv_nsec = 0;
+    if(!sim->replay_stamped)
+        return;
+
+    for(i=8;i<16;i++)
+        sec = (sec << 8) | h[i];
+    stamp->tv_sec = (time_t)sec;
+    stamp->tv_nsec = (h[16] << 24) | (h[17] << 16) | (h[18] << 8) | h[19];
+}
+
+// A data frame from the radio, EP6 or EP4. Capture files also hold the
+// EP2 frames sent to it.
+static int metis_replay_data(unsigned char* frame) {
+    return frame[0] == 0xEF && frame[1] == 0xFE && frame[2] == 0x01 && (frame[3] == 6 || frame[3] == 4);
+}
+
+// The receivers the file's EP6 frames carry, from the first of its EP2
+// frames near the start that sets them, 0 when none does.
+static int metis_replay_receivers(SIM_LINK* sim) {
+    unsigned char* frame;
+    unsigned char* usb;
+    long f;
+    int u;
+
+    for(f=0;f<sim->replay_frames && f<SIM_SCAN_FRAMES;f++) {
+        frame = metis_replay_frame(sim, f);
+        if(frame[0] != 0xEF || frame[1] != 0xFE || frame[2] != 0x01 || frame[3] != 2)
+            continue;
+        for(u=0;u<2;u++) {
+            usb = frame + 8 + u*512;
+            if(usb[0] == 0x7F && (usb[3] & 0xFE) == 0x00)
+                return ((usb[7] >> 3) & 7) + 1;
+        }
+    }
+    return 0;
+}
+
+// Note which of EP6 and EP4 the file holds. A capture's index tells for
+// all but the records of its last block, so only those are looked at;
+// other files are looked through until both have turned up.
+static void metis_replay_streams(SIM_LINK* sim, const char* path) {
+    METIS_CAPTURE_ENTRY* entries = NULL;
+    unsigned char* frame;
+    long count = -1;
+    long f = 0;
+
+    memset(sim->replay_has, 0, sizeof(sim->replay_has));
+    if(sim->replay_stamped)
+        count = metis_capture_index(path, &entries);
+    if(count > 0) {
+        sim->replay_has[6] = entries[count-1].sequence[0] != 0xFFFFFFFF;
+        sim->replay_has[4] = entries[count-1].sequence[1] != 0xFFFFFFFF;
+        if(entries[count-1].record > 0)
+            f = (long)entries[count-1].record - 1;	// record 0 is the file header
+    }
+    free(entries);
+
+    for(;f<sim->replay_frames && !(sim->replay_has[6] && sim->replay_has[4]);f++) {
+        frame = metis_replay_frame(sim, f);
+        if(metis_replay_data(frame))
+            sim->replay_has[frame[3]] = 1;
+    }
+}
+
+static int metis_replay_open(METIS_LINK* link, const char* interface) {
+    const char* path = interface + 5;	// skip "file:"
+    SIM_LINK* sim = metis_sim_open(link, 0x02);
+    struct stat st;
+    char layout[32] = "";
+
+
+    sim->replay_fd = open(path, O_RDONLY);
+    if(sim->replay_fd < 0 || fstat(sim->replay_fd, &st) < 0) {
+        perror("cannot open Metis replay file");
+        exit(1);
+    }
+
+    sim->replay_size = st.st_size;
+    if(sim->replay_size < SIM_FRAME_SIZE) {
+        fprintf(stderr,"Metis replay file %s holds no complete frame\n", path);
+        exit(1);
+    }
+
+    sim->replay_map = (unsigned char*)mmap(NULL, sim->replay_size, PROT_READ, MAP_PRIVATE, sim->replay_fd, 0);
+    if(sim->replay_map == MAP_FAILED) {
+        perror("mmap failed for Metis replay file");
+        exit(1);
+    }
+    madvise(sim->replay_map, sim->replay_size, MADV_SEQUENTIAL);
+
+    sim->replay_stamped = sim->replay_size >= METIS_CAPTURE_RECORD && memcmp(sim->replay_map, "HPSDRCAP", 8) == 0;
+    sim->replay_record = sim->replay_stamped ? METIS_CAPTURE_RECORD : SIM_FRAME_SIZE;
+    sim->replay_first = sim->replay_stamped ? METIS_CAPTURE_RECORD : 0;	// past the file header
+    sim->replay_frames = (sim->replay_size - sim->replay_first) / sim->replay_record;
+
+    memset(sim->replay_next, 0, sizeof(sim->replay_next));
+    metis_replay_streams(sim, path);
+    if(!sim->replay_has[6] && !sim->replay_has[4]) {
+        fprintf(stderr,"Metis replay file %s holds no EP6 or EP4 frame\n", path);
+        exit(1);
+    }
+
+    sim->receivers = metis_replay_receivers(sim);	// 0: as the proxies' C&C bytes say
+    sim->replay_pace = link->config.replay_pace;
+    link->finished = 0;
+    if(sim->replay_pace == RxReplay_Original && !sim->replay_stamped) {
+        fprintf(stderr,"Metis replay: %s has no capture times, replaying at the nominal rate\n", path);
+        sim->replay_pace = RxReplay_Nominal;
+    }
+
+    if(sim->receivers > 1)
+        snprintf(layout, sizeof(layout), ", %d receivers", sim->receivers);
+    fprintf(stderr,"Metis replay: %ld %s from %s%s%s%s, %s\n", sim->replay_frames,
+        sim->replay_stamped ? "captured frames" : "frames", path,
+        sim->replay_has[6] ? ", EP6" : "", sim->replay_has[4] ? ", EP4" : "", layout,
+        sim->replay_pace == RxReplay_Original ? "as captured" :
+        sim->replay_pace == RxReplay_Fast ? "as fast as taken" : "at the nominal rate");
+    return 0;
+}
+
+// Copy the next frame for ep out of the file and renumber it. A stream the
+// file does not hold gets a frame with the right header and no samples.
+static void metis_replay_source(SIM_LINK* sim, unsigned char* frame, unsigned char ep) {
+    unsigned int* sequence = ep == 6 ? &sim->ep6_sequence : &sim->ep4_sequence;
+    unsigned char* from;
+
+    if(sim->replay_has[ep]) {
+        do {
+            from = metis_replay_frame(sim, sim->replay_next[ep]);
+            sim->replay_next[ep] = (sim->replay_next[ep] + 1) % sim->replay_frames;	// wrap at the end
+        } while(!metis_replay_data(from) || from[3] != ep);
+        memcpy(frame, from, SIM_FRAME_SIZE);
+    } else
+        memset(frame, 0, SIM_FRAME_SIZE);
+
+    metis_sim_header(frame, ep, (*sequence)++);
+}
+
+// How long before frame f is due, in nsec, for RxReplay_Original. Frames
+// with no capture time are due at once.
+static long long metis_replay_until(SIM_LINK* sim, long f) {
+    struct timespec stamp;
+    struct timespec now;
+    long long due;
+
+    metis_replay_stamp(sim, f, &stamp);
+    if(stamp.tv_sec == 0)
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    due = (long long)(stamp.tv_sec - sim->replay_base_stamp.tv_sec) * 1000000000LL + (stamp.tv_nsec - sim->replay_base_stamp.tv_nsec);
+    return due - ((long long)(now.tv_sec - sim->replay_base.tv_sec) * 1000000000LL + (now.tv_nsec - sim->replay_base.tv_nsec));
+}
+
+// RxReplay_Original and RxReplay_Fast: the frames of the enabled streams,
+// in file order, with the sequence numbers and times they were captured
+// with. Original waits for the first one to fall due, at most
+// SIM_WAIT_MSEC, and takes the others that are due by then.
+static int metis_replay_in_order(METIS_LINK* link, METIS_FRAME* frames, int max) {
+    SIM_LINK* sim=(SIM_LINK*)link->state;
+    struct timespec wait = { 0, SIM_WAIT_MSEC * 1000000L };
+    int streams = __atomic_load_n(&sim->streams, __ATOMIC_ACQUIRE);
+    unsigned char* frame;
+    long long until;
+    int count = 0;
+
+    if(streams == 0 || sim->replay_position >= sim->replay_frames) {
+        nanosleep(&wait, NULL);
+        return 0;
+    }
+
+    if(max > METIS_MAX_RX_BATCH)
+        max = METIS_MAX_RX_BATCH;
+
+    while(count < max && sim->replay_position < sim->replay_frames) {
+        frame = metis_replay_frame(sim, sim->replay_position);
+        if(!metis_replay_data(frame) || !(streams & (frame[3] == 6 ? 1 : 2))) {
+            sim->replay_position++;		// EP2, or a stream not asked for
+            continue;
+        }
+
+        // the clock starts with the first frame handed out after a start
+        if(__atomic_exchange_n(&sim->restart, 0, __ATOMIC_RELAXED)) {
+            clock_gettime(CLOCK_MONOTONIC, &sim->replay_base);
+            metis_replay_stamp(sim, sim->replay_position, &sim->replay_base_stamp);
+        }
+
+        if(sim->replay_pace == RxReplay_Original && (until = metis_replay_until(sim, sim->replay_position)) > 0) {
+            if(count > 0)
+                break;			// hand out what is due now
+            if(until < wait.tv_nsec)
+                wait.tv_nsec = (long)until;
+            nanosleep(&wait, NULL);
+            if(metis_replay_until(sim, sim->replay_position) > 0)
+                return 0;
+        }
+
+        memcpy(sim->slots[count], frame, SIM_FRAME_SIZE);
+        frames[count].buffer = sim->slots[count];
+        frames[count].length = SIM_FRAME_SIZE;
+        memset(&frames[count].from, 0, sizeof(frames[count].from));
+        frames[count].from.sin_family = AF_INET;
+        frames[count].from.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        frames[count].from.sin_port = htons(METIS_PORT);
+        metis_replay_stamp(sim, sim->replay_position, &frames[count].stamp);
+        if(frames[count].stamp.tv_sec == 0)
+            clock_gettime(CLOCK_REALTIME, &frames[count].stamp);
+        count++;
+        sim->replay_position++;
+    }
+
+    if(sim->replay_position >= sim->replay_frames) {
+        fprintf(stderr,"Metis replay: end of file\n");
+        __atomic_store_n(&link->finished, 1, __ATOMIC_RELEASE);
+    }
+
+    link->stats.syscalls++;
+    return count;
+}
+
+static int metis_replay_receive(METIS_LINK* link, METIS_FRAME* frames, int max) {
+    SIM_LINK* sim=(SIM_LINK*)link->state;
+
+    if(sim->replay_pace != RxReplay_Nominal)
+        return metis_replay_in_order(link, frames, max);
+    return metis_sim_receive(link, frames, max, metis_replay_source);
+}
+
+static void metis_replay_close(METIS_LINK* link) {
+    SIM_LINK* sim=(SIM_LINK*)link->state;
+
+    fprintf(stderr,"Metis replay: %lu Tx frames received\n", sim->tx_frames);
+    if(sim->replay_map != NULL)
+        munmap(sim->replay_map, sim->replay_size);
+    if(sim->replay_fd >= 0)
+        close(sim->replay_fd);
+    free(sim);
+    link->state = NULL;
+}
+
+METIS_TRANSPORT metis_replay_transport = {
+    "file replay",
+    1,
+    metis_replay_open,
+    metis_sim_discover,
+    metis_sim_connect,
+    metis_replay_receive,
+    metis_sim_send,
+    NULL,
+    metis_replay_close
+};
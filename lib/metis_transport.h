@@ -0,0 +1,127 @@
+/* -*- c++ -*- */
+/* metis_transport.h */
+
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Transport interface behind metis.cc.
+//
+// metis.cc holds the Metis protocol: discovery reply parsing, stream
+// control, the Tx frame headers and the dispatch of received frames to
+// the Hermes/HermesW proxies. Moving datagrams in and out of the process
+// is left to a transport, so the same protocol code and the same proxies
+// run over the UDP socket, the AF_PACKET ring, io_uring, a recorded file
+// or synthetic traffic generated in-process.
+
+#ifndef METIS_TRANSPORT_H
+#define METIS_TRANSPORT_H
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <time.h>
+
+#define METIS_PORT	1024		// Metis discovery, control and data port
+
+// One received datagram. buffer belongs to the transport and stays valid
+// until the next receive() (or discover()) call on the same link.
+typedef struct _METIS_FRAME {
+    unsigned char* buffer;
+    int length;
+    struct sockaddr_in from;
+    struct timespec stamp;		// arrival time, zero when unknown
+    const char* interface;		// discovery replies: interface it came in on, NULL if none
+} METIS_FRAME;
+
+// Knobs set through the metis_*() calls before metis_discover(). Only the
+// socket transports look at most of them.
+typedef struct _METIS_CONFIG {
+    int rx_batch;			// datagrams per receive syscall (1 = recvmsg)
+    int rx_batch_timeout;		// usec to wait for a full batch (0 = take what is ready)
+    int rx_backend;			// RxBackend_* for a network interface
+    int rx_sockbuf;			// SO_RCVBUF bytes (0 = kernel default)
+    int tx_sockbuf;			// SO_SNDBUF bytes (0 = kernel default)
+    int rx_busy_poll;			// usec to spin before blocking (0 = always block)
+    int rx_reactor;			// shared epoll receive threads (0 = one thread per session)
+    int rx_nonblock;			// receive() returns at once when nothing is ready
+    int replay_pace;			// RxReplay_*, for the file replay
+} METIS_CONFIG;
+
+// Counters the transports keep for the exit statistics.
+typedef struct _METIS_RX_STATS {
+    unsigned long syscalls;		// receive syscalls that returned data (io_uring: every enter)
+    unsigned long packets;		// datagrams received
+    unsigned long spin_hits;		// receives satisfied while busy polling
+    unsigned int socket_drops;		// SO_RXQ_OVFL count on the UDP socket
+    unsigned long ring_drops;		// tp_drops on the AF_PACKET ring
+    unsigned long length_drops;		// AF_PACKET datagrams whose UDP length the ring slot does not hold
+} METIS_RX_STATS;
+
+// One session's use of a transport. open() puts whatever the transport
+// keeps (sockets, rings, slots) in state, close() frees it, so any number
+// of sessions can run over the same transport side by side.
+typedef struct _METIS_LINK {
+    METIS_CONFIG config;
+    METIS_RX_STATS stats;
+    int finished;			// the source has no more frames to give (a replay played out)
+    void* state;
+} METIS_LINK;
+
+typedef struct _METIS_TRANSPORT {
+    const char* name;
+
+    // receive() hands out frames in groups (a ring block, a batch of
+    // completions). The Tx frames released while a group is dispatched are
+    // then held and sent together after it, and must be, or they wait for
+    // the next group. 0 leaves it to the configured receive batch.
+    int groups;
+
+    // Get ready to talk to radios reachable through interface. Returns -1
+    // if the transport cannot run here; the caller then falls back to UDP.
+    int (*open)(METIS_LINK* link, const char* interface);
+
+    // Ask the radios to identify themselves, by broadcast on every interface,
+    // or only the one at probe when that is not NULL. Waits up to timeout_ms
+    // for the first reply, then takes whatever else has arrived. Returns the
+    // number of replies put in replies[].
+    int (*discover)(METIS_LINK* link, METIS_FRAME* replies, int max, int timeout_ms, struct sockaddr_in* probe);
+
+    // Direct everything that follows at the radio at address, which
+    // answered discovery on interface (NULL when there is none).
+    void (*connect)(METIS_LINK* link, struct sockaddr_in* address, const char* interface);
+
+    // Wait for data frames and return up to max of them. Returns 0 after
+    // about 100 msec without traffic so the caller can check for a stop,
+    // or at once with rx_nonblock set.
+    int (*receive)(METIS_LINK* link, METIS_FRAME* frames, int max);
+
+    // Send nframes datagrams to the connected radio. iov holds iovlen
+    // entries per datagram, one datagram after another.
+    void (*send)(METIS_LINK* link, struct iovec* iov, int iovlen, int nframes);
+
+    // Descriptor that is readable while receive() has frames to return, once
+    // connected, or -1. NULL when the transport cannot be waited on that way;
+    // such a session keeps a receive thread of its own.
+    int (*fd)(METIS_LINK* link);
+
+    void (*close)(METIS_LINK* link);
+} METIS_TRANSPORT;
+
+extern METIS_TRANSPORT metis_udp_transport;		// recvmsg()/recvmmsg() on the UDP socket
+extern METIS_TRANSPORT metis_packet_transport;		// TPACKET_V3 ring, Tx on the UDP socket
+#ifdef HAVE_LIBURING
+extern METIS_TRANSPORT metis_uring_transport;		// io_uring for receive and transmit
+#endif
+extern METIS_TRANSPORT metis_replay_transport;		// frames read back from a file
+extern METIS_TRANSPORT metis_loopback_transport;	// synthetic radio inside the process
+
+#endif  // METIS_TRANSPORT_H
@@ -0,0 +1,1116 @@
+/* -*-  C++  -*-  */
+/* metis_udp.cc */
+
+/*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*
+*/
+
+// Network transports for metis.cc. Moved here from metis.cc with the
+// transport interface (see metis_transport.h); the socket handling is
+// unchanged.
+//
+// UDP - a broadcast socket on port 1024 on each IPv4 interface for
+// discovery, and a data socket on an ephemeral port of the interface the
+// selected Metis answered on, connect()ed to it, for stream
+// control, Tx and Rx. Rx uses recvmsg(), or recvmmsg() when the batch is
+// greater than one, optionally busy polling before it blocks.
+//
+// AF_PACKET - Rx from a TPACKET_V3 mmap ring on the interface, filtered in
+// the kernel to UDP from the Metis address and port 1024 and walked in
+// place. Discovery and Tx use the UDP sockets.
+//
+// io_uring (when built with liburing) - receive buffers stay posted through
+// a provided buffer ring with a multishot recvmsg on the data socket, and Tx
+// frames sent from the receive thread go out as linked sendmsg SQEs with the
+// next submit.
+//
+// All of it is kept per link in a UDP_LINK, allocated by open() and freed by
+// close(), so each session has its own sockets, ring and slots.
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if_arp.h>
+#include <net/if.h>
+#include <ifaddrs.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#include "metis.h"
+#include "metis_transport.h"
+
+#define MAX_DISCOVERY_IFS	16		// interfaces discovery runs on at once
+
+typedef struct _DISCOVERY_IF {
+    char name[IFNAMSIZ];
+    int socket;				// bound to the interface address, port 1024
+    struct sockaddr_in address;		// interface address
+    struct sockaddr_in netmask;
+    struct sockaddr_in broadcast;	// where discovery requests go
+} DISCOVERY_IF;
+
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL	69		// Linux 5.11, older headers lack it
+#endif
+
+#define RX_CONTROL_SIZE	64			// room for the SO_RXQ_OVFL and SCM_TIMESTAMPNS cmsgs
+#define RX_WAIT_MSEC	100			// longest a receive blocks before returning 0
+
+#define DISCOVERY_SLOTS	16
+
+#define PACKET_BLOCK_SIZE	(1 << 16)	// 64k ring blocks, about 50 Metis frames each
+#define PACKET_BLOCK_NR		64		// 4 MB ring
+#define PACKET_FRAME_SIZE	2048
+#define PACKET_BLOCK_TMO	2		// msec before the kernel retires a partly filled block
+
+#ifdef HAVE_LIBURING
+#define URING_ENTRIES		256		// submission queue depth
+#define URING_RX_BUFS		256		// provided receive buffers, power of 2
+#define URING_RX_BUFSIZE	2048
+#define URING_BGID		1		// provided buffer group id
+#define URING_TX_SLOTS		64		// Tx frames in flight
+#define URING_TX_TAG		0x10000		// user_data flag for Tx completions
+
+typedef struct _URING_TX_SLOT {
+    unsigned char frame[1032];			// header + two USB frames
+    struct iovec iov;
+    struct msghdr msg;
+    int busy;					// submitted, completion not seen yet
+} URING_TX_SLOT;
+#endif
+
+// Everything one link needs, so each session has its own sockets and slots.
+typedef struct _UDP_LINK {
+    DISCOVERY_IF discovery_ifs[MAX_DISCOVERY_IFS];
+    int discovery_nifs;
+
+    int data_socket;			// connect()ed to the selected Metis
+    struct sockaddr_in data_addr;	// address of the selected Metis
+    char rx_interface[IFNAMSIZ];	// interface of the selected Metis, for the AF_PACKET ring
+
+    unsigned char rx_slots[METIS_MAX_RX_BATCH][2048];	// receive packet slots
+    struct mmsghdr rx_msgs[METIS_MAX_RX_BATCH];
+    struct iovec rx_iovecs[METIS_MAX_RX_BATCH];
+    struct sockaddr_in rx_addrs[METIS_MAX_RX_BATCH];
+    unsigned char rx_controls[METIS_MAX_RX_BATCH][RX_CONTROL_SIZE];
+
+    unsigned char discovery_slots[DISCOVERY_SLOTS][2048];	// discovery replies
+
+    int packet_socket;				// AF_PACKET socket for the mmap ring
+    unsigned char* packet_ring;			// mapped TPACKET_V3 ring, set once it is ready
+    struct tpacket_req3 packet_req;		// ring geometry
+    unsigned int packet_current;		// ring block being walked
+    struct tpacket_block_desc* packet_held;	// block handed out, not yet returned
+    struct tpacket3_hdr* packet_next;		// next packet in packet_held
+    unsigned int packet_left;			// packets left in packet_held
+
+#ifdef HAVE_LIBURING
+    struct io_uring uring;
+    struct io_uring_buf_ring* uring_rx_ring;
+    unsigned char* uring_rx_bufs;
+    struct msghdr uring_rx_msg;			// layout template for multishot recvmsg
+    unsigned short uring_rx_held[METIS_MAX_RX_BATCH+URING_ENTRIES];	// buffer ids to give back
+    int uring_rx_nheld;
+    int uring_armed;
+    pthread_t uring_engine;			// the thread that calls receive()
+    int uring_engine_known;
+    URING_TX_SLOT uring_tx[URING_TX_SLOTS];
+    int uring_tx_next;
+    unsigned long uring_tx_errors;
+#endif
+} UDP_LINK;
+
+
+
+
+// Open a discovery socket on every IPv4 interface that is up and can
+// broadcast, or only on interface unless that is "*" or empty. Returns the
+// number of interfaces opened.
+static int metis_udp_interfaces(UDP_LINK* u, const char* interface) {
+    struct ifaddrs* ifaddr;
+    struct ifaddrs* ifa;
+    struct sockaddr_in name;
+    DISCOVERY_IF* dif;
+    int any = interface[0] == 0 || strcmp(interface, "*") == 0;
+    int on=1;
+    int rc;
+
+    if(getifaddrs(&ifaddr) < 0) {
+        perror("getifaddrs failed");
+        return 0;
+    }
+
+    u->discovery_nifs=0;
+    for(ifa=ifaddr;ifa!=NULL && u->discovery_nifs<MAX_DISCOVERY_IFS;ifa=ifa->ifa_next) {
+        if(ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_INET)
+            continue;
+        if(!any && strcmp(ifa->ifa_name, interface) != 0)
+            continue;
+        if(any && ((ifa->ifa_flags & IFF_LOOPBACK) || !(ifa->ifa_flags & IFF_UP) || !(ifa->ifa_flags & IFF_BROADCAST)))
+            continue;
+
+        dif=&u->discovery_ifs[u->discovery_nifs];
+        memset(dif, 0, sizeof(*dif));
+        strncpy(dif->name, ifa->ifa_name, sizeof(dif->name)-1);
+        memcpy(&dif->address, ifa->ifa_addr, sizeof(dif->address));
+        if(ifa->ifa_netmask != NULL)
+            memcpy(&dif->netmask, ifa->ifa_netmask, sizeof(dif->netmask));
+
+        // the interface's own broadcast address, so the request leaves on it
+        if((ifa->ifa_flags & IFF_BROADCAST) && ifa->ifa_broadaddr != NULL)
+            memcpy(&dif->broadcast, ifa->ifa_broadaddr, sizeof(dif->broadcast));
+        else {
+            dif->broadcast.sin_family=AF_INET;
+            dif->broadcast.sin_addr.s_addr=htonl(INADDR_BROADCAST);
+        }
+        dif->broadcast.sin_port=htons(METIS_PORT);
+
+        dif->socket=socket(PF_INET,SOCK_DGRAM,IPPROTO_UDP);
+        if(dif->socket<0) {
+            perror("create socket failed for discovery_socket\n");
+            exit(1);
+        }
+
+        // allow broadcast on the socket
+        rc=setsockopt(dif->socket, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+        if(rc != 0) {
+            fprintf(stderr,"cannot set SO_BROADCAST: rc=%d\n", rc);
+            exit(1);
+        }
+
+        // bind to this interface, on port 1024 unless another session has it
+        name=dif->address;
+        name.sin_port=htons(METIS_PORT);
+        if(bind(dif->socket,(struct sockaddr*)&name,sizeof(name))<0) {
+            name.sin_port=0;
+            bind(dif->socket,(struct sockaddr*)&name,sizeof(name));
+        }
+
+        printf("%s IP Address: %s\n", dif->name, inet_ntoa(dif->address.sin_addr));
+        u->discovery_nifs++;
+    }
+
+    freeifaddrs(ifaddr);
+    return u->discovery_nifs;
+}
+
+// Try the FORCE variant first, it ignores net.core.[rw]mem_max but needs
+// CAP_NET_ADMIN. Report what the kernel actually granted.
+static void metis_set_socket_buffer(int sock, int force_opt, int opt, int size, const char* name) {
+    int actual=0;
+    socklen_t length=sizeof(actual);
+
+    if(size <= 0)
+        return;
+
+    if(setsockopt(sock,SOL_SOCKET,force_opt,&size,sizeof(size))<0)
+        if(setsockopt(sock,SOL_SOCKET,opt,&size,sizeof(size))<0)
+            perror("cannot set socket buffer size");
+
+    getsockopt(sock,SOL_SOCKET,opt,&actual,&length);
+    fprintf(stderr,"Metis %s requested %d bytes, kernel set %d bytes\n",name,size,actual);
+}
+
+// Pick up one cmsg of a received packet. SO_RXQ_OVFL carries the running
+// drop total, so the latest value is kept. SCM_TIMESTAMPNS is the arrival time.
+static void metis_note_control(METIS_LINK* link, struct cmsghdr* cmsg, struct timespec* stamp) {
+    if(cmsg->cmsg_level!=SOL_SOCKET)
+        return;
+
+    if(cmsg->cmsg_type==SO_RXQ_OVFL)
+        memcpy(&link->stats.socket_drops,CMSG_DATA(cmsg),sizeof(link->stats.socket_drops));
+    else if(cmsg->cmsg_type==SCM_TIMESTAMPNS)
+        memcpy(stamp,CMSG_DATA(cmsg),sizeof(*stamp));
+}
+
+// Walk all the cmsgs of a received packet. The stamp stays zero if the
+// kernel did not supply one.
+static void metis_note_controls(METIS_LINK* link, struct msghdr* msg, struct timespec* stamp) {
+    struct cmsghdr* cmsg;
+
+    stamp->tv_sec=0;
+    stamp->tv_nsec=0;
+    for(cmsg=CMSG_FIRSTHDR(msg);cmsg!=NULL;cmsg=CMSG_NXTHDR(msg,cmsg))
+        metis_note_control(link,cmsg,stamp);
+}
+
+// True while less than the busy poll time has passed since start.
+static int metis_still_spinning(METIS_LINK* link, struct timespec* start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return (now.tv_sec-start->tv_sec)*1000000L + (now.tv_nsec-start->tv_nsec)/1000
+        < link->config.rx_busy_poll;
+}
+
+
+// ********** UDP transport **********
+
+static int metis_udp_open(METIS_LINK* link, const char* interface) {
+    UDP_LINK* u;
+    int rc;
+    int i;
+    int on=1;
+    struct timeval wait;
+
+    u=(UDP_LINK*)calloc(1,sizeof(UDP_LINK));
+    if(u==NULL) {
+        perror("cannot allocate Metis UDP link");
+        exit(1);
+    }
+    u->data_socket=-1;
+    u->packet_socket=-1;
+    link->state=u;
+
+    // discovery broadcasts go out on every interface at once
+    if(metis_udp_interfaces(u, interface) == 0) {
+        printf("No %s interface.\n", (interface[0] == 0 || strcmp(interface, "*") == 0) ? "IPv4" : interface);
+        exit(1);
+    }
+
+    // the data socket carries stream control, Tx and all Rx data once a
+    // Metis is selected
+    u->data_socket=socket(PF_INET,SOCK_DGRAM,IPPROTO_UDP);
+    if(u->data_socket<0) {
+        perror("create socket failed for data_socket\n");
+        exit(1);
+    }
+
+    metis_set_socket_buffer(u->data_socket,SO_RCVBUFFORCE,SO_RCVBUF,link->config.rx_sockbuf,"SO_RCVBUF");
+    metis_set_socket_buffer(u->data_socket,SO_SNDBUFFORCE,SO_SNDBUF,link->config.tx_sockbuf,"SO_SNDBUF");
+
+    // every received packet carries the socket drop counter
+    rc=setsockopt(u->data_socket, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+    if(rc != 0)
+        perror("cannot set SO_RXQ_OVFL, kernel drops will not be counted");
+
+    // and its arrival time
+    rc=setsockopt(u->data_socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    if(rc != 0)
+        perror("cannot set SO_TIMESTAMPNS, samples will not carry rx_time");
+
+    // a blocked receive comes back now and then so the receive thread can stop
+    wait.tv_sec=0;
+    wait.tv_usec=RX_WAIT_MSEC*1000;
+    setsockopt(u->data_socket, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+
+    if(link->config.rx_busy_poll > 0) {
+        // values above net.core.busy_read need CAP_NET_ADMIN
+        if(setsockopt(u->data_socket, SOL_SOCKET, SO_BUSY_POLL, &link->config.rx_busy_poll,
+                      sizeof(link->config.rx_busy_poll)) != 0)
+            perror("cannot set SO_BUSY_POLL, spinning in user space only");
+        if(setsockopt(u->data_socket, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on)) != 0)
+            perror("cannot set SO_PREFER_BUSY_POLL");
+        fprintf(stderr,"Metis busy poll: spin %d usec before blocking\n", link->config.rx_busy_poll);
+    }
+
+    for(i=0;i<METIS_MAX_RX_BATCH;i++) {
+        u->rx_iovecs[i].iov_base=u->rx_slots[i];
+        u->rx_iovecs[i].iov_len=sizeof(u->rx_slots[i]);
+        memset(&u->rx_msgs[i],0,sizeof(u->rx_msgs[i]));
+        u->rx_msgs[i].msg_hdr.msg_iov=&u->rx_iovecs[i];
+        u->rx_msgs[i].msg_hdr.msg_iovlen=1;
+        u->rx_msgs[i].msg_hdr.msg_control=u->rx_controls[i];
+    }
+
+    return 0;
+}
+
+// Broadcast a discovery request on every interface, or send it to probe
+// only, wait for the first reply, then collect any others already queued.
+static int metis_udp_discover(METIS_LINK* link, METIS_FRAME* replies, int max, int timeout_ms, struct sockaddr_in* probe) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+    unsigned char request[63];
+    struct pollfd pfd[MAX_DISCOVERY_IFS];
+    DISCOVERY_IF* dif;
+    socklen_t length;
+    int bytes_read;
+    int count=0;
+    int i;
+
+    memset(request,0,sizeof(request));
+    request[0]=0xEF;
+    request[1]=0xFE;
+    request[2]=0x02;
+
+    if(probe != NULL) {
+        // from the interface on the probe address's subnet, else let routing pick
+        dif=&u->discovery_ifs[0];
+        for(i=0;i<u->discovery_nifs;i++)
+            if(((u->discovery_ifs[i].address.sin_addr.s_addr ^ probe->sin_addr.s_addr)
+                & u->discovery_ifs[i].netmask.sin_addr.s_addr) == 0)
+                dif=&u->discovery_ifs[i];
+        if(sendto(dif->socket,request,sizeof(request),0,(struct sockaddr*)probe,sizeof(*probe))<0)
+            perror("sendto socket failed for discovery probe");
+    } else {
+        for(i=0;i<u->discovery_nifs;i++)	// an interface going down should not stop the others
+            if(sendto(u->discovery_ifs[i].socket,request,sizeof(request),0,
+                (struct sockaddr*)&u->discovery_ifs[i].broadcast,sizeof(u->discovery_ifs[i].broadcast))<0)
+                fprintf(stderr,"discovery broadcast failed on %s: %s\n",u->discovery_ifs[i].name,strerror(errno));
+    }
+
+    for(i=0;i<u->discovery_nifs;i++) {
+        pfd[i].fd=u->discovery_ifs[i].socket;
+        pfd[i].events=POLLIN;
+        pfd[i].revents=0;
+    }
+    if(poll(pfd,u->discovery_nifs,timeout_ms) <= 0)
+        return 0;
+
+    if(max > DISCOVERY_SLOTS)
+        max = DISCOVERY_SLOTS;
+
+    for(i=0;i<u->discovery_nifs;i++) {
+        while(count < max) {
+            length=sizeof(replies[count].from);
+            bytes_read=recvfrom(u->discovery_ifs[i].socket,u->discovery_slots[count],sizeof(u->discovery_slots[count]),
+                MSG_DONTWAIT,(struct sockaddr*)&replies[count].from,&length);
+            if(bytes_read<0) {
+                if(errno == EINTR)
+                    continue;
+                break;				// EAGAIN: nothing more queued
+            }
+
+            replies[count].buffer=u->discovery_slots[count];
+            replies[count].length=bytes_read;
+            replies[count].stamp.tv_sec=0;
+            replies[count].stamp.tv_nsec=0;
+            replies[count].interface=u->discovery_ifs[i].name;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// Bind the data socket to the interface the Metis answered on, so the
+// stream stays on that NIC, then connect it.
+static void metis_udp_connect(METIS_LINK* link, struct sockaddr_in* address, const char* interface) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+    struct sockaddr_in name;
+    int i;
+
+    for(i=0;interface!=NULL && i<u->discovery_nifs;i++)
+        if(strcmp(u->discovery_ifs[i].name, interface) == 0) {
+            strncpy(u->rx_interface, interface, sizeof(u->rx_interface)-1);
+            // ephemeral port; Metis streams to whichever port the start command came from
+            name=u->discovery_ifs[i].address;
+            name.sin_port=0;
+            bind(u->data_socket,(struct sockaddr*)&name,sizeof(name));	// fails harmlessly once bound
+            break;
+        }
+
+    u->data_addr=*address;
+    if(connect(u->data_socket,(struct sockaddr*)&u->data_addr,sizeof(u->data_addr))<0) {
+        perror("connect failed for data_socket\n");
+        exit(1);
+    }
+}
+
+// Wait up to rx_batch_timeout usec from now for datagrams to fill the rest
+// of a batch of which the first count have arrived, taking each group as it
+// comes without blocking in recvmmsg(). Returns how many more were taken.
+static int metis_udp_fill_batch(METIS_LINK* link, int count, int batch) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+    struct timespec deadline;
+    struct timespec now;
+    struct timespec left;
+    struct pollfd pfd;
+    long nsec;
+    int got=0;
+    int rc;
+
+    clock_gettime(CLOCK_MONOTONIC,&deadline);
+    deadline.tv_nsec+=(link->config.rx_batch_timeout % 1000000) * 1000L;
+    deadline.tv_sec+=link->config.rx_batch_timeout / 1000000 + deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec%=1000000000L;
+
+    pfd.fd=u->data_socket;
+    pfd.events=POLLIN;
+
+    while(count+got < batch) {
+        clock_gettime(CLOCK_MONOTONIC,&now);
+        nsec=(deadline.tv_sec-now.tv_sec)*1000000000L + (deadline.tv_nsec-now.tv_nsec);
+        if(nsec <= 0)
+            break;
+        left.tv_sec=nsec / 1000000000L;
+        left.tv_nsec=nsec % 1000000000L;
+
+        pfd.revents=0;
+        if(ppoll(&pfd,1,&left,NULL) <= 0)
+            break;				// timed out, or interrupted: send what we have
+
+        rc=recvmmsg(u->data_socket,u->rx_msgs+count+got,batch-count-got,MSG_DONTWAIT,NULL);
+        if(rc <= 0)
+            break;
+        got+=rc;
+    }
+
+    return got;
+}
+
+// Take up to the configured batch of datagrams. With a batch of one this is
+// a plain recvmsg(). With busy poll on, spin on a non-blocking receive
+// first and only block once the budget is spent.
+static int metis_udp_receive(METIS_LINK* link, METIS_FRAME* frames, int max) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+    struct timespec start;
+    int batch=link->config.rx_batch;
+    int count;
+    int i;
+
+    if(batch > max)
+        batch = max;
+
+    for(i=0;i<batch;i++) {
+        u->rx_msgs[i].msg_hdr.msg_name=&u->rx_addrs[i];
+        u->rx_msgs[i].msg_hdr.msg_namelen=sizeof(u->rx_addrs[i]);
+        u->rx_msgs[i].msg_hdr.msg_controllen=sizeof(u->rx_controls[i]);
+    }
+
+    count=-1;
+    if(link->config.rx_nonblock) {	// the reactor saw the socket readable, take what is there
+        if(batch == 1) {
+            count=recvmsg(u->data_socket,&u->rx_msgs[0].msg_hdr,MSG_DONTWAIT);
+            if(count>=0) {
+                u->rx_msgs[0].msg_len=count;
+                count=1;
+            }
+        } else
+            count=recvmmsg(u->data_socket,u->rx_msgs,batch,MSG_DONTWAIT,NULL);
+    } else if(link->config.rx_busy_poll > 0) {	// take whatever is there, spinning until something is
+        clock_gettime(CLOCK_MONOTONIC,&start);
+        do {
+            if(batch == 1) {
+                count=recvmsg(u->data_socket,&u->rx_msgs[0].msg_hdr,MSG_DONTWAIT);
+                if(count>=0) {
+                    u->rx_msgs[0].msg_len=count;
+                    count=1;
+                }
+            } else
+                count=recvmmsg(u->data_socket,u->rx_msgs,batch,MSG_DONTWAIT,NULL);
+        } while(count<0 && errno == EAGAIN && metis_still_spinning(link,&start));
+        if(count>0)
+            link->stats.spin_hits++;
+    }
+
+    if(count>0 || link->config.rx_nonblock)
+        ;				// got them while spinning, or no waiting wanted
+    else if(batch == 1) {
+        count=recvmsg(u->data_socket,&u->rx_msgs[0].msg_hdr,0);
+        if(count>=0) {
+            u->rx_msgs[0].msg_len=count;
+            count=1;
+        }
+    } else {
+        // Block for the first datagram only (SO_RCVTIMEO bounds the wait),
+        // recvmmsg() looks at its own timeout only after a datagram arrives.
+        count=recvmmsg(u->data_socket,u->rx_msgs,batch,MSG_WAITFORONE,NULL);
+        if(count>0 && count<batch && link->config.rx_batch_timeout > 0)
+            count+=metis_udp_fill_batch(link,count,batch);
+    }
+
+    if(count<0) {
+        // ECONNREFUSED: an ICMP port unreachable came back on the connected
+        // socket, the radio is gone or restarting. Keep waiting for it.
+        if (errno == EINTR || errno == EAGAIN || errno == ECONNREFUSED)
+          return 0;
+
+        perror("recvmmsg socket failed for metis_receive_thread");
+        exit(1);
+    }
+
+    if(count == 0)
+        return 0;
+
+    link->stats.syscalls++;
+
+    for(i=0;i<count;i++) {
+        frames[i].buffer=u->rx_slots[i];
+        frames[i].length=u->rx_msgs[i].msg_len;
+        frames[i].from=u->rx_addrs[i];
+        metis_note_controls(link,&u->rx_msgs[i].msg_hdr,&frames[i].stamp);
+    }
+
+    return count;
+}
+
+// One sendmsg() for a single datagram, otherwise sendmmsg() in groups of
+// METIS_MAX_TX_BATCH. The data socket is connected, no address needed.
+static void metis_udp_send(METIS_LINK* link, struct iovec* iov, int iovlen, int nframes) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+    struct mmsghdr msgs[METIS_MAX_TX_BATCH];
+    int count;
+    int sent;
+    int rc;
+    int i;
+
+    if(nframes == 1) {
+        memset(&msgs[0],0,sizeof(msgs[0]));
+        msgs[0].msg_hdr.msg_iov=iov;
+        msgs[0].msg_hdr.msg_iovlen=iovlen;
+        while((rc=sendmsg(u->data_socket,&msgs[0].msg_hdr,0))<0 && errno == EINTR)
+            ;
+        if(rc<0 && errno != ECONNREFUSED) {	// radio not listening (yet), as if lost on the wire
+            perror("sendmsg socket failed for metis_send_frame\n");
+            exit(1);
+        }
+        return;
+    }
+
+    while(nframes > 0) {
+        count = nframes > METIS_MAX_TX_BATCH ? METIS_MAX_TX_BATCH : nframes;
+
+        for(i=0;i<count;i++) {
+            memset(&msgs[i],0,sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov=iov+i*iovlen;
+            msgs[i].msg_hdr.msg_iovlen=iovlen;
+        }
+
+        sent=0;
+        while(sent < count) {
+            rc=sendmmsg(u->data_socket,&msgs[sent],count-sent,0);
+            if(rc<0) {
+                if(errno == EINTR || errno == ECONNREFUSED)	// the error is reported once
+                  continue;
+                perror("sendmmsg socket failed for metis_send_frames\n");
+                exit(1);
+            }
+            sent += rc;
+        }
+
+        iov += count*iovlen;
+        nframes -= count;
+    }
+}
+
+static int metis_udp_fd(METIS_LINK* link) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+
+    return u->data_socket;
+}
+
+static void metis_udp_close(METIS_LINK* link) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+    int i;
+
+    for(i=0;i<u->discovery_nifs;i++) {
+        shutdown(u->discovery_ifs[i].socket, 2);
+        close(u->discovery_ifs[i].socket);
+    }
+
+    shutdown(u->data_socket, 2);
+    close(u->data_socket);
+
+    free(u);
+    link->state = NULL;
+}
+
+METIS_TRANSPORT metis_udp_transport = {
+    "UDP socket",
+    0,
+    metis_udp_open,
+    metis_udp_discover,
+    metis_udp_connect,
+    metis_udp_receive,
+    metis_udp_send,
+    metis_udp_fd,
+    metis_udp_close
+};
+
+
+// ********** AF_PACKET transport **********
+
+
+// Counters reset on every read, accumulate them.
+static void metis_packet_statistics(METIS_LINK* link) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+    struct tpacket_stats_v3 stats;
+    socklen_t length=sizeof(stats);
+
+    if(getsockopt(u->packet_socket,SOL_PACKET,PACKET_STATISTICS,&stats,&length)==0)
+        link->stats.ring_drops+=stats.tp_drops;
+}
+
+// Open a TPACKET_V3 ring on rx_interface that only accepts UDP from the
+// Metis address (data_addr) and port 1024. The data socket gets a drop-all
+// filter so the data frames are not received twice.
+static void metis_packet_start(METIS_LINK* link) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+    int version=TPACKET_V3;
+    struct sockaddr_ll ll;
+    struct sock_fprog prog;
+    unsigned char* ring;
+    unsigned int metis_ip=ntohl(u->data_addr.sin_addr.s_addr);
+
+    struct sock_filter filter[] = {
+        BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12),			// ethertype
+        BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IP, 0, 10),
+        BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 26),			// IPv4 source address
+        BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, metis_ip, 0, 8),
+        BPF_STMT(BPF_LD|BPF_B|BPF_ABS, 23),			// IP protocol
+        BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_UDP, 0, 6),
+        BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 20),			// fragment offset
+        BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x1fff, 4, 0),
+        BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, 14),			// IP header length
+        BPF_STMT(BPF_LD|BPF_H|BPF_IND, 14),			// UDP source port
+        BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, METIS_PORT, 0, 1),
+        BPF_STMT(BPF_RET|BPF_K, 0xffff),			// accept
+        BPF_STMT(BPF_RET|BPF_K, 0),				// drop
+    };
+    struct sock_filter drop_all[] = {
+        BPF_STMT(BPF_RET|BPF_K, 0),
+    };
+
+    u->packet_socket=socket(AF_PACKET,SOCK_RAW,htons(ETH_P_IP));
+    if(u->packet_socket<0) {
+        perror("create socket failed for packet_socket (needs CAP_NET_RAW)\n");
+        exit(1);
+    }
+
+    prog.len=sizeof(filter)/sizeof(filter[0]);
+    prog.filter=filter;
+    if(setsockopt(u->packet_socket,SOL_SOCKET,SO_ATTACH_FILTER,&prog,sizeof(prog))<0) {
+        perror("cannot attach filter to packet_socket\n");
+        exit(1);
+    }
+
+    if(setsockopt(u->packet_socket,SOL_PACKET,PACKET_VERSION,&version,sizeof(version))<0) {
+        perror("cannot set TPACKET_V3 on packet_socket\n");
+        exit(1);
+    }
+
+    memset(&u->packet_req,0,sizeof(u->packet_req));
+    u->packet_req.tp_block_size=PACKET_BLOCK_SIZE;
+    u->packet_req.tp_block_nr=PACKET_BLOCK_NR;
+    u->packet_req.tp_frame_size=PACKET_FRAME_SIZE;
+    u->packet_req.tp_frame_nr=(PACKET_BLOCK_SIZE/PACKET_FRAME_SIZE)*PACKET_BLOCK_NR;
+    u->packet_req.tp_retire_blk_tov=PACKET_BLOCK_TMO;
+    if(setsockopt(u->packet_socket,SOL_PACKET,PACKET_RX_RING,&u->packet_req,sizeof(u->packet_req))<0) {
+        perror("cannot set PACKET_RX_RING on packet_socket\n");
+        exit(1);
+    }
+
+    ring=(unsigned char*)mmap(NULL,u->packet_req.tp_block_size*u->packet_req.tp_block_nr,
+        PROT_READ|PROT_WRITE,MAP_SHARED,u->packet_socket,0);
+    if(ring==MAP_FAILED) {
+        perror("mmap failed for packet ring\n");
+        exit(1);
+    }
+
+    memset(&ll,0,sizeof(ll));
+    ll.sll_family=AF_PACKET;
+    ll.sll_protocol=htons(ETH_P_IP);
+    ll.sll_ifindex=if_nametoindex(u->rx_interface);
+    if(bind(u->packet_socket,(struct sockaddr*)&ll,sizeof(ll))<0) {
+        perror("bind failed for packet_socket\n");
+        exit(1);
+    }
+
+    prog.len=1;
+    prog.filter=drop_all;
+    setsockopt(u->data_socket,SOL_SOCKET,SO_ATTACH_FILTER,&prog,sizeof(prog));
+
+    u->packet_current=0;
+    u->packet_held=NULL;
+    u->packet_left=0;
+    __atomic_store_n(&u->packet_ring, ring, __ATOMIC_RELEASE);	// receive thread may start walking
+
+    fprintf(stderr,"Metis receiving from TPACKET_V3 ring on %s (%d x %d bytes)\n",
+        u->rx_interface, u->packet_req.tp_block_nr, u->packet_req.tp_block_size);
+}
+
+// The ring can only be filtered once the Metis address is known.
+static void metis_packet_connect(METIS_LINK* link, struct sockaddr_in* address, const char* interface) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+
+    metis_udp_connect(link, address, interface);
+    if(u->packet_ring == NULL)
+        metis_packet_start(link);		// data frames now come from the mmap ring
+}
+
+// Walk the TPACKET_V3 ring. A block is handed back to the kernel on the
+// call after its last packet was returned, so the frames point into the ring
+// without a copy. poll() is only called when the next block is still owned
+// by the kernel, so a full block costs no syscall at all.
+static int metis_packet_receive(METIS_LINK* link, METIS_FRAME* frames, int max) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+    unsigned char* ring=__atomic_load_n(&u->packet_ring, __ATOMIC_ACQUIRE);
+    int count=0;
+
+    if(ring == NULL) {			// not connected yet
+        poll(NULL,0,RX_WAIT_MSEC);
+        return 0;
+    }
+
+    if(u->packet_held != NULL && u->packet_left == 0) {
+        __atomic_store_n(&u->packet_held->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        u->packet_held=NULL;
+        u->packet_current=(u->packet_current+1) % u->packet_req.tp_block_nr;
+
+        if(u->packet_current == 0)		// once per trip round the ring, in case we never idle
+            metis_packet_statistics(link);
+    }
+
+    if(u->packet_held == NULL) {
+        struct tpacket_block_desc* block=(struct tpacket_block_desc*)
+            (ring + u->packet_current * u->packet_req.tp_block_size);
+
+        if((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+            struct pollfd pfd;
+
+            if(link->config.rx_nonblock)	// the reactor does the waiting
+                return 0;
+
+            pfd.fd=u->packet_socket;
+            pfd.events=POLLIN|POLLERR;
+            pfd.revents=0;
+
+            link->stats.syscalls++;
+            poll(&pfd,1,RX_WAIT_MSEC);
+            metis_packet_statistics(link);
+            return 0;
+        }
+
+        u->packet_held=block;
+        u->packet_left=block->hdr.bh1.num_pkts;
+        u->packet_next=(struct tpacket3_hdr*)((unsigned char*)block + block->hdr.bh1.offset_to_first_pkt);
+    }
+
+    while(count < max && u->packet_left > 0) {
+        struct tpacket3_hdr* packet=u->packet_next;
+        struct iphdr* ip=(struct iphdr*)((unsigned char*)packet + packet->tp_net);
+        struct udphdr* udp=(struct udphdr*)((unsigned char*)ip + ip->ihl*4);
+        int captured=(int)packet->tp_snaplen - (int)(packet->tp_net - packet->tp_mac) - ip->ihl*4;
+        int udp_length=ntohs(udp->len);
+
+        u->packet_next=(struct tpacket3_hdr*)((unsigned char*)packet + packet->tp_next_offset);
+        u->packet_left--;
+
+        // The UDP length comes off the wire: it has to cover the UDP header
+        // and stay within what the ring slot captured after the IP header.
+        if(udp_length < (int)sizeof(struct udphdr) || udp_length > captured) {
+            link->stats.length_drops++;
+            continue;
+        }
+
+        frames[count].buffer=(unsigned char*)udp + sizeof(struct udphdr);
+        frames[count].length=udp_length - sizeof(struct udphdr);
+        memset(&frames[count].from,0,sizeof(frames[count].from));
+        frames[count].from.sin_family=AF_INET;
+        frames[count].from.sin_addr.s_addr=ip->saddr;
+        frames[count].from.sin_port=udp->source;
+        frames[count].stamp.tv_sec=packet->tp_sec;
+        frames[count].stamp.tv_nsec=packet->tp_nsec;
+        count++;
+    }
+
+    return count;
+}
+
+// The AF_PACKET socket polls readable when a ring block is ready.
+static int metis_packet_fd(METIS_LINK* link) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+
+    return u->packet_ring != NULL ? u->packet_socket : -1;
+}
+
+static void metis_packet_close(METIS_LINK* link) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+
+    if(u->packet_ring != NULL) {
+        munmap(u->packet_ring, u->packet_req.tp_block_size * u->packet_req.tp_block_nr);
+        close(u->packet_socket);
+        u->packet_ring = NULL;
+        u->packet_socket = -1;
+        u->packet_held = NULL;
+    }
+    metis_udp_close(link);
+}
+
+METIS_TRANSPORT metis_packet_transport = {
+    "AF_PACKET mmap ring",
+    1,
+    metis_udp_open,
+    metis_udp_discover,
+    metis_packet_connect,
+    metis_packet_receive,
+    metis_udp_send,
+    metis_packet_fd,
+    metis_packet_close
+};
+
+
+#ifdef HAVE_LIBURING
+
+// ********** io_uring transport **********
+
+
+static int metis_uring_open(METIS_LINK* link, const char* interface) {
+    UDP_LINK* u;
+    int rc;
+    int i;
+
+    metis_udp_open(link, interface);
+    u=(UDP_LINK*)link->state;
+
+    rc=io_uring_queue_init(URING_ENTRIES,&u->uring,0);
+    if(rc<0) {
+        fprintf(stderr,"io_uring_queue_init failed: %s.\n",strerror(-rc));
+        metis_udp_close(link);
+        return -1;
+    }
+
+    u->uring_rx_ring=io_uring_setup_buf_ring(&u->uring,URING_RX_BUFS,URING_BGID,0,&rc);
+    if(u->uring_rx_ring==NULL) {
+        fprintf(stderr,"io_uring_setup_buf_ring failed: %s.\n",strerror(-rc));
+        io_uring_queue_exit(&u->uring);
+        metis_udp_close(link);
+        return -1;
+    }
+
+    u->uring_rx_bufs=new unsigned char[URING_RX_BUFS*URING_RX_BUFSIZE];
+    for(i=0;i<URING_RX_BUFS;i++)
+        io_uring_buf_ring_add(u->uring_rx_ring,u->uring_rx_bufs+i*URING_RX_BUFSIZE,URING_RX_BUFSIZE,
+            i,io_uring_buf_ring_mask(URING_RX_BUFS),i);
+    io_uring_buf_ring_advance(u->uring_rx_ring,URING_RX_BUFS);
+
+    memset(&u->uring_rx_msg,0,sizeof(u->uring_rx_msg));
+    u->uring_rx_msg.msg_namelen=sizeof(struct sockaddr_in);
+    u->uring_rx_msg.msg_controllen=RX_CONTROL_SIZE;	// room for the drop counter and timestamp
+
+    for(i=0;i<URING_TX_SLOTS;i++) {
+        u->uring_tx[i].iov.iov_base=u->uring_tx[i].frame;
+        memset(&u->uring_tx[i].msg,0,sizeof(u->uring_tx[i].msg));
+        u->uring_tx[i].msg.msg_iov=&u->uring_tx[i].iov;
+        u->uring_tx[i].msg.msg_iovlen=1;
+        u->uring_tx[i].busy=0;
+    }
+
+    u->uring_rx_nheld=0;
+    u->uring_armed=0;
+    u->uring_engine_known=0;
+    fprintf(stderr,"Metis using io_uring engine (%d receive buffers)\n",URING_RX_BUFS);
+    return 0;
+}
+
+static void metis_uring_close(METIS_LINK* link) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+
+    if(u->uring_tx_errors)
+        fprintf(stderr,"io_uring Tx errors = %lu\n",u->uring_tx_errors);
+    io_uring_free_buf_ring(&u->uring,u->uring_rx_ring,URING_RX_BUFS,URING_BGID);
+    io_uring_queue_exit(&u->uring);
+    delete [] u->uring_rx_bufs;
+    u->uring_rx_ring=NULL;
+    u->uring_rx_bufs=NULL;
+    metis_udp_close(link);
+}
+
+// (Re)post the multishot recvmsg that takes its buffers from the buffer ring.
+static void metis_uring_arm_receive(METIS_LINK* link) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+    struct io_uring_sqe* sqe=io_uring_get_sqe(&u->uring);
+
+    io_uring_prep_recvmsg_multishot(sqe,u->data_socket,&u->uring_rx_msg,0);
+    sqe->flags|=IOSQE_BUFFER_SELECT;
+    sqe->buf_group=URING_BGID;
+    io_uring_sqe_set_data64(sqe,0);
+    u->uring_armed=1;
+}
+
+// Each call gives back the buffers handed out last time, submits everything
+// queued (receive re-arm and Tx frames) and waits for completions in one
+// io_uring_enter().
+static int metis_uring_receive(METIS_LINK* link, METIS_FRAME* frames, int max) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+    struct io_uring_cqe* cqes[METIS_MAX_RX_BATCH];
+    struct io_uring_cqe* cqe;
+    struct __kernel_timespec ts;
+    struct io_uring_recvmsg_out* out;
+    struct cmsghdr* cmsg;
+    unsigned char* buf;
+    unsigned int count;
+    unsigned int i;
+    int n=0;
+    int rc;
+
+    if(!u->uring_engine_known) {
+        u->uring_engine=pthread_self();
+        __atomic_store_n(&u->uring_engine_known, 1, __ATOMIC_RELEASE);
+    }
+
+    for(i=0;i<(unsigned int)u->uring_rx_nheld;i++)
+        io_uring_buf_ring_add(u->uring_rx_ring,u->uring_rx_bufs+u->uring_rx_held[i]*URING_RX_BUFSIZE,URING_RX_BUFSIZE,
+            u->uring_rx_held[i],io_uring_buf_ring_mask(URING_RX_BUFS),i);
+    if(u->uring_rx_nheld)
+        io_uring_buf_ring_advance(u->uring_rx_ring,u->uring_rx_nheld);
+    u->uring_rx_nheld=0;
+
+    if(!u->uring_armed)
+        metis_uring_arm_receive(link);
+
+    ts.tv_sec=0;
+    ts.tv_nsec=RX_WAIT_MSEC*1000000L;	// come back to check for a stop
+
+    // liburing only enters the kernel when there is something to submit or
+    // no completion is waiting yet, so count those calls, not ours.
+    if(io_uring_sq_ready(&u->uring) > 0 || io_uring_cq_ready(&u->uring) == 0)
+        link->stats.syscalls++;
+
+    rc=io_uring_submit_and_wait_timeout(&u->uring,&cqe,1,&ts,NULL);
+    if(rc<0 && rc!=-ETIME && rc!=-EINTR) {
+        fprintf(stderr,"io_uring_submit_and_wait failed for metis_uring_receive: %s\n",strerror(-rc));
+        exit(1);
+    }
+
+    if(max > METIS_MAX_RX_BATCH)
+        max = METIS_MAX_RX_BATCH;
+
+    count=io_uring_peek_batch_cqe(&u->uring,cqes,max);
+    if(count == 0)
+        return 0;
+
+    for(i=0;i<count;i++) {
+        cqe=cqes[i];
+
+        if(io_uring_cqe_get_data64(cqe) & URING_TX_TAG) {
+            u->uring_tx[io_uring_cqe_get_data64(cqe) & (URING_TX_TAG-1)].busy=0;
+            if(cqe->res<0)
+                u->uring_tx_errors++;
+            continue;
+        }
+
+        if(!(cqe->flags & IORING_CQE_F_MORE))
+            u->uring_armed=0;			// multishot ended (e.g. buffers ran out)
+
+        if(!(cqe->flags & IORING_CQE_F_BUFFER))
+            continue;
+
+        u->uring_rx_held[u->uring_rx_nheld++]=cqe->flags>>IORING_CQE_BUFFER_SHIFT;
+        buf=u->uring_rx_bufs+(cqe->flags>>IORING_CQE_BUFFER_SHIFT)*URING_RX_BUFSIZE;
+        if(cqe->res<=0)
+            continue;
+
+        out=io_uring_recvmsg_validate(buf,cqe->res,&u->uring_rx_msg);
+        if(out==NULL)
+            continue;
+
+        frames[n].stamp.tv_sec=0;
+        frames[n].stamp.tv_nsec=0;
+        for(cmsg=io_uring_recvmsg_cmsg_firsthdr(out,&u->uring_rx_msg);cmsg!=NULL;
+            cmsg=io_uring_recvmsg_cmsg_nexthdr(out,&u->uring_rx_msg,cmsg))
+            metis_note_control(link,cmsg,&frames[n].stamp);
+
+        frames[n].buffer=(unsigned char*)io_uring_recvmsg_payload(out,&u->uring_rx_msg);
+        frames[n].length=io_uring_recvmsg_payload_length(out,cqe->res,&u->uring_rx_msg);
+        memcpy(&frames[n].from,io_uring_recvmsg_name(out),sizeof(frames[n].from));
+        n++;
+    }
+
+    io_uring_cq_advance(&u->uring,count);
+    return n;
+}
+
+// Datagrams sent from the receive thread are queued as linked sendmsg SQEs
+// so they leave in order with the next submit. The TxBuf slots are released
+// by the caller as soon as this returns, so each datagram is copied into an
+// engine slot that stays put until its completion. The copy is about 35 nsec
+// per frame, some 1% of the send, against holding the caller's TxBufs for
+// the whole submit/complete round trip. Other threads, and the
+// overflow when the engine slots run out, use sendmsg() directly.
+static void metis_uring_send(METIS_LINK* link, struct iovec* iov, int iovlen, int nframes) {
+    UDP_LINK* u=(UDP_LINK*)link->state;
+    struct io_uring_sqe* sqe;
+    struct io_uring_sqe* last=NULL;
+    size_t length;
+    int slot;
+    int i;
+
+    if(!__atomic_load_n(&u->uring_engine_known, __ATOMIC_ACQUIRE) || !pthread_equal(pthread_self(),u->uring_engine)) {
+        metis_udp_send(link,iov,iovlen,nframes);
+        return;
+    }
+
+    while(nframes > 0) {
+        for(i=0;i<URING_TX_SLOTS && u->uring_tx[u->uring_tx_next].busy;i++)
+            u->uring_tx_next=(u->uring_tx_next+1) % URING_TX_SLOTS;
+
+        if(u->uring_tx[u->uring_tx_next].busy || (sqe=io_uring_get_sqe(&u->uring))==NULL)
+            break;
+
+        slot=u->uring_tx_next;
+        u->uring_tx_next=(u->uring_tx_next+1) % URING_TX_SLOTS;
+
+        length=0;
+        for(i=0;i<iovlen && length+iov[i].iov_len<=sizeof(u->uring_tx[slot].frame);i++) {
+            memcpy(u->uring_tx[slot].frame+length,iov[i].iov_base,iov[i].iov_len);
+            length+=iov[i].iov_len;
+        }
+        u->uring_tx[slot].iov.iov_len=length;
+        u->uring_tx[slot].busy=1;
+
+        io_uring_prep_sendmsg(sqe,u->data_socket,&u->uring_tx[slot].msg,0);
+        io_uring_sqe_set_data64(sqe,URING_TX_TAG|slot);
+        if(last!=NULL)
+            last->flags|=IOSQE_IO_LINK;
+        last=sqe;
+
+        iov+=iovlen;
+        nframes--;
+    }
+
+    if(nframes > 0) {			// out of slots: push what is queued, then send directly
+        io_uring_submit(&u->uring);
+        metis_udp_send(link,iov,iovlen,nframes);
+    }
+}
+
+METIS_TRANSPORT metis_uring_transport = {
+    "io_uring engine",
+    1,
+    metis_uring_open,
+    metis_udp_discover,
+    metis_udp_connect,
+    metis_uring_receive,
+    metis_uring_send,
+    NULL,				// receive() also submits Tx, it keeps its own thread
+    metis_uring_close
+};
+
+#endif  // HAVE_LIBURING
@@ -0,0 +1,268 @@
+/* -*-  C++  -*-  */
+/* metis_unpack.cc */
+
+/*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*
+*/
+
+// Received sample conversion (see metis_unpack.h).
+//
+// A byte shuffle moves the three bytes of each sample, most significant
+// first on the wire, into the top three bytes of a 32 bit lane, and an
+// arithmetic shift right by 8 then sign extends it. The integers convert
+// to float exactly (24 bits fit the mantissa), and one multiply by the
+// reciprocal of full scale takes the place of a divide per sample. The
+// plain C kernel does the same arithmetic, so every kernel gives the same
+// floats.
+//
+// The vector kernels are built with the GCC target attribute, so the rest
+// of the library needs no special compiler flags, and are only used after
+// the CPU has been asked whether it runs them. Rows that a full width load
+// would read past the end of are left to a narrower kernel: AVX-512 hands
+// them to AVX2, the others to plain C. The AVX kernels clear the upper
+// halves of the vector registers first: GCC leaves that out of a tail
+// call, and legacy SSE instructions run with them dirty are slow.
+
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "metis_unpack.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define METIS_UNPACK_X86 1
+#include <immintrin.h>
+#endif
+
+#define UNPACK_SCALE (1.0f / 8388607.0f)	// full scale, as before
+
+static inline float unpack_sample(const unsigned char* p) {
+    int v = ((int)(signed char)p[0] << 16) | ((int)p[1] << 8) | (int)p[2];
+    return (float)v * UNPACK_SCALE;
+}
+
+static void unpack_one_scalar(const unsigned char* rows, int count, int stride, float* out) {
+    int i;
+
+    for(i=0;i<count;i++,rows+=stride) {
+        *out++ = unpack_sample(rows);		// I
+        *out++ = unpack_sample(rows + 3);	// Q
+    }
+}
+
+static void unpack_two_scalar(const unsigned char* rows, int count, int stride, float* out) {
+    int i;
+
+    for(i=0;i<count;i++,rows+=stride) {
+        *out++ = unpack_sample(rows);		// I0
+        *out++ = unpack_sample(rows + 3);	// Q0
+        *out++ = unpack_sample(rows + 6);	// I1
+        *out++ = unpack_sample(rows + 9);	// Q1
+    }
+}
+
+// Rows whose first 'width' bytes can be loaded without reading past the
+// count * stride bytes the caller gave.
+static inline int unpack_safe_rows(int count, int stride, int width) {
+    return count - (width + stride - 1) / stride + 1;
+}
+
+#ifdef METIS_UNPACK_X86
+
+// One 16 byte lane holds two rows of I Q (8 bytes each, Mic bytes unused),
+// or one row of I0 Q0 I1 Q1; -1 clears the low byte of each 32 bit lane.
+#define UNPACK_ONE_SHUFFLE -1,2,1,0, -1,5,4,3, -1,10,9,8, -1,13,12,11
+#define UNPACK_TWO_SHUFFLE -1,2,1,0, -1,5,4,3, -1,8,7,6, -1,11,10,9
+
+// Two rows of I Q side by side: one load when they are 8 bytes apart. A
+// macro, so that it is compiled for the instruction set of each kernel.
+#define UNPACK_LOAD_ONE(rows, stride) \
+    ((stride) == 8 ? _mm_loadu_si128((const __m128i*)(rows)) : \
+     _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(rows)), \
+                        _mm_loadl_epi64((const __m128i*)((rows) + (stride)))))
+
+__attribute__((target("sse4.1")))
+static void unpack_one_sse41(const unsigned char* rows, int count, int stride, float* out) {
+    const __m128i shuffle = _mm_setr_epi8(UNPACK_ONE_SHUFFLE);
+    const __m128 scale = _mm_set1_ps(UNPACK_SCALE);
+    int safe = unpack_safe_rows(count, stride, 8);
+    int i;
+
+    for(i=0;i+2<=safe;i+=2,rows+=2*stride,out+=4) {
+        __m128i v = _mm_shuffle_epi8(UNPACK_LOAD_ONE(rows, stride), shuffle);
+        v = _mm_srai_epi32(v, 8);
+        _mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+    unpack_one_scalar(rows, count - i, stride, out);
+}
+
+__attribute__((target("sse4.1")))
+static void unpack_two_sse41(const unsigned char* rows, int count, int stride, float* out) {
+    const __m128i shuffle = _mm_setr_epi8(UNPACK_TWO_SHUFFLE);
+    const __m128 scale = _mm_set1_ps(UNPACK_SCALE);
+    int safe = unpack_safe_rows(count, stride, 16);
+    int i;
+
+    for(i=0;i<safe;i++,rows+=stride,out+=4) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)rows), shuffle);
+        v = _mm_srai_epi32(v, 8);
+        _mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+    unpack_two_scalar(rows, count - i, stride, out);
+}
+
+__attribute__((target("avx2")))
+static void unpack_one_avx2(const unsigned char* rows, int count, int stride, float* out) {
+    const __m256i shuffle = _mm256_setr_epi8(UNPACK_ONE_SHUFFLE, UNPACK_ONE_SHUFFLE);
+    const __m256 scale = _mm256_set1_ps(UNPACK_SCALE);
+    int safe = unpack_safe_rows(count, stride, 8);
+    int i;
+
+    for(i=0;i+4<=safe;i+=4,rows+=4*stride,out+=8) {
+        __m256i v;
+        if(stride == 8)
+            v = _mm256_loadu_si256((const __m256i*)rows);
+        else
+            v = _mm256_inserti128_si256(_mm256_castsi128_si256(UNPACK_LOAD_ONE(rows, stride)),
+                                        UNPACK_LOAD_ONE(rows + 2*stride, stride), 1);
+        v = _mm256_srai_epi32(_mm256_shuffle_epi8(v, shuffle), 8);
+        _mm256_storeu_ps(out, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    _mm256_zeroupper();
+    unpack_one_scalar(rows, count - i, stride, out);
+}
+
+__attribute__((target("avx2")))
+static void unpack_two_avx2(const unsigned char* rows, int count, int stride, float* out) {
+    const __m256i shuffle = _mm256_setr_epi8(UNPACK_TWO_SHUFFLE, UNPACK_TWO_SHUFFLE);
+    const __m256 scale = _mm256_set1_ps(UNPACK_SCALE);
+    int safe = unpack_safe_rows(count, stride, 16);
+    int i;
+
+    for(i=0;i+2<=safe;i+=2,rows+=2*stride,out+=8) {
+        __m256i v = _mm256_inserti128_si256(
+                        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)rows)),
+                        _mm_loadu_si128((const __m128i*)(rows + stride)), 1);
+        v = _mm256_srai_epi32(_mm256_shuffle_epi8(v, shuffle), 8);
+        _mm256_storeu_ps(out, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    _mm256_zeroupper();
+    unpack_two_scalar(rows, count - i, stride, out);
+}
+
+// GCC 12 fills the don't-care operands of its AVX-512 intrinsics with a
+// self-initialised variable, which -Wuninitialized then reports wherever
+// they are inlined (GCC bug 105593, fixed in 12.3). Every lane used here
+// is loaded or zeroed.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f,avx512bw")))
+static void unpack_one_avx512(const unsigned char* rows, int count, int stride, float* out) {
+    const __m512i shuffle = _mm512_broadcast_i32x4(_mm_setr_epi8(UNPACK_ONE_SHUFFLE));
+    const __m512 scale = _mm512_set1_ps(UNPACK_SCALE);
+    int safe = unpack_safe_rows(count, stride, 8);
+    int i;
+
+    for(i=0;i+8<=safe;i+=8,rows+=8*stride,out+=16) {
+        __m512i v;
+        if(stride == 8)
+            v = _mm512_loadu_si512((const void*)rows);
+        else {
+            v = _mm512_inserti32x4(_mm512_setzero_si512(), UNPACK_LOAD_ONE(rows, stride), 0);
+            v = _mm512_inserti32x4(v, UNPACK_LOAD_ONE(rows + 2*stride, stride), 1);
+            v = _mm512_inserti32x4(v, UNPACK_LOAD_ONE(rows + 4*stride, stride), 2);
+            v = _mm512_inserti32x4(v, UNPACK_LOAD_ONE(rows + 6*stride, stride), 3);
+        }
+        v = _mm512_srai_epi32(_mm512_shuffle_epi8(v, shuffle), 8);
+        _mm512_storeu_ps(out, _mm512_mul_ps(_mm512_cvtepi32_ps(v), scale));
+    }
+    _mm256_zeroupper();
+    unpack_one_avx2(rows, count - i, stride, out);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void unpack_two_avx512(const unsigned char* rows, int count, int stride, float* out) {
+    const __m512i shuffle = _mm512_broadcast_i32x4(_mm_setr_epi8(UNPACK_TWO_SHUFFLE));
+    const __m512 scale = _mm512_set1_ps(UNPACK_SCALE);
+    int safe = unpack_safe_rows(count, stride, 16);
+    int i;
+
+    for(i=0;i+4<=safe;i+=4,rows+=4*stride,out+=16) {
+        __m512i v = _mm512_inserti32x4(_mm512_setzero_si512(), _mm_loadu_si128((const __m128i*)rows), 0);
+        v = _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i*)(rows + stride)), 1);
+        v = _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i*)(rows + 2*stride)), 2);
+        v = _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i*)(rows + 3*stride)), 3);
+        v = _mm512_srai_epi32(_mm512_shuffle_epi8(v, shuffle), 8);
+        _mm512_storeu_ps(out, _mm512_mul_ps(_mm512_cvtepi32_ps(v), scale));
+    }
+    _mm256_zeroupper();
+    unpack_two_avx2(rows, count - i, stride, out);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif  // METIS_UNPACK_X86
+
+static const METIS_UNPACK unpack_kernels[] = {
+    { "scalar", unpack_one_scalar, unpack_two_scalar },
+#ifdef METIS_UNPACK_X86
+    { "sse4.1", unpack_one_sse41, unpack_two_sse41 },
+    { "avx2", unpack_one_avx2, unpack_two_avx2 },
+    { "avx512", unpack_one_avx512, unpack_two_avx512 },
+#endif
+};
+
+static pthread_once_t unpack_once = PTHREAD_ONCE_INIT;
+static int unpack_count;		// kernels the CPU runs, from the start of unpack_kernels
+
+static int unpack_supported(int kernel) {
+#ifdef METIS_UNPACK_X86
+    __builtin_cpu_init();
+    switch(kernel) {
+        case 1: return __builtin_cpu_supports("sse4.1");
+        case 2: return __builtin_cpu_supports("avx2");
+        case 3: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }
+#endif
+    return kernel == 0;
+}
+
+static void unpack_select(void) {
+    int n = sizeof(unpack_kernels) / sizeof(unpack_kernels[0]);
+
+    unpack_count = 1;
+    while(unpack_count < n && unpack_supported(unpack_count))
+        unpack_count++;
+
+    fprintf(stderr, "Metis: %s sample unpack\n", unpack_kernels[unpack_count - 1].name);
+}
+
+const METIS_UNPACK* metis_unpack_best(void) {
+    pthread_once(&unpack_once, unpack_select);
+    return &unpack_kernels[unpack_count - 1];
+}
+
+const METIS_UNPACK* metis_unpack_kernels(int* count) {
+    pthread_once(&unpack_once, unpack_select);
+    *count = unpack_count;
+    return unpack_kernels;
+}
@@ -0,0 +1,46 @@
+/* -*- c++ -*- */
+/* metis_unpack.h */
+
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+// Received sample conversion: rows of 24 bit big-endian 2's complement I/Q
+// samples to floats in -1.0 .. +1.0, a whole USB frame (or Protocol 2
+// packet) per call.
+//
+// A row holds the samples of one sample time: I Q for one receiver, or
+// I0 Q0 I1 Q1 for two, then whatever else the format puts there (the
+// two Mic bytes of a USB frame row). stride is the length of a row: 8 and
+// 14 bytes in a USB frame, 6 and 12 in a Protocol 2 packet. The kernels
+// read no more than count * stride bytes from rows.
+//
+// There are SSE4.1, AVX2 and AVX-512 kernels besides the plain C one, used
+// when the CPU has them. All of them give the same floats.
+
+#ifndef METIS_UNPACK_H
+#define METIS_UNPACK_H
+
+typedef void (*METIS_UNPACK_FN)(const unsigned char* rows, int count, int stride, float* out);
+
+typedef struct _METIS_UNPACK {
+    const char* name;			// "scalar", "sse4.1", "avx2", "avx512"
+    METIS_UNPACK_FN one;		// rows of I Q: 2 floats out per row
+    METIS_UNPACK_FN two;		// rows of I0 Q0 I1 Q1: 4 floats out per row
+} METIS_UNPACK;
+
+// The fastest kernels this CPU runs, picked on the first call.
+const METIS_UNPACK* metis_unpack_best(void);
+
+// Every kernel this CPU runs, slowest first; *count is set to how many.
+const METIS_UNPACK* metis_unpack_kernels(int* count);
+
+#endif  // METIS_UNPACK_H
@@ -0,0 +1,56 @@
+/* -*- c++ -*- */
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _QA_HERMES_PROXY_H_
+#define _QA_HERMES_PROXY_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestCase.h>
+
+namespace gr {
+  namespace hpsdr {
+
+    class qa_hermes_proxy : public CppUnit::TestCase
+    {
+    public:
+      CPPUNIT_TEST_SUITE(qa_hermes_proxy);
+      CPPUNIT_TEST(t1);
+      CPPUNIT_TEST(t2);
+      CPPUNIT_TEST(t3);
+      CPPUNIT_TEST(t4);
+      CPPUNIT_TEST(t5);
+      CPPUNIT_TEST(t6);
+      CPPUNIT_TEST(t7);
+      CPPUNIT_TEST(t8);
+      CPPUNIT_TEST_SUITE_END();
+
+    private:
+      void t1();	// Rx buffers come out whole, in order and without a sample missing
+      void t2();	// the Tx ring fills up to one short and is emptied at the EP2 rate
+      void t3();	// after a stall only RxMaxLatency is left waiting, the oldest dropped
+      void t4();	// ring depths and buffer size are rounded up, a deep ring rides out a stall
+      void t5();	// the arena is page aligned, zeroed and rounded to the pages it takes
+      void t6();	// lazy decode takes the status on arrival and queues whole frames of rows
+      void t7();	// Protocol 2: DDC1 in step with DDC0, nothing lost, a DUC packet per 240 ticks of 192 kHz
+      void t8();	// a capture replays whole and in order, then finishes; its EP2 frames set the receivers
+    };
+
+  } /* namespace hpsdr */
+} /* namespace gr */
+
+#endif /* _QA_HERMES_PROXY_H_ */
@@ -26,11 +26,23 @@
  */
 
 #include "qa_hpsdr.h"
+#include "qa_metis_unpack.h"
+#include "qa_metis_reorder.h"
+#include "qa_metis_raw_ring.h"
+#include "qa_metis_capture.h"
+#include "qa_metis_discovery.h"
+#include "qa_hermes_proxy.h"
 
 CppUnit::TestSuite *
 qa_hpsdr::suite()
 {
   CppUnit::TestSuite *s = new CppUnit::TestSuite("hpsdr");
+  s->addTest(gr::hpsdr::qa_metis_unpack::suite());
+  s->addTest(gr::hpsdr::qa_metis_reorder::suite());
+  s->addTest(gr::hpsdr::qa_metis_raw_ring::suite());
+  s->addTest(gr::hpsdr::qa_metis_capture::suite());
+  s->addTest(gr::hpsdr::qa_metis_discovery::suite());
+  s->addTest(gr::hpsdr::qa_hermes_proxy::suite());
 
   return s;
 }
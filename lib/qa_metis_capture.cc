@@ -0,0 +1,172 @@
+/* -*- c++ -*- */
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <gnuradio/attributes.h>
+#include <cppunit/TestAssert.h>
+#include "qa_metis_capture.h"
+#include "metis_capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace gr {
+  namespace hpsdr {
+
+    #define FRAMES 300		// records 1..300, in three blocks
+
+    static unsigned int
+    get32(const unsigned char* p)
+    {
+      return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+    }
+
+    // Frame n: EP6 mostly, every 4th EP4 and every 5th EP2, each end point
+    // numbered on its own, stamped n msec into the capture.
+    static void
+    make_frame(int n, unsigned char* frame, unsigned int* sequence, struct timespec* stamp)
+    {
+      int ep = (n % 5 == 0) ? 2 : (n % 4 == 0) ? 4 : 6;
+      unsigned int s = sequence[ep == 6 ? 0 : ep == 4 ? 1 : 2]++;
+
+      for (int i = 0; i < METIS_CAPTURE_FRAME; i++)
+	frame[i] = (unsigned char)(n + i);
+      frame[0] = 0xEF; frame[1] = 0xFE; frame[2] = 0x01; frame[3] = ep;
+      frame[4] = s >> 24; frame[5] = s >> 16; frame[6] = s >> 8; frame[7] = s;
+      stamp->tv_sec = 1700000000 + n / 1000;
+      stamp->tv_nsec = (n % 1000) * 1000000L;
+    }
+
+    static void
+    temp_path(char* path, size_t size)
+    {
+      const char* dir = getenv("TMPDIR");
+      int fd;
+
+      snprintf(path, size, "%s/qa_metis_capture.XXXXXX", dir != NULL ? dir : "/tmp");
+      fd = mkstemp(path);
+      CPPUNIT_ASSERT(fd >= 0);
+      close(fd);
+    }
+
+    static void
+    remove_capture(const char* path)
+    {
+      char index_path[600];
+
+      snprintf(index_path, sizeof(index_path), "%s.idx", path);
+      unlink(index_path);
+      unlink(path);
+    }
+
+    void
+    qa_metis_capture::t1()
+    {
+      char path[512];
+      unsigned char frame[METIS_CAPTURE_FRAME];
+      unsigned char record[METIS_CAPTURE_RECORD];
+      unsigned int sequence[3] = { 0, 0, 0 };
+      unsigned int last[3] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+      struct timespec stamp;
+      struct iovec iov[2];
+      METIS_CAPTURE_ENTRY* entries;
+      METIS_CAPTURE* capture;
+      FILE* file;
+      long count;
+      long bad = 0;
+
+      temp_path(path, sizeof(path));
+      capture = metis_capture_open(path, "qa");
+      for (int n = 1; n <= FRAMES; n++)
+      {
+	make_frame(n, frame, sequence, &stamp);
+	iov[0].iov_base = frame;		// header and the rest apart, as metis.cc sends
+	iov[0].iov_len = 8;
+	iov[1].iov_base = frame + 8;
+	iov[1].iov_len = METIS_CAPTURE_FRAME - 8;
+	metis_capture_frame(capture, iov, 2, &stamp);
+      }
+      metis_capture_close(capture);
+
+      count = metis_capture_index(path, &entries);
+      CPPUNIT_ASSERT_EQUAL((long)(FRAMES + 1 + METIS_CAPTURE_BLOCK_RECORDS - 1) / METIS_CAPTURE_BLOCK_RECORDS, count);
+
+      file = fopen(path, "rb");
+      CPPUNIT_ASSERT(file != NULL);
+      CPPUNIT_ASSERT_EQUAL((size_t)1, fread(record, sizeof(record), 1, file));
+      CPPUNIT_ASSERT(memcmp(record, "HPSDRCAP", 8) == 0);
+      CPPUNIT_ASSERT_EQUAL((unsigned)METIS_CAPTURE_RECORD, get32(record + 12));
+      CPPUNIT_ASSERT_EQUAL(0ULL, entries[0].record);
+
+      memset(sequence, 0, sizeof(sequence));
+      for (int n = 1; n <= FRAMES; n++)
+      {
+	make_frame(n, frame, sequence, &stamp);
+	CPPUNIT_ASSERT_EQUAL((size_t)1, fread(record, sizeof(record), 1, file));
+
+	// the record header, then the frame as it was
+	if (record[0] != frame[3] || record[1] != (frame[3] == 2 ? METIS_CAPTURE_TX : 0) ||
+	    (record[2] << 8 | record[3]) != METIS_CAPTURE_FRAME || get32(record + 4) != get32(frame + 4) ||
+	    get32(record + 12) != (unsigned)stamp.tv_sec || get32(record + 16) != (unsigned)stamp.tv_nsec ||
+	    memcmp(record + METIS_CAPTURE_HEADER, frame, METIS_CAPTURE_FRAME) != 0)
+	  bad++;
+
+	last[frame[3] == 6 ? 0 : frame[3] == 4 ? 1 : 2] = get32(frame + 4);
+	if (n % METIS_CAPTURE_BLOCK_RECORDS == 0)	// first record of a block
+	{
+	  METIS_CAPTURE_ENTRY* entry = &entries[n / METIS_CAPTURE_BLOCK_RECORDS];
+	  CPPUNIT_ASSERT_EQUAL((unsigned long long)n, entry->record);
+	  CPPUNIT_ASSERT_EQUAL(stamp.tv_sec, entry->stamp.tv_sec);
+	  CPPUNIT_ASSERT_EQUAL(stamp.tv_nsec, entry->stamp.tv_nsec);
+	  for (int ep = 0; ep < 3; ep++)
+	    CPPUNIT_ASSERT_EQUAL(last[ep], entry->sequence[ep]);
+	}
+      }
+      CPPUNIT_ASSERT_EQUAL((size_t)0, fread(record, 1, 1, file));	// trimmed to its records
+      CPPUNIT_ASSERT_EQUAL(0L, bad);
+
+      fclose(file);
+      free(entries);
+      remove_capture(path);
+    }
+
+    void
+    qa_metis_capture::t2()
+    {
+      char path[512];
+      char index_path[600];
+      METIS_CAPTURE_ENTRY* entries = NULL;
+      FILE* file;
+
+      temp_path(path, sizeof(path));
+      CPPUNIT_ASSERT_EQUAL(-1L, metis_capture_index(path, &entries));
+
+      snprintf(index_path, sizeof(index_path), "%s.idx", path);
+      file = fopen(index_path, "wb");
+      CPPUNIT_ASSERT(file != NULL);
+      fputs("HPSDRIDX but not this version or layout", file);
+      fclose(file);
+      CPPUNIT_ASSERT_EQUAL(-1L, metis_capture_index(path, &entries));
+      CPPUNIT_ASSERT(entries == NULL);
+
+      remove_capture(path);
+    }
+
+  } /* namespace hpsdr */
+} /* namespace gr */
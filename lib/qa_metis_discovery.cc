@@ -0,0 +1,182 @@
+/* -*- c++ -*- */
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <gnuradio/attributes.h>
+#include <cppunit/TestAssert.h>
+#include "qa_metis_discovery.h"
+#include "metis.h"
+
+#include <pthread.h>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace gr {
+  namespace hpsdr {
+
+    // The loopback radio answers discovery as 02:00:00:00:00:01.
+
+    static double
+    seconds(clockid_t clock)
+    {
+      struct timespec now;
+
+      clock_gettime(clock, &now);
+      return now.tv_sec + now.tv_nsec * 1e-9;
+    }
+
+    void
+    qa_metis_discovery::t1()
+    {
+      METIS_SESSION* session = metis_open("loopback", "02:00:00:00:00:01", NULL, NULL);
+      double start = seconds(CLOCK_MONOTONIC);
+
+      metis_discover(session);
+      CPPUNIT_ASSERT_EQUAL(0, metis_wait_found(session, "02:00:00:00:00:01", 5000));
+      CPPUNIT_ASSERT(seconds(CLOCK_MONOTONIC) - start < 1.0);
+      CPPUNIT_ASSERT_EQUAL(1, metis_found(session));
+
+      metis_close(session, NULL, NULL);
+    }
+
+    void
+    qa_metis_discovery::t2()
+    {
+      METIS_SESSION* session = metis_open("loopback", "02:00:00:00:00:77", NULL, NULL);
+      double start, cpu, elapsed;
+
+      metis_discover(session);
+      start = seconds(CLOCK_MONOTONIC);
+      cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+      CPPUNIT_ASSERT_EQUAL(-1, metis_wait_found(session, "02:00:00:00:00:77", 500));
+      elapsed = seconds(CLOCK_MONOTONIC) - start;
+      cpu = seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+      CPPUNIT_ASSERT(elapsed >= 0.5 && elapsed < 1.5);
+      CPPUNIT_ASSERT(cpu < 0.1);		// the wait, and discovery meanwhile, sleep
+
+      metis_close(session, NULL, NULL);
+    }
+
+    // A radio that only listens on 127.0.0.1, so broadcasts do not reach
+    // it and it is only found by a probe sent to that address.
+    struct responder {
+      int socket;
+      int stop;
+      int requests;
+    };
+
+    static void*
+    respond(void* arg)
+    {
+      struct responder* r = (struct responder*)arg;
+      unsigned char request[64];
+      unsigned char reply[60];
+      struct sockaddr_in from;
+      socklen_t length;
+      ssize_t n;
+
+      memset(reply, 0, sizeof(reply));
+      reply[0] = 0xEF; reply[1] = 0xFE; reply[2] = 0x02;
+      reply[3] = 0x02; reply[8] = 0x5A;		// 02:00:00:00:00:5A
+      reply[9] = 31; reply[10] = 0x01;		// firmware, Hermes
+
+      while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE))
+      {
+	length = sizeof(from);
+	n = recvfrom(r->socket, request, sizeof(request), 0, (struct sockaddr*)&from, &length);
+	if (n >= 3 && request[0] == 0xEF && request[1] == 0xFE && request[2] == 0x02)
+	{
+	  __atomic_add_fetch(&r->requests, 1, __ATOMIC_RELAXED);
+	  sendto(r->socket, reply, sizeof(reply), 0, (struct sockaddr*)&from, length);
+	}
+      }
+      return NULL;
+    }
+
+    void
+    qa_metis_discovery::t3()
+    {
+      char path[512];
+      char line[128];
+      const char* dir = getenv("TMPDIR");
+      struct responder r;
+      struct sockaddr_in address;
+      struct timeval poll = { 0, 100000 };
+      pthread_t thread;
+      METIS_SESSION* session;
+      FILE* cache;
+      double start;
+      int fd;
+      int one = 1;
+
+      snprintf(path, sizeof(path), "%s/qa_metis_cache.XXXXXX", dir != NULL ? dir : "/tmp");
+      fd = mkstemp(path);
+      CPPUNIT_ASSERT(fd >= 0);
+      close(fd);
+      cache = fopen(path, "w");
+      fputs("02:00:00:00:00:5B eth9 10.9.9.9\n02:00:00:00:00:5A lo 127.0.0.1\n", cache);
+      fclose(cache);
+      setenv("HPSDR_METIS_CACHE", path, 1);
+
+      memset(&r, 0, sizeof(r));
+      r.socket = socket(AF_INET, SOCK_DGRAM, 0);
+      setsockopt(r.socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      setsockopt(r.socket, SOL_SOCKET, SO_RCVTIMEO, &poll, sizeof(poll));
+      memset(&address, 0, sizeof(address));
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      address.sin_port = htons(1024);
+      CPPUNIT_ASSERT(bind(r.socket, (struct sockaddr*)&address, sizeof(address)) == 0);
+      CPPUNIT_ASSERT(pthread_create(&thread, NULL, respond, &r) == 0);
+
+      session = metis_open("lo", "02:00:00:00:00:5A", NULL, NULL);
+      start = seconds(CLOCK_MONOTONIC);
+      metis_discover(session);
+      CPPUNIT_ASSERT(metis_wait_found(session, "02:00:00:00:00:5A", 3000) >= 0);
+      CPPUNIT_ASSERT(seconds(CLOCK_MONOTONIC) - start < 0.5);	// the first probe, no broadcast round
+      CPPUNIT_ASSERT_EQUAL(std::string("127.0.0.1"), std::string(metis_ip_address(session, 0)));
+      metis_close(session, NULL, NULL);
+
+      __atomic_store_n(&r.stop, 1, __ATOMIC_RELEASE);
+      pthread_join(thread, NULL);
+      close(r.socket);
+      CPPUNIT_ASSERT(r.requests >= 1);
+
+      // the radio found moves to the top, the other entry stays
+      cache = fopen(path, "r");
+      CPPUNIT_ASSERT(cache != NULL);
+      CPPUNIT_ASSERT(fgets(line, sizeof(line), cache) != NULL);
+      CPPUNIT_ASSERT_EQUAL(std::string("02:00:00:00:00:5A lo 127.0.0.1\n"), std::string(line));
+      CPPUNIT_ASSERT(fgets(line, sizeof(line), cache) != NULL);
+      CPPUNIT_ASSERT_EQUAL(std::string("02:00:00:00:00:5B eth9 10.9.9.9\n"), std::string(line));
+      CPPUNIT_ASSERT(fgets(line, sizeof(line), cache) == NULL);
+      fclose(cache);
+
+      unsetenv("HPSDR_METIS_CACHE");
+      unlink(path);
+    }
+
+  } /* namespace hpsdr */
+} /* namespace gr */
@@ -0,0 +1,125 @@
+/* -*- c++ -*- */
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <gnuradio/attributes.h>
+#include <cppunit/TestAssert.h>
+#include "qa_metis_raw_ring.h"
+#include "metis_raw_ring.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+namespace gr {
+  namespace hpsdr {
+
+    #define RING_FRAMES 8
+    #define PASS_FRAMES 200000
+
+    void
+    qa_metis_raw_ring::t1()
+    {
+      METIS_RAW_RING ring;
+      METIS_RAW_SLOT* slot;
+
+      metis_raw_ring_init(&ring, 5);
+      CPPUNIT_ASSERT_EQUAL(7u, ring.mask);	// rounded up to 8
+
+      // Start just short of where the free running counters wrap.
+      ring.head = ring.tail = 0xFFFFFFFCu;
+
+      for (int round = 0; round < 3; round++)
+      {
+	CPPUNIT_ASSERT(metis_raw_ring_peek(&ring) == NULL);
+	CPPUNIT_ASSERT_EQUAL(0u, metis_raw_ring_count(&ring));
+	CPPUNIT_ASSERT_EQUAL((unsigned)RING_FRAMES, metis_raw_ring_space(&ring));
+
+	for (int i = 0; i < RING_FRAMES; i++)
+	{
+	  slot = metis_raw_ring_claim(&ring);
+	  CPPUNIT_ASSERT(slot != NULL);
+	  slot->length = round * RING_FRAMES + i;
+	  metis_raw_ring_publish(&ring);
+	}
+
+	CPPUNIT_ASSERT(metis_raw_ring_claim(&ring) == NULL);
+	CPPUNIT_ASSERT_EQUAL((unsigned long)round + 1, ring.overruns);
+	CPPUNIT_ASSERT_EQUAL((unsigned)RING_FRAMES, metis_raw_ring_count(&ring));
+	CPPUNIT_ASSERT_EQUAL(0u, metis_raw_ring_space(&ring));
+
+	for (int i = 0; i < RING_FRAMES; i++)
+	{
+	  slot = metis_raw_ring_peek(&ring);
+	  CPPUNIT_ASSERT(slot != NULL);
+	  CPPUNIT_ASSERT_EQUAL(round * RING_FRAMES + i, slot->length);
+	  metis_raw_ring_release(&ring);
+	}
+      }
+      CPPUNIT_ASSERT(ring.head < 0xFFFFFFFCu);	// the counters did wrap
+
+      metis_raw_ring_free(&ring);
+    }
+
+    static void*
+    producer(void* arg)
+    {
+      METIS_RAW_RING* ring = (METIS_RAW_RING*)arg;
+      METIS_RAW_SLOT* slot;
+
+      for (int i = 0; i < PASS_FRAMES; i++)
+      {
+	while ((slot = metis_raw_ring_claim(ring)) == NULL)
+	  sched_yield();
+	slot->length = i;
+	memcpy(slot->frame, &i, sizeof(i));
+	metis_raw_ring_publish(ring);
+	metis_raw_ring_wake(ring);
+      }
+      return NULL;
+    }
+
+    void
+    qa_metis_raw_ring::t2()
+    {
+      METIS_RAW_RING ring;
+      METIS_RAW_SLOT* slot;
+      pthread_t thread;
+      int copy;
+      int bad = 0;
+
+      metis_raw_ring_init(&ring, RING_FRAMES);
+      CPPUNIT_ASSERT(pthread_create(&thread, NULL, producer, &ring) == 0);
+
+      for (int i = 0; i < PASS_FRAMES; i++)
+      {
+	while ((slot = metis_raw_ring_peek(&ring)) == NULL)
+	  metis_raw_ring_wait(&ring, 100);
+	memcpy(&copy, slot->frame, sizeof(copy));
+	if (slot->length != i || copy != i)
+	  bad++;
+	metis_raw_ring_release(&ring);
+      }
+
+      pthread_join(thread, NULL);
+      CPPUNIT_ASSERT_EQUAL(0, bad);
+      CPPUNIT_ASSERT(metis_raw_ring_peek(&ring) == NULL);
+      metis_raw_ring_free(&ring);
+    }
+
+  } /* namespace hpsdr */
+} /* namespace gr */
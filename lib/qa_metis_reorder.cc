@@ -0,0 +1,189 @@
+/* -*- c++ -*- */
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <gnuradio/attributes.h>
+#include <cppunit/TestAssert.h>
+#include "qa_metis_reorder.h"
+#include "metis_reorder.h"
+
+#include <string.h>
+
+namespace gr {
+  namespace hpsdr {
+
+    #define MAX_DELIVERED 64
+
+    // What the window handed on, in order.
+    struct delivered {
+      int count;
+      unsigned int sequence[MAX_DELIVERED];
+    };
+
+    static unsigned int
+    frame_sequence(const unsigned char* frame)
+    {
+      return ((unsigned int)frame[4] << 24) | ((unsigned int)frame[5] << 16) |
+	     ((unsigned int)frame[6] << 8) | (unsigned int)frame[7];
+    }
+
+    static void
+    deliver(void* arg, unsigned char* frame, const struct timespec* stamp)
+    {
+      struct delivered* d = (struct delivered*)arg;
+
+      (void)stamp;
+      if (d->count < MAX_DELIVERED)
+	d->sequence[d->count] = frame_sequence(frame);
+      d->count++;
+    }
+
+    static void
+    push(METIS_REORDER* reorder, struct delivered* d, unsigned int sequence)
+    {
+      unsigned char frame[METIS_FRAME_BYTES];
+
+      memset(frame, 0, sizeof(frame));
+      frame[0] = 0xEF; frame[1] = 0xFE; frame[2] = 0x01; frame[3] = 0x06;
+      frame[4] = sequence >> 24; frame[5] = sequence >> 16;
+      frame[6] = sequence >> 8; frame[7] = sequence;
+      metis_reorder_push(reorder, frame, sizeof(frame), NULL, deliver, d);
+    }
+
+    static void
+    start(METIS_REORDER* reorder, struct delivered* d, int window)
+    {
+      memset(reorder, 0, sizeof(*reorder));	// init keeps the counters
+      metis_reorder_init(reorder, window);
+      memset(d, 0, sizeof(*d));
+    }
+
+    void
+    qa_metis_reorder::t1()
+    {
+      METIS_REORDER reorder;
+      struct delivered d;
+
+      start(&reorder, &d, 4);
+      push(&reorder, &d, 100);
+      push(&reorder, &d, 102);
+      push(&reorder, &d, 103);
+      CPPUNIT_ASSERT_EQUAL(1, d.count);		// 102 and 103 wait for 101
+      push(&reorder, &d, 101);
+      push(&reorder, &d, 104);
+
+      CPPUNIT_ASSERT_EQUAL(5, d.count);
+      for (int i = 0; i < 5; i++)
+	CPPUNIT_ASSERT_EQUAL(100u + i, d.sequence[i]);
+      CPPUNIT_ASSERT_EQUAL(1ul, reorder.reordered);
+      CPPUNIT_ASSERT_EQUAL(0ul, reorder.gaps);
+      CPPUNIT_ASSERT_EQUAL(0ul, reorder.duplicates);
+    }
+
+    void
+    qa_metis_reorder::t2()
+    {
+      METIS_REORDER reorder;
+      struct delivered d;
+
+      start(&reorder, &d, 4);
+      push(&reorder, &d, 10);
+      push(&reorder, &d, 10);			// already handed on
+      push(&reorder, &d, 12);
+      push(&reorder, &d, 12);			// already held
+      push(&reorder, &d, 11);
+      push(&reorder, &d, 11);			// handed on with 12
+
+      CPPUNIT_ASSERT_EQUAL(3, d.count);
+      CPPUNIT_ASSERT_EQUAL(10u, d.sequence[0]);
+      CPPUNIT_ASSERT_EQUAL(11u, d.sequence[1]);
+      CPPUNIT_ASSERT_EQUAL(12u, d.sequence[2]);
+      CPPUNIT_ASSERT_EQUAL(3ul, reorder.duplicates);
+      CPPUNIT_ASSERT_EQUAL(0ul, reorder.late);
+    }
+
+    void
+    qa_metis_reorder::t3()
+    {
+      METIS_REORDER reorder;
+      struct delivered d;
+
+      start(&reorder, &d, 4);
+      push(&reorder, &d, 0);
+      push(&reorder, &d, 2);
+      push(&reorder, &d, 3);
+      push(&reorder, &d, 4);
+      CPPUNIT_ASSERT_EQUAL(1, d.count);		// 1 may still come
+      CPPUNIT_ASSERT_EQUAL(0ul, reorder.gaps);
+
+      push(&reorder, &d, 5);			// a window past 1: give up on it
+      CPPUNIT_ASSERT_EQUAL(5, d.count);
+      CPPUNIT_ASSERT_EQUAL(0u, d.sequence[0]);
+      for (int i = 1; i < 5; i++)
+	CPPUNIT_ASSERT_EQUAL(1u + i, d.sequence[i]);
+      CPPUNIT_ASSERT_EQUAL(1ul, reorder.gaps);
+
+      push(&reorder, &d, 1);			// too late now
+      CPPUNIT_ASSERT_EQUAL(5, d.count);
+      CPPUNIT_ASSERT_EQUAL(1ul, reorder.late);
+      CPPUNIT_ASSERT_EQUAL(0ul, reorder.duplicates);
+
+      // A long outage with nothing held: the run is counted in one go,
+      // and the frames after it still wait out the window.
+      for (unsigned int sequence = 1000; sequence < 1004; sequence++)
+	push(&reorder, &d, sequence);
+      CPPUNIT_ASSERT_EQUAL(9, d.count);
+      for (int i = 5; i < 9; i++)
+	CPPUNIT_ASSERT_EQUAL(995u + i, d.sequence[i]);
+      CPPUNIT_ASSERT_EQUAL(1ul + 1000 - 6, reorder.gaps);
+    }
+
+    void
+    qa_metis_reorder::t4()
+    {
+      METIS_REORDER reorder;
+      struct delivered d;
+
+      start(&reorder, &d, 4);
+      push(&reorder, &d, 0xFFFFFFFEu);
+      push(&reorder, &d, 0u);
+      push(&reorder, &d, 0xFFFFFFFFu);
+      push(&reorder, &d, 2u);
+      push(&reorder, &d, 1u);
+
+      CPPUNIT_ASSERT_EQUAL(5, d.count);
+      CPPUNIT_ASSERT_EQUAL(0xFFFFFFFEu, d.sequence[0]);
+      CPPUNIT_ASSERT_EQUAL(0xFFFFFFFFu, d.sequence[1]);
+      CPPUNIT_ASSERT_EQUAL(0u, d.sequence[2]);
+      CPPUNIT_ASSERT_EQUAL(1u, d.sequence[3]);
+      CPPUNIT_ASSERT_EQUAL(2u, d.sequence[4]);
+      CPPUNIT_ASSERT_EQUAL(0ul, reorder.gaps);
+      CPPUNIT_ASSERT_EQUAL(2ul, reorder.reordered);
+
+      // The radio was restarted: far behind is taken as a new sequence,
+      // not as thousands of late frames.
+      push(&reorder, &d, 5u);
+      push(&reorder, &d, 0x80000000u);
+      push(&reorder, &d, 0u);
+      push(&reorder, &d, 1u);
+      CPPUNIT_ASSERT_EQUAL(0ul, reorder.late);
+      CPPUNIT_ASSERT_EQUAL(0u, d.sequence[d.count - 2]);
+      CPPUNIT_ASSERT_EQUAL(1u, d.sequence[d.count - 1]);
+    }
+
+  } /* namespace hpsdr */
+} /* namespace gr */
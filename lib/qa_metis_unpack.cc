@@ -0,0 +1,97 @@
+/* -*- c++ -*- */
+/*
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <gnuradio/attributes.h>
+#include <cppunit/TestAssert.h>
+#include "qa_metis_unpack.h"
+#include "metis_unpack.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace gr {
+  namespace hpsdr {
+
+    static const int strides[] = { 6, 8, 12, 14 };	// P2 and USB rows, one and two receivers
+    #define MAX_ROWS 70
+    #define MAX_OUT (4 * MAX_ROWS)
+
+    void
+    qa_metis_unpack::t1()
+    {
+      unsigned char rows[2 * 8];
+      float out[4];
+
+      memset(rows, 0, sizeof(rows));
+      rows[0] = 0x7F; rows[1] = 0xFF; rows[2] = 0xFF;	// I = +full scale
+      rows[3] = 0x80; rows[4] = 0x00; rows[5] = 0x00;	// Q = -full scale - 1
+      metis_unpack_best()->one(rows, 2, 8, out);
+
+      CPPUNIT_ASSERT_EQUAL(1.0f, out[0]);
+      CPPUNIT_ASSERT_EQUAL(-8388608.0f / 8388607.0f, out[1]);
+      CPPUNIT_ASSERT_EQUAL(0.0f, out[2]);
+      CPPUNIT_ASSERT_EQUAL(0.0f, out[3]);
+    }
+
+    void
+    qa_metis_unpack::t2()
+    {
+      int nkernels;
+      const METIS_UNPACK* kernels = metis_unpack_kernels(&nkernels);
+      long page = sysconf(_SC_PAGESIZE);
+      float expect[MAX_OUT + 1];
+      float out[MAX_OUT + 1];
+
+      // The rows end where a page without access begins, so a kernel that
+      // reads past count * stride bytes faults.
+      unsigned char* map = (unsigned char*)mmap(NULL, 2 * page, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      CPPUNIT_ASSERT(map != MAP_FAILED);
+      CPPUNIT_ASSERT(mprotect(map + page, page, PROT_NONE) == 0);
+
+      srand(1);
+      for (int pass = 0; pass < 20; pass++)
+	for (unsigned s = 0; s < sizeof(strides) / sizeof(strides[0]); s++)
+	  for (int count = 0; count <= MAX_ROWS; count++)
+	  {
+	    int stride = strides[s];
+	    int two = stride >= 12;
+	    int floats = count * (two ? 4 : 2);
+	    unsigned char* rows = map + page - count * stride;
+
+	    for (int i = 0; i < count * stride; i++)
+	      rows[i] = rand();
+
+	    (two ? kernels[0].two : kernels[0].one)(rows, count, stride, expect);
+	    for (int k = 1; k < nkernels; k++)
+	    {
+	      out[floats] = 12345.0f;
+	      (two ? kernels[k].two : kernels[k].one)(rows, count, stride, out);
+	      CPPUNIT_ASSERT_MESSAGE(kernels[k].name, memcmp(out, expect, floats * sizeof(float)) == 0);
+	      CPPUNIT_ASSERT_MESSAGE(kernels[k].name, out[floats] == 12345.0f);	// nothing past the end
+	    }
+	  }
+
+      munmap(map, 2 * page);
+    }
+
+  } /* namespace hpsdr */
+} /* namespace gr */
+
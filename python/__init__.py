@@ -46,6 +46,16 @@ from hpsdr_swig import *
 
 # import any pure python here
 
+def options(**kwargs):
+    """A hermes_options with the given fields set and the rest at their
+    defaults, e.g. hpsdr.options(RxBatch=32)."""
+    opts = hermes_options()
+    for key, value in kwargs.items():
+        if not hasattr(opts, key):
+            raise TypeError("hermes_options has no field %s" % key)
+        setattr(opts, key, value)
+    return opts
+
 #
 
 # ----------------------------------------------------------------